@@ -20,9 +20,18 @@
 //
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 #include "DataStore.h"
+#include "DataStoreImage.h"
+#include "../utility/debug.hpp"
+#include <algorithm>
+#include <new>
 
 
 DataStore::DataStore()
+: m_uGeneration(0)
+, m_pImage(nullptr)
+, m_hImageFile(INVALID_HANDLE_VALUE)
+, m_hImageMapping(nullptr)
+, m_pvImageView(nullptr)
 {
     // do nothing
 }
@@ -30,45 +39,180 @@ DataStore::DataStore()
 
 DataStore::~DataStore()
 {
-    Clear();
+    DetachImage();
+
+    for (ArenaVector::iterator iter = m_vecArenas.begin();
+         iter != m_vecArenas.end(); ++iter)
+    {
+        _FreeArena(*iter);
+    }
+}
+
+
+BOOL DataStore::AttachImage(LPCWSTR pwzPath, DWORD cbSize)
+{
+    Lock lock(m_csStore);
+
+    DetachImage();
+
+    m_hImageFile = CreateFileW(pwzPath, GENERIC_READ | GENERIC_WRITE,
+        FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (m_hImageFile != INVALID_HANDLE_VALUE)
+    {
+        // Grows a new file to cbSize. If the size changed since the file was
+        // written, the image header no longer matches and it gets formatted.
+        m_hImageMapping = CreateFileMappingW(m_hImageFile, nullptr,
+            PAGE_READWRITE, 0, cbSize, nullptr);
+    }
+
+    if (m_hImageMapping)
+    {
+        m_pvImageView = MapViewOfFile(
+            m_hImageMapping, FILE_MAP_WRITE, 0, 0, cbSize);
+    }
+
+    if (m_pvImageView)
+    {
+        m_pImage = new DataStoreImage();
+
+        if (m_pImage->Attach(m_pvImageView, cbSize))
+        {
+            for (UINT uSlot = 0; uSlot < DataStoreImage::SLOT_COUNT; ++uSlot)
+            {
+                DWORD dwIdent, dwLength;
+                const void* pvData;
+
+                if (m_pImage->GetItem(uSlot, dwIdent, pvData, dwLength))
+                {
+                    _Insert(dwIdent, pvData, dwLength);
+                }
+            }
+
+            TRACE("DataStore: restored %u items from %ls",
+                (UINT)m_mapItems.size(), pwzPath);
+        }
+        else
+        {
+            delete m_pImage;
+            m_pImage = nullptr;
+        }
+    }
+
+    if (m_pImage == nullptr)
+    {
+        TRACE("DataStore: failed to map %ls (%u)", pwzPath, GetLastError());
+        DetachImage();
+    }
+
+    return m_pImage != nullptr;
+}
+
+
+void DataStore::DetachImage()
+{
+    Lock lock(m_csStore);
+
+    if (m_pImage)
+    {
+        delete m_pImage;
+        m_pImage = nullptr;
+    }
+
+    if (m_pvImageView)
+    {
+        FlushViewOfFile(m_pvImageView, 0);
+        UnmapViewOfFile(m_pvImageView);
+        m_pvImageView = nullptr;
+    }
+
+    if (m_hImageMapping)
+    {
+        CloseHandle(m_hImageMapping);
+        m_hImageMapping = nullptr;
+    }
+
+    if (m_hImageFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hImageFile);
+        m_hImageFile = INVALID_HANDLE_VALUE;
+    }
 }
 
 
 void DataStore::Clear()
 {
-    DataHolderMap::iterator iter = m_dhmData.begin();
+    Lock lock(m_csStore);
 
-    while (iter != m_dhmData.end())
+    if (m_pImage)
     {
-        delete iter->second;
-        ++iter;
+        m_pImage->Clear();
     }
 
-    m_dhmData.clear();
+    ItemMap::iterator iter = m_mapItems.begin();
+
+    while (iter != m_mapItems.end())
+    {
+        Arena* pArena = iter->second.pArena;
+        iter = m_mapItems.erase(iter);
+
+        _Unreference(pArena);
+    }
 }
 
 
 size_t DataStore::Count()
 {
-    return m_dhmData.size();
+    Lock lock(m_csStore);
+
+    return m_mapItems.size();
 }
 
 
-BOOL DataStore::StoreData(WORD wIdent, void *pvData, WORD wLength)
+void DataStore::NextGeneration()
 {
-    BOOL bReturn = FALSE;
+    Lock lock(m_csStore);
+
+    ++m_uGeneration;
+}
+
+
+BOOL DataStore::StoreData(DWORD dwIdent, const void *pvData, DWORD dwLength)
+{
+    Lock lock(m_csStore);
+
+    BOOL bReturn = _Insert(dwIdent, pvData, dwLength);
 
-    if (pvData != NULL && wLength > 0)
+    // The in-memory item is what modules restore, failing to persist it
+    // only costs it surviving a restart
+    if (bReturn && m_pImage && !m_pImage->Write(dwIdent, pvData, dwLength))
     {
-        DataHolderMap::iterator iter = m_dhmData.find(wIdent);
+        TRACE("DataStore: item %u does not fit into the image", dwIdent);
+    }
+
+    return bReturn;
+}
+
+
+//
+// _Insert
+// Must be called with m_csStore held
+//
+BOOL DataStore::_Insert(DWORD dwIdent, const void *pvData, DWORD dwLength)
+{
+    BOOL bReturn = FALSE;
 
-        if (iter == m_dhmData.end())
+    if (pvData != NULL && dwLength > 0)
+    {
+        if (m_mapItems.find(dwIdent) == m_mapItems.end())
         {
-            DataHolder* pdhData = new DataHolder(pvData, wLength);
+            Item item;
+            item.dwLength = dwLength;
+            item.pbData = _Allocate(pvData, dwLength, item.pArena);
 
-            if (pdhData != NULL)
+            if (item.pbData != NULL)
             {
-                m_dhmData[wIdent] = pdhData;
+                m_mapItems.insert(ItemMap::value_type(dwIdent, item));
                 bReturn = TRUE;
             }
         }
@@ -78,26 +222,26 @@ BOOL DataStore::StoreData(WORD wIdent, void *pvData, WORD wLength)
 }
 
 
-BOOL DataStore::ReleaseData(WORD wIdent, void *pvData, WORD wLength)
+BOOL DataStore::ReleaseData(DWORD dwIdent, void *pvData, DWORD dwLength)
 {
     BOOL bReturn = FALSE;
 
-    if (pvData != NULL && wLength > 0)
+    if (pvData != NULL && dwLength > 0)
     {
-        DataHolderMap::iterator iter = m_dhmData.find(wIdent);
+        Lock lock(m_csStore);
+
+        ItemMap::iterator iter = m_mapItems.find(dwIdent);
 
-        if (iter != m_dhmData.end())
+        if (iter != m_mapItems.end())
         {
-            DataHolder* pdhData = iter->second;
+            Item item = iter->second;
+            m_mapItems.erase(iter);
 
-            if (pdhData != NULL)
-            {
-                pdhData->GetData(pvData, wLength);
-                delete pdhData;
-                bReturn = TRUE;
-            }
+            memcpy(pvData, item.pbData, std::min(dwLength, item.dwLength));
+            _Unreference(item.pArena);
+            _Forget(dwIdent);
 
-            m_dhmData.erase(iter);
+            bReturn = TRUE;
         }
     }
 
@@ -105,94 +249,228 @@ BOOL DataStore::ReleaseData(WORD wIdent, void *pvData, WORD wLength)
 }
 
 
-DataHolder::DataHolder()
-: m_wLength(0), m_pvData(NULL)
+BOOL DataStore::RestoreData(DWORD dwIdent, void *pvData, DWORD& dwLength)
 {
-    // do nothing
-}
+    BOOL bReturn = FALSE;
 
+    Lock lock(m_csStore);
 
-DataHolder::DataHolder(void *pvData, WORD wLength)
-{
-    if (pvData == NULL || wLength == 0)
+    ItemMap::iterator iter = m_mapItems.find(dwIdent);
+
+    if (iter == m_mapItems.end())
     {
-        m_wLength = 0;
-        m_pvData = NULL;
+        dwLength = 0;
     }
     else
     {
-        m_pvData = new BYTE[wLength];
+        Item item = iter->second;
 
-        if (m_pvData != NULL)
+        if (pvData != NULL && dwLength >= item.dwLength)
         {
-            m_wLength = wLength;
-            memcpy(m_pvData, pvData, wLength);
+            m_mapItems.erase(iter);
+
+            memcpy(pvData, item.pbData, item.dwLength);
+            _Unreference(item.pArena);
+            _Forget(dwIdent);
+
+            bReturn = TRUE;
         }
+
+        dwLength = item.dwLength;
     }
+
+    return bReturn;
 }
 
 
-DataHolder::~DataHolder()
+BOOL DataStore::AcquireView(DWORD dwIdent, const void** ppvData, DWORD& dwLength)
 {
-    if (m_pvData)
+    BOOL bReturn = FALSE;
+
+    if (ppvData != NULL)
     {
-        delete [] m_pvData;
+        Lock lock(m_csStore);
+
+        ItemMap::iterator iter = m_mapItems.find(dwIdent);
+
+        if (iter != m_mapItems.end())
+        {
+            Item item = iter->second;
+            m_mapItems.erase(iter);
+
+            // The item's arena reference is handed over to the view
+            m_mapViews.insert(ViewMap::value_type(item.pbData, item.pArena));
+
+            *ppvData = item.pbData;
+            dwLength = item.dwLength;
+
+            _Forget(dwIdent);
+
+            bReturn = TRUE;
+        }
     }
+
+    return bReturn;
 }
 
 
-int DataHolder::GetData(void *pvData, WORD wLength)
+BOOL DataStore::ReleaseView(const void* pvData)
 {
-    int nReturn = 0;
+    BOOL bReturn = FALSE;
+
+    Lock lock(m_csStore);
+
+    ViewMap::iterator iter = m_mapViews.find(pvData);
 
-    if (pvData != NULL && wLength > 0 &&
-        m_pvData != NULL && m_wLength > 0)
+    if (iter != m_mapViews.end())
     {
-        if (wLength > m_wLength)
-        {
-            wLength = m_wLength;
-        }
+        Arena* pArena = iter->second;
+        m_mapViews.erase(iter);
+
+        _Unreference(pArena);
 
-        memcpy(pvData, m_pvData, wLength);
-        nReturn = wLength;
+        bReturn = TRUE;
     }
 
-    return nReturn;
+    return bReturn;
+}
+
+
+//
+// _Forget
+// Must be called with m_csStore held
+//
+void DataStore::_Forget(DWORD dwIdent)
+{
+    if (m_pImage)
+    {
+        m_pImage->Remove(dwIdent);
+    }
 }
 
 
-int DataHolder::SetData(void *pvData, WORD wLength)
+//
+// _Allocate
+// Must be called with m_csStore held
+//
+BYTE* DataStore::_Allocate(const void* pvData, DWORD dwLength, Arena*& pArena)
 {
-    int nReturn = 0;
+    // Keep payloads 16 byte aligned so views can hold any structure
+    if (dwLength > MAXDWORD - 15)
+    {
+        return NULL;
+    }
+
+    DWORD dwAligned = (dwLength + 15) & ~15UL;
 
-    if ((pvData == NULL) || (wLength == 0))
+    if (m_vecArenas.empty() || m_vecArenas.back()->uGeneration != m_uGeneration)
     {
-        if (m_pvData)
+        pArena = new (std::nothrow) Arena;
+
+        if (pArena == NULL)
         {
-            delete [] m_pvData;
-            m_pvData = NULL;
-            m_wLength = 0;
+            return NULL;
         }
+
+        pArena->uGeneration = m_uGeneration;
+        pArena->dwUsed = 0;
+        pArena->dwSize = 0;
+        pArena->uReferences = 0;
+
+        m_vecArenas.push_back(pArena);
     }
-    else if (pvData != NULL && wLength > 0)
+    else
+    {
+        pArena = m_vecArenas.back();
+    }
+
+    BYTE* pbData = NULL;
+
+    if (!pArena->vecBlocks.empty() && pArena->dwSize - pArena->dwUsed >= dwAligned)
     {
-        if (m_pvData == NULL)
+        pbData = pArena->vecBlocks.back() + pArena->dwUsed;
+        pArena->dwUsed += dwAligned;
+    }
+    else if (dwAligned > ARENA_BLOCK_SIZE / 2)
+    {
+        // Large payloads get a block of their own, inserted in front of
+        // the block being filled so that one keeps being used
+        pbData = new (std::nothrow) BYTE[dwAligned];
+
+        if (pbData != NULL)
         {
-            m_pvData = new BYTE[wLength];
+            pArena->vecBlocks.insert(
+                pArena->vecBlocks.end() - (pArena->vecBlocks.empty() ? 0 : 1),
+                pbData);
+
+            if (pArena->vecBlocks.size() == 1)
+            {
+                pArena->dwSize = pArena->dwUsed = dwAligned;
+            }
         }
-        else
+    }
+    else
+    {
+        BYTE* pbBlock = new (std::nothrow) BYTE[ARENA_BLOCK_SIZE];
+
+        if (pbBlock != NULL)
         {
-            delete [] m_pvData;
-            m_pvData = new BYTE[wLength];
+            pArena->vecBlocks.push_back(pbBlock);
+            pArena->dwSize = ARENA_BLOCK_SIZE;
+            pArena->dwUsed = dwAligned;
+
+            pbData = pbBlock;
         }
+    }
 
-        if (m_pvData != NULL)
+    if (pbData != NULL)
+    {
+        memcpy(pbData, pvData, dwLength);
+        ++pArena->uReferences;
+    }
+    else if (pArena->uReferences == 0)
+    {
+        m_vecArenas.pop_back();
+        _FreeArena(pArena);
+        pArena = NULL;
+    }
+
+    return pbData;
+}
+
+
+//
+// _Unreference
+// Must be called with m_csStore held
+//
+void DataStore::_Unreference(Arena* pArena)
+{
+    ASSERT(pArena != NULL && pArena->uReferences > 0);
+
+    if (--pArena->uReferences == 0)
+    {
+        // Freeing the current generation's arena as well keeps an empty
+        // store from holding on to memory; the next store starts a new one
+        ArenaVector::iterator iter =
+            std::find(m_vecArenas.begin(), m_vecArenas.end(), pArena);
+
+        if (iter != m_vecArenas.end())
         {
-            memcpy(m_pvData, pvData, wLength);
-            m_wLength = wLength;
-            nReturn = m_wLength;
+            m_vecArenas.erase(iter);
         }
+
+        _FreeArena(pArena);
+    }
+}
+
+
+void DataStore::_FreeArena(Arena* pArena)
+{
+    for (std::vector<BYTE*>::iterator iter = pArena->vecBlocks.begin();
+         iter != pArena->vecBlocks.end(); ++iter)
+    {
+        delete [] *iter;
     }
 
-    return nReturn;
+    delete pArena;
 }
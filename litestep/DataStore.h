@@ -23,72 +23,126 @@
 #define DATASTORE_H
 
 #include "../utility/common.h"
+#include "../utility/criticalsection.h"
 #include <map>
+#include <vector>
+
+class DataStoreImage;
 
 
 /**
- * Item in the data store.
+ * Manages module data that needs to be preserved across recycles.
+ *
+ * Payloads are copied into a bump-allocated arena. Each recycle starts a new
+ * generation with its own arena; the arena of an older generation is freed
+ * as soon as its last item has been restored and its last view released.
+ * All methods may be called from any thread.
+ *
+ * Optionally, every item is also written to a memory-mapped file, which is
+ * read back when LiteStep starts so items survive a crash or restart.
  */
-class DataHolder
+class DataStore
 {
-private:
+    /** Granularity of arena blocks, larger payloads get a block of their own */
+    static const DWORD ARENA_BLOCK_SIZE = 64 * 1024;
+
+    /**
+     * Arena holding the payloads stored during one recycle generation.
+     */
+    struct Arena
+    {
+        /** Generation number */
+        UINT uGeneration;
 
-    /** Size of data in bytes */
-    WORD m_wLength;
+        /** Blocks allocated so far, the last one is being filled */
+        std::vector<BYTE*> vecBlocks;
 
-    /** Pointer to data */
-    BYTE* m_pvData;
+        /** Bytes used in the last block */
+        DWORD dwUsed;
 
-public:
+        /** Size of the last block */
+        DWORD dwSize;
+
+        /** Number of stored items and open views in this arena */
+        UINT uReferences;
+    };
 
     /**
-     * Constructs an empty DataHolder.
+     * Item in the data store.
      */
-    DataHolder();
+    struct Item
+    {
+        /** Pointer to the payload, inside pArena */
+        BYTE* pbData;
+
+        /** Size of the payload in bytes */
+        DWORD dwLength;
+
+        /** Arena owning the payload */
+        Arena* pArena;
+    };
+
+    /** Maps data identifiers to items */
+    typedef std::map<DWORD, Item> ItemMap;
+
+    /** Maps view pointers handed out to their arena */
+    typedef std::map<const void*, Arena*> ViewMap;
+
+    /** Arenas of the current and older generations, current one last */
+    typedef std::vector<Arena*> ArenaVector;
+
+    /** List of data items indexed by identifier */
+    ItemMap m_mapItems;
+
+    /** Open zero-copy views */
+    ViewMap m_mapViews;
+
+    /** Arenas with live items or views */
+    ArenaVector m_vecArenas;
+
+    /** Current generation number */
+    UINT m_uGeneration;
+
+    /** Guards all members */
+    CriticalSection m_csStore;
+
+    /** Persistent copy of the items, if enabled */
+    DataStoreImage* m_pImage;
+
+    /** File backing m_pImage */
+    HANDLE m_hImageFile;
+
+    /** File mapping backing m_pImage */
+    HANDLE m_hImageMapping;
+
+    /** View of m_hImageMapping */
+    void* m_pvImageView;
 
     /**
-     * Constructs a DataHolder containing a copy of the specified data.
-     *
-     * @param  pvData   pointer to data
-     * @param  wLength  size of data in bytes
+     * Adds an item without writing it to the image.
      */
-    DataHolder(void *pvData, WORD wLength);
+    BOOL _Insert(DWORD dwIdent, const void *pvData, DWORD dwLength);
 
     /**
-     * Destructor.
+     * Removes an item from the image, if one is attached.
      */
-    virtual ~DataHolder();
+    void _Forget(DWORD dwIdent);
 
     /**
-     * Copies the data into the supplied buffer.
-     *
-     * @param   pvData   buffer to receive data
-     * @param   wLength  maximum number of bytes to copy
-     * @return  number of bytes copied
+     * Copies a payload into the arena of the current generation.
      */
-    int GetData(void *pvData, WORD wLength);
+    BYTE* _Allocate(const void* pvData, DWORD dwLength, Arena*& pArena);
 
     /**
-     * Replaces the current data with a copy of the specified data.
-     *
-     * @param   pvData   pointer to data
-     * @param   wLength  size of data in bytes
-     * @return  number of bytes copied
+     * Drops one reference from an arena and frees it once nothing uses it,
+     * even when it is the current generation's arena.
      */
-    int SetData(void *pvData, WORD wLength);
-};
-
+    void _Unreference(Arena* pArena);
 
-/**
- * Manages module data that needs to be preserved across recycles.
- */
-class DataStore
-{
-    /** Maps data identifiers to DataHolders */
-    typedef std::map<WORD, DataHolder*> DataHolderMap;
-
-    /** List of data item index by identifier */
-    DataHolderMap m_dhmData;
+    /**
+     * Frees all blocks of an arena.
+     */
+    static void _FreeArena(Arena* pArena);
 
 public:
 
@@ -102,39 +156,96 @@ public:
      */
     virtual ~DataStore();
 
+    /**
+     * Maps a file and keeps a copy of all items in it. Items that a previous
+     * LiteStep process left in the file are loaded into the data store.
+     *
+     * @param   pwzPath  path of the file, created if it doesn't exist
+     * @param   cbSize   size of the file in bytes
+     * @return  <code>TRUE</code> if the file could be mapped
+     */
+    BOOL AttachImage(LPCWSTR pwzPath, DWORD cbSize);
+
+    /**
+     * Unmaps the file. Items that are still stored remain in it.
+     */
+    void DetachImage();
+
     /**
      * Returns the number of items in the data store.
      */
     size_t Count();
 
     /**
-     * Removes all data from the data store.
+     * Removes all data from the data store and its image. Open views stay
+     * valid until they are released.
      */
     void Clear();
 
+    /**
+     * Starts a new generation. Items stored from now on go into a fresh
+     * arena, older arenas are freed once they are no longer referenced.
+     */
+    void NextGeneration();
+
     /**
      * Retrieves a stored data item and removes it from the data store.
      *
-     * @param   wIdent   data identifier
-     * @param   pvData   buffer to receive data
-     * @param   wLength  maximum number of bytes to copy
+     * @param   dwIdent   data identifier
+     * @param   pvData    buffer to receive data
+     * @param   dwLength  maximum number of bytes to copy
      * @return  <code>TRUE</code> if the operation succeeds or
      *          <code>FALSE</code> if no data item with the given
      *          identifier exists
      */
-    BOOL ReleaseData(WORD wIdent, void *pvData, WORD wLength);
+    BOOL ReleaseData(DWORD dwIdent, void *pvData, DWORD dwLength);
+
+    /**
+     * Retrieves a stored data item and removes it from the data store,
+     * but only if the buffer is large enough to hold all of it.
+     *
+     * @param   dwIdent   data identifier
+     * @param   pvData    buffer to receive data, may be <code>NULL</code>
+     * @param   dwLength  on input the size of the buffer, on output the
+     *                    size of the data item
+     * @return  <code>TRUE</code> if the item was copied and removed or
+     *          <code>FALSE</code> if it does not exist or the buffer is too
+     *          small, in which case the item stays in the data store
+     */
+    BOOL RestoreData(DWORD dwIdent, void *pvData, DWORD& dwLength);
+
+    /**
+     * Removes a data item from the data store without copying it. The
+     * returned pointer stays valid until it is passed to ReleaseView.
+     *
+     * @param   dwIdent   data identifier
+     * @param   ppvData   receives a pointer to the data
+     * @param   dwLength  receives the size of the data
+     * @return  <code>TRUE</code> if the operation succeeds or
+     *          <code>FALSE</code> if no data item with the given
+     *          identifier exists
+     */
+    BOOL AcquireView(DWORD dwIdent, const void** ppvData, DWORD& dwLength);
+
+    /**
+     * Releases a view returned by AcquireView.
+     *
+     * @param   pvData  pointer returned by AcquireView
+     * @return  <code>TRUE</code> if the view was open
+     */
+    BOOL ReleaseView(const void* pvData);
 
     /**
      * Adds a data item to the data store.
      *
-     * @param   wIdent   data identifier
-     * @param   pvData   pointer to data
-     * @param   wLength  size of data in bytes
+     * @param   dwIdent   data identifier
+     * @param   pvData    pointer to data
+     * @param   dwLength  size of data in bytes
      * @return  <code>TRUE</code> if the operation succeeds or
      *          <code>FALSE</code> if another data item with the same
      *          identifier already exists
      */
-    BOOL StoreData(WORD wIdent, void *pvData, WORD wLength);
+    BOOL StoreData(DWORD dwIdent, const void *pvData, DWORD dwLength);
 };
 
 #endif // DATASTORE_H
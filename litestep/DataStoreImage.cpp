@@ -0,0 +1,363 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "DataStoreImage.h"
+#include "../utility/crc32.h"
+#include "../utility/debug.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+
+// "LSDS"
+#define IMAGE_MAGIC     0x5344534C
+// Bump whenever the layout of Header or Slot changes
+#define IMAGE_VERSION   1
+
+#define SLOT_FREE       0
+#define SLOT_COMMITTED  0xC0FFEE01
+
+
+struct DataStoreImage::Header
+{
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD dwSlotCount;
+    DWORD dwDataSize;
+    DWORD dwRun;
+    DWORD dwChecksum;   // CRC32 of the fields above
+    DWORD adwReserved[2];
+};
+
+
+struct DataStoreImage::Slot
+{
+    DWORD dwState;      // written last when committing, first when freeing
+    DWORD dwIdent;
+    DWORD dwRun;        // run the item was written in
+    DWORD dwOffset;     // into the payload area
+    DWORD dwLength;
+    DWORD dwDataCrc;    // CRC32 of the payload
+    DWORD dwSlotCrc;    // CRC32 of dwIdent through dwDataCrc
+    DWORD dwReserved;
+};
+
+
+const DWORD DataStoreImage::HEADER_SIZE =
+    sizeof(DataStoreImage::Header) + SLOT_COUNT * sizeof(DataStoreImage::Slot);
+
+
+//
+// AlignPayload
+// Keeps payloads 8 byte aligned
+//
+static DWORD AlignPayload(DWORD dwLength)
+{
+    return (dwLength + 7) & ~7UL;
+}
+
+
+DataStoreImage::DataStoreImage()
+: m_pHeader(nullptr), m_pSlots(nullptr), m_pbData(nullptr), m_dwDataUsed(0)
+{
+    // do nothing
+}
+
+
+bool DataStoreImage::Attach(void* pvBase, DWORD cbSize)
+{
+    Detach();
+
+    // Require room for at least a page of payloads
+    if (pvBase == nullptr || cbSize < HEADER_SIZE + 4096)
+    {
+        return false;
+    }
+
+    m_pHeader = (Header*)pvBase;
+    m_pSlots = (Slot*)(m_pHeader + 1);
+    m_pbData = (BYTE*)pvBase + HEADER_SIZE;
+
+    if (m_pHeader->dwMagic != IMAGE_MAGIC ||
+        m_pHeader->dwVersion != IMAGE_VERSION ||
+        m_pHeader->dwSlotCount != SLOT_COUNT ||
+        m_pHeader->dwDataSize != cbSize - HEADER_SIZE ||
+        m_pHeader->dwChecksum != _Crc32(m_pHeader, offsetof(Header, dwChecksum)))
+    {
+        TRACE("DataStoreImage: formatting %u byte image", cbSize);
+        _Format(cbSize);
+    }
+
+    // Items from the previous run are kept for the modules to restore, items
+    // that already survived a whole run without being restored are dropped
+    DWORD dwRun = ++m_pHeader->dwRun;
+    m_pHeader->dwChecksum = _Crc32(m_pHeader, offsetof(Header, dwChecksum));
+
+    for (UINT uSlot = 0; uSlot < SLOT_COUNT; ++uSlot)
+    {
+        Slot& slot = m_pSlots[uSlot];
+
+        if (slot.dwState == SLOT_FREE)
+        {
+            continue;
+        }
+
+        if (slot.dwState != SLOT_COMMITTED || !_Validate(slot) ||
+            slot.dwRun + 1 < dwRun)
+        {
+            slot.dwState = SLOT_FREE;
+            continue;
+        }
+
+        SlotMap::iterator iter = m_mapSlots.find(slot.dwIdent);
+
+        if (iter != m_mapSlots.end())
+        {
+            // Only a crash during Write can leave duplicates, keep the newer
+            Slot& other = m_pSlots[iter->second];
+
+            if (other.dwRun > slot.dwRun)
+            {
+                slot.dwState = SLOT_FREE;
+                continue;
+            }
+
+            other.dwState = SLOT_FREE;
+            iter->second = uSlot;
+        }
+        else
+        {
+            m_mapSlots.insert(SlotMap::value_type(slot.dwIdent, uSlot));
+        }
+    }
+
+    for (SlotMap::iterator iter = m_mapSlots.begin();
+         iter != m_mapSlots.end(); ++iter)
+    {
+        const Slot& slot = m_pSlots[iter->second];
+
+        m_dwDataUsed = std::max(m_dwDataUsed,
+            slot.dwOffset + AlignPayload(slot.dwLength));
+    }
+
+    return true;
+}
+
+
+void DataStoreImage::Detach()
+{
+    m_pHeader = nullptr;
+    m_pSlots = nullptr;
+    m_pbData = nullptr;
+    m_dwDataUsed = 0;
+    m_mapSlots.clear();
+}
+
+
+bool DataStoreImage::GetItem(UINT uSlot, DWORD& dwIdent, const void*& pvData, DWORD& dwLength) const
+{
+    if (m_pSlots == nullptr || uSlot >= SLOT_COUNT ||
+        m_pSlots[uSlot].dwState != SLOT_COMMITTED)
+    {
+        return false;
+    }
+
+    const Slot& slot = m_pSlots[uSlot];
+
+    dwIdent = slot.dwIdent;
+    pvData = m_pbData + slot.dwOffset;
+    dwLength = slot.dwLength;
+
+    return true;
+}
+
+
+bool DataStoreImage::Write(DWORD dwIdent, const void* pvData, DWORD dwLength)
+{
+    if (m_pHeader == nullptr || pvData == nullptr || dwLength == 0 ||
+        dwLength > m_pHeader->dwDataSize - 7)
+    {
+        return false;
+    }
+
+    Remove(dwIdent);
+
+    UINT uSlot = 0;
+
+    while (uSlot < SLOT_COUNT && m_pSlots[uSlot].dwState != SLOT_FREE)
+    {
+        ++uSlot;
+    }
+
+    DWORD dwAligned = AlignPayload(dwLength);
+
+    if (uSlot == SLOT_COUNT)
+    {
+        return false;
+    }
+
+    if (m_pHeader->dwDataSize - m_dwDataUsed < dwAligned)
+    {
+        _Compact();
+
+        if (m_pHeader->dwDataSize - m_dwDataUsed < dwAligned)
+        {
+            return false;
+        }
+    }
+
+    // Everything past m_dwDataUsed is unreferenced, so a crash before the
+    // slot is committed leaves the image consistent
+    Slot& slot = m_pSlots[uSlot];
+
+    memcpy(m_pbData + m_dwDataUsed, pvData, dwLength);
+
+    slot.dwIdent = dwIdent;
+    slot.dwRun = m_pHeader->dwRun;
+    slot.dwOffset = m_dwDataUsed;
+    slot.dwLength = dwLength;
+    slot.dwDataCrc = _Crc32(pvData, dwLength);
+    slot.dwSlotCrc = _Checksum(slot);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.dwState = SLOT_COMMITTED;
+
+    m_dwDataUsed += dwAligned;
+    m_mapSlots.insert(SlotMap::value_type(dwIdent, uSlot));
+
+    return true;
+}
+
+
+bool DataStoreImage::Remove(DWORD dwIdent)
+{
+    SlotMap::iterator iter = m_mapSlots.find(dwIdent);
+
+    if (iter == m_mapSlots.end())
+    {
+        return false;
+    }
+
+    m_pSlots[iter->second].dwState = SLOT_FREE;
+    m_mapSlots.erase(iter);
+
+    if (m_mapSlots.empty())
+    {
+        m_dwDataUsed = 0;
+    }
+
+    return true;
+}
+
+
+void DataStoreImage::Clear()
+{
+    for (SlotMap::iterator iter = m_mapSlots.begin();
+         iter != m_mapSlots.end(); ++iter)
+    {
+        m_pSlots[iter->second].dwState = SLOT_FREE;
+    }
+
+    m_mapSlots.clear();
+    m_dwDataUsed = 0;
+}
+
+
+void DataStoreImage::_Format(DWORD cbSize)
+{
+    memset(m_pHeader, 0, HEADER_SIZE);
+
+    m_pHeader->dwMagic = IMAGE_MAGIC;
+    m_pHeader->dwVersion = IMAGE_VERSION;
+    m_pHeader->dwSlotCount = SLOT_COUNT;
+    m_pHeader->dwDataSize = cbSize - HEADER_SIZE;
+}
+
+
+bool DataStoreImage::_Validate(const Slot& slot) const
+{
+    return slot.dwSlotCrc == _Checksum(slot) &&
+        slot.dwOffset <= m_pHeader->dwDataSize &&
+        slot.dwLength <= m_pHeader->dwDataSize - slot.dwOffset &&
+        slot.dwDataCrc == _Crc32(m_pbData + slot.dwOffset, slot.dwLength);
+}
+
+
+DWORD DataStoreImage::_Checksum(const Slot& slot) const
+{
+    return _Crc32(&slot.dwIdent,
+        offsetof(Slot, dwSlotCrc) - offsetof(Slot, dwIdent));
+}
+
+
+//
+// _Compact
+// Moves all payloads to the start of the payload area, in offset order so
+// no payload is overwritten before it has been moved
+//
+void DataStoreImage::_Compact()
+{
+    std::vector<std::pair<DWORD, UINT> > vecItems;
+    vecItems.reserve(m_mapSlots.size());
+
+    for (SlotMap::iterator iter = m_mapSlots.begin();
+         iter != m_mapSlots.end(); ++iter)
+    {
+        vecItems.push_back(
+            std::make_pair(m_pSlots[iter->second].dwOffset, iter->second));
+    }
+
+    std::sort(vecItems.begin(), vecItems.end());
+
+    DWORD dwOffset = 0;
+
+    for (size_t n = 0; n < vecItems.size(); ++n)
+    {
+        Slot& slot = m_pSlots[vecItems[n].second];
+
+        if (slot.dwOffset != dwOffset)
+        {
+            // Uncommit while moving, a torn move then just drops the item
+            slot.dwState = SLOT_FREE;
+            std::atomic_thread_fence(std::memory_order_release);
+
+            memmove(m_pbData + dwOffset, m_pbData + slot.dwOffset, slot.dwLength);
+
+            slot.dwOffset = dwOffset;
+            slot.dwSlotCrc = _Checksum(slot);
+
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.dwState = SLOT_COMMITTED;
+        }
+
+        dwOffset += AlignPayload(slot.dwLength);
+    }
+
+    m_dwDataUsed = dwOffset;
+}
+
+
+DWORD DataStoreImage::_Crc32(const void* pvData, DWORD cbData) const
+{
+    return Crc32(0, (const unsigned char*)pvData, cbData);
+}
@@ -0,0 +1,133 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(DATASTOREIMAGE_H)
+#define DATASTOREIMAGE_H
+
+#include "../utility/portable.h"
+#include <map>
+
+
+/**
+ * Persistent copy of the data store inside a block of shared memory.
+ *
+ * The block starts with a versioned header, followed by a fixed table of
+ * slots and the payload area. A slot only counts once its payload and its
+ * own fields have been written and it has been marked committed, and both
+ * carry a CRC32. Anything torn by a crash or left by an incompatible build
+ * is discarded when the block is attached.
+ *
+ * The class only works on memory it is given; mapping the block is up to
+ * the caller. It makes no system calls.
+ */
+class DataStoreImage
+{
+    /** Size of a block with no room for payloads */
+    static const DWORD HEADER_SIZE;
+
+public:
+
+    /** Number of items the image can hold */
+    static const DWORD SLOT_COUNT = 1024;
+
+    /**
+     * Constructor.
+     */
+    DataStoreImage();
+
+    /**
+     * Attaches to a block of memory. Validates the header, formatting the
+     * block if it is not a compatible image, and discards torn slots as well
+     * as items left unrestored by a run before the previous one.
+     *
+     * @param   pvBase  start of the block
+     * @param   cbSize  size of the block in bytes
+     * @return  <code>true</code> if the block is large enough
+     */
+    bool Attach(void* pvBase, DWORD cbSize);
+
+    /**
+     * Forgets the block. The memory is not touched.
+     */
+    void Detach();
+
+    /**
+     * Retrieves the item in a slot.
+     *
+     * @param   uSlot     slot index, less than SLOT_COUNT
+     * @param   dwIdent   receives the data identifier
+     * @param   pvData    receives a pointer to the data
+     * @param   dwLength  receives the size of the data
+     * @return  <code>true</code> if the slot holds an item
+     */
+    bool GetItem(UINT uSlot, DWORD& dwIdent, const void*& pvData, DWORD& dwLength) const;
+
+    /**
+     * Writes an item, replacing an existing item with the same identifier.
+     * Compacts the payload area if needed.
+     *
+     * @return  <code>true</code> if the item fit
+     */
+    bool Write(DWORD dwIdent, const void* pvData, DWORD dwLength);
+
+    /**
+     * Removes an item.
+     *
+     * @return  <code>true</code> if the item existed
+     */
+    bool Remove(DWORD dwIdent);
+
+    /**
+     * Removes all items.
+     */
+    void Clear();
+
+private:
+
+    struct Header;
+    struct Slot;
+
+    /** Maps identifiers of committed items to their slot */
+    typedef std::map<DWORD, UINT> SlotMap;
+
+    void _Format(DWORD cbSize);
+    bool _Validate(const Slot& slot) const;
+    DWORD _Checksum(const Slot& slot) const;
+    void _Compact();
+    DWORD _Crc32(const void* pvData, DWORD cbData) const;
+
+    /** Header of the attached block */
+    Header* m_pHeader;
+
+    /** Slot table of the attached block */
+    Slot* m_pSlots;
+
+    /** Payload area of the attached block */
+    BYTE* m_pbData;
+
+    /** Bytes in use at the start of the payload area */
+    DWORD m_dwDataUsed;
+
+    /** Index of committed items */
+    SlotMap m_mapSlots;
+};
+
+#endif // DATASTOREIMAGE_H
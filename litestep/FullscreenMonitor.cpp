@@ -22,15 +22,32 @@
 #include "FullscreenMonitor.h"
 #include "../lsapi/lsapi.h"
 #include "../utility/debug.hpp"
+#include <algorithm>
+
+// Time to gather shell hook and location change events before re-checking
+#define FULLSCREEN_COALESCE_DELAY  50
+
+// Fallback re-check interval while any window is fullscreen
+#define FULLSCREEN_POLL_INTERVAL   1000
+
+// Thread messages understood by the worker
+#define WM_FSM_SHELLHOOK  (WM_APP + 0)
+#define WM_FSM_REHIDE     (WM_APP + 1)
+
+
+FullscreenTracker* FullscreenMonitor::s_pTracker = nullptr;
 
 
 //
 // FullscreenMonitor
 //
 FullscreenMonitor::FullscreenMonitor() :
-    m_workerSleepDuration(100)
+    m_dwLiteStepProcID(0),
+    m_hLocationHook(nullptr),
+    m_dwWatchedProcID(0)
 {
-    m_bReHide = false;
+    m_bRun = false;
+    m_dwThreadId = 0;
 }
 
 
@@ -183,159 +200,249 @@ void FullscreenMonitor::HideModules(HMONITOR hMonitor, HWND hWnd)
 
 
 //
-// ThreadProc
+// _WinEventProc
 //
-void FullscreenMonitor::ThreadProc()
+void CALLBACK FullscreenMonitor::_WinEventProc(HWINEVENTHOOK, DWORD,
+    HWND hWnd, LONG idObject, LONG idChild, DWORD, DWORD)
 {
+    // Location changes arrive for every caret and cursor move as well. Only
+    // the foreground window can become fullscreen, and only tracked windows
+    // can stop being fullscreen.
+    if (idObject == OBJID_WINDOW && idChild == CHILDID_SELF && s_pTracker)
+    {
+        if (hWnd == GetForegroundWindow() || s_pTracker->IsTracking(hWnd))
+        {
+            s_pTracker->NotifyEvent(GetTickCount());
+        }
+    }
+}
 
-#if defined(_DEBUG)
-    DbgSetCurrentThreadName("LS FullscreenMonitor Service");
-#endif
 
-    //
-    struct FSWindow {
-        FSWindow(HWND hWnd, HMONITOR hMonitor) {
-            this->hWnd = hWnd;
-            this->hMonitor = hMonitor;
-        }
-        HWND hWnd;
-        HMONITOR hMonitor;
-    };
+//
+// _WatchForeground
+// Windows going fullscreen while already active, such as a browser after
+// F11, raise no shell hook message. Only the foreground application's
+// location changes are watched for those, a global hook would wake us for
+// every window moving anywhere. Tracked windows that stop being fullscreen
+// in the background are left to the fallback check.
+//
+void FullscreenMonitor::_WatchForeground(HWND hWnd)
+{
+    DWORD dwProcID = 0;
+
+    if (hWnd)
+    {
+        GetWindowThreadProcessId(hWnd, &dwProcID);
+    }
+
+    if (dwProcID == m_dwLiteStepProcID)
+    {
+        dwProcID = 0;
+    }
 
-    // List of all currently living known fullscreen windows
-    std::list<FSWindow> fullscreenWindows;
+    if (dwProcID == m_dwWatchedProcID && (m_hLocationHook || !dwProcID))
+    {
+        return;
+    }
 
-    // The monitors which currently have modules hidden
-    std::unordered_multiset<HMONITOR> hiddenMonitors;
+    if (m_hLocationHook)
+    {
+        UnhookWinEvent(m_hLocationHook);
+        m_hLocationHook = nullptr;
+    }
 
-    DWORD dwLiteStepProcID;
-    GetWindowThreadProcessId(GetLitestepWnd(), &dwLiteStepProcID);
+    m_dwWatchedProcID = dwProcID;
 
-    // On startup, find any existing fullscreen windows.
-    EnumDesktopWindows(nullptr, [] (HWND hWnd, LPARAM lParam) -> BOOL
+    if (dwProcID)
     {
-        HMONITOR hMonitor = IsFullscreenWindow(hWnd);
-        std::list<FSWindow> *fullscreenWindows = (std::list<FSWindow>*)lParam;
-        if (hMonitor)
+        m_hLocationHook = SetWinEventHook(
+            EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, nullptr,
+            _WinEventProc, dwProcID, 0, WINEVENT_OUTOFCONTEXT);
+    }
+}
+
+
+//
+// OnShellHook
+//
+void FullscreenMonitor::OnShellHook(UINT uMsg, HWND hWnd)
+{
+    switch (uMsg)
+    {
+    case LM_WINDOWACTIVATED:
+    case LM_WINDOWDESTROYED:
+    case LM_WINDOWREPLACED:
+    case LM_MONITORCHANGED:
+        if (m_dwThreadId)
         {
-            // And add it to the list of fullscreen windows.
-            fullscreenWindows->push_back(FSWindow(hWnd, hMonitor));
+            PostThreadMessage(m_dwThreadId, WM_FSM_SHELLHOOK, uMsg, (LPARAM)hWnd);
         }
-        return TRUE;
-    }, (LPARAM)&fullscreenWindows);
+        break;
 
-    // Hide modules on any monitor we found
-    for (FSWindow window : fullscreenWindows)
+    default:
+        break;
+    }
+}
+
+
+//
+// Apply
+//
+void FullscreenMonitor::Apply(const FullscreenTracker::ActionList& actions)
+{
+    for (const FullscreenTracker::Action& action : actions)
     {
-        hiddenMonitors.insert(window.hMonitor);
-        if (hiddenMonitors.count(window.hMonitor) == 1)
+        if (action.type == FullscreenTracker::HideModules)
+        {
+            HideModules(action.hMonitor, action.hWnd);
+        }
+        else
         {
-            HideModules(window.hMonitor, window.hWnd);
+            ShowModules(action.hMonitor);
         }
     }
+}
 
-    // Main Loop
-    while (m_bRun.load())
+
+//
+// Evaluate
+//
+void FullscreenMonitor::Evaluate(FullscreenTracker& tracker)
+{
+    FullscreenTracker::ActionList actions;
+    std::vector<HWND> vecWindows;
+
+    HWND hwndForeGround = GetForegroundWindow();
+
+    // In case an activation slipped past the shell hook
+    _WatchForeground(hwndForeGround);
+
+    // Verify that all currently known fullscreen windows are still fullscreen.
+    tracker.GetWindows(vecWindows);
+
+    for (HWND hWnd : vecWindows)
     {
-        HWND hwndForeGround = GetForegroundWindow();
-        bool bCheckedForeGround = false;
+        tracker.SetWindowMonitor(hWnd, IsFullscreenWindow(hWnd), actions);
+    }
+
+    // Check if the currently active window is a fullscreen window. If we
+    // already checked it, don't bother doing it again.
+    if (std::find(vecWindows.begin(), vecWindows.end(), hwndForeGround) == vecWindows.end())
+    {
+        // If the currently active window belongs to litestep, show all modules.
+        DWORD dwProcID;
+        GetWindowThreadProcessId(hwndForeGround, &dwProcID);
 
-        // Re-Hide modules on all monitors
-        if (m_bReHide.load())
+        if (dwProcID == m_dwLiteStepProcID)
         {
-            hiddenMonitors.clear();
-            for (FSWindow window : fullscreenWindows)
-            {
-                hiddenMonitors.insert(window.hMonitor);
-                if (hiddenMonitors.count(window.hMonitor) == 1)
-                {
-                    HideModules(window.hMonitor, window.hWnd);
-                }
-            }
+            tracker.ShowAll(actions);
         }
-
-        // Verify that all currently known fullscreen windows are still fullscreen.
-        std::list<FSWindow>::iterator iter = fullscreenWindows.begin();
-        while (iter != fullscreenWindows.end())
+        else
         {
-            HMONITOR hNewMonitor = IsFullscreenWindow(iter->hWnd);
+            HMONITOR hMonitor = IsFullscreenWindow(hwndForeGround);
 
-            // If we already checked the foreground window, don't bother doing it again.
-            if (iter->hWnd == hwndForeGround)
+            if (hMonitor)
             {
-                bCheckedForeGround = true;
+                tracker.SetWindowMonitor(hwndForeGround, hMonitor, actions);
             }
+        }
+    }
 
-            //
-            if (hNewMonitor != iter->hMonitor)
-            {
-                hiddenMonitors.erase(iter->hMonitor);
+    Apply(actions);
+}
 
-                // If there are no fullscreen windows left on the monitor, show the modules
-                if (hiddenMonitors.count(iter->hMonitor) == 0)
-                {
-                    ShowModules(iter->hMonitor);
-                }
 
-                // Check if the window moved to another monitor (and stayed fullscreen)
-                if (hNewMonitor)
-                {
-                    iter->hMonitor = hNewMonitor;
-                    hiddenMonitors.insert(hNewMonitor);
-                    if (hiddenMonitors.count(hNewMonitor) == 1)
-                    {
-                        HideModules(hNewMonitor, iter->hWnd);
-                    }
-                }
-                else
-                {
-                    iter = fullscreenWindows.erase(iter);
-                    continue;
-                }
-            }
+//
+// ThreadProc
+//
+void FullscreenMonitor::ThreadProc()
+{
+
+#if defined(_DEBUG)
+    DbgSetCurrentThreadName("LS FullscreenMonitor Service");
+#endif
+
+    // Create the message queue before anyone posts to it
+    MSG msg;
+    PeekMessage(&msg, nullptr, WM_USER, WM_USER, PM_NOREMOVE);
+
+    m_dwThreadId = GetCurrentThreadId();
+    m_queueReady.set_value();
+
+    FullscreenTracker tracker(FULLSCREEN_COALESCE_DELAY, FULLSCREEN_POLL_INTERVAL);
+    FullscreenTracker::ActionList actions;
+
+    s_pTracker = &tracker;
 
-            ++iter;
+    GetWindowThreadProcessId(GetLitestepWnd(), &m_dwLiteStepProcID);
+
+    _WatchForeground(GetForegroundWindow());
+
+    // On startup, find any existing fullscreen windows, and hide modules on
+    // any monitor we found.
+    EnumDesktopWindows(nullptr, [] (HWND hWnd, LPARAM lParam) -> BOOL
+    {
+        HMONITOR hMonitor = IsFullscreenWindow(hWnd);
+        if (hMonitor)
+        {
+            s_pTracker->SetWindowMonitor(hWnd, hMonitor,
+                *(FullscreenTracker::ActionList*)lParam);
         }
+        return TRUE;
+    }, (LPARAM)&actions);
 
-        // Check if the currently active window is a fullscreen window.
-        if (!bCheckedForeGround)
+    Apply(actions);
+
+    // Main Loop. Sleeps until a shell hook or location change event comes
+    // in, or the tracker asks for a fallback check.
+    while (m_bRun.load())
+    {
+        MsgWaitForMultipleObjects(0, nullptr, FALSE,
+            tracker.GetTimeout(GetTickCount()), QS_ALLINPUT);
+
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
         {
-            // If the currently active window belongs to litestep, show all modules.
-            DWORD dwProcID;
-            GetWindowThreadProcessId(hwndForeGround, &dwProcID);
-            if (dwProcID == dwLiteStepProcID)
+            actions.clear();
+
+            if (msg.message == WM_FSM_SHELLHOOK)
             {
-                if (!hiddenMonitors.empty())
+                if (msg.wParam == LM_WINDOWDESTROYED)
+                {
+                    tracker.RemoveWindow((HWND)msg.lParam, actions);
+                    Apply(actions);
+                }
+                else
                 {
-                    for (HMONITOR hMonitor : hiddenMonitors)
+                    if (msg.wParam == LM_WINDOWACTIVATED)
                     {
-                        ShowModules(hMonitor);
+                        _WatchForeground((HWND)msg.lParam);
                     }
-                    hiddenMonitors.clear();
-                    fullscreenWindows.clear();
+
+                    tracker.NotifyEvent(GetTickCount());
                 }
             }
+            else if (msg.message == WM_FSM_REHIDE)
+            {
+                tracker.Rehide(actions);
+                Apply(actions);
+            }
             else
             {
-                HMONITOR hMonitor = IsFullscreenWindow(hwndForeGround);
-                if (hMonitor)
-                {
-                    // Add the window to the list of known foreground windows.
-                    fullscreenWindows.push_back(FSWindow(hwndForeGround, hMonitor));
-                    hiddenMonitors.insert(hMonitor);
-
-                    // If we didn't know about any fullscreen windows on this monitor before, hide the modules on it.
-                    if (hiddenMonitors.count(hMonitor) == 1)
-                    {
-                        HideModules(hMonitor, hwndForeGround);
-                    }
-                }
+                DispatchMessage(&msg);
             }
         }
 
-        // Avoid using excesive amounts of CPU time
-        std::this_thread::sleep_for(m_workerSleepDuration);
+        if (m_bRun.load() && tracker.BeginEvaluation(GetTickCount()))
+        {
+            Evaluate(tracker);
+        }
     }
+
+    _WatchForeground(nullptr);
+
+    s_pTracker = nullptr;
+
+    TRACE("FullscreenMonitor: %u evaluations", tracker.GetEvaluationCount());
 }
 
 
@@ -346,8 +453,15 @@ HRESULT FullscreenMonitor::Start()
 {
     m_bAutoHideModules = GetRCBoolW(L"LSAutoHideModules", TRUE) != FALSE;
     m_bRun.store(true);
+
+    m_queueReady = std::promise<void>();
+    std::future<void> queueReady = m_queueReady.get_future();
+
     m_fullscreenMonitorThread = std::thread(std::bind(&FullscreenMonitor::ThreadProc, this));
 
+    // OnShellHook and Stop post to the worker's queue
+    queueReady.wait();
+
     return S_OK;
 }
 
@@ -358,7 +472,9 @@ HRESULT FullscreenMonitor::Start()
 HRESULT FullscreenMonitor::Stop()
 {
     m_bRun.store(false);
+    PostThreadMessage(m_dwThreadId, WM_NULL, 0, 0);
     m_fullscreenMonitorThread.join();
+    m_dwThreadId = 0;
 
     return S_OK;
 }
@@ -379,7 +495,7 @@ HRESULT FullscreenMonitor::Recycle()
         ParseBangCommandW(nullptr, L"!ShowModules", nullptr);
     }
 
-    m_bReHide.store(true);
+    PostThreadMessage(m_dwThreadId, WM_FSM_REHIDE, 0, 0);
 
     return S_OK;
 }
@@ -24,10 +24,10 @@
 #define FULLSCREENMONITOR_H
 
 #include "../utility/IService.h"
+#include "FullscreenTracker.h"
 #include <thread>
 #include <atomic>
-#include <list>
-#include <unordered_set>
+#include <future>
 
 class FullscreenMonitor: public IService
 {
@@ -39,27 +39,39 @@ public:
     HRESULT Stop() override;
     HRESULT Recycle() override;
 
+    // Forwards a translated shell hook message to the worker thread
+    void OnShellHook(UINT uMsg, HWND hWnd);
+
 private:
     static HMONITOR _FullScreenGetMonitorHelper(HWND hWnd);
     static BOOL CALLBACK _EnumThreadFSWnd(HWND hWnd, LPARAM lParam);
     static HMONITOR IsFullscreenWindow(HWND hwnd);
+    static void CALLBACK _WinEventProc(HWINEVENTHOOK hHook, DWORD dwEvent,
+        HWND hWnd, LONG idObject, LONG idChild, DWORD dwThread, DWORD dwTime);
     void ThreadProc();
+    void _WatchForeground(HWND hWnd);
+    void Evaluate(FullscreenTracker& tracker);
+    void Apply(const FullscreenTracker::ActionList& actions);
     void ShowModules(HMONITOR hMonitor);
     void HideModules(HMONITOR hMonitor, HWND hWnd);
 
     // LS thread only
 private:
     std::thread m_fullscreenMonitorThread;
+    std::promise<void> m_queueReady;
 
     // Shared
 private:
     std::atomic<bool> m_bRun;
-    std::atomic<bool> m_bReHide;
     std::atomic<bool> m_bAutoHideModules;
+    std::atomic<DWORD> m_dwThreadId;
 
     // Worker thread only
 private:
-    std::chrono::milliseconds m_workerSleepDuration;
+    static FullscreenTracker* s_pTracker;
+    DWORD m_dwLiteStepProcID;
+    HWINEVENTHOOK m_hLocationHook;
+    DWORD m_dwWatchedProcID;
 };
 
 #endif // FULLSCREENMONITOR_H
@@ -0,0 +1,239 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "FullscreenTracker.h"
+#include <algorithm>
+
+
+//
+// FullscreenTracker
+//
+FullscreenTracker::FullscreenTracker(DWORD dwCoalesceDelay, DWORD dwPollInterval)
+: m_dwCoalesceDelay(dwCoalesceDelay)
+, m_dwPollInterval(dwPollInterval)
+, m_bPending(false)
+, m_dwDue(0)
+, m_dwLastEvaluation(0)
+, m_uEvaluations(0)
+{
+}
+
+
+//
+// NotifyEvent
+//
+void FullscreenTracker::NotifyEvent(DWORD dwNow)
+{
+    if (!m_bPending)
+    {
+        m_bPending = true;
+        m_dwDue = dwNow + m_dwCoalesceDelay;
+    }
+}
+
+
+//
+// GetTimeout
+// Tick counts wrap, so all comparisons go through signed differences
+//
+DWORD FullscreenTracker::GetTimeout(DWORD dwNow) const
+{
+    LONG lTimeout = -1;
+
+    if (m_bPending)
+    {
+        lTimeout = (LONG)(m_dwDue - dwNow);
+    }
+    else if (!m_mapWindows.empty())
+    {
+        // Fallback for fullscreen windows that stop being fullscreen
+        // without telling anyone
+        lTimeout = (LONG)(m_dwLastEvaluation + m_dwPollInterval - dwNow);
+    }
+    else
+    {
+        return INFINITE;
+    }
+
+    return (DWORD)std::max<LONG>(0, lTimeout);
+}
+
+
+//
+// BeginEvaluation
+//
+bool FullscreenTracker::BeginEvaluation(DWORD dwNow)
+{
+    if (GetTimeout(dwNow) != 0)
+    {
+        return false;
+    }
+
+    m_bPending = false;
+    m_dwLastEvaluation = dwNow;
+    ++m_uEvaluations;
+
+    return true;
+}
+
+
+//
+// SetWindowMonitor
+//
+void FullscreenTracker::SetWindowMonitor(HWND hWnd, HMONITOR hMonitor, ActionList& actions)
+{
+    std::map<HWND, HMONITOR>::iterator iter = m_mapWindows.find(hWnd);
+
+    if (iter == m_mapWindows.end())
+    {
+        if (hMonitor)
+        {
+            m_mapWindows.insert(std::make_pair(hWnd, hMonitor));
+            _Attach(hWnd, hMonitor, actions);
+        }
+    }
+    else if (iter->second != hMonitor)
+    {
+        HMONITOR hOldMonitor = iter->second;
+
+        if (hMonitor)
+        {
+            // Moved to another monitor and stayed fullscreen
+            iter->second = hMonitor;
+        }
+        else
+        {
+            m_mapWindows.erase(iter);
+        }
+
+        _Detach(hOldMonitor, actions);
+
+        if (hMonitor)
+        {
+            _Attach(hWnd, hMonitor, actions);
+        }
+    }
+}
+
+
+//
+// RemoveWindow
+//
+void FullscreenTracker::RemoveWindow(HWND hWnd, ActionList& actions)
+{
+    SetWindowMonitor(hWnd, nullptr, actions);
+}
+
+
+//
+// ShowAll
+//
+void FullscreenTracker::ShowAll(ActionList& actions)
+{
+    for (std::map<HMONITOR, UINT>::iterator iter = m_mapMonitors.begin();
+         iter != m_mapMonitors.end(); ++iter)
+    {
+        Action action = { ShowModules, iter->first, nullptr };
+        actions.push_back(action);
+    }
+
+    m_mapMonitors.clear();
+    m_mapWindows.clear();
+}
+
+
+//
+// Rehide
+//
+void FullscreenTracker::Rehide(ActionList& actions)
+{
+    for (std::map<HMONITOR, UINT>::iterator iter = m_mapMonitors.begin();
+         iter != m_mapMonitors.end(); ++iter)
+    {
+        // Report the first window filling the monitor, as a fresh hide would
+        for (std::map<HWND, HMONITOR>::iterator wnd = m_mapWindows.begin();
+             wnd != m_mapWindows.end(); ++wnd)
+        {
+            if (wnd->second == iter->first)
+            {
+                Action action = { HideModules, iter->first, wnd->first };
+                actions.push_back(action);
+                break;
+            }
+        }
+    }
+}
+
+
+//
+// IsTracking
+//
+bool FullscreenTracker::IsTracking(HWND hWnd) const
+{
+    return m_mapWindows.find(hWnd) != m_mapWindows.end();
+}
+
+
+//
+// GetWindows
+//
+void FullscreenTracker::GetWindows(std::vector<HWND>& vecWindows) const
+{
+    vecWindows.clear();
+    vecWindows.reserve(m_mapWindows.size());
+
+    for (std::map<HWND, HMONITOR>::const_iterator iter = m_mapWindows.begin();
+         iter != m_mapWindows.end(); ++iter)
+    {
+        vecWindows.push_back(iter->first);
+    }
+}
+
+
+//
+// _Attach
+//
+void FullscreenTracker::_Attach(HWND hWnd, HMONITOR hMonitor, ActionList& actions)
+{
+    // Only the first fullscreen window on a monitor hides its modules
+    if (++m_mapMonitors[hMonitor] == 1)
+    {
+        Action action = { HideModules, hMonitor, hWnd };
+        actions.push_back(action);
+    }
+}
+
+
+//
+// _Detach
+//
+void FullscreenTracker::_Detach(HMONITOR hMonitor, ActionList& actions)
+{
+    std::map<HMONITOR, UINT>::iterator iter = m_mapMonitors.find(hMonitor);
+
+    if (iter != m_mapMonitors.end() && --iter->second == 0)
+    {
+        m_mapMonitors.erase(iter);
+
+        Action action = { ShowModules, hMonitor, nullptr };
+        actions.push_back(action);
+    }
+}
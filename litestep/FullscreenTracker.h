@@ -0,0 +1,151 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(FULLSCREENTRACKER_H)
+#define FULLSCREENTRACKER_H
+
+#include "../utility/portable.h"
+#include <map>
+#include <vector>
+
+
+/**
+ * Decides when modules are hidden and shown on each monitor, and when the
+ * fullscreen monitor needs to wake up.
+ *
+ * The tracker never queries windows itself. The caller reports what it
+ * observed and performs the returned actions, which lets recorded event
+ * traces be replayed against it.
+ */
+class FullscreenTracker
+{
+public:
+    /** What to do with the modules on a monitor */
+    enum ActionType
+    {
+        HideModules,
+        ShowModules
+    };
+
+    struct Action
+    {
+        ActionType type;
+        HMONITOR hMonitor;
+        HWND hWnd;  // fullscreen window that caused a hide
+    };
+
+    typedef std::vector<Action> ActionList;
+
+    /**
+     * Constructor.
+     *
+     * @param  dwCoalesceDelay  milliseconds to gather events before evaluating
+     * @param  dwPollInterval   milliseconds between evaluations while any
+     *                          window is fullscreen
+     */
+    FullscreenTracker(DWORD dwCoalesceDelay, DWORD dwPollInterval);
+
+    /**
+     * Notes that something that may affect a fullscreen window happened.
+     * Events arriving before the evaluation is due are folded into it.
+     */
+    void NotifyEvent(DWORD dwNow);
+
+    /**
+     * Returns how long the caller may sleep before calling BeginEvaluation,
+     * or <code>INFINITE</code> if only an event can change anything.
+     */
+    DWORD GetTimeout(DWORD dwNow) const;
+
+    /**
+     * Returns <code>true</code> if an evaluation is due, in which case the
+     * caller re-checks its windows and reports them through
+     * SetWindowMonitor.
+     */
+    bool BeginEvaluation(DWORD dwNow);
+
+    /**
+     * Number of evaluations so far.
+     */
+    UINT GetEvaluationCount() const
+    {
+        return m_uEvaluations;
+    }
+
+    /**
+     * Reports the monitor a window fills, or <code>nullptr</code> if it is
+     * not fullscreen (any more).
+     */
+    void SetWindowMonitor(HWND hWnd, HMONITOR hMonitor, ActionList& actions);
+
+    /**
+     * Forgets a window that was destroyed.
+     */
+    void RemoveWindow(HWND hWnd, ActionList& actions);
+
+    /**
+     * Shows the modules on all monitors and forgets all windows, for when
+     * LiteStep itself is activated.
+     */
+    void ShowAll(ActionList& actions);
+
+    /**
+     * Hides the modules again on every monitor with a fullscreen window,
+     * for after a recycle.
+     */
+    void Rehide(ActionList& actions);
+
+    /**
+     * Returns <code>true</code> if the window is known to be fullscreen.
+     */
+    bool IsTracking(HWND hWnd) const;
+
+    /**
+     * Retrieves all windows known to be fullscreen.
+     */
+    void GetWindows(std::vector<HWND>& vecWindows) const;
+
+private:
+    void _Attach(HWND hWnd, HMONITOR hMonitor, ActionList& actions);
+    void _Detach(HMONITOR hMonitor, ActionList& actions);
+
+    /** Fullscreen windows and the monitor each one fills */
+    std::map<HWND, HMONITOR> m_mapWindows;
+
+    /** Number of fullscreen windows per monitor with hidden modules */
+    std::map<HMONITOR, UINT> m_mapMonitors;
+
+    DWORD m_dwCoalesceDelay;
+    DWORD m_dwPollInterval;
+
+    /** An event is waiting for its evaluation */
+    bool m_bPending;
+
+    /** When the pending evaluation is due */
+    DWORD m_dwDue;
+
+    /** When the last evaluation ran */
+    DWORD m_dwLastEvaluation;
+
+    UINT m_uEvaluations;
+};
+
+#endif // FULLSCREENTRACKER_H
@@ -20,17 +20,75 @@
 //
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 #include "MessageManager.h"
+#include "../utility/debug.hpp"
 
+// The Win32 transport is all that ties the message manager to Windows; the
+// rest builds anywhere, for the tests
+#if defined(_WIN32)
+#include "../lsapi/lsapidefines.h"
 
-MessageManager::MessageManager()
+
+//
+// Win32Transport
+// Delivers messages through the regular Win32 messaging functions
+//
+class Win32Transport : public MessageManager::Transport
+{
+public:
+    bool Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam,
+        UINT uTimeout, LRESULT& lResult)
+    {
+        DWORD_PTR dwResult = 0;
+
+        // SMTO_ABORTIFHUNG returns immediately for windows that the system
+        // already considers hung, so those don't cost us the full timeout
+        if (::SendMessageTimeout(hWnd, uMsg, wParam, lParam,
+            SMTO_NORMAL | SMTO_ABORTIFHUNG, uTimeout, &dwResult) == 0)
+        {
+            return false;
+        }
+
+        lResult = (LRESULT)dwResult;
+        return true;
+    }
+
+    LRESULT Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        return ::SendMessage(hWnd, uMsg, wParam, lParam);
+    }
+
+    BOOL Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        return ::PostMessage(hWnd, uMsg, wParam, lParam);
+    }
+
+    HINSTANCE GetInstance(HWND hWnd)
+    {
+        return (HINSTANCE)GetWindowLongPtr(hWnd, GWLP_HINSTANCE);
+    }
+};
+
+
+MessageManager::MessageManager() :
+    m_pTransport(new Win32Transport()),
+    m_uTimeoutMessage(LM_MESSAGETIMEOUT)
 {
     // do nothing
 }
+#endif // defined(_WIN32)
+
+
+MessageManager::MessageManager(Transport* pTransport, UINT uTimeoutMessage) :
+    m_pTransport(pTransport),
+    m_uTimeoutMessage(uTimeoutMessage)
+{
+    ASSERT(pTransport != NULL);
+}
 
 
 MessageManager::~MessageManager()
 {
-    // do nothing
+    delete m_pTransport;
 }
 
 
@@ -75,6 +133,28 @@ void MessageManager::RemoveMessage(HWND window, UINT message)
             m_MessageMap.erase(it);
         }
     }
+
+    // Don't keep counting timeouts for windows that are gone
+    if (m_TimeoutMap.find(window) != m_TimeoutMap.end() &&
+        !_IsRegistered(window))
+    {
+        m_TimeoutMap.erase(window);
+    }
+}
+
+
+bool MessageManager::_IsRegistered(HWND hWnd) const
+{
+    for (messageMapT::const_iterator iter = m_MessageMap.begin();
+        iter != m_MessageMap.end(); ++iter)
+    {
+        if (iter->second.find(hWnd) != iter->second.end())
+        {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 
@@ -96,26 +176,53 @@ void MessageManager::ClearMessages(void)
 {
     Lock lock(m_cs);
     m_MessageMap.clear();
+    m_TimeoutMap.clear();
 }
 
 
 LRESULT MessageManager::SendMessage(UINT message, WPARAM wParam, LPARAM lParam)
 {
-    Lock lock(m_cs);
     LRESULT lResult = 0;
+    windowSetT windowSet;
 
-    messageMapT::iterator it = m_MessageMap.find(message);
-
-    if (it != m_MessageMap.end())
+    // Deliver to a copy of the set since modules may unregister messages in
+    // their message handlers. The lock is only held while copying, so other
+    // threads can still (un)register while a window processes the message.
+    if (GetWindowsForMessage(message, windowSet))
     {
-        // Make a copy since modules may unregister messages in their message
-        // handlers
-        windowSetT windowSet(it->second);
+        for (windowSetT::const_iterator winIt = windowSet.begin();
+            winIt != windowSet.end(); ++winIt)
+        {
+            lResult |= m_pTransport->Send(*winIt, message, wParam, lParam);
+        }
+    }
+
+    return lResult;
+}
+
 
+LRESULT MessageManager::SendMessageTimeout(UINT message, WPARAM wParam,
+    LPARAM lParam, UINT uTimeout)
+{
+    LRESULT lResult = 0;
+    windowSetT windowSet;
+
+    if (GetWindowsForMessage(message, windowSet))
+    {
         for (windowSetT::const_iterator winIt = windowSet.begin();
             winIt != windowSet.end(); ++winIt)
         {
-            lResult |= ::SendMessage(*winIt, message, wParam, lParam);
+            LRESULT lWindowResult = 0;
+
+            bool bDelivered = m_pTransport->Send(
+                *winIt, message, wParam, lParam, uTimeout, lWindowResult);
+
+            if (bDelivered)
+            {
+                lResult |= lWindowResult;
+            }
+
+            _TrackTimeout(*winIt, message, bDelivered);
         }
     }
 
@@ -123,21 +230,50 @@ LRESULT MessageManager::SendMessage(UINT message, WPARAM wParam, LPARAM lParam)
 }
 
 
+void MessageManager::_TrackTimeout(HWND hWnd, UINT uMsg, bool bDelivered)
+{
+    bool bReport = false;
+
+    {
+        Lock lock(m_cs);
+
+        if (bDelivered)
+        {
+            m_TimeoutMap.erase(hWnd);
+        }
+        else if (++m_TimeoutMap[hWnd] >= MESSAGE_TIMEOUT_THRESHOLD)
+        {
+            // Start counting again so that a window which stays unresponsive
+            // is reported periodically rather than on every message
+            m_TimeoutMap.erase(hWnd);
+            bReport = true;
+        }
+    }
+
+    if (bReport)
+    {
+        TRACE("Window %p timed out %u times in a row (last message: %u)",
+            hWnd, MESSAGE_TIMEOUT_THRESHOLD, uMsg);
+
+        // Posted, so that a diagnostic listener can never block us either
+        PostMessage(m_uTimeoutMessage, (WPARAM)hWnd, (LPARAM)uMsg);
+    }
+}
+
+
 BOOL MessageManager::PostMessage(UINT message, WPARAM wParam, LPARAM lParam)
 {
-    Lock lock(m_cs);
     BOOL bResult = TRUE;
+    windowSetT windowSet;
 
-    messageMapT::iterator it = m_MessageMap.find(message);
-
-    if (it != m_MessageMap.end())
+    if (GetWindowsForMessage(message, windowSet))
     {
-        windowSetT::iterator winIt;
+        windowSetT::const_iterator winIt;
 
-        for (winIt = it->second.begin();
-            winIt != it->second.end() && bResult; ++winIt)
+        for (winIt = windowSet.begin();
+            winIt != windowSet.end() && bResult; ++winIt)
         {
-            bResult = ::PostMessage(*winIt, message, wParam, lParam);
+            bResult = m_pTransport->Post(*winIt, message, wParam, lParam);
         }
     }
 
@@ -152,6 +288,28 @@ BOOL MessageManager::HandlerExists(UINT message)
 }
 
 
+UINT MessageManager::GetMessageCount(HINSTANCE hInstance) const
+{
+    Lock lock(m_cs);
+    UINT uCount = 0;
+
+    for (messageMapT::const_iterator iter = m_MessageMap.begin();
+        iter != m_MessageMap.end(); ++iter)
+    {
+        for (windowSetT::const_iterator iterWnd = iter->second.begin();
+            iterWnd != iter->second.end(); ++iterWnd)
+        {
+            if (m_pTransport->GetInstance(*iterWnd) == hInstance)
+            {
+                ++uCount;
+            }
+        }
+    }
+
+    return uCount;
+}
+
+
 bool MessageManager::GetWindowsForMessage(UINT uMsg, windowSetT& setWindows) const
 {
     Lock lock(m_cs);
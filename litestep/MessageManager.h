@@ -22,13 +22,17 @@
 #if !defined(MESSAGEMANAGER_H)
 #define MESSAGEMANAGER_H
 
-#include "../utility/common.h"
+#include "../utility/portable.h"
 #include "../utility/criticalsection.h"
 
 #include <map>
 #include <set>
 
 
+/** Consecutive timeouts after which a window is reported as unresponsive */
+#define MESSAGE_TIMEOUT_THRESHOLD  3
+
+
 /**
  * Manages association of messages with windows.
  *
@@ -41,7 +45,8 @@ class MessageManager
 {
 public:
     /**
-     * Constructor.
+     * Constructor. Messages are delivered through the Win32 messaging
+     * functions.
      */
     MessageManager();
 
@@ -53,16 +58,94 @@ public:
     /** Set of window handles */
     typedef std::set<HWND> windowSetT;
 
+    /**
+     * Delivers messages to individual windows.
+     *
+     * The default implementation forwards to the Win32 messaging functions.
+     * A different transport can be passed to the constructor to drive the
+     * dispatch logic without any real windows.
+     */
+    class Transport
+    {
+    public:
+        virtual ~Transport()
+        {
+            // do nothing
+        }
+
+        /**
+         * Sends a message to a window and waits at most
+         * <code>uTimeout</code> milliseconds for it to be processed.
+         *
+         * @param  lResult  receives the window's result
+         * @return <code>true</code> if the window processed the message or
+         *         <code>false</code> if it timed out or is hung
+         */
+        virtual bool Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam,
+            UINT uTimeout, LRESULT& lResult) = 0;
+
+        /**
+         * Sends a message to a window and waits until it is processed.
+         *
+         * @return the window's result
+         */
+        virtual LRESULT Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) = 0;
+
+        /**
+         * Places a message in a window's message queue.
+         */
+        virtual BOOL Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) = 0;
+
+        /**
+         * Returns the instance handle of the module that owns a window.
+         */
+        virtual HINSTANCE GetInstance(HWND hWnd) = 0;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param  pTransport        transport used to deliver messages. The
+     *                           message manager takes ownership of the
+     *                           object.
+     * @param  uTimeoutMessage   message that reports unresponsive windows,
+     *                           <code>LM_MESSAGETIMEOUT</code> normally
+     */
+    MessageManager(Transport* pTransport, UINT uTimeoutMessage);
+
 private:
     /** Maps message numbers to sets of window handles */
     typedef std::map<UINT, windowSetT> messageMapT;
 
+    /** Maps window handles to their number of consecutive timeouts */
+    typedef std::map<HWND, UINT> timeoutMapT;
+
     /** Message map */
     messageMapT m_MessageMap;
 
+    /** Consecutive timeouts of windows registered for messages */
+    timeoutMapT m_TimeoutMap;
+
+    /** Transport used to deliver messages */
+    Transport* m_pTransport;
+
+    /** Message that reports unresponsive windows */
+    UINT m_uTimeoutMessage;
+
     /** Critical section used to serialize access to data members */
     mutable CriticalSection m_cs;
 
+    /**
+     * Records the outcome of a timeout-bounded delivery and reports windows
+     * that time out repeatedly through <code>LM_MESSAGETIMEOUT</code>.
+     */
+    void _TrackTimeout(HWND hWnd, UINT uMsg, bool bDelivered);
+
+    /**
+     * Returns <code>true</code> if a window is registered for any message.
+     */
+    bool _IsRegistered(HWND hWnd) const;
+
 public:
     /**
      * Registers a window as a handler for a message.
@@ -113,6 +196,23 @@ public:
      */
     LRESULT SendMessage(UINT message, WPARAM wParam, LPARAM lParam);
 
+    /**
+     * Sends a message to all windows that have registered for it, waiting
+     * at most <code>uTimeout</code> milliseconds for each window. Windows
+     * that are hung or don't respond in time are skipped. Windows that time
+     * out <code>MESSAGE_TIMEOUT_THRESHOLD</code> times in a row are reported
+     * to the windows registered for <code>LM_MESSAGETIMEOUT</code>.
+     *
+     * @param   message   message number
+     * @param   wParam    message parameter
+     * @param   lParam    message parameter
+     * @param   uTimeout  per-window timeout in milliseconds
+     * @return  bitwise OR of the results from the windows that processed
+     *          the message in time
+     */
+    LRESULT SendMessageTimeout(UINT message, WPARAM wParam, LPARAM lParam,
+        UINT uTimeout);
+
     /**
      * Posts a message to all windows that have registered for it. Returns
      * as soon as the messages have been placed in the message queue. Does
@@ -146,6 +246,15 @@ public:
      *         message, <code>false</code> otherwise
      */
     bool GetWindowsForMessage(UINT uMsg, windowSetT& setWindows) const;
+
+    /**
+     * Counts the message registrations of windows that belong to a module,
+     * i.e. whose window instance handle is the module's instance.
+     *
+     * @param  hInstance  module instance handle
+     * @return number of (window, message) registrations
+     */
+    UINT GetMessageCount(HINSTANCE hInstance) const;
 };
 
 
@@ -25,6 +25,7 @@
 #include "../utility/core.hpp"
 #include "../utility/stringutility.h"
 
+#include <algorithm>
 #include <process.h>
 
 
@@ -38,10 +39,60 @@ Module::Module(const std::wstring& sLocation, DWORD dwFlags)
     m_pQuit = nullptr;
     m_dwFlags = dwFlags;
     m_dwLoadTime = 0;
+    m_dwLibraryTime = 0;
+    m_dwResolveTime = 0;
+    m_dwInitTime = 0;
+    m_bDeclaredDependencies = false;
+    m_hReadyEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    m_iLoadStart = 0;
+    m_iInitStart = 0;
+    m_iInitBegin = 0;
+    m_iInitEnd = 0;
+    m_iQuitBegin = 0;
+    m_iQuitEnd = 0;
+    m_iLibraryTicks = 0;
+    m_iResolveTicks = 0;
+    m_uBangCount = 0;
+    m_uMessageCount = 0;
+    m_dwCriticalPathTime = 0;
     m_wzLocation = sLocation;
 }
 
 
+static __int64 GetTimestamp()
+{
+    LARGE_INTEGER liCounter;
+    QueryPerformanceCounter(&liCounter);
+    return liCounter.QuadPart;
+}
+
+
+static DWORD TimestampToMilliseconds(__int64 iTicks)
+{
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    return (DWORD)(iTicks * 1000 / liFrequency.QuadPart);
+}
+
+
+static ULONGLONG TimestampToNanoseconds(__int64 iTicks)
+{
+    LARGE_INTEGER liFrequency;
+
+    if (iTicks <= 0 || !QueryPerformanceFrequency(&liFrequency))
+    {
+        return 0;
+    }
+
+    // Split the conversion so that long intervals don't overflow
+    ULONGLONG ullTicks = (ULONGLONG)iTicks;
+    ULONGLONG ullFrequency = (ULONGLONG)liFrequency.QuadPart;
+
+    return (ullTicks / ullFrequency) * 1000000000ULL +
+        (ullTicks % ullFrequency) * 1000000000ULL / ullFrequency;
+}
+
+
 static WORD GetModuleArchitecture(LPCWSTR wzModuleName)
 {
     WORD wRet = 0;
@@ -67,6 +118,120 @@ static WORD GetModuleArchitecture(LPCWSTR wzModuleName)
 }
 
 
+//
+// Image helpers for Module::Preload
+//
+// Modules mapped with LOAD_LIBRARY_AS_DATAFILE have the low bits of their
+// handle set, and are laid out like the file on disk unless they were mapped
+// with LOAD_LIBRARY_AS_IMAGE_RESOURCE.
+//
+static LPBYTE GetImageBase(HMODULE hModule)
+{
+    return (LPBYTE)((ULONG_PTR)hModule & ~(ULONG_PTR)3);
+}
+
+
+static LPBYTE ImageRvaToPointer(LPBYTE pBase, PIMAGE_NT_HEADERS pNTHeader,
+    DWORD dwRva, bool bImageLayout)
+{
+    if (bImageLayout)
+    {
+        return pBase + dwRva;
+    }
+
+    PIMAGE_SECTION_HEADER pSection = IMAGE_FIRST_SECTION(pNTHeader);
+
+    for (WORD w = 0; w < pNTHeader->FileHeader.NumberOfSections; ++w, ++pSection)
+    {
+        DWORD dwSize = std::max(
+            (DWORD)pSection->Misc.VirtualSize, pSection->SizeOfRawData);
+
+        if (dwRva >= pSection->VirtualAddress &&
+            dwRva < pSection->VirtualAddress + dwSize)
+        {
+            return pBase + pSection->PointerToRawData +
+                (dwRva - pSection->VirtualAddress);
+        }
+    }
+
+    return nullptr;
+}
+
+
+static void GetImageImports(HMODULE hModule, bool bImageLayout,
+    std::vector<std::string>& vecImports)
+{
+    LPBYTE pBase = GetImageBase(hModule);
+    PIMAGE_DOS_HEADER pDosHeader = (PIMAGE_DOS_HEADER)pBase;
+
+    if (pDosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+    {
+        return;
+    }
+
+    PIMAGE_NT_HEADERS pNTHeader =
+        (PIMAGE_NT_HEADERS)(pBase + pDosHeader->e_lfanew);
+
+    // Modules for the wrong architecture will fail to load anyway
+    if (pNTHeader->Signature != IMAGE_NT_SIGNATURE ||
+        pNTHeader->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR_MAGIC ||
+        pNTHeader->OptionalHeader.NumberOfRvaAndSizes <=
+        IMAGE_DIRECTORY_ENTRY_IMPORT)
+    {
+        return;
+    }
+
+    DWORD dwImportRva = pNTHeader->OptionalHeader.DataDirectory[
+        IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress;
+
+    PIMAGE_IMPORT_DESCRIPTOR pImport = (PIMAGE_IMPORT_DESCRIPTOR)
+        ImageRvaToPointer(pBase, pNTHeader, dwImportRva, bImageLayout);
+
+    while (dwImportRva != 0 && pImport != nullptr && pImport->Name != 0)
+    {
+        LPCSTR pszName = (LPCSTR)ImageRvaToPointer(
+            pBase, pNTHeader, pImport->Name, bImageLayout);
+
+        if (pszName != nullptr)
+        {
+            vecImports.push_back(pszName);
+        }
+
+        ++pImport;
+    }
+}
+
+
+static void TouchImagePages(HMODULE hModule)
+{
+    LPBYTE pBase = GetImageBase(hModule);
+    LPBYTE pCurrent = pBase;
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    MEMORY_BASIC_INFORMATION mbi;
+
+    while (VirtualQuery(pCurrent, &mbi, sizeof(mbi)) == sizeof(mbi) &&
+        mbi.AllocationBase == pBase)
+    {
+        if (mbi.State == MEM_COMMIT &&
+            !(mbi.Protect & (PAGE_GUARD | PAGE_NOACCESS)))
+        {
+            volatile const BYTE* pPage = (volatile const BYTE*)mbi.BaseAddress;
+
+            for (SIZE_T stOffset = 0; stOffset < mbi.RegionSize;
+                stOffset += si.dwPageSize)
+            {
+                (void)pPage[stOffset];
+            }
+        }
+
+        pCurrent = (LPBYTE)mbi.BaseAddress + mbi.RegionSize;
+    }
+}
+
+
 //
 // This is a workaround because Microsofts std::function implementation is bugged
 //
@@ -98,7 +263,14 @@ bool Module::_LoadDll()
         // First, make Windows display all errors
         UINT uOldMode = SetErrorMode(0);
 
-        if ((m_hInstance = LoadLibraryW(m_wzLocation.c_str())) != nullptr)
+        __int64 iLoadStart = GetTimestamp();
+        m_hInstance = LoadLibraryW(m_wzLocation.c_str());
+
+        __int64 iResolveStart = GetTimestamp();
+        m_iLibraryTicks = iResolveStart - iLoadStart;
+        m_dwLibraryTime = TimestampToMilliseconds(m_iLibraryTicks);
+
+        if (m_hInstance != nullptr)
         {
             AssignToFunction(m_pInit, (initModuleProc) GetProcAddress(
                 m_hInstance, "initModuleW"));
@@ -134,6 +306,25 @@ bool Module::_LoadDll()
                     m_hInstance, "_quitModule");
             }
 
+            // Optional, lists further modules this one depends on
+            getModuleDependenciesProc pDependencies =
+                (getModuleDependenciesProc)GetProcAddress(
+                m_hInstance, "getModuleDependencies");
+
+            if (pDependencies)
+            {
+                LPCWSTR pwzDependency = pDependencies();
+
+                while (pwzDependency && *pwzDependency)
+                {
+                    m_vecDependencies.push_back(pwzDependency);
+                    pwzDependency += wcslen(pwzDependency) + 1;
+                }
+            }
+
+            m_iResolveTicks = GetTimestamp() - iResolveStart;
+            m_dwResolveTime = TimestampToMilliseconds(m_iResolveTicks);
+
             if (m_pInit == nullptr)
             {
                 RESOURCE_STR(nullptr, IDS_INITMODULEEXNOTFOUND_ERROR,
@@ -222,6 +413,19 @@ bool Module::_LoadDll()
 
 Module::~Module()
 {
+    ReleasePreload();
+
+    std::for_each(m_vecDependencyEvents.begin(), m_vecDependencyEvents.end(),
+        CloseHandle);
+
+    // Release anybody still waiting for this module
+    if (m_hReadyEvent)
+    {
+        SetEvent(m_hReadyEvent);
+        CloseHandle(m_hReadyEvent);
+        m_hReadyEvent = nullptr;
+    }
+
     if (m_dwFlags & LS_MODULE_THREADED)
     {
         // Note:
@@ -257,22 +461,23 @@ Module::~Module()
 }
 
 
-bool Module::Init(HWND hMainWindow, const std::wstring& sAppPath)
+bool Module::Load()
 {
     ASSERT(NULL == m_hInstance);
 
-    DWORD dwStartTime = 0;
-    __int64 iStartTime, iEndTime, iFrequency;
-    bool bResult = false;
+    m_iLoadStart = GetTimestamp();
 
-    if (QueryPerformanceCounter((LARGE_INTEGER*)&iStartTime) == FALSE)
-    {
-        dwStartTime = GetTickCount();
-    }
+    return _LoadDll();
+}
+
+
+bool Module::Init(HWND hMainWindow, const std::wstring& sAppPath)
+{
+    bool bResult = false;
 
     // delaying the LoadLibrary call until this point is necessary to make
     // grdtransparent work (it hooks LoadLibrary)
-    if (_LoadDll())
+    if (m_hInstance || Load())
     {
         ASSERT(nullptr != m_pInit);
         ASSERT(nullptr != m_pQuit);
@@ -280,6 +485,8 @@ bool Module::Init(HWND hMainWindow, const std::wstring& sAppPath)
         m_hMainWindow = hMainWindow;
         m_wzAppPath = sAppPath;
 
+        m_iInitStart = GetTimestamp();
+
         if (m_dwFlags & LS_MODULE_THREADED)
         {
             SECURITY_ATTRIBUTES sa;
@@ -298,21 +505,164 @@ bool Module::Init(HWND hMainWindow, const std::wstring& sAppPath)
         }
         else
         {
+            // The module manager has already waited for our dependencies
+            m_iInitBegin = GetTimestamp();
             bResult = CallInit() == 0;
-        }
+            m_iInitEnd = GetTimestamp();
 
-        if (QueryPerformanceCounter((LARGE_INTEGER*)&iEndTime) == FALSE ||
-            QueryPerformanceFrequency((LARGE_INTEGER*)&iFrequency) == FALSE)
-        {
-            m_dwLoadTime = GetTickCount() - dwStartTime;
+            SetEvent(m_hReadyEvent);
         }
-        else
+
+        __int64 iEndTime = GetTimestamp();
+
+        m_dwInitTime = TimestampToMilliseconds(iEndTime - m_iInitStart);
+        m_dwLoadTime = TimestampToMilliseconds(iEndTime - m_iLoadStart);
+    }
+
+    return bResult;
+}
+
+
+DWORD Module::GetWallTime() const
+{
+    DWORD dwWallTime = m_dwLibraryTime + m_dwResolveTime;
+
+    if (m_iInitEnd > m_iInitBegin)
+    {
+        dwWallTime += TimestampToMilliseconds(m_iInitEnd - m_iInitBegin);
+    }
+
+    return dwWallTime;
+}
+
+
+void Module::GetPerformance(LSMODULEPERFORMANCE& lsmp) const
+{
+    ASSERT(lsmp.cbSize >= sizeof(LSMODULEPERFORMANCE));
+
+    lsmp.dwFlags = m_dwFlags;
+    lsmp.dwLoadTime = m_dwLoadTime;
+    lsmp.dwWallTime = GetWallTime();
+    lsmp.dwCriticalPathTime = m_dwCriticalPathTime;
+
+    lsmp.ullLibraryTime = TimestampToNanoseconds(m_iLibraryTicks);
+    lsmp.ullResolveTime = TimestampToNanoseconds(m_iResolveTicks);
+
+    if (m_iInitEnd > m_iInitBegin)
+    {
+        lsmp.ullInitTime = TimestampToNanoseconds(m_iInitEnd - m_iInitBegin);
+    }
+
+    // A threaded module signals its init event right after initModuleEx
+    // returns, so this covers the dependency wait and the init itself
+    if ((m_dwFlags & LS_MODULE_THREADED) && m_iInitEnd > m_iInitStart)
+    {
+        lsmp.ullInitEventLatency =
+            TimestampToNanoseconds(m_iInitEnd - m_iInitStart);
+    }
+
+    lsmp.uBangCount = m_uBangCount;
+    lsmp.uMessageCount = m_uMessageCount;
+}
+
+
+bool Module::SupportsWarmRecycle() const
+{
+    // Modules that need DllMain or their static initializers to run again
+    // export noWarmRecycle
+    return m_hInstance != nullptr &&
+        GetProcAddress(m_hInstance, "noWarmRecycle") == nullptr;
+}
+
+
+ULONGLONG Module::GetQuitTime() const
+{
+    ULONGLONG ullQuitTime = 0;
+
+    if (m_iQuitEnd > m_iQuitBegin)
+    {
+        ullQuitTime = TimestampToNanoseconds(m_iQuitEnd - m_iQuitBegin);
+    }
+
+    return ullQuitTime;
+}
+
+
+void Module::Preload()
+{
+    ASSERT(m_vecPreloaded.empty());
+
+    // Still mapped from before a warm recycle, nothing to warm up
+    if (GetModuleHandleW(m_wzLocation.c_str()) != nullptr)
+    {
+        return;
+    }
+
+    // Mapping the file as an image resource lets the memory manager reuse
+    // the image section when the module is really loaded later on
+    DWORD dwFlags = LOAD_LIBRARY_AS_DATAFILE;
+    bool bImageLayout = IsVistaOrAbove();
+
+    if (bImageLayout)
+    {
+        dwFlags |= LOAD_LIBRARY_AS_IMAGE_RESOURCE;
+    }
+
+    HMODULE hImage = LoadLibraryExW(m_wzLocation.c_str(), nullptr, dwFlags);
+
+    if (hImage != nullptr)
+    {
+        m_vecPreloaded.push_back(hImage);
+
+        std::vector<std::string> vecImports;
+        GetImageImports(hImage, bImageLayout, vecImports);
+
+        wchar_t wzDirectory[MAX_PATH] = { 0 };
+        StringCchCopyW(wzDirectory, _countof(wzDirectory), m_wzLocation.c_str());
+        PathRemoveFileSpecW(wzDirectory);
+
+        for (const std::string& sImport : vecImports)
         {
-            m_dwLoadTime = (DWORD)((iEndTime - iStartTime)*1000/iFrequency);
+            wchar_t wzImport[MAX_PATH] = { 0 };
+            MultiByteToWideChar(CP_ACP, 0, sImport.c_str(), -1,
+                wzImport, _countof(wzImport));
+
+            // Already mapped, nothing to gain
+            if (GetModuleHandleW(wzImport) != nullptr)
+            {
+                continue;
+            }
+
+            // Modules commonly ship their dependencies next to themselves
+            wchar_t wzPath[MAX_PATH] = { 0 };
+            HMODULE hImport = nullptr;
+
+            if (PathCombineW(wzPath, wzDirectory, wzImport) &&
+                PathFileExistsW(wzPath))
+            {
+                hImport = LoadLibraryExW(wzPath, nullptr, dwFlags);
+            }
+            else
+            {
+                hImport = LoadLibraryExW(wzImport, nullptr, dwFlags);
+            }
+
+            if (hImport != nullptr)
+            {
+                m_vecPreloaded.push_back(hImport);
+            }
         }
+
+        std::for_each(m_vecPreloaded.begin(), m_vecPreloaded.end(),
+            TouchImagePages);
     }
+}
 
-    return bResult;
+
+void Module::ReleasePreload()
+{
+    std::for_each(m_vecPreloaded.begin(), m_vecPreloaded.end(), FreeLibrary);
+    m_vecPreloaded.clear();
 }
 
 
@@ -326,7 +676,10 @@ int Module::CallInit()
 void Module::CallQuit()
 {
     ASSERT(m_pQuit != NULL);
+
+    m_iQuitBegin = GetTimestamp();
     m_pQuit(m_hInstance);
+    m_iQuitEnd = GetTimestamp();
 }
 
 
@@ -336,7 +689,16 @@ void Module::Quit()
     {
         if (m_dwFlags & LS_MODULE_THREADED)
         {
-            PostThreadMessage(m_dwThreadID, WM_DESTROY, 0, (LPARAM)this);
+            // The post fails until the thread has created its message
+            // queue, so keep trying for as long as the thread is alive
+            while (!PostThreadMessage(
+                m_dwThreadID, WM_DESTROY, 0, (LPARAM)this))
+            {
+                if (WaitForSingleObject(m_hThread, 10) != WAIT_TIMEOUT)
+                {
+                    break;
+                }
+            }
         }
         else
         {
@@ -355,13 +717,28 @@ UINT __stdcall Module::ThreadProc(void* dllModPtr)
     DbgSetCurrentThreadName(WCSTOMBS(pszFileName));
 #endif
 
+    // Create our message queue before waiting, so that a quit request which
+    // arrives while we wait for our dependencies isn't lost
+    MSG msg;
+    PeekMessage(&msg, NULL, WM_USER, WM_USER, PM_NOREMOVE);
+
+    if (!dllMod->_WaitForDependencies())
+    {
+        // Told to quit before we got to initialize. Don't leave anyone
+        // waiting on us.
+        SetEvent(dllMod->m_hInitCopyEvent);
+        SetEvent(dllMod->m_hReadyEvent);
+        return 0;
+    }
+
+    dllMod->m_iInitBegin = GetTimestamp();
     dllMod->CallInit();
+    dllMod->m_iInitEnd = GetTimestamp();
 
     // We must use a copy of our event, and hope no one has closed it before
     // waiting for it to be signaled.  See: TakeThread() member function.
     SetEvent(dllMod->m_hInitCopyEvent);
-
-    MSG msg;
+    SetEvent(dllMod->m_hReadyEvent);
 
     while (GetMessage(&msg, 0, 0, 0) > 0)
     {
@@ -382,6 +759,47 @@ UINT __stdcall Module::ThreadProc(void* dllModPtr)
 }
 
 
+bool Module::_WaitForDependencies()
+{
+    std::vector<HANDLE> vecPending(m_vecDependencyEvents);
+
+    while (!vecPending.empty())
+    {
+        // MsgWaitForMultipleObjects reserves one slot for the message queue.
+        // With fWaitAll it would only return once everything is signaled
+        // *and* a message arrives, so wait for any and drop what's done.
+        DWORD dwCount = (DWORD)std::min<size_t>(
+            vecPending.size(), MAXIMUM_WAIT_OBJECTS - 1);
+
+        DWORD dwResult = MsgWaitForMultipleObjects(
+            dwCount, &vecPending[0], FALSE, INFINITE, QS_POSTMESSAGE);
+
+        if (dwResult < WAIT_OBJECT_0 + dwCount)
+        {
+            vecPending.erase(vecPending.begin() + (dwResult - WAIT_OBJECT_0));
+        }
+        else if (dwResult == WAIT_OBJECT_0 + dwCount)
+        {
+            // Only pull out quit requests. Anything else (e.g. threaded
+            // bang commands) stays queued until we're initialized.
+            MSG msg;
+
+            if (PeekMessage(&msg, (HWND)-1, WM_DESTROY, WM_DESTROY, PM_REMOVE))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            // Invalid handle or similar; waiting again would just spin
+            break;
+        }
+    }
+
+    return true;
+}
+
+
 void Module::HandleThreadMessage(MSG &msg)
 {
     switch (msg.message)
@@ -26,6 +26,7 @@
 #include "../utility/common.h"
 #include <string>
 #include <functional>
+#include <vector>
 
 
 /**
@@ -64,6 +65,59 @@ private:
     /** The amount of time it took to load the module */
     DWORD m_dwLoadTime;
 
+    /** Time spent in <code>LoadLibrary</code> */
+    DWORD m_dwLibraryTime;
+
+    /** Time spent resolving the module's entry points */
+    DWORD m_dwResolveTime;
+
+    /**
+     * Time spent in <code>initModuleEx</code>, or in starting the module's
+     * thread for threaded modules
+     */
+    DWORD m_dwInitTime;
+
+    /** Images mapped by <code>Preload</code> to warm up the loader */
+    std::vector<HMODULE> m_vecPreloaded;
+
+    /** File names of the modules this module depends on */
+    std::vector<std::wstring> m_vecDependencies;
+
+    /** Whether the dependencies were declared on the LoadModule line */
+    bool m_bDeclaredDependencies;
+
+    /**
+     * Events of the modules this module depends on. Initialization waits
+     * until all of them are set. The module owns these handles.
+     */
+    std::vector<HANDLE> m_vecDependencyEvents;
+
+    /**
+     * Event that is set once the module has finished initializing (whether
+     * it succeeded or not) or is destroyed. Owned by the module, other
+     * modules wait on duplicates of it.
+     */
+    HANDLE m_hReadyEvent;
+
+    /** Timestamps (performance counter) of the module's phases */
+    __int64 m_iLoadStart;
+    __int64 m_iInitStart;
+    __int64 m_iInitBegin;
+    __int64 m_iInitEnd;
+    __int64 m_iQuitBegin;
+    __int64 m_iQuitEnd;
+
+    /** Durations (performance counter ticks) of LoadLibrary and resolving */
+    __int64 m_iLibraryTicks;
+    __int64 m_iResolveTicks;
+
+    /** Bang commands and messages the module registered during init */
+    UINT m_uBangCount;
+    UINT m_uMessageCount;
+
+    /** Time this module added to the startup's critical path */
+    DWORD m_dwCriticalPathTime;
+
     /**
      * Event that is triggered when a threaded module completes initialization
      */
@@ -85,8 +139,19 @@ public:
     virtual ~Module();
 
     /**
-     * Loads and initializes the module. If the module is loaded in its own
-     * thread then initialization is done asynchronously. Use the event handle
+     * Loads the module's DLL and resolves its entry points, without
+     * initializing it. Dependencies exported by the module through
+     * <code>getModuleDependencies</code> are available afterwards.
+     *
+     * @return <code>true</code> if successful or <code>false</code> otherwise
+     */
+    bool Load();
+
+    /**
+     * Loads (unless <code>Load</code> was already called) and initializes
+     * the module. If the module is loaded in its own thread then
+     * initialization is done asynchronously, once all dependency events
+     * have been set. Use the event handle
      * returned by <code>GetInitEvent</code> to wait for initialization to
      * complete. The parameters are passed to the module's
      * <code>initModuleEx</code> function.
@@ -97,6 +162,19 @@ public:
      */
     bool Init(HWND hMainWindow, const std::wstring& sAppPath);
 
+    /**
+     * Maps the module's DLL and the DLLs it imports as data, and touches
+     * all of their pages. No module code is executed, so this may be called
+     * from any thread before <code>Init</code> to take the disk I/O off the
+     * thread that initializes the module.
+     */
+    void Preload();
+
+    /**
+     * Releases the mappings created by <code>Preload</code>.
+     */
+    void ReleasePreload();
+
     /**
      * Shuts down the module and unloads it. If the module was loaded in its
      * own thread then shutdown is done asynchronously. Use event handle
@@ -119,6 +197,126 @@ public:
      */
     static void HandleThreadMessage(MSG &msg);
 
+    /**
+     * Declares the modules this module depends on.
+     *
+     * @param  vecDependencies  file names of the modules
+     */
+    void SetDependencies(const std::vector<std::wstring>& vecDependencies)
+    {
+        m_vecDependencies = vecDependencies;
+        m_bDeclaredDependencies = true;
+    }
+
+    /**
+     * Returns the file names of the modules this module depends on.
+     */
+    const std::vector<std::wstring>& GetDependencies() const
+    {
+        return m_vecDependencies;
+    }
+
+    /**
+     * Returns <code>true</code> if the dependencies were declared on the
+     * module's LoadModule line, meaning it doesn't rely on load order.
+     */
+    bool HasDeclaredDependencies() const
+    {
+        return m_bDeclaredDependencies;
+    }
+
+    /**
+     * Sets the events that must be set before the module initializes. The
+     * module takes ownership of the handles.
+     */
+    void SetDependencyEvents(const std::vector<HANDLE>& vecEvents)
+    {
+        m_vecDependencyEvents = vecEvents;
+    }
+
+    /**
+     * Returns an event that is set once this module has finished
+     * initializing or is destroyed. The module keeps ownership; duplicate
+     * the handle to wait on it beyond the module's lifetime.
+     */
+    HANDLE GetReadyEvent() const
+    {
+        return m_hReadyEvent;
+    }
+
+    /**
+     * Returns the performance counter value when <code>initModuleEx</code>
+     * was called.
+     */
+    __int64 GetInitBegin() const
+    {
+        return m_iInitBegin;
+    }
+
+    /**
+     * Returns the performance counter value when <code>initModuleEx</code>
+     * returned. Only valid once the ready event is set.
+     */
+    __int64 GetInitEnd() const
+    {
+        return m_iInitEnd;
+    }
+
+    /**
+     * Returns the wall time spent loading and initializing this module,
+     * including <code>initModuleEx</code> on the module's own thread but
+     * excluding time spent waiting for dependencies.
+     */
+    DWORD GetWallTime() const;
+
+    /**
+     * Returns how much time this module added to the critical path of the
+     * startup it was loaded in.
+     */
+    DWORD GetCriticalPathTime() const
+    {
+        return m_dwCriticalPathTime;
+    }
+
+    /**
+     * Sets how much time this module added to the startup's critical path.
+     */
+    void SetCriticalPathTime(DWORD dwCriticalPathTime)
+    {
+        m_dwCriticalPathTime = dwCriticalPathTime;
+    }
+
+    /**
+     * Records how many bang commands and messages the module registered
+     * while initializing.
+     */
+    void SetRegistrationCounts(UINT uBangCount, UINT uMessageCount)
+    {
+        m_uBangCount = uBangCount;
+        m_uMessageCount = uMessageCount;
+    }
+
+    /**
+     * Fills in the module's performance record. <code>ullQuitTime</code> is
+     * left alone, since a running module hasn't been unloaded yet.
+     *
+     * @param  lsmp  receives the statistics. <code>cbSize</code> must be
+     *               set by the caller.
+     */
+    void GetPerformance(LSMODULEPERFORMANCE& lsmp) const;
+
+    /**
+     * Returns <code>true</code> if the module's DLL may stay mapped across a
+     * recycle, i.e. the module does not export <code>noWarmRecycle</code>.
+     */
+    bool SupportsWarmRecycle() const;
+
+    /**
+     * Returns how many nanoseconds <code>quitModule</code> took, or 0 if it
+     * hasn't returned yet.
+     */
+    ULONGLONG GetQuitTime() const;
+
     /**
      * Returns this module's DLL instance handle.
      */
@@ -198,6 +396,31 @@ public:
         return m_dwLoadTime;
     }
 
+    /**
+     * Returns how long <code>LoadLibrary</code> took for this module.
+     */
+    DWORD GetLibraryTime() const
+    {
+        return m_dwLibraryTime;
+    }
+
+    /**
+     * Returns how long resolving this module's entry points took.
+     */
+    DWORD GetResolveTime() const
+    {
+        return m_dwResolveTime;
+    }
+
+    /**
+     * Returns how long this module's <code>initModuleEx</code> took. For
+     * threaded modules this is the time it took to start the thread.
+     */
+    DWORD GetInitTime() const
+    {
+        return m_dwInitTime;
+    }
+
     /**
      * Returns a pointer to this module's <code>quitModule</code> function.
      */
@@ -223,6 +446,15 @@ private:
      */
     bool _LoadDll();
 
+    /**
+     * Waits for the modules this module depends on, while watching the
+     * thread's message queue for a quit request.
+     *
+     * @return <code>true</code> once all dependencies are ready or
+     *         <code>false</code> if the module was told to quit first
+     */
+    bool _WaitForDependencies();
+
     /**
      * Calls this module's <code>initModuleEx</code> function.
      *
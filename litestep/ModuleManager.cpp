@@ -25,8 +25,24 @@
 #include <vector>
 
 
+//
+// Converts a difference of performance counter values to milliseconds
+//
+static DWORD CounterToMilliseconds(__int64 iCounter)
+{
+    LARGE_INTEGER liFrequency;
+
+    if (iCounter <= 0 || !QueryPerformanceFrequency(&liFrequency))
+    {
+        return 0;
+    }
+
+    return (DWORD)(iCounter * 1000 / liFrequency.QuadPart);
+}
+
+
 ModuleManager::ModuleManager() :
-    m_pILiteStep(NULL), m_hLiteStep(NULL)
+    m_pILiteStep(NULL), m_hLiteStep(NULL), m_bKeepImages(false)
 {
     // do nothing
 }
@@ -34,7 +50,15 @@ ModuleManager::ModuleManager() :
 
 ModuleManager::~ModuleManager()
 {
-    // do nothing
+    // Modules that never finished quitting keep their DLL loaded, we can't
+    // free it while their thread is still running
+    for (StragglerList::iterator iter = m_lstStragglers.begin();
+        iter != m_lstStragglers.end(); ++iter)
+    {
+        CloseHandle(iter->second);
+    }
+
+    _ReleaseImages();
 }
 
 
@@ -59,6 +83,9 @@ HRESULT ModuleManager::Start(ILiteStep *pILiteStep)
 
             _LoadModules();
 
+            // Whatever wasn't loaded again is gone from step.rc
+            _ReleaseImages();
+
             hr = S_OK;
         }
     }
@@ -76,6 +103,7 @@ HRESULT ModuleManager::Stop()
     HRESULT hr = S_OK;
 
     _QuitModules();
+    m_bKeepImages = false;
 
     if (m_pILiteStep)
     {
@@ -87,6 +115,12 @@ HRESULT ModuleManager::Stop()
 }
 
 
+void ModuleManager::PrepareWarmRecycle()
+{
+    m_bKeepImages = (GetRCBoolDefW(L"LSWarmRecycle", FALSE) != FALSE);
+}
+
+
 HRESULT ModuleManager::rStart()
 {
     HRESULT hr = S_OK;
@@ -132,12 +166,12 @@ UINT ModuleManager::_LoadModules()
         {
             wchar_t wzCommand[MAX_RCCOMMAND] = { 0 };
             wchar_t wzToken1[MAX_LINE_LENGTH] = { 0 };
-            wchar_t wzToken2[MAX_LINE_LENGTH] = { 0 };
+            wchar_t wzExtra[MAX_LINE_LENGTH] = { 0 };
 
             // first buffer takes the "LoadModule" token
-            LPWSTR lpwzBuffers[] = { wzCommand, wzToken1, wzToken2 };
+            LPWSTR lpwzBuffers[] = { wzCommand, wzToken1 };
 
-            if (LCTokenizeW(wzLine, lpwzBuffers, 3, nullptr) >= 2)
+            if (LCTokenizeW(wzLine, lpwzBuffers, 2, wzExtra) >= 2)
             {
 #if defined(LS_COMPAT_LCREADNEXTCONFIG)
                 if (_wcsicmp(wzCommand, L"LoadModule"))
@@ -146,17 +180,39 @@ UINT ModuleManager::_LoadModules()
                 }
 #endif
 
+                // LoadModule <module> [threaded] [depends <module> ...]
                 DWORD dwFlags = 0;
+                bool bDepends = false;
+                std::vector<std::wstring> vecDependencies;
 
-                if (_wcsicmp(wzToken2, L"threaded") == 0)
+                wchar_t wzToken[MAX_LINE_LENGTH];
+                LPCWSTR pwzNext = wzExtra;
+
+                while (pwzNext && GetTokenW(pwzNext, wzToken, &pwzNext, FALSE))
                 {
-                    dwFlags |= LS_MODULE_THREADED;
+                    if (bDepends)
+                    {
+                        vecDependencies.push_back(wzToken);
+                    }
+                    else if (_wcsicmp(wzToken, L"threaded") == 0)
+                    {
+                        dwFlags |= LS_MODULE_THREADED;
+                    }
+                    else if (_wcsicmp(wzToken, L"depends") == 0)
+                    {
+                        bDepends = true;
+                    }
                 }
 
                 Module* pModule = _MakeModule(wzToken1, dwFlags);
 
                 if (pModule)
                 {
+                    if (bDepends)
+                    {
+                        pModule->SetDependencies(vecDependencies);
+                    }
+
                     mqModules.push_back(pModule);
                 }
             }
@@ -193,6 +249,99 @@ Module* ModuleManager::_MakeModule(LPCWSTR pwzLocation, DWORD dwFlags)
 }
 
 
+void ModuleManager::_PreloadModules(const ModuleQueue& mqModules,
+    std::vector<HANDLE>& vecEvents)
+{
+    ASSERT(!m_pPreloadContext);
+
+    m_pPreloadContext.reset(new PreloadContext);
+    m_pPreloadContext->vecModules.assign(mqModules.begin(), mqModules.end());
+    m_pPreloadContext->lNext = 0;
+    m_pPreloadContext->lWorkers = 0;
+    m_pPreloadContext->hDoneEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    for (size_t i = 0; i < mqModules.size(); ++i)
+    {
+        HANDLE hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+        if (hEvent == nullptr)
+        {
+            // Without an event per module we can't tell when it's safe to
+            // touch a module, so don't preload at all
+            std::for_each(m_pPreloadContext->vecEvents.begin(),
+                m_pPreloadContext->vecEvents.end(), CloseHandle);
+
+            m_pPreloadContext.reset();
+            return;
+        }
+
+        m_pPreloadContext->vecEvents.push_back(hEvent);
+    }
+
+    // Preloading is mostly disk I/O, so use a few workers even on single
+    // core machines to keep the disk busy
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    LONG lWorkers = (LONG)std::max<size_t>(si.dwNumberOfProcessors, 4);
+    lWorkers = (LONG)std::min<size_t>(lWorkers, mqModules.size());
+
+    if (m_pPreloadContext->hDoneEvent)
+    {
+        // Count all workers up front, so the first one to finish can't
+        // mistake itself for the last
+        m_pPreloadContext->lWorkers = lWorkers;
+
+        for (LONG i = 0; i < lWorkers; ++i)
+        {
+            if (!LSQueueWorkItem(_PreloadWorkProc,
+                m_pPreloadContext.get(), LSWORK_LONG))
+            {
+                if (InterlockedDecrement(&m_pPreloadContext->lWorkers) == 0)
+                {
+                    SetEvent(m_pPreloadContext->hDoneEvent);
+                }
+            }
+        }
+    }
+
+    if (m_pPreloadContext->lWorkers == 0)
+    {
+        // Couldn't start any workers, so don't make anybody wait on them
+        std::for_each(m_pPreloadContext->vecEvents.begin(),
+            m_pPreloadContext->vecEvents.end(), SetEvent);
+    }
+
+    vecEvents = m_pPreloadContext->vecEvents;
+}
+
+
+void CALLBACK ModuleManager::_PreloadWorkProc(LPVOID pvContext)
+{
+    PreloadContext* pContext = (PreloadContext*)pvContext;
+    LONG lCount = (LONG)pContext->vecModules.size();
+    LONG lIndex;
+
+    // Modules are handed out in load order, so the first modules are ready
+    // first and the main thread can start initializing them right away
+    while ((lIndex = InterlockedIncrement(&pContext->lNext) - 1) < lCount)
+    {
+        if (pContext->vecModules[lIndex])
+        {
+            pContext->vecModules[lIndex]->Preload();
+        }
+
+        SetEvent(pContext->vecEvents[lIndex]);
+    }
+
+    // The context may go away as soon as the main thread sees this
+    if (InterlockedDecrement(&pContext->lWorkers) == 0)
+    {
+        SetEvent(pContext->hDoneEvent);
+    }
+}
+
+
 UINT ModuleManager::_StartModules(ModuleQueue& mqModules)
 {
     UINT uReturn = 0;
@@ -200,37 +349,156 @@ UINT ModuleManager::_StartModules(ModuleQueue& mqModules)
     if (mqModules.size() > 0)
     {
         std::vector<HANDLE> vecInitEvents;
-        ModuleQueue::iterator iter = mqModules.begin();
+        std::vector<HANDLE> vecPreloadEvents;
 
-        while (iter != mqModules.end())
+        __int64 iStart = 0;
+        QueryPerformanceCounter((LARGE_INTEGER*)&iStart);
+
+        // Map all DLLs on worker threads while modules are initialized here,
+        // in order, as soon as their DLL is ready. A nested call (a module
+        // loading another module during its init) just skips the preload.
+        if (mqModules.size() > 1 && !m_pPreloadContext &&
+            GetRCBoolDefW(L"LSPreloadModules", TRUE))
         {
-            if (*iter)
+            _PreloadModules(mqModules, vecPreloadEvents);
+        }
+
+        // Threaded modules that declare their dependencies don't rely on
+        // load order, so they are started first and their thread waits for
+        // exactly the modules they need. Everybody else keeps the order of
+        // step.rc.
+        std::vector<std::pair<Module*, size_t> > vecOrder;
+        size_t stIndex = 0;
+
+        for (ModuleQueue::iterator iter = mqModules.begin();
+            iter != mqModules.end(); ++iter, ++stIndex)
+        {
+            if (*iter && ((*iter)->GetFlags() & LS_MODULE_THREADED) &&
+                (*iter)->HasDeclaredDependencies())
+            {
+                vecOrder.push_back(std::make_pair(*iter, stIndex));
+            }
+        }
+
+        stIndex = 0;
+
+        for (ModuleQueue::iterator iter = mqModules.begin();
+            iter != mqModules.end(); ++iter, ++stIndex)
+        {
+            if (!*iter || !((*iter)->GetFlags() & LS_MODULE_THREADED) ||
+                !(*iter)->HasDeclaredDependencies())
+            {
+                vecOrder.push_back(std::make_pair(*iter, stIndex));
+            }
+        }
+
+        std::set<Module*> setStarted;
+        std::set<Module*> setInvalid;
+        DependencyMap mapDependencies;
+        std::map<Module*, Module*> mapPredecessor;
+        Module* pLastOnMainThread = nullptr;
+        std::map<Module*, std::pair<UINT, UINT> > mapRegistrations;
+
+        for (size_t i = 0; i < vecOrder.size(); ++i)
+        {
+            Module* pModule = vecOrder[i].first;
+            stIndex = vecOrder[i].second;
+
+            if (stIndex < vecPreloadEvents.size())
+            {
+                // The worker must be done with the module before we touch it
+                _WaitForModules(&vecPreloadEvents[stIndex], 1);
+            }
+
+            if (!pModule)
             {
-                if (_FindModule((*iter)->GetLocation()) == m_ModuleQueue.end())
+                continue;
+            }
+
+            bool bInitialized = false;
+
+            // A previous instance of the DLL may still be quitting
+            _ReapStragglers(pModule->GetLocation());
+            _ReleaseStaleImage(pModule->GetLocation());
+
+            if (_FindModule(pModule->GetLocation()) == m_ModuleQueue.end() &&
+                pModule->Load())
+            {
+                std::vector<HANDLE> vecWait;
+
+                _ResolveDependencies(pModule, mqModules, setStarted,
+                    mapDependencies, vecWait);
+
+                if (!vecWait.empty())
                 {
-                    if ((*iter)->Init(m_hLiteStep, m_sAppPath))
-                    {
-                        if ((*iter)->GetInitEvent())
-                        {
-                            // Note: We are taking ownership of the Event handle
-                            //       here.  We call CloseHandle() below.
-                            vecInitEvents.push_back((*iter)->TakeInitEvent());
-                        }
-
-                        m_ModuleQueue.push_back(*iter);
-                        ++uReturn;
-
-                        ++iter;
-                        continue;
-                    }
+                    _WaitForModules(&vecWait[0], vecWait.size());
+
+                    std::for_each(vecWait.begin(), vecWait.end(), CloseHandle);
+                }
+
+                mapPredecessor[pModule] = pLastOnMainThread;
+                setStarted.insert(pModule);
+
+                // Snapshot before init, so that anything a previous
+                // instance of the DLL left registered isn't counted
+                std::pair<UINT, UINT>& prBefore = mapRegistrations[pModule];
+                _GetRegistrationCounts(pModule->GetInstance(),
+                    prBefore.first, prBefore.second);
+
+                bInitialized = pModule->Init(m_hLiteStep, m_sAppPath);
+
+                if (!(pModule->GetFlags() & LS_MODULE_THREADED))
+                {
+                    pLastOnMainThread = pModule;
+
+                    _CountRegistrations(pModule, prBefore);
                 }
             }
 
-            // If we got here, then this is an invalid entry, and needs erased.
-            ModuleQueue::iterator iterOld = iter++;
+            // The real image is mapped now (or failed to), either way
+            // the preloaded mappings have served their purpose
+            pModule->ReleasePreload();
+
+            TRACE("Module %ls: load %u ms, resolve %u ms, init %u ms",
+                PathFindFileNameW(pModule->GetLocation()),
+                pModule->GetLibraryTime(), pModule->GetResolveTime(),
+                pModule->GetInitTime());
 
-            delete *iterOld;
-            mqModules.erase(iterOld);
+            if (bInitialized)
+            {
+                if (pModule->GetInitEvent())
+                {
+                    // Note: We are taking ownership of the Event handle
+                    //       here.  We call CloseHandle() below.
+                    vecInitEvents.push_back(pModule->TakeInitEvent());
+                }
+
+                m_ModuleQueue.push_back(pModule);
+                ++uReturn;
+            }
+            else
+            {
+                // Don't keep modules that depend on this one waiting. The
+                // module itself is deleted once the batch is done.
+                SetEvent(pModule->GetReadyEvent());
+                setInvalid.insert(pModule);
+            }
+        }
+
+        if (m_pPreloadContext)
+        {
+            if (m_pPreloadContext->hDoneEvent)
+            {
+                // All events have been waited on, so the workers are
+                // finishing up
+                WaitForSingleObject(m_pPreloadContext->hDoneEvent, INFINITE);
+                CloseHandle(m_pPreloadContext->hDoneEvent);
+            }
+
+            std::for_each(m_pPreloadContext->vecEvents.begin(),
+                m_pPreloadContext->vecEvents.end(), CloseHandle);
+
+            m_pPreloadContext.reset();
         }
 
         // Are there any "threaded" modules?
@@ -243,62 +511,659 @@ UINT ModuleManager::_StartModules(ModuleQueue& mqModules)
             std::for_each(
                 vecInitEvents.begin(), vecInitEvents.end(), CloseHandle);
         }
+
+        _ComputeCriticalPath(
+            mqModules, mapDependencies, mapPredecessor, iStart);
+
+        // Threaded modules are done with init once their events are set
+        for (std::map<Module*, std::pair<UINT, UINT> >::const_iterator
+            iterCounts = mapRegistrations.begin();
+            iterCounts != mapRegistrations.end(); ++iterCounts)
+        {
+            if ((iterCounts->first->GetFlags() & LS_MODULE_THREADED) &&
+                setInvalid.find(iterCounts->first) == setInvalid.end())
+            {
+                _CountRegistrations(iterCounts->first, iterCounts->second);
+            }
+        }
+
+        // Get rid of invalid entries, and keep the loaded modules in the
+        // order of step.rc (modules are unloaded in reverse order)
+        ModuleQueue::iterator iter = mqModules.begin();
+
+        while (iter != mqModules.end())
+        {
+            if (*iter && setInvalid.find(*iter) == setInvalid.end())
+            {
+                ModuleQueue::iterator iterLoaded = std::find(
+                    m_ModuleQueue.begin(), m_ModuleQueue.end(), *iter);
+
+                if (iterLoaded != m_ModuleQueue.end())
+                {
+                    m_ModuleQueue.splice(
+                        m_ModuleQueue.end(), m_ModuleQueue, iterLoaded);
+                }
+
+                ++iter;
+            }
+            else
+            {
+                delete *iter;
+                iter = mqModules.erase(iter);
+            }
+        }
     }
 
     return uReturn;
 }
 
 
+void ModuleManager::_ResolveDependencies(Module* pModule,
+    const ModuleQueue& mqModules, const std::set<Module*>& setStarted,
+    DependencyMap& mapDependencies, std::vector<HANDLE>& vecWait)
+{
+    const std::vector<std::wstring>& vecNames = pModule->GetDependencies();
+    std::vector<Module*>& vecResolved = mapDependencies[pModule];
+    std::vector<HANDLE> vecEvents;
+    bool bThreaded = (pModule->GetFlags() & LS_MODULE_THREADED) != 0;
+
+    for (size_t i = 0; i < vecNames.size(); ++i)
+    {
+        LPCWSTR pwzName = vecNames[i].c_str();
+        Module* pDependency = _FindDependency(pwzName, mqModules);
+
+        if (!pDependency || pDependency == pModule)
+        {
+            TRACE("Module %ls: unknown dependency %ls",
+                PathFindFileNameW(pModule->GetLocation()), pwzName);
+            continue;
+        }
+
+        // Refuse anything that would have the dependency wait for us
+        std::vector<Module*> vecStack(1, pDependency);
+        std::set<Module*> setVisited;
+        bool bCycle = false;
+
+        while (!vecStack.empty() && !bCycle)
+        {
+            Module* pCurrent = vecStack.back();
+            vecStack.pop_back();
+
+            if (pCurrent == pModule)
+            {
+                bCycle = true;
+            }
+            else if (setVisited.insert(pCurrent).second)
+            {
+                DependencyMap::const_iterator iter =
+                    mapDependencies.find(pCurrent);
+
+                if (iter != mapDependencies.end())
+                {
+                    vecStack.insert(vecStack.end(),
+                        iter->second.begin(), iter->second.end());
+                }
+            }
+        }
+
+        if (bCycle)
+        {
+            TRACE("Module %ls: ignoring circular dependency on %ls",
+                PathFindFileNameW(pModule->GetLocation()), pwzName);
+            continue;
+        }
+
+        bool bInBatch = std::find(mqModules.begin(), mqModules.end(),
+            pDependency) != mqModules.end();
+
+        if (!bThreaded)
+        {
+            // Waiting on the main thread is only safe if the dependency, and
+            // everything it waits for in turn, is already running.
+            // setVisited holds exactly those modules.
+            bool bSafe = true;
+
+            for (std::set<Module*>::const_iterator iter = setVisited.begin();
+                iter != setVisited.end() && bSafe; ++iter)
+            {
+                bool bVisitedInBatch = std::find(mqModules.begin(),
+                    mqModules.end(), *iter) != mqModules.end();
+
+                if (bVisitedInBatch)
+                {
+                    bSafe = setStarted.find(*iter) != setStarted.end();
+                }
+                else
+                {
+                    // Modules from earlier batches may still be waiting for
+                    // something while a module loads another one
+                    bSafe = WaitForSingleObject(
+                        (*iter)->GetReadyEvent(), 0) == WAIT_OBJECT_0;
+                }
+            }
+
+            if (!bSafe)
+            {
+                TRACE("Module %ls: %ls is not running yet, load it earlier",
+                    PathFindFileNameW(pModule->GetLocation()), pwzName);
+                continue;
+            }
+        }
+
+        HANDLE hEvent = nullptr;
+
+        if (DuplicateHandle(GetCurrentProcess(), pDependency->GetReadyEvent(),
+            GetCurrentProcess(), &hEvent, SYNCHRONIZE, FALSE, 0))
+        {
+            if (bInBatch)
+            {
+                vecResolved.push_back(pDependency);
+            }
+
+            vecEvents.push_back(hEvent);
+        }
+    }
+
+    if (bThreaded)
+    {
+        pModule->SetDependencyEvents(vecEvents);
+    }
+    else
+    {
+        vecWait.insert(vecWait.end(), vecEvents.begin(), vecEvents.end());
+    }
+}
+
+
+Module* ModuleManager::_FindDependency(LPCWSTR pwzName,
+    const ModuleQueue& mqModules)
+{
+    bool bFileName = (PathFindFileNameW(pwzName) == pwzName);
+
+    // Loaded modules first, the batch may contain duplicates of them that
+    // are going to be rejected
+    const ModuleQueue* pQueues[] = { &m_ModuleQueue, &mqModules };
+
+    for (size_t i = 0; i < sizeof(pQueues) / sizeof(pQueues[0]); ++i)
+    {
+        for (ModuleQueue::const_iterator iter = pQueues[i]->begin();
+            iter != pQueues[i]->end(); ++iter)
+        {
+            if (*iter)
+            {
+                LPCWSTR pwzLocation = (*iter)->GetLocation();
+
+                if (bFileName)
+                {
+                    pwzLocation = PathFindFileNameW(pwzLocation);
+                }
+
+                if (_wcsicmp(pwzName, pwzLocation) == 0)
+                {
+                    return *iter;
+                }
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+
+void ModuleManager::_ComputeCriticalPath(const ModuleQueue& mqModules,
+    const DependencyMap& mapDependencies,
+    const std::map<Module*, Module*>& mapPredecessor, __int64 iStart)
+{
+    // A module could start once its latest dependency finished, or once the
+    // main thread got to it, whichever happened last
+    std::map<Module*, Module*> mapGate;
+    Module* pLast = nullptr;
+
+    for (ModuleQueue::const_iterator iter = mqModules.begin();
+        iter != mqModules.end(); ++iter)
+    {
+        Module* pModule = *iter;
+        Module* pGate = nullptr;
+
+        if (!pModule)
+        {
+            continue;
+        }
+
+        std::map<Module*, Module*>::const_iterator iterPrev =
+            mapPredecessor.find(pModule);
+
+        if (iterPrev != mapPredecessor.end())
+        {
+            pGate = iterPrev->second;
+        }
+
+        DependencyMap::const_iterator iterDeps = mapDependencies.find(pModule);
+
+        if (iterDeps != mapDependencies.end())
+        {
+            for (size_t i = 0; i < iterDeps->second.size(); ++i)
+            {
+                Module* pDependency = iterDeps->second[i];
+
+                if (!pGate || pDependency->GetInitEnd() > pGate->GetInitEnd())
+                {
+                    pGate = pDependency;
+                }
+            }
+        }
+
+        mapGate[pModule] = pGate;
+        pModule->SetCriticalPathTime(0);
+
+        if (!pLast || pModule->GetInitEnd() > pLast->GetInitEnd())
+        {
+            pLast = pModule;
+        }
+    }
+
+    // Walk back from the module that finished last. Every module on the way
+    // is charged for the time between its gate and its own end, so the
+    // contributions add up to the duration of the whole batch.
+    std::set<Module*> setVisited;
+
+    while (pLast && setVisited.insert(pLast).second)
+    {
+        std::map<Module*, Module*>::const_iterator iterGate =
+            mapGate.find(pLast);
+
+        Module* pGate = nullptr;
+        __int64 iGateTime = iStart;
+
+        if (iterGate != mapGate.end() && iterGate->second &&
+            std::find(mqModules.begin(), mqModules.end(), iterGate->second)
+            != mqModules.end())
+        {
+            pGate = iterGate->second;
+            iGateTime = pGate->GetInitEnd();
+        }
+
+        pLast->SetCriticalPathTime(
+            CounterToMilliseconds(pLast->GetInitEnd() - iGateTime));
+
+        pLast = pGate;
+    }
+}
+
+
+//
+// Counts bang commands per module instance. Used by _GetRegistrationCounts.
+//
+static BOOL CALLBACK CountBangsCallback(HINSTANCE hInstance, LPCWSTR, LPARAM lParam)
+{
+    std::map<HINSTANCE, UINT>* pmapBangs = (std::map<HINSTANCE, UINT>*)lParam;
+    ++(*pmapBangs)[hInstance];
+
+    return TRUE;
+}
+
+
+void ModuleManager::_GetRegistrationCounts(HINSTANCE hInstance,
+    UINT& uBangCount, UINT& uMessageCount)
+{
+    std::map<HINSTANCE, UINT> mapBangs;
+    EnumLSDataW(ELD_BANGS_V2, (FARPROC)CountBangsCallback, (LPARAM)&mapBangs);
+
+    uBangCount = mapBangs[hInstance];
+    uMessageCount = m_pILiteStep->GetMessageCount(hInstance);
+}
+
+
+void ModuleManager::_CountRegistrations(Module* pModule,
+    const std::pair<UINT, UINT>& prBefore)
+{
+    UINT uBangCount = 0;
+    UINT uMessageCount = 0;
+
+    if (pModule->GetInstance())
+    {
+        _GetRegistrationCounts(
+            pModule->GetInstance(), uBangCount, uMessageCount);
+    }
+
+    // Whatever init removed doesn't make for a negative count
+    pModule->SetRegistrationCounts(
+        uBangCount > prBefore.first ? uBangCount - prBefore.first : 0,
+        uMessageCount > prBefore.second ? uMessageCount - prBefore.second : 0);
+}
+
+
 void ModuleManager::_QuitModules()
 {
-    std::vector<HANDLE> vecQuitObjects;
-    ModuleQueue::reverse_iterator iter = m_ModuleQueue.rbegin();
-    ModuleQueue TempQueue;
+    _ReapStragglers(nullptr);
 
     // Note:
     //  Store each module in a temporary queue, so that the module may not be
     //  accessed via our main queue while it is being unloaded.  This does -not-
     //  protect us from threads, however it does hopefully add some security
     //  through obscurity from recursion.
+    ModuleQueue TempQueue(m_ModuleQueue.rbegin(), m_ModuleQueue.rend());
 
-    while (iter != m_ModuleQueue.rend())
-    {
-        TempQueue.push_back(*iter);
+    // A module may only quit once all modules that depend on it are done
+    std::map<Module*, std::set<Module*> > mapDependents;
 
+    for (ModuleQueue::iterator iter = TempQueue.begin();
+        iter != TempQueue.end(); ++iter)
+    {
         if (*iter)
         {
-            (*iter)->Quit();
+            const std::vector<std::wstring>& vecNames =
+                (*iter)->GetDependencies();
 
-            if ((*iter)->GetThread())
+            for (size_t i = 0; i < vecNames.size(); ++i)
             {
-                vecQuitObjects.push_back((*iter)->TakeThread());
+                Module* pDependency =
+                    _FindDependency(vecNames[i].c_str(), ModuleQueue());
+
+                if (pDependency && pDependency != *iter)
+                {
+                    mapDependents[pDependency].insert(*iter);
+                }
             }
         }
-
-        ++iter;
     }
 
-    m_ModuleQueue.clear();
+    DWORD dwTimeout = (DWORD)std::max(0,
+        GetRCIntW(L"LSModuleQuitTimeout", MODULE_QUIT_TIMEOUT));
 
-    if (!vecQuitObjects.empty())
+    ModuleQueue mqPending(TempQueue);
+    std::set<Module*> setDone;
+    std::set<Module*> setStraggling;
+
+    // Threaded modules that are quitting
+    std::vector<Module*> vecRunning;
+    std::vector<HANDLE> vecThreads;
+    std::vector<DWORD> vecStarted;
+
+    while (!mqPending.empty() || !vecRunning.empty())
     {
-        _WaitForModules(&vecQuitObjects[0], vecQuitObjects.size());
+        bool bProgress = false;
+
+        // Non-threaded modules quit on this thread, in reverse load order.
+        // Threaded modules are told to quit as soon as nothing depends on
+        // them any longer, and then quit concurrently.
+        bool bMainThreadBlocked = false;
+        ModuleQueue::iterator iter = mqPending.begin();
+
+        while (iter != mqPending.end())
+        {
+            Module* pModule = *iter;
+
+            if (!pModule)
+            {
+                iter = mqPending.erase(iter);
+                continue;
+            }
+
+            bool bThreaded = (pModule->GetFlags() & LS_MODULE_THREADED) != 0;
+            bool bReady = bThreaded || !bMainThreadBlocked;
+
+            std::map<Module*, std::set<Module*> >::const_iterator iterDeps =
+                mapDependents.find(pModule);
+
+            if (bReady && iterDeps != mapDependents.end())
+            {
+                for (std::set<Module*>::const_iterator iterDep =
+                    iterDeps->second.begin();
+                    iterDep != iterDeps->second.end() && bReady; ++iterDep)
+                {
+                    bReady = (setDone.find(*iterDep) != setDone.end());
+                }
+            }
+
+            if (!bReady)
+            {
+                bMainThreadBlocked |= !bThreaded;
+                ++iter;
+                continue;
+            }
+
+            pModule->Quit();
+
+            if (pModule->GetThread())
+            {
+                // Note: We are taking ownership of the thread handle here.
+                vecRunning.push_back(pModule);
+                vecThreads.push_back(pModule->TakeThread());
+                vecStarted.push_back(GetTickCount());
+            }
+            else
+            {
+                if (dwTimeout && pModule->GetQuitTime() / 1000000 > dwTimeout)
+                {
+                    // Nothing we can do about it on this thread but tell
+                    LSLogPrintf(LOG_WARNING, "LiteStep",
+                        "Module %ls took %I64u ms to quit",
+                        pModule->GetLocation(),
+                        pModule->GetQuitTime() / 1000000);
+                }
+
+                setDone.insert(pModule);
+            }
+
+            iter = mqPending.erase(iter);
+            bProgress = true;
+        }
+
+        if (bProgress)
+        {
+            // Something quit, which may have unblocked other modules
+            continue;
+        }
+
+        if (vecRunning.empty())
+        {
+            if (!mqPending.empty())
+            {
+                // The dependencies declared in step.rc form a cycle, just go
+                // with the load order for the rest
+                TRACE("Circular module dependencies, ignoring them on quit");
+                mapDependents.clear();
+            }
+
+            continue;
+        }
+
+        // Wait for a threaded module to finish, or for the closest deadline
+        DWORD dwWait = INFINITE;
+
+        if (dwTimeout)
+        {
+            DWORD dwNow = GetTickCount();
+            dwWait = 0;
+
+            for (size_t i = 0; i < vecStarted.size(); ++i)
+            {
+                DWORD dwElapsed = dwNow - vecStarted[i];
+                DWORD dwLeft = (dwElapsed < dwTimeout) ? dwTimeout - dwElapsed : 0;
+
+                dwWait = (i == 0) ? dwLeft : std::min(dwWait, dwLeft);
+            }
+        }
+
+        size_t stIndex = 0;
+
+        if (_WaitForAnyModule(&vecThreads[0], vecThreads.size(), dwWait, stIndex))
+        {
+            CloseHandle(vecThreads[stIndex]);
+            setDone.insert(vecRunning[stIndex]);
+
+            vecRunning.erase(vecRunning.begin() + stIndex);
+            vecThreads.erase(vecThreads.begin() + stIndex);
+            vecStarted.erase(vecStarted.begin() + stIndex);
+        }
+        else if (!dwTimeout)
+        {
+            // The wait failed, fall back to waiting for all of them
+            _WaitForModules(&vecThreads[0], vecThreads.size());
+
+            std::for_each(vecThreads.begin(), vecThreads.end(), CloseHandle);
+            setDone.insert(vecRunning.begin(), vecRunning.end());
+
+            vecRunning.clear();
+            vecThreads.clear();
+            vecStarted.clear();
+        }
+        else
+        {
+            DWORD dwNow = GetTickCount();
+
+            for (size_t i = 0; i < vecRunning.size(); )
+            {
+                if (dwNow - vecStarted[i] >= dwTimeout)
+                {
+                    // Leave the straggler loaded, freeing the DLL under its
+                    // thread would crash. It is cleaned up once it's done.
+                    LSLogPrintf(LOG_WARNING, "LiteStep",
+                        "Module %ls did not quit within %u ms",
+                        vecRunning[i]->GetLocation(), dwTimeout);
+
+                    TRACE("Module %ls did not quit within %u ms",
+                        vecRunning[i]->GetLocation(), dwTimeout);
+
+                    m_lstStragglers.push_back(
+                        std::make_pair(vecRunning[i], vecThreads[i]));
 
-        // Close the handles we have taken ownership of.
-        std::for_each(
-            vecQuitObjects.begin(), vecQuitObjects.end(), CloseHandle);
+                    setStraggling.insert(vecRunning[i]);
+                    setDone.insert(vecRunning[i]);
+
+                    vecRunning.erase(vecRunning.begin() + i);
+                    vecThreads.erase(vecThreads.begin() + i);
+                    vecStarted.erase(vecStarted.begin() + i);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
     }
 
+    m_ModuleQueue.clear();
+
     // Clean it all up
-    iter = TempQueue.rbegin();
+    ModuleQueue::reverse_iterator iter = TempQueue.rbegin();
     while (iter != TempQueue.rend())
     {
-        delete *iter;
+        if (*iter && setStraggling.find(*iter) == setStraggling.end())
+        {
+            m_mapQuitTimes[(*iter)->GetLocation()] = (*iter)->GetQuitTime();
+
+            if (m_bKeepImages)
+            {
+                _KeepImage(*iter);
+            }
+
+            delete *iter;
+        }
+
         ++iter;
     }
 }
 
 
+void ModuleManager::_KeepImage(const Module* pModule)
+{
+    if (!pModule->SupportsWarmRecycle())
+    {
+        return;
+    }
+
+    WarmImage image;
+    wchar_t wzPath[MAX_PATH] = { 0 };
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+
+    // Taking a reference through the instance doesn't run DllMain again
+    if (GetModuleFileNameW(pModule->GetInstance(), wzPath, MAX_PATH) &&
+        GetFileAttributesExW(wzPath, GetFileExInfoStandard, &fad) &&
+        GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+        (LPCWSTR)pModule->GetInstance(), &image.hModule))
+    {
+        image.sLocation = pModule->GetLocation();
+        image.sPath = wzPath;
+        image.ftLastWrite = fad.ftLastWriteTime;
+
+        m_vecWarmImages.push_back(image);
+    }
+}
+
+
+void ModuleManager::_ReleaseStaleImage(LPCWSTR pwzLocation)
+{
+    for (std::vector<WarmImage>::iterator iter = m_vecWarmImages.begin();
+        iter != m_vecWarmImages.end(); ++iter)
+    {
+        if (_wcsicmp(iter->sLocation.c_str(), pwzLocation) == 0)
+        {
+            WIN32_FILE_ATTRIBUTE_DATA fad;
+
+            if (!GetFileAttributesExW(iter->sPath.c_str(),
+                GetFileExInfoStandard, &fad) ||
+                CompareFileTime(&fad.ftLastWriteTime, &iter->ftLastWrite) != 0)
+            {
+                TRACE("Module %ls changed, doing a full reload", pwzLocation);
+
+                FreeLibrary(iter->hModule);
+                m_vecWarmImages.erase(iter);
+            }
+
+            break;
+        }
+    }
+}
+
+
+void ModuleManager::_ReleaseImages()
+{
+    for (std::vector<WarmImage>::iterator iter = m_vecWarmImages.begin();
+        iter != m_vecWarmImages.end(); ++iter)
+    {
+        FreeLibrary(iter->hModule);
+    }
+
+    m_vecWarmImages.clear();
+}
+
+
+void ModuleManager::_ReapStragglers(LPCWSTR pwzLocation)
+{
+    StragglerList::iterator iter = m_lstStragglers.begin();
+
+    while (iter != m_lstStragglers.end())
+    {
+        Module* pModule = iter->first;
+        HANDLE hThread = iter->second;
+
+        if (pwzLocation &&
+            _wcsicmp(pwzLocation, pModule->GetLocation()) == 0)
+        {
+            // Don't run initModuleEx while the same DLL is still quitting
+            TRACE("Waiting for module %ls to quit", pwzLocation);
+            _WaitForModules(&hThread, 1);
+        }
+
+        if (WaitForSingleObject(hThread, 0) == WAIT_OBJECT_0)
+        {
+            m_mapQuitTimes[pModule->GetLocation()] = pModule->GetQuitTime();
+
+            CloseHandle(hThread);
+            delete pModule;
+
+            iter = m_lstStragglers.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+
 BOOL ModuleManager::QuitModule(HINSTANCE hModule)
 {
     ModuleQueue::iterator iter = _FindModule(hModule);
@@ -316,6 +1181,8 @@ BOOL ModuleManager::QuitModule(HINSTANCE hModule)
             CloseHandle(hThread);
         }
 
+        m_mapQuitTimes[(*iter)->GetLocation()] = (*iter)->GetQuitTime();
+
         delete *iter;
         m_ModuleQueue.erase(iter);
     }
@@ -399,6 +1266,52 @@ void ModuleManager::_WaitForModules(const HANDLE* pHandles, size_t stCount) cons
 }
 
 
+bool ModuleManager::_WaitForAnyModule(const HANDLE* pHandles, size_t stCount,
+    DWORD dwTimeout, size_t& stIndex) const
+{
+    // MsgWaitForMultipleObjects needs one slot for the message queue. Any
+    // further handles are waited for on a later call.
+    DWORD dwCount = (DWORD)std::min<size_t>(stCount, MAXIMUM_WAIT_OBJECTS - 1);
+    DWORD dwStart = GetTickCount();
+
+    for (;;)
+    {
+        // Handle all pending messages first
+        m_pILiteStep->PeekAllMsgs();
+
+        DWORD dwRemaining = INFINITE;
+
+        if (dwTimeout != INFINITE)
+        {
+            DWORD dwElapsed = GetTickCount() - dwStart;
+
+            if (dwElapsed >= dwTimeout)
+            {
+                break;
+            }
+
+            dwRemaining = dwTimeout - dwElapsed;
+        }
+
+        DWORD dwWaitStatus = MsgWaitForMultipleObjects(dwCount, pHandles,
+            FALSE, dwRemaining, QS_ALLINPUT);
+
+        if (dwWaitStatus < (WAIT_OBJECT_0 + dwCount))
+        {
+            stIndex = dwWaitStatus - WAIT_OBJECT_0;
+            return true;
+        }
+        else if (dwWaitStatus != (WAIT_OBJECT_0 + dwCount))
+        {
+            // Timed out or failed
+            break;
+        }
+    }
+
+    return false;
+}
+
+
 HRESULT ModuleManager::EnumModules(LSENUMMODULESPROCW pfnCallback, LPARAM lParam) const
 {
     HRESULT hr = S_OK;
@@ -435,3 +1348,34 @@ HRESULT ModuleManager::EnumPerformance(LSENUMPERFORMANCEPROCW pfnCallback, LPARA
 
     return hr;
 }
+
+
+HRESULT ModuleManager::EnumPerformanceEx(LSENUMPERFORMANCEEXPROCW pfnCallback, LPARAM lParam) const
+{
+    HRESULT hr = S_OK;
+
+    for (ModuleQueue::const_iterator iter = m_ModuleQueue.begin();
+        iter != m_ModuleQueue.end(); ++iter)
+    {
+        LSMODULEPERFORMANCE lsmp = { 0 };
+
+        lsmp.cbSize = sizeof(lsmp);
+        (*iter)->GetPerformance(lsmp);
+
+        std::map<std::wstring, ULONGLONG>::const_iterator iterQuit =
+            m_mapQuitTimes.find((*iter)->GetLocation());
+
+        if (iterQuit != m_mapQuitTimes.end())
+        {
+            lsmp.ullQuitTime = iterQuit->second;
+        }
+
+        if (!pfnCallback((*iter)->GetLocation(), &lsmp, lParam))
+        {
+            hr = S_FALSE;
+            break;
+        }
+    }
+
+    return hr;
+}
@@ -26,11 +26,18 @@
 #include "../utility/IManager.h"
 #include "../utility/common.h"
 #include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
 
 
 /** List of modules */
 typedef std::list<Module*> ModuleQueue;
 
+/** Default time a module gets to quit, in milliseconds */
+#define MODULE_QUIT_TIMEOUT 10000
+
 
 /**
  * Manages loaded modules.
@@ -64,6 +71,14 @@ public:
      */
     HRESULT Stop();
 
+    /**
+     * Keeps the DLLs of the modules unloaded by the next <code>Stop</code>
+     * mapped, so that the following <code>Start</code> only has to call
+     * their <code>quitModule</code> and <code>initModuleEx</code> functions.
+     * Does nothing unless <code>LSWarmRecycle</code> is enabled.
+     */
+    void PrepareWarmRecycle();
+
     /**
      * Loads all the modules specified in <code>step.rc</code>.
      *
@@ -143,7 +158,26 @@ public:
      */
     HRESULT EnumPerformance(LSENUMPERFORMANCEPROCW pfnCallback, LPARAM lParam) const;
 
+    /**
+     * Enumerates extended performance statistics for loaded modules, such as
+     * the time spent initializing and the contribution to the startup
+     * critical path. Calls the callback function once for each loaded module.
+     * Continues until all modules have been enumerated or the callback
+     * function returns <code>FALSE</code>.
+     *
+     * @param  pfnCallback  pointer to callback function
+     * @param  lParam       application-defined value passed to the callback
+     *                      function
+     * @return <code>S_OK</code> if all modules were enumerated,
+     *         <code>S_FALSE</code> if the callback function returned
+     *         <code>FALSE</code>, or an error code
+     */
+    HRESULT EnumPerformanceEx(LSENUMPERFORMANCEEXPROCW pfnCallback, LPARAM lParam) const;
+
 private:
+    /** Resolved dependencies of each module started in one batch */
+    typedef std::map<Module*, std::vector<Module*> > DependencyMap;
+
     /**
      * Loads all the modules specified in <code>step.rc</code>.
      *
@@ -160,10 +194,125 @@ private:
     UINT _StartModules(ModuleQueue& mqModules);
 
     /**
-     * Unloads all loaded modules.
+     * Queues work items that preload the DLLs of the specified modules on
+     * the LSAPI thread pool, in list order. The event at index i is set once
+     * the module at index i has been preloaded.
+     *
+     * @param  mqModules    list of modules to preload
+     * @param  vecEvents    receives one event per module
+     */
+    void _PreloadModules(const ModuleQueue& mqModules,
+        std::vector<HANDLE>& vecEvents);
+
+    /**
+     * Entry point for the preload work items.
+     *
+     * @param  pvContext  preload context shared by all workers
+     */
+    static void CALLBACK _PreloadWorkProc(LPVOID pvContext);
+
+    /**
+     * Resolves the dependencies a module declared, either on its
+     * <code>LoadModule</code> line or through its
+     * <code>getModuleDependencies</code> export, and hands it the events it
+     * has to wait for before initializing. Dependencies that cannot be
+     * resolved, or that would form a cycle, are dropped.
+     *
+     * @param  pModule          module to resolve the dependencies of
+     * @param  mqModules        modules that are started in the same batch
+     * @param  setStarted       modules of the batch that have been started
+     * @param  mapDependencies  resolved dependencies of the batch so far
+     * @param  vecWait          receives the events the main thread has to
+     *                          wait for before initializing the module
+     */
+    void _ResolveDependencies(Module* pModule, const ModuleQueue& mqModules,
+        const std::set<Module*>& setStarted, DependencyMap& mapDependencies,
+        std::vector<HANDLE>& vecWait);
+
+    /**
+     * Finds a module given a dependency name, which is either a full path or
+     * just the DLL's file name. Modules of the current batch are searched
+     * first, then the loaded modules.
+     *
+     * @param  pwzName    name of the dependency
+     * @param  mqModules  modules that are started in the same batch
+     * @return pointer to the module or <code>nullptr</code>
+     */
+    Module* _FindDependency(LPCWSTR pwzName, const ModuleQueue& mqModules);
+
+    /**
+     * Computes each module's contribution to the critical path of a batch,
+     * once all modules of the batch are done initializing.
+     *
+     * @param  mqModules        modules that were started in the batch
+     * @param  mapDependencies  resolved dependencies of the batch
+     * @param  mapPredecessor   module the main thread finished right before
+     *                          getting to each module
+     * @param  iStart           time stamp of the start of the batch
+     */
+    static void _ComputeCriticalPath(const ModuleQueue& mqModules,
+        const DependencyMap& mapDependencies,
+        const std::map<Module*, Module*>& mapPredecessor, __int64 iStart);
+
+    /**
+     * Counts the bang commands and messages currently registered by a
+     * module instance.
+     *
+     * @param  hInstance      module instance
+     * @param  uBangCount     receives the number of bang commands
+     * @param  uMessageCount  receives the number of messages
+     */
+    void _GetRegistrationCounts(HINSTANCE hInstance,
+        UINT& uBangCount, UINT& uMessageCount);
+
+    /**
+     * Records how many bang commands and messages a module registered
+     * during init, given the counts from just before init.
+     *
+     * @param  pModule   module that finished its init
+     * @param  prBefore  bang and message counts from before init
+     */
+    void _CountRegistrations(Module* pModule,
+        const std::pair<UINT, UINT>& prBefore);
+
+    /**
+     * Unloads all loaded modules. Modules quit in reverse load order, but
+     * threaded modules quit concurrently as soon as no module that depends
+     * on them is left. Threaded modules that don't quit within
+     * <code>LSModuleQuitTimeout</code> are reported and left behind.
      */
     void _QuitModules();
 
+    /**
+     * Takes a reference to a module's DLL so it stays mapped once the module
+     * is deleted, unless the module opted out of warm recycles.
+     *
+     * @param  pModule  module that is about to be deleted
+     */
+    void _KeepImage(const Module* pModule);
+
+    /**
+     * Releases the kept DLL for a module if the file changed on disk since,
+     * so that it is loaded from scratch.
+     *
+     * @param  pwzLocation  path to the module's DLL
+     */
+    void _ReleaseStaleImage(LPCWSTR pwzLocation);
+
+    /**
+     * Releases all kept DLLs. Those that were loaded again stay loaded.
+     */
+    void _ReleaseImages();
+
+    /**
+     * Deletes modules that missed their quit deadline earlier and have
+     * finished quitting since.
+     *
+     * @param  pwzLocation  if not <code>NULL</code>, first waits for the
+     *                      module with this DLL path to finish quitting
+     */
+    void _ReapStragglers(LPCWSTR pwzLocation);
+
     /**
      * Finds a module in the loaded module list based on the path to its DLL.
      *
@@ -196,6 +345,20 @@ private:
      */
     void _WaitForModules(const HANDLE* pHandles, size_t stCount) const;
 
+    /**
+     * Waits for any one of an array of handles to be set while remaining
+     * responsive to user input.
+     *
+     * @param  pHandles   array of handles
+     * @param  stCount    number of handles in the array
+     * @param  dwTimeout  timeout in milliseconds, or <code>INFINITE</code>
+     * @param  stIndex    receives the index of the handle that was set
+     * @return <code>true</code> if a handle was set or <code>false</code> if
+     *         the wait timed out or failed
+     */
+    bool _WaitForAnyModule(const HANDLE* pHandles, size_t stCount,
+        DWORD dwTimeout, size_t& stIndex) const;
+
     /** List of loaded modules */
     ModuleQueue m_ModuleQueue;
 
@@ -208,6 +371,53 @@ private:
     /** Path to LiteStep's root directory */
     std::wstring m_sAppPath;
 
+    /** Work shared by the preload work items */
+    struct PreloadContext
+    {
+        std::vector<Module*> vecModules;
+        std::vector<HANDLE> vecEvents;
+        volatile LONG lNext;
+        volatile LONG lWorkers;
+        HANDLE hDoneEvent;  // set once the last work item is done
+    };
+
+    /** Context of the preload that is currently running */
+    std::unique_ptr<PreloadContext> m_pPreloadContext;
+
+    /**
+     * Nanoseconds the last <code>quitModule</code> of each DLL took, so the
+     * figure survives a recycle
+     */
+    std::map<std::wstring, ULONGLONG> m_mapQuitTimes;
+
+    /** Modules that missed their quit deadline, with their thread handle */
+    typedef std::list<std::pair<Module*, HANDLE> > StragglerList;
+
+    /** Modules that are still quitting after their deadline */
+    StragglerList m_lstStragglers;
+
+    /** A module DLL that is kept mapped across a warm recycle */
+    struct WarmImage
+    {
+        /** Path given to LoadModule */
+        std::wstring sLocation;
+
+        /** Path of the file that is mapped */
+        std::wstring sPath;
+
+        /** Extra reference on the DLL */
+        HMODULE hModule;
+
+        /** Last write time of the file when the reference was taken */
+        FILETIME ftLastWrite;
+    };
+
+    /** Whether the next Stop keeps module DLLs mapped */
+    bool m_bKeepImages;
+
+    /** DLLs kept mapped for the next Start */
+    std::vector<WarmImage> m_vecWarmImages;
+
     /**
      * Predicate used by <code>_FindModule</code> to locate a loaded module
      * given the path to its DLL.
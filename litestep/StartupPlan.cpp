@@ -0,0 +1,163 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "StartupPlan.h"
+#include "../utility/debug.hpp"
+#include <algorithm>
+
+
+// Orders a run of non-blocking items, normal ones first
+struct DeferredLast
+{
+    const std::vector<StartupPlan::DelayClass>* pvecClasses;
+
+    DeferredLast(const std::vector<StartupPlan::DelayClass>& vecClasses)
+    : pvecClasses(&vecClasses)
+    {
+    }
+
+    bool operator()(size_t stLeft, size_t stRight) const
+    {
+        return (*pvecClasses)[stLeft] < (*pvecClasses)[stRight];
+    }
+};
+
+
+//
+// StartupPlan
+//
+StartupPlan::StartupPlan(UINT uConcurrency, DWORD dwDeferDelay)
+: m_stNext(0)
+, m_uInFlight(0)
+, m_bBlocked(false)
+, m_uConcurrency(std::max(uConcurrency, 1u))
+, m_dwDeferDelay(dwDeferDelay)
+, m_dwStart(0)
+{
+}
+
+
+//
+// Add
+//
+size_t StartupPlan::Add(DelayClass dcClass)
+{
+    m_vecClasses.push_back(dcClass);
+    return m_vecClasses.size() - 1;
+}
+
+
+//
+// Start
+//
+void StartupPlan::Start(DWORD dwNow)
+{
+    m_vecOrder.clear();
+
+    for (size_t i = 0; i < m_vecClasses.size(); ++i)
+    {
+        m_vecOrder.push_back(i);
+    }
+
+    std::vector<size_t>::iterator itRun = m_vecOrder.begin();
+
+    while (itRun != m_vecOrder.end())
+    {
+        std::vector<size_t>::iterator itEnd = itRun;
+
+        while (itEnd != m_vecOrder.end() &&
+            m_vecClasses[*itEnd] != ClassBlocking)
+        {
+            ++itEnd;
+        }
+
+        std::stable_sort(itRun, itEnd, DeferredLast(m_vecClasses));
+
+        itRun = (itEnd == m_vecOrder.end()) ? itEnd : itEnd + 1;
+    }
+
+    m_stNext = 0;
+    m_uInFlight = 0;
+    m_bBlocked = false;
+    m_dwStart = dwNow;
+}
+
+
+//
+// GetNext
+// Tick counts wrap, so the defer delay goes through a signed difference
+//
+StartupPlan::NextStep StartupPlan::GetNext(
+    DWORD dwNow, size_t& stIndex, DWORD& dwTimeout)
+{
+    dwTimeout = INFINITE;
+
+    if (m_stNext >= m_vecOrder.size())
+    {
+        return (m_uInFlight == 0) ? StepDone : StepWait;
+    }
+
+    size_t stCandidate = m_vecOrder[m_stNext];
+    DelayClass dcClass = m_vecClasses[stCandidate];
+
+    // Blocking items are barriers in both directions
+    if (m_bBlocked || m_uInFlight >= m_uConcurrency ||
+        (dcClass == ClassBlocking && m_uInFlight > 0))
+    {
+        return StepWait;
+    }
+
+    if (dcClass == ClassDeferred)
+    {
+        LONG lRemaining = (LONG)(m_dwStart + m_dwDeferDelay - dwNow);
+
+        if (lRemaining > 0)
+        {
+            // Anything already running may still finish first
+            dwTimeout = (DWORD)lRemaining;
+            return StepWait;
+        }
+    }
+
+    stIndex = stCandidate;
+    ++m_stNext;
+    ++m_uInFlight;
+    m_bBlocked = (dcClass == ClassBlocking);
+
+    return StepLaunch;
+}
+
+
+//
+// Done
+//
+void StartupPlan::Done(size_t stIndex)
+{
+    ASSERT(m_uInFlight > 0);
+    ASSERT(stIndex < m_vecClasses.size());
+
+    if (m_vecClasses[stIndex] == ClassBlocking)
+    {
+        m_bBlocked = false;
+    }
+
+    --m_uInFlight;
+}
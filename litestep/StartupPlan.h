@@ -0,0 +1,137 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(STARTUPPLAN_H)
+#define STARTUPPLAN_H
+
+#include "../utility/portable.h"
+#include <vector>
+
+
+/**
+ * Decides in which order startup items are launched and how many of them
+ * may be launching at once.
+ *
+ * The plan only deals in item indices. The caller enumerates the items,
+ * launches the index it is handed and reports back once the launch is done,
+ * which lets the plan be driven by a fake launcher.
+ */
+class StartupPlan
+{
+public:
+    /** When an item may be launched */
+    enum DelayClass
+    {
+        /** Runs alone; nothing before it is pending and nothing starts until
+         *  it is done. Used for RunOnce items that are waited on. */
+        ClassBlocking,
+
+        /** Launched as soon as a slot is free */
+        ClassNormal,
+
+        /** Launched once the defer delay has passed since Start */
+        ClassDeferred
+    };
+
+    /** Result of GetNext */
+    enum NextStep
+    {
+        /** Launch the returned item */
+        StepLaunch,
+
+        /** Wait for a launch to finish or for the returned timeout */
+        StepWait,
+
+        /** All items have been launched and are done */
+        StepDone
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param  uConcurrency   maximum number of launches in flight
+     * @param  dwDeferDelay   milliseconds before deferred items are launched
+     */
+    StartupPlan(UINT uConcurrency, DWORD dwDeferDelay);
+
+    /**
+     * Adds an item. Items are numbered in the order they are added, which
+     * should be the order the sources would run in one after another.
+     *
+     * @return  index of the item
+     */
+    size_t Add(DelayClass dcClass);
+
+    /**
+     * Orders the items and starts the defer clock. Blocking items stay
+     * where they are; between them, normal items move ahead of deferred
+     * ones and otherwise keep their order.
+     */
+    void Start(DWORD dwNow);
+
+    /**
+     * Picks the next item to launch.
+     *
+     * @param  dwNow       current tick count
+     * @param  stIndex     receives the item to launch for StepLaunch
+     * @param  dwTimeout   receives how long to wait for StepWait, or
+     *                     <code>INFINITE</code> to wait for a launch to
+     *                     finish
+     */
+    NextStep GetNext(DWORD dwNow, size_t& stIndex, DWORD& dwTimeout);
+
+    /**
+     * Reports that the launch of an item is done.
+     */
+    void Done(size_t stIndex);
+
+    /**
+     * Number of items in the plan.
+     */
+    size_t GetCount() const
+    {
+        return m_vecClasses.size();
+    }
+
+private:
+    /** Class of each item, by index */
+    std::vector<DelayClass> m_vecClasses;
+
+    /** Items in launch order */
+    std::vector<size_t> m_vecOrder;
+
+    /** Position of the next item to launch in m_vecOrder */
+    size_t m_stNext;
+
+    /** Number of launches in flight */
+    UINT m_uInFlight;
+
+    /** A blocking item is in flight */
+    bool m_bBlocked;
+
+    UINT m_uConcurrency;
+    DWORD m_dwDeferDelay;
+
+    /** When Start was called */
+    DWORD m_dwStart;
+};
+
+#endif // STARTUPPLAN_H
@@ -21,6 +21,7 @@
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 #include "StartupRunner.h"
 #include "../utility/core.hpp"
+#include <algorithm>
 #include <regstr.h>
 
 
@@ -31,7 +32,7 @@
 #define ERK_WAITFOR_IDLE        0x0008 // wait until process waits for input
 #define ERK_WIN64_BOTH          0x0010 // run key from 32-bit and 64-bit branch
 
-// Used internally by _RunRegKeys and _RunRegKeysWorker
+// Used internally by _EnumRegKeys and _EnumRegKeysWorker
 #define ERK_WIN64_KEY32         0x0020 // run 32-bit key specifically
 #define ERK_WIN64_KEY64         0x0040 // run 64-bit key specifically
 
@@ -50,15 +51,57 @@ StartupRunner::~StartupRunner()
 
 void StartupRunner::Run(BOOL bForce)
 {
-    CloseHandle(LSCreateThread("StartupRunner",
-        StartupRunner::_ThreadProc, (LPVOID)(INT_PTR)bForce, NULL));
+    // Settings are read here, on the main thread, and travel with the work
+    RunContext* pContext = new RunContext(
+        bForce, (UINT)std::max(GetRCIntW(L"LSStartupConcurrency", 4), 1),
+        (DWORD)std::max(GetRCIntW(L"LSStartupDeferDelay", 5000), 0));
+
+    LPVOID f = LCOpenW(nullptr);
+
+    if (f)
+    {
+        wchar_t wzLine[MAX_LINE_LENGTH];
+
+        while (LCReadNextConfigW(f, L"*LSStartupDefer", wzLine, MAX_LINE_LENGTH))
+        {
+            wchar_t wzToken[MAX_LINE_LENGTH];
+            LPCWSTR pwzNext = wzLine;
+
+            // The first token is the setting's name
+            GetTokenW(pwzNext, wzToken, &pwzNext, FALSE);
+
+            while (pwzNext && GetTokenW(pwzNext, wzToken, &pwzNext, FALSE))
+            {
+                pContext->vecDeferPatterns.push_back(wzToken);
+            }
+        }
+
+        LCClose(f);
+    }
+
+    // Marked as long running since startup items may be waited on
+    if (!LSQueueWorkItem(StartupRunner::_WorkProc, pContext, LSWORK_LONG))
+    {
+        delete pContext;
+    }
 }
 
 
-DWORD WINAPI StartupRunner::_ThreadProc(LPVOID lpData)
+StartupRunner::RunContext::RunContext(
+    BOOL bForceStartup, UINT uConcurrency, DWORD dwDeferDelay)
+: bForce(bForceStartup)
+, plan(uConcurrency, dwDeferDelay)
+, hDoneEvent(nullptr)
 {
+}
+
+
+void CALLBACK StartupRunner::_WorkProc(LPVOID lpData)
+{
+    RunContext* pContext = (RunContext*)lpData;
+
     bool bRunStartup = IsFirstRunThisSession(_T("StartupHasBeenRun"));
-    BOOL bForceStartup = (lpData != 0);
+    BOOL bForceStartup = pContext->bForce;
 
     if (IsVistaOrAbove())
     {
@@ -96,6 +139,9 @@ DWORD WINAPI StartupRunner::_ThreadProc(LPVOID lpData)
             bHKCURunOnce = !pSHRestricted(REST_NOCURRENTUSERRUNONCE);
         }
 
+        //
+        // All sources are enumerated up front, in the order they used to
+        // run in, and then handed to the launch plan.
         //
         // On Win64 there are separate 32-Bit and 64-Bit versions of
         // HKLM\Run, HKLM\RunOnce, and HKLM\RunOnceEx.
@@ -103,44 +149,202 @@ DWORD WINAPI StartupRunner::_ThreadProc(LPVOID lpData)
         //
         // There is only a single version of all HKCU keys.
         //
+        ItemList& items = pContext->vecItems;
+
         if (bHKLMRunOnce)
         {
-            _RunRegKeys(HKEY_LOCAL_MACHINE, REGSTR_PATH_RUNONCE,
+            _EnumRegKeys(HKEY_LOCAL_MACHINE, REGSTR_PATH_RUNONCE,
                 (ERK_RUNSUBKEYS | ERK_DELETE |
-                 ERK_WAITFOR_QUIT | ERK_WIN64_BOTH));
+                 ERK_WAITFOR_QUIT | ERK_WIN64_BOTH), items);
         }
 
-        _RunRunOnceEx();
+        _EnumRunOnceEx(items);
 
         if (bHKLMRun)
         {
-            _RunRegKeys(HKEY_LOCAL_MACHINE, REGSTR_PATH_RUN, ERK_WIN64_BOTH);
+            _EnumRegKeys(HKEY_LOCAL_MACHINE, REGSTR_PATH_RUN,
+                ERK_WIN64_BOTH, items);
         }
 
-        _RunRegKeys(HKEY_LOCAL_MACHINE, REGSTR_PATH_RUN_POLICY, ERK_NONE);
-        _RunRegKeys(HKEY_CURRENT_USER, REGSTR_PATH_RUN_POLICY, ERK_NONE);
+        _EnumRegKeys(HKEY_LOCAL_MACHINE, REGSTR_PATH_RUN_POLICY,
+            ERK_NONE, items);
+        _EnumRegKeys(HKEY_CURRENT_USER, REGSTR_PATH_RUN_POLICY,
+            ERK_NONE, items);
 
         if (bHKCURun)
         {
-            _RunRegKeys(HKEY_CURRENT_USER, REGSTR_PATH_RUN, ERK_NONE);
+            _EnumRegKeys(HKEY_CURRENT_USER, REGSTR_PATH_RUN, ERK_NONE, items);
         }
 
-        _RunStartupMenu();
+        _EnumStartupMenu(items);
 
         if (bHKCURunOnce)
         {
-            _RunRegKeys(HKEY_CURRENT_USER, REGSTR_PATH_RUNONCE,
-                (ERK_RUNSUBKEYS | ERK_DELETE));
+            _EnumRegKeys(HKEY_CURRENT_USER, REGSTR_PATH_RUNONCE,
+                (ERK_RUNSUBKEYS | ERK_DELETE), items);
         }
 
+        _RunItems(pContext);
+
+        // Pool threads are shared, leave this one the way we found it
         CoUninitialize();
     }
 
-    return bRunStartup;
+    delete pContext;
 }
 
 
-void StartupRunner::_RunRunOnceEx()
+//
+// _RunItems
+//
+// Launches the enumerated items as the plan allows. Each launch is its own
+// work item, so a slow ShellExecuteEx only holds up its own slot.
+//
+void StartupRunner::_RunItems(RunContext* pContext)
+{
+    for (size_t i = 0; i < pContext->vecItems.size(); ++i)
+    {
+        const StartupItem& item = pContext->vecItems[i];
+        StartupPlan::DelayClass dcClass = StartupPlan::ClassNormal;
+
+        // RunOnce items that are waited on keep their barrier semantics
+        if (item.dwFlags & ERK_WAITFOR_QUIT)
+        {
+            dcClass = StartupPlan::ClassBlocking;
+        }
+        else
+        {
+            for (std::vector<std::wstring>::const_iterator iter =
+                 pContext->vecDeferPatterns.begin();
+                 iter != pContext->vecDeferPatterns.end(); ++iter)
+            {
+                if (matchW(iter->c_str(), item.strName.c_str()))
+                {
+                    dcClass = StartupPlan::ClassDeferred;
+                    break;
+                }
+            }
+        }
+
+        pContext->plan.Add(dcClass);
+    }
+
+    // Without an event nothing can be waited on, so launch one at a time
+    // on this thread instead
+    pContext->hDoneEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    pContext->plan.Start(GetTickCount());
+
+    for (;;)
+    {
+        size_t stIndex = 0;
+        DWORD dwTimeout = INFINITE;
+        StartupPlan::NextStep nsStep;
+
+        {
+            Lock lock(pContext->csPlan);
+            nsStep = pContext->plan.GetNext(GetTickCount(), stIndex, dwTimeout);
+        }
+
+        if (nsStep == StartupPlan::StepDone)
+        {
+            break;
+        }
+        else if (nsStep == StartupPlan::StepWait)
+        {
+            if (pContext->hDoneEvent)
+            {
+                WaitForSingleObject(pContext->hDoneEvent, dwTimeout);
+            }
+            else
+            {
+                ASSERT(dwTimeout != INFINITE);
+                Sleep(dwTimeout);
+            }
+        }
+        else
+        {
+            LaunchItem* pLaunch = new LaunchItem;
+            pLaunch->pContext = pContext;
+            pLaunch->stIndex = stIndex;
+
+            if (pContext->hDoneEvent == nullptr ||
+                !LSQueueWorkItem(_LaunchProc, pLaunch, LSWORK_LONG))
+            {
+                _LaunchProc(pLaunch);
+            }
+        }
+    }
+
+    if (pContext->hDoneEvent)
+    {
+        CloseHandle(pContext->hDoneEvent);
+    }
+}
+
+
+void CALLBACK StartupRunner::_LaunchProc(LPVOID lpData)
+{
+    LaunchItem* pLaunch = (LaunchItem*)lpData;
+    RunContext* pContext = pLaunch->pContext;
+    const StartupItem& item = pContext->vecItems[pLaunch->stIndex];
+
+    // ShellExecuteEx needs COM on whichever thread it runs on
+    HRESULT hr = CoInitializeEx(
+        NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+
+    if (item.bCommandLine)
+    {
+        TCHAR tzCommandLine[MAX_LINE_LENGTH] = { 0 };
+
+        // _SpawnProcess splits the command line in place
+        if (SUCCEEDED(StringCchCopy(tzCommandLine,
+            COUNTOF(tzCommandLine), item.strCommand.c_str())))
+        {
+            _SpawnProcess(tzCommandLine, item.dwFlags);
+        }
+    }
+    else
+    {
+        SHELLEXECUTEINFO seiCommand = { 0 };
+
+        seiCommand.cbSize = sizeof(SHELLEXECUTEINFO);
+        seiCommand.lpFile = item.strCommand.c_str();
+        seiCommand.lpParameters =
+            item.strArgs.empty() ? NULL : item.strArgs.c_str();
+        seiCommand.lpDirectory =
+            item.strDirectory.empty() ? NULL : item.strDirectory.c_str();
+        seiCommand.nShow = SW_SHOWNORMAL;
+        seiCommand.fMask = SEE_MASK_DOENVSUBST | SEE_MASK_FLAG_NO_UI;
+
+        if (!LSShellExecuteEx(&seiCommand))
+        {
+            TRACE("StartupRunner failed to launch '%ls'",
+                item.strCommand.c_str());
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        CoUninitialize();
+    }
+
+    {
+        // Signal under the lock; once the plan is done the runner frees
+        // the context, event included
+        Lock lock(pContext->csPlan);
+        pContext->plan.Done(pLaunch->stIndex);
+
+        if (pContext->hDoneEvent)
+        {
+            SetEvent(pContext->hDoneEvent);
+        }
+    }
+
+    delete pLaunch;
+}
+
+
+void StartupRunner::_EnumRunOnceEx(ItemList& items)
 {
     //
     // TODO: Figure out how this works on Win64
@@ -156,25 +360,31 @@ void StartupRunner::_RunRunOnceEx()
             if (PathFileExists(szArgs) && SUCCEEDED(StringCchCat(szArgs,
                 MAX_PATH, _T(",RunOnceExProcess"))))
             {
-                LSShellExecute(NULL,
-                    _T("open"), _T("rundll32.exe"), szArgs, NULL, SW_NORMAL);
+                StartupItem item;
+                item.strCommand = _T("rundll32.exe");
+                item.strArgs = szArgs;
+                item.strName = _T("RunOnceEx");
+                item.dwFlags = ERK_NONE;
+                item.bCommandLine = false;
+
+                items.push_back(item);
             }
         }
     }
 }
 
 
-void StartupRunner::_RunStartupMenu()
+void StartupRunner::_EnumStartupMenu(ItemList& items)
 {
-    _RunShellFolderContents(CSIDL_COMMON_STARTUP);
-    _RunShellFolderContents(CSIDL_COMMON_ALTSTARTUP);
+    _EnumShellFolderContents(CSIDL_COMMON_STARTUP, items);
+    _EnumShellFolderContents(CSIDL_COMMON_ALTSTARTUP, items);
 
-    _RunShellFolderContents(CSIDL_STARTUP);
-    _RunShellFolderContents(CSIDL_ALTSTARTUP);
+    _EnumShellFolderContents(CSIDL_STARTUP, items);
+    _EnumShellFolderContents(CSIDL_ALTSTARTUP, items);
 }
 
 
-void StartupRunner::_RunShellFolderContents(int nFolder)
+void StartupRunner::_EnumShellFolderContents(int nFolder, ItemList& items)
 {
     TCHAR tzPath[MAX_PATH] = { 0 };
 
@@ -194,20 +404,14 @@ void StartupRunner::_RunShellFolderContents(int nFolder)
                     !(findData.dwFileAttributes & FILE_ATTRIBUTE_SYSTEM) &&
                     !(findData.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN))
                 {
-                    SHELLEXECUTEINFO seiCommand = { 0 };
-
-                    seiCommand.cbSize = sizeof(SHELLEXECUTEINFO);
-                    seiCommand.lpFile = findData.cFileName;
-                    seiCommand.lpDirectory = tzPath;
-                    seiCommand.nShow = SW_SHOWNORMAL;
-                    seiCommand.fMask =
-                        SEE_MASK_DOENVSUBST | SEE_MASK_FLAG_NO_UI;
-
-                    if (!LSShellExecuteEx(&seiCommand))
-                    {
-                        TRACE("StartupRunner failed to launch '%ls'",
-                            findData.cFileName);
-                    }
+                    StartupItem item;
+                    item.strCommand = findData.cFileName;
+                    item.strDirectory = tzPath;
+                    item.strName = findData.cFileName;
+                    item.dwFlags = ERK_NONE;
+                    item.bCommandLine = false;
+
+                    items.push_back(item);
                 }
 
                 if (!FindNextFile(hSearch, &findData))
@@ -331,9 +535,10 @@ bool StartupRunner::IsFirstRunThisSession(LPCTSTR pszSubkey)
 
 
 //
-// RunRegKeys
+// _EnumRegKeys
 //
-void StartupRunner::_RunRegKeys(HKEY hkParent, LPCTSTR ptzSubKey, DWORD dwFlags)
+void StartupRunner::_EnumRegKeys(HKEY hkParent,
+                                 LPCTSTR ptzSubKey, DWORD dwFlags, ItemList& items)
 {
 #ifdef _WIN64
     if (dwFlags & ERK_WIN64_BOTH)
@@ -342,21 +547,26 @@ void StartupRunner::_RunRegKeys(HKEY hkParent, LPCTSTR ptzSubKey, DWORD dwFlags)
 #endif
     {
         dwFlags &= ~ERK_WIN64_BOTH;
-        _RunRegKeysWorker(hkParent, ptzSubKey, dwFlags | ERK_WIN64_KEY64);
-        _RunRegKeysWorker(hkParent, ptzSubKey, dwFlags | ERK_WIN64_KEY32);
+        _EnumRegKeysWorker(hkParent, ptzSubKey,
+            dwFlags | ERK_WIN64_KEY64, items);
+        _EnumRegKeysWorker(hkParent, ptzSubKey,
+            dwFlags | ERK_WIN64_KEY32, items);
     }
     else
     {
-        _RunRegKeysWorker(hkParent, ptzSubKey, dwFlags);
+        _EnumRegKeysWorker(hkParent, ptzSubKey, dwFlags, items);
     }
 }
 
 
 //
-// _RunRegKeysWorker
+// _EnumRegKeysWorker
+//
+// Values marked for deletion are deleted as they are collected, before they
+// are launched, like explorer does for RunOnce.
 //
-void StartupRunner::_RunRegKeysWorker(HKEY hkParent,
-                                      LPCTSTR ptzSubKey, DWORD dwFlags)
+void StartupRunner::_EnumRegKeysWorker(HKEY hkParent,
+                                       LPCTSTR ptzSubKey, DWORD dwFlags, ItemList& items)
 {
     REGSAM samDesired = MAXIMUM_ALLOWED;
 
@@ -402,7 +612,13 @@ void StartupRunner::_RunRegKeysWorker(HKEY hkParent,
                 {
                     if (szValue[0])
                     {
-                        _SpawnProcess(szValue, dwFlags);
+                        StartupItem item;
+                        item.strCommand = szValue;
+                        item.strName = szName;
+                        item.dwFlags = dwFlags;
+                        item.bCommandLine = true;
+
+                        items.push_back(item);
                     }
 
                     if ((dwFlags & ERK_DELETE) && (szName[0] != _T('!')))
@@ -441,7 +657,7 @@ void StartupRunner::_RunRegKeysWorker(HKEY hkParent,
                 }
                 else if (lResult == ERROR_SUCCESS)
                 {
-                    _RunRegKeys(hkey, szName, dwFlags);
+                    _EnumRegKeys(hkey, szName, dwFlags, items);
 
                     if (dwFlags & ERK_DELETE)
                     {
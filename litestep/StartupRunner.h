@@ -23,6 +23,10 @@
 #define STARTUPRUNNER_H
 
 #include "../utility/common.h"
+#include "../utility/criticalsection.h"
+#include "StartupPlan.h"
+#include <string>
+#include <vector>
 
 class StartupRunner
 {
@@ -34,13 +38,56 @@ public:
     static bool IsFirstRunThisSession(LPCTSTR pszSubkey);
 
 public:
-    static DWORD WINAPI _ThreadProc(LPVOID lpData);
+    /** One item found in a startup source */
+    struct StartupItem
+    {
+        /** Command line, or the file to open if bCommandLine is false */
+        std::wstring strCommand;
+        std::wstring strArgs;
+        std::wstring strDirectory;
+
+        /** Registry value or file name, matched against LSStartupDefer */
+        std::wstring strName;
+
+        DWORD dwFlags;
+        bool bCommandLine;
+    };
+
+    typedef std::vector<StartupItem> ItemList;
+
+    /** State shared by the runner and its launch work items */
+    struct RunContext
+    {
+        RunContext(BOOL bForceStartup, UINT uConcurrency, DWORD dwDeferDelay);
+
+        BOOL bForce;
+        std::vector<std::wstring> vecDeferPatterns;
+        ItemList vecItems;
+
+        /** Guards plan */
+        CriticalSection csPlan;
+        StartupPlan plan;
+
+        /** Set whenever a launch is done */
+        HANDLE hDoneEvent;
+    };
+
+    /** Context of a single launch work item */
+    struct LaunchItem
+    {
+        RunContext* pContext;
+        size_t stIndex;
+    };
+
+    static void CALLBACK _WorkProc(LPVOID lpData);
+    static void CALLBACK _LaunchProc(LPVOID lpData);
+    static void _RunItems(RunContext* pContext);
     static HKEY _CreateSessionInfoKey();
-    static void _RunRegKeys(HKEY hkParent, LPCTSTR ptzSubKey, DWORD dwFlags);
-    static void _RunRegKeysWorker(HKEY hkParent, LPCTSTR ptzSubKey, DWORD dwFlags);
-    static void _RunRunOnceEx();
-    static void _RunStartupMenu();
-    static void _RunShellFolderContents(int nFolder);
+    static void _EnumRegKeys(HKEY hkParent, LPCTSTR ptzSubKey, DWORD dwFlags, ItemList& items);
+    static void _EnumRegKeysWorker(HKEY hkParent, LPCTSTR ptzSubKey, DWORD dwFlags, ItemList& items);
+    static void _EnumRunOnceEx(ItemList& items);
+    static void _EnumStartupMenu(ItemList& items);
+    static void _EnumShellFolderContents(int nFolder, ItemList& items);
     static void _SpawnProcess(LPTSTR ptzCommandLine, DWORD dwFlags);
     static HANDLE _ShellExecuteEx(LPCTSTR ptzExecutable, LPCTSTR ptzArgs);
 };
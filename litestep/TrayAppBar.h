@@ -22,7 +22,31 @@
 #if !defined(TRAYAPPBAR_H)
 #define TRAYAPPBAR_H
 
-#include <shellapi.h>
+#include "../utility/portable.h"
+
+#if defined(_WIN32)
+#  include <shellapi.h>
+#else
+#  define ABM_NEW               0x00000000
+#  define ABM_REMOVE            0x00000001
+#  define ABM_QUERYPOS          0x00000002
+#  define ABM_SETPOS            0x00000003
+#  define ABM_GETSTATE          0x00000004
+#  define ABM_GETTASKBARPOS     0x00000005
+#  define ABM_ACTIVATE          0x00000006
+#  define ABM_GETAUTOHIDEBAR    0x00000007
+#  define ABM_SETAUTOHIDEBAR    0x00000008
+#  define ABM_WINDOWPOSCHANGED  0x00000009
+#  define ABM_SETSTATE          0x0000000A
+#  define ABN_STATECHANGE       0x00000000
+#  define ABN_POSCHANGED        0x00000001
+#  define ABN_FULLSCREENAPP     0x00000002
+#  define ABS_AUTOHIDE          0x00000001
+#  define ABE_LEFT              0
+#  define ABE_TOP               1
+#  define ABE_RIGHT             2
+#  define ABE_BOTTOM            3
+#endif // defined(_WIN32)
 
 #define ABE_HORIZONTAL      0x01
 
@@ -0,0 +1,429 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayAppBarLayout.h"
+#include <algorithm>
+#include <cstring>
+
+
+//
+// AppBarLayout
+//
+AppBarLayout::AppBarLayout()
+    : m_ulSequence(0)
+{
+    // do nothing
+}
+
+
+//
+// AddBar
+//
+void AppBarLayout::AddBar(BarId bar)
+{
+    if (m_mapBars.find(bar) == m_mapBars.end())
+    {
+        Bar& newBar = m_mapBars[bar];
+        newBar.ulSequence = m_ulSequence++;
+        newBar.bPlaced = false;
+        newBar.monitor = nullptr;
+        newBar.uEdge = EdgeCount;
+        newBar.rc.left = newBar.rc.top = newBar.rc.right = newBar.rc.bottom = 0;
+    }
+}
+
+
+//
+// RemoveBar
+//
+void AppBarLayout::RemoveBar(BarId bar)
+{
+    BarMap::iterator it = m_mapBars.find(bar);
+
+    if (it != m_mapBars.end())
+    {
+        if (it->second.bPlaced)
+        {
+            _Unplace(it->second);
+        }
+
+        m_mapBars.erase(it);
+    }
+}
+
+
+//
+// PlaceBar
+//
+void AppBarLayout::PlaceBar(BarId bar, MonitorId monitor, unsigned uEdge, const Rect& rc)
+{
+    BarMap::iterator it = m_mapBars.find(bar);
+
+    if (it == m_mapBars.end() || !_IsValidEdge(uEdge))
+    {
+        return;
+    }
+
+    Bar& placed = it->second;
+
+    if (placed.bPlaced && placed.monitor == monitor && placed.uEdge == uEdge)
+    {
+        // Same edge, the stacking order stays as it is
+        if (memcmp(&placed.rc, &rc, sizeof(Rect)) != 0)
+        {
+            placed.rc = rc;
+
+            MonitorState& state = m_mapMonitors[monitor];
+            state.edges[uEdge].bInsetValid = false;
+            state.bDirty = true;
+        }
+
+        return;
+    }
+
+    if (placed.bPlaced)
+    {
+        _Unplace(placed);
+    }
+
+    placed.bPlaced = true;
+    placed.monitor = monitor;
+    placed.uEdge = uEdge;
+    placed.rc = rc;
+
+    MonitorState& state = m_mapMonitors[monitor];
+    EdgeState& edge = state.edges[uEdge];
+
+    edge.vecBars.insert(std::upper_bound(edge.vecBars.begin(),
+        edge.vecBars.end(), &placed, _ComesBefore), &placed);
+    edge.bInsetValid = false;
+    state.bDirty = true;
+}
+
+
+//
+// QueryPos
+//
+AppBarLayout::Rect AppBarLayout::QueryPos(BarId bar, MonitorId monitor,
+    unsigned uEdge, const Rect& rcBase, const Rect& rcRequested) const
+{
+    Rect rcDst = rcBase;
+
+    ApplyExtent(rcDst, rcRequested, uEdge);
+
+    MonitorMap::const_iterator itMonitor = m_mapMonitors.find(monitor);
+
+    if (itMonitor != m_mapMonitors.end() && _IsValidEdge(uEdge))
+    {
+        const MonitorState& state = itMonitor->second;
+        BarMap::const_iterator itBar = m_mapBars.find(bar);
+
+        // Dock against the last bar stacked before this one. Bars we don't
+        // know go on top of all others.
+        const std::vector<const Bar*>& vecSame = state.edges[uEdge].vecBars;
+        std::vector<const Bar*>::const_iterator itBefore = vecSame.end();
+
+        if (itBar != m_mapBars.end())
+        {
+            itBefore = std::lower_bound(vecSame.begin(), vecSame.end(),
+                &itBar->second, _ComesBefore);
+        }
+
+        if (itBefore != vecSame.begin())
+        {
+            const Rect& rcBefore = (*(itBefore - 1))->rc;
+
+            switch (uEdge)
+            {
+            case EdgeLeft:
+                rcDst.left = rcBefore.right;
+                break;
+            case EdgeTop:
+                rcDst.top = rcBefore.bottom;
+                break;
+            case EdgeRight:
+                rcDst.right = rcBefore.left;
+                break;
+            case EdgeBottom:
+                rcDst.bottom = rcBefore.top;
+                break;
+            }
+        }
+
+        // Left/Right bars must resize to top/bottom bars
+        if (uEdge == EdgeLeft || uEdge == EdgeRight)
+        {
+            const Bar* pSelf =
+                (itBar != m_mapBars.end()) ? &itBar->second : nullptr;
+
+            const std::vector<const Bar*>& vecTop = state.edges[EdgeTop].vecBars;
+            const std::vector<const Bar*>& vecBottom = state.edges[EdgeBottom].vecBars;
+
+            for (std::vector<const Bar*>::const_iterator it = vecTop.begin();
+                it != vecTop.end(); ++it)
+            {
+                if (*it != pSelf && _Intersects((*it)->rc, rcDst))
+                {
+                    rcDst.top = std::max(rcDst.top, (*it)->rc.bottom);
+                }
+            }
+
+            for (std::vector<const Bar*>::const_iterator it = vecBottom.begin();
+                it != vecBottom.end(); ++it)
+            {
+                if (*it != pSelf && _Intersects((*it)->rc, rcDst))
+                {
+                    rcDst.bottom = std::min(rcDst.bottom, (*it)->rc.top);
+                }
+            }
+        }
+    }
+
+    ApplyBreadth(rcDst, rcRequested, uEdge);
+
+    return rcDst;
+}
+
+
+//
+// GetWorkArea
+//
+AppBarLayout::Rect AppBarLayout::GetWorkArea(MonitorId monitor, const Rect& rcMonitor)
+{
+    Rect rcWork = rcMonitor;
+    MonitorMap::iterator itMonitor = m_mapMonitors.find(monitor);
+
+    if (itMonitor == m_mapMonitors.end())
+    {
+        return rcWork;
+    }
+
+    for (unsigned uEdge = 0; uEdge < EdgeCount; ++uEdge)
+    {
+        EdgeState& edge = itMonitor->second.edges[uEdge];
+
+        if (!edge.bInsetValid)
+        {
+            _UpdateInset(edge, uEdge);
+        }
+
+        if (edge.vecBars.empty())
+        {
+            continue;
+        }
+
+        switch (uEdge)
+        {
+        case EdgeLeft:
+            rcWork.left = std::max(rcWork.left, edge.lInset);
+            break;
+        case EdgeTop:
+            rcWork.top = std::max(rcWork.top, edge.lInset);
+            break;
+        case EdgeRight:
+            rcWork.right = std::min(rcWork.right, edge.lInset);
+            break;
+        case EdgeBottom:
+            rcWork.bottom = std::min(rcWork.bottom, edge.lInset);
+            break;
+        }
+    }
+
+    // Bars covering everything leave nothing
+    if (rcWork.right < rcWork.left)
+    {
+        rcWork.right = rcWork.left;
+    }
+
+    if (rcWork.bottom < rcWork.top)
+    {
+        rcWork.bottom = rcWork.top;
+    }
+
+    return rcWork;
+}
+
+
+//
+// IsStackedBefore
+//
+bool AppBarLayout::IsStackedBefore(BarId a, BarId b) const
+{
+    BarMap::const_iterator itA = m_mapBars.find(a);
+    BarMap::const_iterator itB = m_mapBars.find(b);
+
+    return itA != m_mapBars.end() && itB != m_mapBars.end() &&
+        _ComesBefore(&itA->second, &itB->second);
+}
+
+
+//
+// Invalidate
+//
+void AppBarLayout::Invalidate(MonitorId monitor)
+{
+    m_mapMonitors[monitor].bDirty = true;
+}
+
+
+//
+// TakeDirty
+//
+bool AppBarLayout::TakeDirty(MonitorId monitor)
+{
+    MonitorMap::iterator itMonitor = m_mapMonitors.find(monitor);
+
+    if (itMonitor == m_mapMonitors.end() || !itMonitor->second.bDirty)
+    {
+        return false;
+    }
+
+    itMonitor->second.bDirty = false;
+    return true;
+}
+
+
+//
+// Clear
+//
+void AppBarLayout::Clear()
+{
+    m_mapBars.clear();
+    m_mapMonitors.clear();
+}
+
+
+//
+// ApplyExtent
+//
+void AppBarLayout::ApplyExtent(Rect& rcDst, const Rect& rcRequested, unsigned uEdge)
+{
+    switch (uEdge)
+    {
+    case EdgeLeft:
+    case EdgeRight:
+        rcDst.top = std::max(rcDst.top, rcRequested.top);
+        rcDst.bottom = std::min(rcDst.bottom, rcRequested.bottom);
+        break;
+    case EdgeTop:
+    case EdgeBottom:
+        rcDst.left = std::max(rcDst.left, rcRequested.left);
+        rcDst.right = std::min(rcDst.right, rcRequested.right);
+        break;
+    }
+}
+
+
+//
+// ApplyBreadth
+//
+void AppBarLayout::ApplyBreadth(Rect& rcDst, const Rect& rcRequested, unsigned uEdge)
+{
+    switch (uEdge)
+    {
+    case EdgeLeft:
+        rcDst.right = rcDst.left + (rcRequested.right - rcRequested.left);
+        break;
+    case EdgeTop:
+        rcDst.bottom = rcDst.top + (rcRequested.bottom - rcRequested.top);
+        break;
+    case EdgeRight:
+        rcDst.left = rcDst.right - (rcRequested.right - rcRequested.left);
+        break;
+    case EdgeBottom:
+        rcDst.top = rcDst.bottom - (rcRequested.bottom - rcRequested.top);
+        break;
+    }
+}
+
+
+//
+// _Intersects
+//
+bool AppBarLayout::_Intersects(const Rect& rcA, const Rect& rcB)
+{
+    return std::max(rcA.left, rcB.left) < std::min(rcA.right, rcB.right) &&
+        std::max(rcA.top, rcB.top) < std::min(rcA.bottom, rcB.bottom);
+}
+
+
+//
+// _ComesBefore
+//
+bool AppBarLayout::_ComesBefore(const Bar* pA, const Bar* pB)
+{
+    return pA->ulSequence < pB->ulSequence;
+}
+
+
+//
+// _Unplace
+//
+void AppBarLayout::_Unplace(const Bar& bar)
+{
+    MonitorState& state = m_mapMonitors[bar.monitor];
+    EdgeState& edge = state.edges[bar.uEdge];
+
+    std::vector<const Bar*>::iterator it = std::lower_bound(
+        edge.vecBars.begin(), edge.vecBars.end(), &bar, _ComesBefore);
+
+    if (it != edge.vecBars.end() && *it == &bar)
+    {
+        edge.vecBars.erase(it);
+    }
+
+    edge.bInsetValid = false;
+    state.bDirty = true;
+}
+
+
+//
+// _UpdateInset
+//
+void AppBarLayout::_UpdateInset(EdgeState& edge, unsigned uEdge)
+{
+    edge.lInset = 0;
+
+    for (std::vector<const Bar*>::const_iterator it = edge.vecBars.begin();
+        it != edge.vecBars.end(); ++it)
+    {
+        const Rect& rc = (*it)->rc;
+        bool bFirst = (it == edge.vecBars.begin());
+
+        switch (uEdge)
+        {
+        case EdgeLeft:
+            edge.lInset = bFirst ? rc.right : std::max(edge.lInset, rc.right);
+            break;
+        case EdgeTop:
+            edge.lInset = bFirst ? rc.bottom : std::max(edge.lInset, rc.bottom);
+            break;
+        case EdgeRight:
+            edge.lInset = bFirst ? rc.left : std::min(edge.lInset, rc.left);
+            break;
+        case EdgeBottom:
+            edge.lInset = bFirst ? rc.top : std::min(edge.lInset, rc.top);
+            break;
+        }
+    }
+
+    edge.bInsetValid = true;
+}
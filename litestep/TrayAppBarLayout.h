@@ -0,0 +1,159 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYAPPBARLAYOUT_H)
+#define TRAYAPPBARLAYOUT_H
+
+#include <unordered_map>
+#include <vector>
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// AppBarLayout
+//
+// Geometry of the positioned (non-overlap) AppBars, grouped per monitor and
+// per screen edge. Within an edge, bars are kept in stacking order, which is
+// the order they were added in: a bar docks against the last bar added
+// before it on the same edge.
+//
+// Placing or removing a bar only invalidates the edge it was on, and marks
+// the monitor dirty so the caller can update the work area once for a whole
+// batch of changes. The work area itself is derived from one cached inset
+// per edge.
+//
+// Bars and monitors are opaque keys. Edges use the ABE_* values, and Rect
+// is laid out like a RECT. The layout makes no system calls.
+//
+class AppBarLayout
+{
+public:
+    typedef const void* BarId;
+    typedef const void* MonitorId;
+
+    enum Edge
+    {
+        EdgeLeft = 0,
+        EdgeTop,
+        EdgeRight,
+        EdgeBottom,
+        EdgeCount
+    };
+
+    struct Rect
+    {
+        long left;
+        long top;
+        long right;
+        long bottom;
+    };
+
+    AppBarLayout();
+
+    // Registers a bar, giving it the next place in the stacking order
+    void AddBar(BarId bar);
+
+    // Forgets a bar, wherever it was placed
+    void RemoveBar(BarId bar);
+
+    //
+    // Sets the position of a registered bar. Only placed bars affect the
+    // position of other bars and the work area.
+    //
+    void PlaceBar(BarId bar, MonitorId monitor, unsigned uEdge, const Rect& rc);
+
+    //
+    // Returns the position a bar should take on an edge. rcBase is the area
+    // available to bars on the monitor, rcRequested the position the bar
+    // asked for.
+    //
+    Rect QueryPos(BarId bar, MonitorId monitor, unsigned uEdge,
+        const Rect& rcBase, const Rect& rcRequested) const;
+
+    // Returns what is left of rcMonitor once all bars on it are subtracted
+    Rect GetWorkArea(MonitorId monitor, const Rect& rcMonitor);
+
+    // Returns true if bar a comes before bar b in the stacking order
+    bool IsStackedBefore(BarId a, BarId b) const;
+
+    // Marks a monitor dirty, e.g. because the area its bars use changed
+    void Invalidate(MonitorId monitor);
+
+    // Returns whether a monitor changed since the last call, and resets it
+    bool TakeDirty(MonitorId monitor);
+
+    // Removes all bars
+    void Clear();
+
+    //
+    // Shared with the overlap bars, which ignore all other bars: clips
+    // rcDst to the requested extent along the edge, and sizes it to the
+    // requested breadth away from the edge.
+    //
+    static void ApplyExtent(Rect& rcDst, const Rect& rcRequested, unsigned uEdge);
+    static void ApplyBreadth(Rect& rcDst, const Rect& rcRequested, unsigned uEdge);
+
+private:
+    struct Bar
+    {
+        unsigned long ulSequence;
+        bool bPlaced;
+        MonitorId monitor;
+        unsigned uEdge;
+        Rect rc;
+    };
+
+    struct EdgeState
+    {
+        // Placed bars on this edge, sorted by stacking order
+        std::vector<const Bar*> vecBars;
+
+        // Innermost coordinate reached by the bars, if bInsetValid
+        long lInset;
+        bool bInsetValid;
+    };
+
+    struct MonitorState
+    {
+        EdgeState edges[EdgeCount];
+        bool bDirty;
+    };
+
+    typedef std::unordered_map<BarId, Bar> BarMap;
+    typedef std::unordered_map<MonitorId, MonitorState> MonitorMap;
+
+    static bool _IsValidEdge(unsigned uEdge)
+    {
+        return uEdge < EdgeCount;
+    }
+
+    static bool _Intersects(const Rect& rcA, const Rect& rcB);
+    static bool _ComesBefore(const Bar* pA, const Bar* pB);
+
+    void _Unplace(const Bar& bar);
+    void _UpdateInset(EdgeState& edge, unsigned uEdge);
+
+    BarMap m_mapBars;
+    MonitorMap m_mapMonitors;
+    unsigned long m_ulSequence;
+};
+
+#endif // TRAYAPPBARLAYOUT_H
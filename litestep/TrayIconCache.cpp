@@ -0,0 +1,345 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayIconCache.h"
+#include "../utility/debug.hpp"
+#include <algorithm>
+#include <string.h>
+
+
+//
+// TrayIconCache
+//
+TrayIconCache::TrayIconCache()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+//
+// ~TrayIconCache
+//
+TrayIconCache::~TrayIconCache()
+{
+    // Icons still referenced here belong to notification icons that outlive
+    // the cache; their owners destroy them. Idle ones should have been
+    // taken with TakeIdle.
+    for (HandleMap::iterator it = m_mapHandles.begin();
+        it != m_mapHandles.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+
+//
+// Hash
+//
+ULONGLONG TrayIconCache::Hash(const BYTE* pbData, size_t cbData)
+{
+    ULONGLONG ullHash = 14695981039346656037ULL;
+
+    for (size_t st = 0; st < cbData; ++st)
+    {
+        ullHash ^= pbData[st];
+        ullHash *= 1099511628211ULL;
+    }
+
+    return ullHash;
+}
+
+
+//
+// FindSource
+//
+HICON TrayIconCache::FindSource(HICON hSource)
+{
+    SourceMap::iterator it = m_mapSources.find(hSource);
+
+    if (it == m_mapSources.end())
+    {
+        return NULL;
+    }
+
+    ++m_stats.uHits;
+    ++m_stats.uSourceHits;
+
+    return _Reference(it->second)->hIcon;
+}
+
+
+//
+// Find
+//
+HICON TrayIconCache::Find(const BYTE* pbBits, size_t cbBits, HICON hSource)
+{
+    std::pair<ContentMap::iterator, ContentMap::iterator> range =
+        m_mapContent.equal_range(Hash(pbBits, cbBits));
+
+    for (ContentMap::iterator it = range.first; it != range.second; ++it)
+    {
+        Entry* pEntry = it->second;
+
+        if (pEntry->vecBits.size() == cbBits &&
+            (cbBits == 0 || memcmp(&pEntry->vecBits[0], pbBits, cbBits) == 0))
+        {
+            ++m_stats.uHits;
+
+            _AddSource(pEntry, hSource);
+            return _Reference(pEntry)->hIcon;
+        }
+    }
+
+    ++m_stats.uMisses;
+    return NULL;
+}
+
+
+//
+// Insert
+//
+void TrayIconCache::Insert(
+    const BYTE* pbBits, size_t cbBits, HICON hIcon, HICON hSource)
+{
+    ASSERT(hIcon != NULL);
+    ASSERT(m_mapHandles.find(hIcon) == m_mapHandles.end());
+
+    Entry* pEntry = new Entry;
+    pEntry->ullHash = Hash(pbBits, cbBits);
+    pEntry->vecBits.assign(pbBits, pbBits + cbBits);
+    pEntry->hIcon = hIcon;
+    pEntry->uRefs = 1;
+
+    m_mapContent.insert(ContentMap::value_type(pEntry->ullHash, pEntry));
+    m_mapHandles.insert(HandleMap::value_type(hIcon, pEntry));
+
+    _AddSource(pEntry, hSource);
+    m_stats.uIcons = (UINT)m_mapHandles.size();
+}
+
+
+//
+// AddRef
+//
+bool TrayIconCache::AddRef(HICON hIcon)
+{
+    HandleMap::iterator it = m_mapHandles.find(hIcon);
+
+    if (it == m_mapHandles.end())
+    {
+        return false;
+    }
+
+    _Reference(it->second);
+    return true;
+}
+
+
+//
+// Release
+//
+HICON TrayIconCache::Release(HICON hIcon)
+{
+    HandleMap::iterator it = m_mapHandles.find(hIcon);
+
+    if (it == m_mapHandles.end())
+    {
+        return hIcon;
+    }
+
+    Entry* pEntry = it->second;
+    ASSERT(pEntry->uRefs > 0);
+
+    if (--pEntry->uRefs > 0)
+    {
+        return NULL;
+    }
+
+    m_vecIdle.push_back(pEntry);
+
+    HICON hDestroy = NULL;
+
+    if (m_vecIdle.size() > MAX_IDLE)
+    {
+        hDestroy = TakeIdle();
+    }
+
+    m_stats.uIdle = (UINT)m_vecIdle.size();
+    return hDestroy;
+}
+
+
+//
+// TakeIdle
+//
+HICON TrayIconCache::TakeIdle()
+{
+    if (m_vecIdle.empty())
+    {
+        return NULL;
+    }
+
+    Entry* pEntry = m_vecIdle.front();
+    m_vecIdle.erase(m_vecIdle.begin());
+
+    HICON hIcon = pEntry->hIcon;
+    _Remove(pEntry);
+
+    m_stats.uIdle = (UINT)m_vecIdle.size();
+    return hIcon;
+}
+
+
+//
+// _Reference
+//
+TrayIconCache::Entry* TrayIconCache::_Reference(Entry* pEntry)
+{
+    if (pEntry->uRefs++ == 0)
+    {
+        m_vecIdle.erase(
+            std::find(m_vecIdle.begin(), m_vecIdle.end(), pEntry));
+        m_stats.uIdle = (UINT)m_vecIdle.size();
+    }
+
+    return pEntry;
+}
+
+
+//
+// _Remove
+//
+void TrayIconCache::_Remove(Entry* pEntry)
+{
+    std::pair<ContentMap::iterator, ContentMap::iterator> range =
+        m_mapContent.equal_range(pEntry->ullHash);
+
+    for (ContentMap::iterator itContent = range.first;
+        itContent != range.second; ++itContent)
+    {
+        if (itContent->second == pEntry)
+        {
+            m_mapContent.erase(itContent);
+            break;
+        }
+    }
+
+    for (size_t st = 0; st < pEntry->vecSources.size(); ++st)
+    {
+        m_mapSources.erase(pEntry->vecSources[st]);
+    }
+
+    m_mapHandles.erase(pEntry->hIcon);
+    delete pEntry;
+
+    m_stats.uIcons = (UINT)m_mapHandles.size();
+}
+
+
+//
+// _AddSource
+//
+void TrayIconCache::_AddSource(Entry* pEntry, HICON hSource)
+{
+    if (hSource == NULL)
+    {
+        return;
+    }
+
+    std::pair<SourceMap::iterator, bool> result =
+        m_mapSources.insert(SourceMap::value_type(hSource, pEntry));
+
+    if (!result.second)
+    {
+        if (result.first->second == pEntry)
+        {
+            return;
+        }
+
+        // Only when the caller skipped FindSource; the newest mapping wins
+        _RemoveSource(result.first->second, hSource);
+        result.first->second = pEntry;
+    }
+
+    if (pEntry->vecSources.size() == MAX_SOURCES)
+    {
+        m_mapSources.erase(pEntry->vecSources.front());
+        pEntry->vecSources.erase(pEntry->vecSources.begin());
+    }
+
+    pEntry->vecSources.push_back(hSource);
+}
+
+
+//
+// _RemoveSource
+//
+void TrayIconCache::_RemoveSource(Entry* pEntry, HICON hSource)
+{
+    std::vector<HICON>::iterator it = std::find(
+        pEntry->vecSources.begin(), pEntry->vecSources.end(), hSource);
+
+    if (it != pEntry->vecSources.end())
+    {
+        pEntry->vecSources.erase(it);
+    }
+}
+
+
+//
+// InternTip
+//
+LPCWSTR TrayIconCache::InternTip(LPCWSTR pwzTip)
+{
+    if (pwzTip == NULL || pwzTip[0] == L'\0')
+    {
+        return NULL;
+    }
+
+    std::pair<TipMap::iterator, bool> result =
+        m_mapTips.insert(TipMap::value_type(pwzTip, 0));
+
+    ++result.first->second;
+    m_stats.uTips = (UINT)m_mapTips.size();
+
+    return result.first->first.c_str();
+}
+
+
+//
+// ReleaseTip
+//
+void TrayIconCache::ReleaseTip(LPCWSTR pwzTip)
+{
+    if (pwzTip == NULL)
+    {
+        return;
+    }
+
+    TipMap::iterator it = m_mapTips.find(pwzTip);
+    ASSERT(it != m_mapTips.end() && it->first.c_str() == pwzTip);
+
+    if (it != m_mapTips.end() && --it->second == 0)
+    {
+        m_mapTips.erase(it);
+        m_stats.uTips = (UINT)m_mapTips.size();
+    }
+}
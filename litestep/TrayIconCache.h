@@ -0,0 +1,180 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYICONCACHE_H)
+#define TRAYICONCACHE_H
+
+#include "../utility/portable.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayIconCache
+//
+// Content-addressed store for the icon copies and tooltips held by the
+// notification icons. Icons are looked up by their bitmap bits, so an
+// application cycling through a handful of animation frames ends up sharing
+// one copy per distinct frame instead of creating and destroying an icon on
+// every modification. Each cached icon is reference counted. One that loses
+// its last reference is kept idle for a while, as the frame it shows is
+// usually about to come round again; Release hands back the icons that have
+// been idle longest once there are too many, for the caller to destroy.
+//
+// Reading an icon's bits takes several GDI calls, so each cached icon also
+// remembers the last few source handles it was copied from. Icons can't be
+// changed once created, and a freed handle value only comes back once its
+// slot's reuse counter wraps, so an application handing in the same handle
+// again gets the cached copy without its bits being read. NotifyIcon has
+// always skipped updates that pass the handle it already has on the same
+// grounds.
+//
+// Tooltips are interned the same way: every icon with the same tip text
+// points at one shared string.
+//
+// The cache never creates or destroys icons itself and makes no system
+// calls; reading the bits and copying the icon is up to the caller.
+//
+class TrayIconCache
+{
+public:
+    struct Statistics
+    {
+        UINT uHits;       // lookups answered from the cache
+        UINT uSourceHits; // hits found by source handle, without the bits
+        UINT uMisses;     // lookups that required a new copy
+        UINT uIcons;      // distinct icons currently cached
+        UINT uIdle;       // cached icons nobody references
+        UINT uTips;       // distinct tooltips currently interned
+    };
+
+    TrayIconCache();
+    ~TrayIconCache();
+
+    //
+    // Looks up an icon by the handle it was copied from. On a hit the
+    // cached icon gains a reference and is returned, otherwise NULL is
+    // returned and the caller goes on to read the bits.
+    //
+    HICON FindSource(HICON hSource);
+
+    //
+    // Looks up an icon by its bits. On a hit the cached icon gains a
+    // reference and remembers hSource, if any; otherwise NULL is returned.
+    //
+    HICON Find(const BYTE* pbBits, size_t cbBits, HICON hSource);
+
+    //
+    // Adds an icon copied from hSource, holding one reference. The bits are
+    // copied.
+    //
+    void Insert(const BYTE* pbBits, size_t cbBits, HICON hIcon, HICON hSource);
+
+    // Adds a reference to a cached icon. Returns false if it is not cached.
+    bool AddRef(HICON hIcon);
+
+    //
+    // Drops a reference. Returns an icon the caller must destroy, or NULL:
+    // hIcon itself if it was never cached, otherwise the icon that has been
+    // idle longest if this made too many idle.
+    //
+    HICON Release(HICON hIcon);
+
+    //
+    // Removes an idle icon from the cache and returns it for the caller to
+    // destroy. Returns NULL once there are none.
+    //
+    HICON TakeIdle();
+
+    //
+    // Returns the shared copy of a tooltip, adding a reference to it. Empty
+    // tips are not interned and yield NULL.
+    //
+    LPCWSTR InternTip(LPCWSTR pwzTip);
+
+    // Drops a reference obtained from InternTip. NULL is ignored.
+    void ReleaseTip(LPCWSTR pwzTip);
+
+    const Statistics& GetStatistics() const
+    {
+        return m_stats;
+    }
+
+    // 64-bit FNV-1a
+    static ULONGLONG Hash(const BYTE* pbData, size_t cbData);
+
+private:
+    struct Entry
+    {
+        ULONGLONG ullHash;
+        std::vector<BYTE> vecBits;
+        HICON hIcon;
+        UINT uRefs;
+
+        // Most recent last
+        std::vector<HICON> vecSources;
+    };
+
+    // Applications that create a new handle for every update never hit by
+    // source; this bounds what they leave behind
+    enum { MAX_SOURCES = 8 };
+
+    // Enough for a few applications animating through several frames each
+    enum { MAX_IDLE = 32 };
+
+    struct HashHash
+    {
+        size_t operator()(ULONGLONG ullHash) const
+        {
+            return (size_t)(ullHash ^ (ullHash >> 32));
+        }
+    };
+
+    // Several entries may share a hash; the bits tell them apart
+    typedef std::unordered_multimap<ULONGLONG, Entry*, HashHash> ContentMap;
+    typedef std::unordered_map<HICON, Entry*> HandleMap;
+    typedef std::unordered_map<HICON, Entry*> SourceMap;
+
+    // Node based, so the strings never move while referenced
+    typedef std::unordered_map<std::wstring, UINT> TipMap;
+
+    Entry* _Reference(Entry* pEntry);
+    void _AddSource(Entry* pEntry, HICON hSource);
+    void _RemoveSource(Entry* pEntry, HICON hSource);
+    void _Remove(Entry* pEntry);
+
+    ContentMap m_mapContent;
+    HandleMap m_mapHandles;
+    SourceMap m_mapSources;
+
+    // Entries without references, longest idle first
+    std::vector<Entry*> m_vecIdle;
+    TipMap m_mapTips;
+    Statistics m_stats;
+
+    // not implemented
+    TrayIconCache(const TrayIconCache& rhs);
+    TrayIconCache& operator=(const TrayIconCache& rhs);
+};
+
+#endif // TRAYICONCACHE_H
@@ -0,0 +1,265 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayIconStore.h"
+
+#if defined(_MSC_VER)
+#pragma warning(disable : 4312)
+#endif
+
+
+//
+// TrayIconStore
+//
+TrayIconStore::TrayIconStore()
+: m_stShadowed(0)
+{
+}
+
+
+//
+// ~TrayIconStore
+//
+TrayIconStore::~TrayIconStore()
+{
+    Clear();
+}
+
+
+//
+// GuidHash
+//
+size_t TrayIconStore::GuidHash::operator()(const GUID& guid) const
+{
+    // GUIDs are random enough that folding them is all the hashing needed
+    const DWORD* pdw = (const DWORD*)&guid;
+    return (size_t)(pdw[0] ^ pdw[1] ^ pdw[2] ^ pdw[3]);
+}
+
+
+//
+// _MakeKey
+//
+TrayIconStore::IdKey TrayIconStore::_MakeKey(const NotifyIcon* pni)
+{
+    IdKey key = { pni->GetHwnd(), pni->GetuID() };
+    return key;
+}
+
+
+//
+// Find(const NID_XX&)
+//
+TrayIconStore::iterator TrayIconStore::Find(const NID_XX& nid)
+{
+    // If the GUID is valid, we ignore the uID and hWnd
+    if ((nid.uFlags & NIF_GUID) == NIF_GUID)
+    {
+        switch (nid.cbSize)
+        {
+        case NID_7W_SIZE:
+        case NID_6W_SIZE:
+            return Find(((NID_6W&)nid).guidItem);
+
+        case NID_6A_SIZE:
+            return Find(((NID_6A&)nid).guidItem);
+
+        default:
+            // Structures this old have no room for a GUID
+            return end();
+        }
+    }
+
+    return Find((HWND)(UINT_PTR)nid.hWnd, nid.uID);
+}
+
+
+//
+// Find(const GUID&)
+//
+TrayIconStore::iterator TrayIconStore::Find(const GUID& guidItem)
+{
+    GuidMap::iterator iter = m_mapGuids.find(guidItem);
+    return iter != m_mapGuids.end() ? iter->second : end();
+}
+
+
+//
+// Find(HWND, UINT)
+//
+TrayIconStore::iterator TrayIconStore::Find(HWND hWnd, UINT uID)
+{
+    IdKey key = { hWnd, uID };
+    IdMap::iterator iter = m_mapIds.find(key);
+    return iter != m_mapIds.end() ? iter->second : end();
+}
+
+
+//
+// FindOwned
+//
+// Only runs when a window goes away, so a scan is cheaper than keeping
+// a third index up to date on every add and remove
+//
+void TrayIconStore::FindOwned(HWND hWnd, std::vector<iterator>& icons)
+{
+    for (iterator it = m_icons.begin(); it != m_icons.end(); ++it)
+    {
+        if ((*it)->GetHwnd() == hWnd)
+        {
+            icons.push_back(it);
+        }
+    }
+}
+
+
+//
+// Add
+//
+TrayIconStore::iterator TrayIconStore::Add(NotifyIcon* pni)
+{
+    iterator it = m_icons.insert(m_icons.end(), pni);
+
+    // An older icon with the same (hWnd, uID) keeps answering lookups, like
+    // it did with the linear scan
+    if (!m_mapIds.insert(IdMap::value_type(_MakeKey(pni), it)).second)
+    {
+        ++m_stShadowed;
+    }
+
+    // NIM_ADD refuses GUIDs that are already taken, so GUIDs are unique
+    if (pni->HasGUID())
+    {
+        m_mapGuids.insert(GuidMap::value_type(pni->GetGUID(), it));
+    }
+
+    return it;
+}
+
+
+//
+// Update
+//
+void TrayIconStore::Update(iterator it, const NID_XX& nid)
+{
+    NotifyIcon* pni = *it;
+
+    bool bHadGUID = pni->HasGUID();
+    GUID guidOld = pni->GetGUID();
+
+    pni->Update(nid);
+
+    // hWnd and uID never change, but the GUID may be set by a later update
+    if (bHadGUID != pni->HasGUID() ||
+        (bHadGUID && !IsEqualGUID(guidOld, pni->GetGUID())))
+    {
+        if (bHadGUID)
+        {
+            GuidMap::iterator iter = m_mapGuids.find(guidOld);
+
+            if (iter != m_mapGuids.end() && iter->second == it)
+            {
+                m_mapGuids.erase(iter);
+            }
+        }
+
+        if (pni->HasGUID())
+        {
+            m_mapGuids.insert(GuidMap::value_type(pni->GetGUID(), it));
+        }
+    }
+}
+
+
+//
+// Remove
+//
+TrayIconStore::iterator TrayIconStore::Remove(iterator it)
+{
+    NotifyIcon* pni = *it;
+    IdKey key = _MakeKey(pni);
+
+    IdMap::iterator iterId = m_mapIds.find(key);
+
+    if (iterId->second != it)
+    {
+        // A shadowed icon, the indexed one stays
+        --m_stShadowed;
+    }
+    else if (m_stShadowed == 0)
+    {
+        m_mapIds.erase(iterId);
+    }
+    else
+    {
+        // Hand the key to the next icon with it; icons are in the order
+        // they were added, so that is the oldest one left
+        iterator itNext = it;
+
+        for (++itNext; itNext != m_icons.end(); ++itNext)
+        {
+            if (_MakeKey(*itNext) == key)
+            {
+                break;
+            }
+        }
+
+        if (itNext != m_icons.end())
+        {
+            iterId->second = itNext;
+            --m_stShadowed;
+        }
+        else
+        {
+            m_mapIds.erase(iterId);
+        }
+    }
+
+    if (pni->HasGUID())
+    {
+        GuidMap::iterator iterGuid = m_mapGuids.find(pni->GetGUID());
+
+        if (iterGuid != m_mapGuids.end() && iterGuid->second == it)
+        {
+            m_mapGuids.erase(iterGuid);
+        }
+    }
+
+    delete pni;
+    return m_icons.erase(it);
+}
+
+
+//
+// Clear
+//
+void TrayIconStore::Clear()
+{
+    m_mapGuids.clear();
+    m_mapIds.clear();
+    m_stShadowed = 0;
+
+    while (!m_icons.empty())
+    {
+        delete m_icons.back();
+        m_icons.pop_back();
+    }
+}
@@ -0,0 +1,135 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYICONSTORE_H)
+#define TRAYICONSTORE_H
+
+#include "TrayNotifyIcon.h"
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayIconStore
+//
+// Owns the tray's NotifyIcons. Icons are kept in the order they were added,
+// which is the order they are replayed to systray modules in. One hash on
+// (hWnd, uID) and one on GUID make every NIM_* lookup a single probe.
+// Iterators stay valid until their icon is removed, so they can be used as
+// handles.
+//
+class TrayIconStore
+{
+    typedef std::list<NotifyIcon*> IconList;
+
+public:
+    typedef IconList::iterator iterator;
+    typedef IconList::const_iterator const_iterator;
+
+    TrayIconStore();
+    ~TrayIconStore();
+
+    iterator begin() { return m_icons.begin(); }
+    iterator end() { return m_icons.end(); }
+    const_iterator begin() const { return m_icons.begin(); }
+    const_iterator end() const { return m_icons.end(); }
+
+    size_t size() const { return m_icons.size(); }
+    bool empty() const { return m_icons.empty(); }
+
+    //
+    // Finds the icon a notification refers to; by GUID if the notification
+    // carries one, by hWnd and uID otherwise. Returns end() if none match.
+    //
+    iterator Find(const NID_XX& nid);
+    iterator Find(const GUID& guidItem);
+    iterator Find(HWND hWnd, UINT uID);
+
+    // Appends the icons owned by hWnd to icons
+    void FindOwned(HWND hWnd, std::vector<iterator>& icons);
+
+    // Takes ownership of pni and appends it
+    iterator Add(NotifyIcon* pni);
+
+    // Updates an icon, keeping the indexes in sync
+    void Update(iterator it, const NID_XX& nid);
+
+    // Deletes an icon, returns the icon after it
+    iterator Remove(iterator it);
+
+    // Deletes all icons
+    void Clear();
+
+private:
+    struct GuidHash
+    {
+        size_t operator()(const GUID& guid) const;
+    };
+
+    struct GuidEqual
+    {
+        bool operator()(const GUID& a, const GUID& b) const
+        {
+            return IsEqualGUID(a, b) != FALSE;
+        }
+    };
+
+    struct IdKey
+    {
+        HWND hWnd;
+        UINT uID;
+
+        bool operator==(const IdKey& rhs) const
+        {
+            return hWnd == rhs.hWnd && uID == rhs.uID;
+        }
+    };
+
+    struct IdHash
+    {
+        size_t operator()(const IdKey& key) const
+        {
+            return (size_t)key.hWnd ^ ((size_t)key.uID * 0x9E3779B9u);
+        }
+    };
+
+    typedef std::unordered_map<GUID, iterator, GuidHash, GuidEqual> GuidMap;
+    typedef std::unordered_map<IdKey, iterator, IdHash> IdMap;
+
+    static IdKey _MakeKey(const NotifyIcon* pni);
+
+    IconList m_icons;
+    GuidMap m_mapGuids;
+    IdMap m_mapIds;
+
+    // Icons whose (hWnd, uID) is already taken by an older icon, which only
+    // happens when icons identified by GUID share them. While there are
+    // none, removing an icon never has to look for its successor.
+    size_t m_stShadowed;
+
+    // not implemented
+    TrayIconStore(const TrayIconStore& rhs);
+    TrayIconStore& operator=(const TrayIconStore& rhs);
+};
+
+#endif // TRAYICONSTORE_H
@@ -24,7 +24,108 @@
 
 #pragma warning(disable : 4312)
 
-NotifyIcon::IcVtr NotifyIcon::s_icVtr;
+NotifyIcon::IcMap NotifyIcon::s_icMap;
+TrayIconCache NotifyIcon::s_iconCache;
+
+
+//
+// AppendBitmapBits
+// Appends the dimensions and the 32bpp top-down pixels of a bitmap
+//
+static bool AppendBitmapBits(HDC hDC, HBITMAP hbm, std::vector<BYTE>& vecBits)
+{
+    BITMAP bm = { 0 };
+
+    if (!GetObject(hbm, sizeof(bm), &bm) || bm.bmWidth <= 0 || bm.bmHeight <= 0)
+    {
+        return false;
+    }
+
+    BITMAPINFO bmi = { 0 };
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = bm.bmWidth;
+    bmi.bmiHeader.biHeight = -bm.bmHeight;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    size_t stOffset = vecBits.size();
+    vecBits.resize(stOffset + 2 * sizeof(LONG) + bm.bmWidth * bm.bmHeight * 4);
+
+    memcpy(&vecBits[stOffset], &bm.bmWidth, sizeof(LONG));
+    memcpy(&vecBits[stOffset + sizeof(LONG)], &bm.bmHeight, sizeof(LONG));
+
+    return GetDIBits(hDC, hbm, 0, bm.bmHeight,
+        &vecBits[stOffset + 2 * sizeof(LONG)], &bmi, DIB_RGB_COLORS) == bm.bmHeight;
+}
+
+
+//
+// GetIconBits
+// Reads what an icon draws: its mask and color planes, if any. Two icons
+// with the same bits are interchangeable.
+//
+static bool GetIconBits(HICON hIcon, std::vector<BYTE>& vecBits)
+{
+    ICONINFO ii;
+
+    if (!GetIconInfo(hIcon, &ii))
+    {
+        return false;
+    }
+
+    bool bResult = false;
+    HDC hDC = GetDC(NULL);
+
+    if (hDC)
+    {
+        vecBits.push_back((BYTE)ii.fIcon);
+
+        bResult = AppendBitmapBits(hDC, ii.hbmMask, vecBits) &&
+            (!ii.hbmColor || AppendBitmapBits(hDC, ii.hbmColor, vecBits));
+
+        ReleaseDC(NULL, hDC);
+    }
+
+    if (ii.hbmMask)
+    {
+        DeleteObject(ii.hbmMask);
+    }
+
+    if (ii.hbmColor)
+    {
+        DeleteObject(ii.hbmColor);
+    }
+
+    return bResult;
+}
+
+//
+// LSNOTIFYICONDATAA
+//
+// Copies an icon for the legacy LM_SYSTRAYA message
+//
+LSNOTIFYICONDATAA::LSNOTIFYICONDATAA(PCLSNOTIFYICONDATA nid)
+{
+    this->cbSize = sizeof(this);
+    this->hWnd = nid->hWnd;
+    this->uID = nid->uID;
+    this->uFlags = nid->uFlags;
+    this->uCallbackMessage = nid->uCallbackMessage;
+    this->hIcon = nid->hIcon;
+    WideCharToMultiByte(CP_ACP, 0, nid->szTip, -1,
+        this->szTip, sizeof(this->szTip), "?", nullptr);
+    this->dwState = nid->dwState;
+    this->dwStateMask = nid->dwStateMask;
+    WideCharToMultiByte(CP_ACP, 0, nid->szInfo, -1,
+        this->szInfo, sizeof(this->szInfo), "?", nullptr);
+    this->uVersion = nid->uVersion;
+    WideCharToMultiByte(CP_ACP, 0, nid->szInfoTitle, -1,
+        this->szInfoTitle, sizeof(this->szInfoTitle), "?", nullptr);
+    this->dwInfoFlags = nid->dwInfoFlags;
+    this->guidItem = nid->guidItem;
+    this->hBalloonIcon = nid->hBalloonIcon;
+}
 
 //
 // ReadMe
@@ -65,34 +166,26 @@ NotifyIcon::NotifyIcon(const NID_XX& nidSource)
     ,m_uFlags(0)
     ,m_uCallbackMessage(0)
     ,m_hIcon(NULL)
+    ,m_pwzTip(NULL)
     ,m_dwState(0)
     ,m_hOriginalIcon(NULL)
     ,m_hSharedWnd(NULL)
     ,m_uSharedID(0)
     ,m_uVersion(0)
 {
-    m_szTip[0] = 0;
     ZeroMemory(&m_guidItem, sizeof(GUID));
     Update(nidSource);
-
-    s_icVtr.push_back(this);
 }
 
 NotifyIcon::~NotifyIcon()
 {
     if (NULL != m_hIcon)
     {
-        DestroyIcon(m_hIcon);
+        release_icon(m_hIcon);
     }
 
-    for (IcVtr::iterator it = s_icVtr.begin(); it != s_icVtr.end(); ++it)
-    {
-        if (*it == this)
-        {
-            s_icVtr.erase(it);
-            break;
-        }
-    }
+    set_original_icon(NULL);
+    set_tip(NULL);
 }
 
 
@@ -185,23 +278,34 @@ void NotifyIcon::copy_icon(PCNID_XX pnidSource)
 
         if (IsShared())
         {
-            for (IcVtr::const_iterator it = s_icVtr.begin();
-                it != s_icVtr.end(); ++it)
+            std::pair<IcMap::const_iterator, IcMap::const_iterator> range =
+                s_icMap.equal_range((HANDLE)pnidSource->hIcon);
+
+            const NotifyIcon* pSource = NULL;
+
+            // Any icon sharing the handle holds a copy of the same image,
+            // but prefer the owner over other icons that share it
+            for (IcMap::const_iterator it = range.first;
+                it != range.second; ++it)
             {
-                const NotifyIcon* p = *it;
+                pSource = it->second;
 
-                if (p->m_hOriginalIcon == (HICON)pnidSource->hIcon)
+                if (!pSource->IsShared())
                 {
-                    m_hSharedWnd = (HANDLE)p->m_hWnd;
-                    m_uSharedID = p->m_uID;
-                    hNewIcon = CopyIcon(p->m_hIcon);
                     break;
                 }
             }
+
+            if (pSource)
+            {
+                m_hSharedWnd = (HANDLE)pSource->m_hWnd;
+                m_uSharedID = pSource->m_uID;
+                hNewIcon = share_icon(pSource->m_hIcon);
+            }
         }
         else
         {
-            hNewIcon = CopyIcon((HICON)pnidSource->hIcon);
+            hNewIcon = acquire_icon((HICON)pnidSource->hIcon);
         }
 
         // Update if we have a new icon, or we were told
@@ -210,11 +314,11 @@ void NotifyIcon::copy_icon(PCNID_XX pnidSource)
         {
             if (m_hIcon)
             {
-                DestroyIcon(m_hIcon);
+                release_icon(m_hIcon);
             }
 
             m_hIcon = hNewIcon;
-            m_hOriginalIcon = (HICON)pnidSource->hIcon;
+            set_original_icon((HANDLE)pnidSource->hIcon);
         }
 
         if (!m_hIcon)
@@ -255,6 +359,8 @@ void NotifyIcon::copy_tip(PCNID_XX pnidSource)
 {
     if (NIF_TIP & pnidSource->uFlags)
     {
+        WCHAR wzTip[TRAY_MAX_TIP_LENGTH] = { 0 };
+
         switch (pnidSource->cbSize)
         {
         case NID_7W_SIZE:
@@ -263,11 +369,11 @@ void NotifyIcon::copy_tip(PCNID_XX pnidSource)
             {
                 LPCWSTR pwzSrc = ((NID_5W*)(pnidSource))->szTip;
 
-                HRESULT hr = StringCchCopy(m_szTip, _countof(m_szTip), pwzSrc);
+                HRESULT hr = StringCchCopy(wzTip, _countof(wzTip), pwzSrc);
 
                 if (FAILED(hr))
                 {
-                    m_szTip[0] = 0;
+                    wzTip[0] = 0;
                 }
             }
             break;
@@ -276,11 +382,11 @@ void NotifyIcon::copy_tip(PCNID_XX pnidSource)
             {
                 LPCWSTR pwzSrc = ((NID_4W*)(pnidSource))->szTip;
 
-                HRESULT hr = StringCchCopy(m_szTip, _countof(m_szTip), pwzSrc);
+                HRESULT hr = StringCchCopy(wzTip, _countof(wzTip), pwzSrc);
 
                 if (FAILED(hr))
                 {
-                    m_szTip[0] = 0;
+                    wzTip[0] = 0;
                 }
             }
             break;
@@ -291,11 +397,11 @@ void NotifyIcon::copy_tip(PCNID_XX pnidSource)
                 LPCSTR pwzSrc = ((NID_5A*)(pnidSource))->szTip;
 
                 int nReturn = MultiByteToWideChar(CP_ACP, 0,
-                    pwzSrc, -1, m_szTip, _countof(m_szTip));
+                    pwzSrc, -1, wzTip, _countof(wzTip));
 
                 if (nReturn == 0)
                 {
-                    m_szTip[0] = 0;
+                    wzTip[0] = 0;
                 }
             }
             break;
@@ -305,23 +411,25 @@ void NotifyIcon::copy_tip(PCNID_XX pnidSource)
                 LPCSTR pwzSrc = ((NID_4A*)(pnidSource))->szTip;
 
                 int nReturn = MultiByteToWideChar(CP_ACP, 0,
-                    pwzSrc, -1, m_szTip, _countof(m_szTip));
+                    pwzSrc, -1, wzTip, _countof(wzTip));
 
                 if (nReturn == 0)
                 {
-                    m_szTip[0] = 0;
+                    wzTip[0] = 0;
                 }
             }
             break;
 
         default:
             {
-                // do nothing
+                // keep the current tip
+                return;
             }
-            break;
         }
 
-        if (0 == m_szTip[0])
+        set_tip(wzTip);
+
+        if (NULL == m_pwzTip)
         {
             m_uFlags &= ~NIF_TIP;
         }
@@ -385,6 +493,116 @@ void NotifyIcon::update_state(DWORD dwState, DWORD dwMask)
     }
 }
 
+void NotifyIcon::set_original_icon(HANDLE hOriginalIcon)
+{
+    if (m_hOriginalIcon)
+    {
+        std::pair<IcMap::iterator, IcMap::iterator> range =
+            s_icMap.equal_range(m_hOriginalIcon);
+
+        for (IcMap::iterator it = range.first; it != range.second; ++it)
+        {
+            if (it->second == this)
+            {
+                s_icMap.erase(it);
+                break;
+            }
+        }
+    }
+
+    m_hOriginalIcon = hOriginalIcon;
+
+    if (m_hOriginalIcon)
+    {
+        s_icMap.insert(IcMap::value_type(m_hOriginalIcon, this));
+    }
+}
+
+void NotifyIcon::set_tip(LPCWSTR pwzTip)
+{
+    // Intern the new tip first, it may well be the current one
+    LPCWSTR pwzNewTip = pwzTip ? s_iconCache.InternTip(pwzTip) : NULL;
+
+    s_iconCache.ReleaseTip(m_pwzTip);
+    m_pwzTip = pwzNewTip;
+}
+
+//
+// Returns a copy of hSource that is owned by the icon cache, shared with
+// every other icon that draws the same image
+//
+HICON NotifyIcon::acquire_icon(HICON hSource)
+{
+    if (!hSource)
+    {
+        return NULL;
+    }
+
+    // Animations cycle through the same few handles; only new ones need
+    // their bits read
+    HICON hIcon = s_iconCache.FindSource(hSource);
+
+    if (hIcon)
+    {
+        return hIcon;
+    }
+
+    std::vector<BYTE> vecBits;
+
+    if (!GetIconBits(hSource, vecBits))
+    {
+        // Can't tell what it looks like, give it a copy of its own
+        return CopyIcon(hSource);
+    }
+
+    hIcon = s_iconCache.Find(&vecBits[0], vecBits.size(), hSource);
+
+    if (!hIcon)
+    {
+        hIcon = CopyIcon(hSource);
+
+        if (hIcon)
+        {
+            s_iconCache.Insert(&vecBits[0], vecBits.size(), hIcon, hSource);
+        }
+    }
+
+    return hIcon;
+}
+
+//
+// Returns another reference to one of our own icon copies
+//
+HICON NotifyIcon::share_icon(HICON hIcon)
+{
+    if (hIcon && !s_iconCache.AddRef(hIcon))
+    {
+        return CopyIcon(hIcon);
+    }
+
+    return hIcon;
+}
+
+void NotifyIcon::release_icon(HICON hIcon)
+{
+    HICON hDestroy = s_iconCache.Release(hIcon);
+
+    if (hDestroy)
+    {
+        DestroyIcon(hDestroy);
+    }
+}
+
+void NotifyIcon::DestroyIdleIcons()
+{
+    HICON hIcon;
+
+    while ((hIcon = s_iconCache.TakeIdle()) != NULL)
+    {
+        DestroyIcon(hIcon);
+    }
+}
+
 void NotifyIcon::CopyLSNID(LSNOTIFYICONDATA * plsnid, UINT uFlagMask) const
 {
     plsnid->cbSize = sizeof(LSNOTIFYICONDATA);
@@ -415,7 +633,8 @@ void NotifyIcon::CopyLSNID(LSNOTIFYICONDATA * plsnid, UINT uFlagMask) const
     if (NIF_TIP & m_uFlags & uFlagMask)
     {
         // Make a copy of the string
-        HRESULT hr = StringCchCopy(plsnid->szTip, TRAY_MAX_TIP_LENGTH, m_szTip);
+        HRESULT hr = StringCchCopy(plsnid->szTip, TRAY_MAX_TIP_LENGTH,
+            m_pwzTip ? m_pwzTip : L"");
 
         if (SUCCEEDED(hr))
         {
@@ -22,8 +22,20 @@
 #if !defined(TRAYNOTIFYICON_H)
 #define TRAYNOTIFYICON_H
 
-#include "../utility/core.hpp"
-#include <vector>
+#include "../utility/portable.h"
+#include "TrayIconCache.h"
+#include <unordered_map>
+
+#if defined(_WIN32)
+#  include <shellapi.h>
+#else
+#  define NIM_ADD       0x00000000
+#  define NIM_MODIFY    0x00000001
+#  define NIM_DELETE    0x00000002
+#  define NIF_MESSAGE   0x00000001
+#  define NIF_ICON      0x00000002
+#  define NIF_TIP       0x00000004
+#endif // defined(_WIN32)
 
 #define TRAY_MAX_TIP_LENGTH       128
 #define TRAY_MAX_INFO_LENGTH      256
@@ -71,26 +83,7 @@ typedef const LSNOTIFYICONDATA * PCLSNOTIFYICONDATA;
 //
 typedef struct LSNOTIFYICONDATAA
 {
-    LSNOTIFYICONDATAA(PCLSNOTIFYICONDATA nid) {
-        this->cbSize = sizeof(this);
-        this->hWnd = nid->hWnd;
-        this->uID = nid->uID;
-        this->uFlags = nid->uFlags;
-        this->uCallbackMessage = nid->uCallbackMessage;
-        this->hIcon = nid->hIcon;
-        WideCharToMultiByte(CP_ACP, 0, nid->szTip, -1,
-            this->szTip, sizeof(this->szTip), "?", nullptr);
-        this->dwState = nid->dwState;
-        this->dwStateMask = nid->dwStateMask;
-        WideCharToMultiByte(CP_ACP, 0, nid->szInfo, -1,
-           this->szInfo, sizeof(this->szInfo), "?", nullptr);
-        this->uVersion = nid->uVersion;
-        WideCharToMultiByte(CP_ACP, 0, nid->szInfoTitle, -1,
-            this->szInfoTitle, sizeof(this->szInfoTitle), "?", nullptr);
-        this->dwInfoFlags = nid->dwInfoFlags;
-        this->guidItem = nid->guidItem;
-        this->hBalloonIcon = nid->hBalloonIcon;
-    }
+    LSNOTIFYICONDATAA(PCLSNOTIFYICONDATA nid);
 
     DWORD cbSize;                                /* arbitrary  &     volatile */
     HWND hWnd;                                   /* persistent & non volatile */
@@ -131,6 +124,13 @@ typedef struct LSNOTIFYICONDATAA
 typedef DWORD HWND32;
 typedef DWORD HICON32;
 
+// Strings in the structures we receive are UTF-16, whatever WCHAR is
+#if defined(_WIN32)
+typedef WCHAR WCHAR16;
+#else
+typedef uint16_t WCHAR16;
+#endif
+
 // Win9x
 typedef struct
 {
@@ -152,7 +152,7 @@ typedef struct
     UINT uFlags;
     UINT uCallbackMessage;
     HICON32 hIcon;
-    WCHAR szTip[64];
+    WCHAR16 szTip[64];
 } NID_4W;
 
 // IE 5 (ME?)
@@ -186,16 +186,16 @@ typedef struct
     UINT uFlags;
     UINT uCallbackMessage;
     HICON32 hIcon;
-    WCHAR szTip[128];
+    WCHAR16 szTip[128];
     DWORD dwState;
     DWORD dwStateMask;
-    WCHAR szInfo[256];
+    WCHAR16 szInfo[256];
     union
     {
         UINT uTimeout;
         UINT uVersion;
     } DUMMYUNIONNAME;
-    WCHAR szInfoTitle[64];
+    WCHAR16 szInfoTitle[64];
     DWORD dwInfoFlags;
 } NID_5W;
 
@@ -231,16 +231,16 @@ typedef struct
     UINT uFlags;
     UINT uCallbackMessage;
     HICON32 hIcon;
-    WCHAR szTip[128];
+    WCHAR16 szTip[128];
     DWORD dwState;
     DWORD dwStateMask;
-    WCHAR szInfo[256];
+    WCHAR16 szInfo[256];
     union
     {
         UINT uTimeout;
         UINT uVersion;
     } DUMMYUNIONNAME;
-    WCHAR szInfoTitle[64];
+    WCHAR16 szInfoTitle[64];
     DWORD dwInfoFlags;
     GUID guidItem;
 } NID_6W;
@@ -254,16 +254,16 @@ typedef struct
     UINT uFlags;
     UINT uCallbackMessage;
     HICON32 hIcon;
-    WCHAR szTip[128];
+    WCHAR16 szTip[128];
     DWORD dwState;
     DWORD dwStateMask;
-    WCHAR szInfo[256];
+    WCHAR16 szInfo[256];
     union
     {
         UINT uTimeout;
         UINT uVersion;
     } DUMMYUNIONNAME;
-    WCHAR szInfoTitle[64];
+    WCHAR16 szInfoTitle[64];
     DWORD dwInfoFlags;
     GUID guidItem;
     HICON32 hBalloonIcon;
@@ -306,8 +306,13 @@ typedef const NID_XX * PCNID_XX;
 
 class NotifyIcon
 {
-    typedef std::vector<NotifyIcon*> IcVtr;
-    static IcVtr s_icVtr;
+    // All icons, keyed by the icon handle their owner passed in; used to
+    // resolve NIS_SHAREDICON
+    typedef std::unordered_multimap<HANDLE, NotifyIcon*> IcMap;
+    static IcMap s_icMap;
+
+    // Icon copies and tooltips, shared between icons with equal content
+    static TrayIconCache s_iconCache;
 
 public:
     NotifyIcon(const NID_XX& nidSource);
@@ -372,6 +377,14 @@ public:
 
     void CopyLSNID(LSNOTIFYICONDATA * plsnid, UINT uFlagMask) const;
 
+    static const TrayIconCache::Statistics& GetCacheStatistics()
+    {
+        return s_iconCache.GetStatistics();
+    }
+
+    // Destroys the cached icon copies no icon uses any more
+    static void DestroyIdleIcons();
+
 private:
     void copy_guid(PCNID_XX pnidSource);
     void copy_message(PCNID_XX pnidSource);
@@ -380,6 +393,12 @@ private:
     void copy_state(PCNID_XX pnidSource);
 
     void update_state(DWORD dwState, DWORD dwMask);
+    void set_original_icon(HANDLE hOriginalIcon);
+    void set_tip(LPCWSTR pwzTip);
+
+    static HICON acquire_icon(HICON hSource);
+    static HICON share_icon(HICON hIcon);
+    static void release_icon(HICON hIcon);
     void set_version(UINT uVersion);
 
     // Preserved Notify Icon Data members
@@ -390,7 +409,7 @@ private:
     UINT  m_uFlags;                              /* persistent &     volatile */
     UINT  m_uCallbackMessage;                    /* persistent &     volatile */
     HICON m_hIcon;                               /* persistent &     volatile */
-    WCHAR  m_szTip[TRAY_MAX_TIP_LENGTH];         /* persistent &     volatile */
+    LPCWSTR m_pwzTip;                            /* persistent &     volatile */
 
     DWORD m_dwState;                             /* persistent &     volatile */
     HICON m_hBalloonIcon;                        /* persistent &     volatile */
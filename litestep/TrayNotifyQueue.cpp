@@ -0,0 +1,201 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayNotifyQueue.h"
+#include <string.h>
+
+
+//
+// TrayNotifyQueue
+//
+TrayNotifyQueue::TrayNotifyQueue()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+//
+// Push
+//
+bool TrayNotifyQueue::Push(const void* pvIcon, DWORD dwMessage, const LSNOTIFYICONDATA& lsnid)
+{
+    bool bWasEmpty = IsEmpty();
+    std::vector<size_t>& vecLive = m_mapIcons[pvIcon];
+
+    ++m_stats.uQueued;
+
+    if (dwMessage == NIM_DELETE)
+    {
+        // Everything since the icon's last pending delete is moot. Modules
+        // never saw a pending add either, so add and delete cancel out.
+        bool bAddPending = false;
+
+        while (!vecLive.empty() &&
+            m_vecPending[vecLive.back()].event.dwMessage != NIM_DELETE)
+        {
+            Pending& pending = m_vecPending[vecLive.back()];
+
+            if (pending.event.dwMessage == NIM_ADD)
+            {
+                bAddPending = true;
+            }
+
+            pending.bDropped = true;
+            vecLive.pop_back();
+            ++m_stats.uDropped;
+        }
+
+        if (bAddPending)
+        {
+            ++m_stats.uDropped;
+
+            if (vecLive.empty())
+            {
+                m_mapIcons.erase(pvIcon);
+
+                if (m_mapIcons.empty())
+                {
+                    m_vecPending.clear();
+                }
+            }
+
+            return bWasEmpty;
+        }
+    }
+    else if (!vecLive.empty())
+    {
+        if (lsnid.uFlags & NIF_ICON)
+        {
+            // The icon's previous handle is gone, so every pending
+            // notification has to use the current one
+            for (std::vector<size_t>::const_iterator it = vecLive.begin();
+                 it != vecLive.end(); ++it)
+            {
+                LSNOTIFYICONDATA& lsnidPending = m_vecPending[*it].event.lsnid;
+
+                if (lsnidPending.uFlags & NIF_ICON)
+                {
+                    lsnidPending.hIcon = lsnid.hIcon;
+                }
+            }
+        }
+
+        Event& last = m_vecPending[vecLive.back()].event;
+
+        // Two balloons can't be merged without losing one of them
+        if (dwMessage == NIM_MODIFY &&
+            (last.dwMessage == NIM_ADD || last.dwMessage == NIM_MODIFY) &&
+            !(last.lsnid.uFlags & lsnid.uFlags & NIF_INFO))
+        {
+            _Merge(last.lsnid, lsnid);
+            ++m_stats.uMerged;
+
+            return bWasEmpty;
+        }
+    }
+
+    Pending pending;
+    pending.event.dwMessage = dwMessage;
+    pending.event.lsnid = lsnid;
+    pending.bDropped = false;
+
+    vecLive.push_back(m_vecPending.size());
+    m_vecPending.push_back(pending);
+
+    return bWasEmpty;
+}
+
+
+//
+// Take
+//
+void TrayNotifyQueue::Take(EventList& events)
+{
+    size_t stBefore = events.size();
+
+    for (std::vector<Pending>::const_iterator it = m_vecPending.begin();
+         it != m_vecPending.end(); ++it)
+    {
+        if (!it->bDropped)
+        {
+            events.push_back(it->event);
+        }
+    }
+
+    if (events.size() > stBefore)
+    {
+        m_stats.uDelivered += (UINT)(events.size() - stBefore);
+        ++m_stats.uBatches;
+    }
+
+    m_vecPending.clear();
+    m_mapIcons.clear();
+}
+
+
+//
+// Clear
+//
+void TrayNotifyQueue::Clear()
+{
+    m_vecPending.clear();
+    m_mapIcons.clear();
+}
+
+
+//
+// _Merge
+// Newer values win; the flags say what the modules should look at
+//
+void TrayNotifyQueue::_Merge(LSNOTIFYICONDATA& lsnidTarget, const LSNOTIFYICONDATA& lsnidSource)
+{
+    if (lsnidSource.uFlags & NIF_MESSAGE)
+    {
+        lsnidTarget.uCallbackMessage = lsnidSource.uCallbackMessage;
+    }
+
+    if (lsnidSource.uFlags & NIF_ICON)
+    {
+        lsnidTarget.hIcon = lsnidSource.hIcon;
+    }
+
+    if (lsnidSource.uFlags & NIF_TIP)
+    {
+        memcpy(lsnidTarget.szTip, lsnidSource.szTip, sizeof(lsnidTarget.szTip));
+    }
+
+    if (lsnidSource.uFlags & NIF_INFO)
+    {
+        memcpy(lsnidTarget.szInfo, lsnidSource.szInfo, sizeof(lsnidTarget.szInfo));
+        memcpy(lsnidTarget.szInfoTitle, lsnidSource.szInfoTitle,
+            sizeof(lsnidTarget.szInfoTitle));
+        lsnidTarget.dwInfoFlags = lsnidSource.dwInfoFlags;
+        lsnidTarget.uTimeout = lsnidSource.uTimeout;
+    }
+
+    if (lsnidSource.uFlags & NIF_GUID)
+    {
+        lsnidTarget.guidItem = lsnidSource.guidItem;
+    }
+
+    lsnidTarget.hBalloonIcon = lsnidSource.hBalloonIcon;
+    lsnidTarget.uFlags |= lsnidSource.uFlags;
+}
@@ -0,0 +1,108 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYNOTIFYQUEUE_H)
+#define TRAYNOTIFYQUEUE_H
+
+#include "TrayNotifyIcon.h"
+#include <unordered_map>
+#include <vector>
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayNotifyQueue
+//
+// Holds the NIM_ADD, NIM_MODIFY and NIM_DELETE notifications meant for the
+// systray modules until they are flushed in one batch. A modification of an
+// icon whose last pending notification is an add or modification is merged
+// into it, so an icon animating at 30 Hz costs the modules one notification
+// per flush instead of one per frame.
+//
+// Pending notifications point at the icon handles owned by NotifyIcon. The
+// queue keeps them pointing at the current handle and drops them when the
+// icon is deleted, so nothing stale is ever delivered. The queue makes no
+// system calls.
+//
+class TrayNotifyQueue
+{
+public:
+    struct Event
+    {
+        DWORD dwMessage;
+        LSNOTIFYICONDATA lsnid;
+    };
+
+    typedef std::vector<Event> EventList;
+
+    struct Statistics
+    {
+        UINT uQueued;     // notifications pushed
+        UINT uMerged;     // merged into a pending one
+        UINT uDropped;    // made moot by a delete before delivery
+        UINT uDelivered;  // handed out by Take
+        UINT uBatches;    // calls to Take that handed out anything
+    };
+
+    TrayNotifyQueue();
+
+    //
+    // Queues a notification for an icon. pvIcon identifies the icon and is
+    // never dereferenced. Returns true if the queue was empty before, in
+    // which case the caller should schedule a flush.
+    //
+    bool Push(const void* pvIcon, DWORD dwMessage, const LSNOTIFYICONDATA& lsnid);
+
+    // Moves all pending notifications, in order, into events
+    void Take(EventList& events);
+
+    // Drops all pending notifications
+    void Clear();
+
+    bool IsEmpty() const
+    {
+        return m_mapIcons.empty();
+    }
+
+    const Statistics& GetStatistics() const
+    {
+        return m_stats;
+    }
+
+private:
+    struct Pending
+    {
+        Event event;
+        bool bDropped;
+    };
+
+    // Indices into m_vecPending of each icon's live notifications
+    typedef std::unordered_map<const void*, std::vector<size_t> > IconMap;
+
+    static void _Merge(LSNOTIFYICONDATA& lsnidTarget, const LSNOTIFYICONDATA& lsnidSource);
+
+    // Dropped entries stay in place, marked as such
+    std::vector<Pending> m_vecPending;
+    IconMap m_mapIcons;
+    Statistics m_stats;
+};
+
+#endif // TRAYNOTIFYQUEUE_H
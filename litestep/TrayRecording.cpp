@@ -0,0 +1,199 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayRecording.h"
+#include <algorithm>
+#include <cstring>
+
+
+//
+// _PaddedSize
+//
+static size_t _PaddedSize(DWORD cbData)
+{
+    return (cbData + 3) & ~(size_t)3;
+}
+
+
+//
+// TrayRecorder
+//
+TrayRecorder::TrayRecorder()
+    : m_dwStart(0)
+{
+}
+
+
+//
+// Begin
+//
+void TrayRecorder::Begin(DWORD dwNow)
+{
+    TRAYRECHEADER header = { 0 };
+    header.dwMagic = TRAYREC_MAGIC;
+    header.dwVersion = TRAYREC_VERSION;
+    header.cbHeader = sizeof(TRAYRECHEADER);
+
+    m_buffer.assign((const BYTE*)&header, (const BYTE*)(&header + 1));
+    m_dwStart = dwNow;
+}
+
+
+//
+// Append
+//
+void TrayRecorder::Append(DWORD dwData, DWORD cbData, LPCVOID pvData, DWORD dwNow)
+{
+    TRAYRECENTRY entry = { 0 };
+    entry.dwData = dwData;
+    entry.cbData = pvData ? cbData : 0;
+    entry.dwTime = dwNow - m_dwStart;
+
+    size_t stOffset = m_buffer.size();
+    m_buffer.resize(stOffset + sizeof(entry) + _PaddedSize(entry.cbData), 0);
+
+    memcpy(&m_buffer[stOffset], &entry, sizeof(entry));
+
+    if (entry.cbData > 0)
+    {
+        memcpy(&m_buffer[stOffset + sizeof(entry)], pvData, entry.cbData);
+    }
+}
+
+
+//
+// TrayReplayer
+//
+TrayReplayer::TrayReplayer(LPCVOID pvRecording, size_t cbRecording)
+    : m_pbEntries(NULL)
+    , m_pbNext(NULL)
+    , m_pbEnd(NULL)
+{
+    const BYTE* pbRecording = (const BYTE*)pvRecording;
+
+    if (pbRecording && cbRecording >= sizeof(TRAYRECHEADER))
+    {
+        TRAYRECHEADER header;
+        memcpy(&header, pbRecording, sizeof(header));
+
+        if (header.dwMagic == TRAYREC_MAGIC &&
+            header.dwVersion == TRAYREC_VERSION &&
+            header.cbHeader >= sizeof(TRAYRECHEADER) &&
+            header.cbHeader <= cbRecording)
+        {
+            m_pbEntries = pbRecording + header.cbHeader;
+            m_pbNext = m_pbEntries;
+            m_pbEnd = pbRecording + cbRecording;
+        }
+    }
+}
+
+
+//
+// Next
+//
+bool TrayReplayer::Next(TRAYRECENTRY& entry, LPCVOID& pvData)
+{
+    if (!m_pbNext || (size_t)(m_pbEnd - m_pbNext) < sizeof(TRAYRECENTRY))
+    {
+        return false;
+    }
+
+    memcpy(&entry, m_pbNext, sizeof(entry));
+
+    size_t cbEntry = sizeof(TRAYRECENTRY) + _PaddedSize(entry.cbData);
+
+    if ((size_t)(m_pbEnd - m_pbNext) < cbEntry)
+    {
+        // Truncated, ie. the recording session didn't end cleanly
+        m_pbNext = m_pbEnd;
+        return false;
+    }
+
+    pvData = m_pbNext + sizeof(TRAYRECENTRY);
+    m_pbNext += cbEntry;
+
+    return true;
+}
+
+
+//
+// Run
+//
+UINT TrayReplayer::Run(ITrayMessageSink& sink, TickProc pfnTicks, StatisticsMap& stats)
+{
+    UINT uReplayed = 0;
+
+    TRAYRECENTRY entry;
+    LPCVOID pvData;
+
+    // Keep room for the largest payload a sink could expect, so a short
+    // recording can't make it read past the buffer
+    const size_t cbHeadroom = 1024;
+
+    // Size the buffer once, for the largest payload still to come
+    const BYTE* pbStart = m_pbNext;
+    size_t cbLargest = 0;
+
+    while (Next(entry, pvData))
+    {
+        cbLargest = std::max<size_t>(cbLargest, _PaddedSize(entry.cbData));
+    }
+
+    m_pbNext = pbStart;
+
+    if (m_scratch.size() < cbLargest + cbHeadroom)
+    {
+        m_scratch.resize(cbLargest + cbHeadroom);
+    }
+
+    while (Next(entry, pvData))
+    {
+        // The sink sees zeros after the payload, not the previous one
+        memcpy(&m_scratch[0], pvData, entry.cbData);
+        memset(&m_scratch[entry.cbData], 0, cbHeadroom);
+
+        ULONGLONG ullStart = pfnTicks();
+        sink.HandleCopyData(entry.dwData, entry.cbData, &m_scratch[0]);
+        ULONGLONG ullTicks = pfnTicks() - ullStart;
+
+        StatisticsMap::iterator it = stats.find(entry.dwData);
+
+        if (it == stats.end())
+        {
+            Statistics zero = { 0 };
+            it = stats.insert(StatisticsMap::value_type(entry.dwData, zero)).first;
+        }
+
+        ++it->second.uCount;
+        it->second.ullBytes += entry.cbData;
+        it->second.ullTotal += ullTicks;
+
+        if (ullTicks > it->second.ullMax)
+        {
+            it->second.ullMax = ullTicks;
+        }
+
+        ++uReplayed;
+    }
+
+    return uReplayed;
+}
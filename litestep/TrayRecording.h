@@ -0,0 +1,180 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYRECORDING_H)
+#define TRAYRECORDING_H
+
+#include "../utility/portable.h"
+#include <map>
+#include <vector>
+
+//
+// Recording format
+//
+// A recording is a TRAYRECHEADER followed by any number of entries. Each
+// entry is a TRAYRECENTRY followed by cbData bytes of WM_COPYDATA payload,
+// padded with zeros to a multiple of four bytes. Payloads are stored as they
+// arrived, so they contain the HWNDs and HICONs of the recording session.
+//
+#define TRAYREC_MAGIC    0x5254534C // "LSTR"
+#define TRAYREC_VERSION  1
+
+typedef struct _TRAYRECHEADER
+{
+    DWORD dwMagic;
+    DWORD dwVersion;
+    DWORD cbHeader;    // sizeof(TRAYRECHEADER), entries start after it
+    DWORD dwReserved;
+} TRAYRECHEADER;
+
+typedef struct _TRAYRECENTRY
+{
+    DWORD dwData;      // COPYDATASTRUCT::dwData, ie. SH_TRAY_DATA
+    DWORD cbData;      // payload size, without padding
+    DWORD dwTime;      // milliseconds since the first entry
+    DWORD dwReserved;
+} TRAYRECENTRY;
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// ITrayMessageSink
+//
+// Whatever decodes the shell's WM_COPYDATA messages. TrayShell implements
+// it, fed by the "Shell_TrayWnd" window; TrayReplayer feeds it recordings.
+//
+class ITrayMessageSink
+{
+public:
+    virtual ~ITrayMessageSink() { }
+
+    //
+    // Handles one message. lpData is writable, AppBar handlers return their
+    // results in it.
+    //
+    virtual LRESULT HandleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData) = 0;
+};
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayRecorder
+//
+// Appends shell messages to an in-memory recording. The owner decides when
+// to write the buffer out and calls Reset afterwards. It makes no system
+// calls.
+//
+class TrayRecorder
+{
+public:
+    TrayRecorder();
+
+    // Starts a new recording
+    void Begin(DWORD dwNow);
+
+    void Append(DWORD dwData, DWORD cbData, LPCVOID pvData, DWORD dwNow);
+
+    // Drops what has been written out; entry times stay relative to Begin
+    void Reset()
+    {
+        m_buffer.clear();
+    }
+
+    LPCVOID GetData() const
+    {
+        return m_buffer.empty() ? NULL : &m_buffer[0];
+    }
+
+    size_t GetSize() const
+    {
+        return m_buffer.size();
+    }
+
+private:
+    std::vector<BYTE> m_buffer;
+    DWORD m_dwStart;
+};
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayReplayer
+//
+// Reads a recording and plays it into an ITrayMessageSink as fast as the
+// sink allows, timing every message. The clock is supplied by the caller, so
+// it makes no system calls of its own. The recording must stay valid for the
+// replayer's lifetime.
+//
+class TrayReplayer
+{
+public:
+    struct Statistics
+    {
+        UINT uCount;        // messages replayed
+        ULONGLONG ullBytes; // payload bytes replayed
+        ULONGLONG ullTotal; // clock ticks spent in the sink
+        ULONGLONG ullMax;   // slowest message, in clock ticks
+    };
+
+    // Statistics per COPYDATASTRUCT::dwData
+    typedef std::map<DWORD, Statistics> StatisticsMap;
+
+    typedef ULONGLONG (*TickProc)();
+
+    TrayReplayer(LPCVOID pvRecording, size_t cbRecording);
+
+    // False if the recording has no valid header
+    bool IsValid() const
+    {
+        return m_pbEntries != NULL;
+    }
+
+    //
+    // Returns the next entry and its payload, or false at the end or at the
+    // first truncated entry.
+    //
+    bool Next(TRAYRECENTRY& entry, LPCVOID& pvData);
+
+    void Rewind()
+    {
+        m_pbNext = m_pbEntries;
+    }
+
+    //
+    // Replays all remaining entries into sink and adds their timings to
+    // stats. Returns the number of entries replayed.
+    //
+    UINT Run(ITrayMessageSink& sink, TickProc pfnTicks, StatisticsMap& stats);
+
+private:
+    // not implemented
+    TrayReplayer(const TrayReplayer& rhs);
+    TrayReplayer& operator=(const TrayReplayer& rhs);
+
+    const BYTE* m_pbEntries;
+    const BYTE* m_pbNext;
+    const BYTE* m_pbEnd;
+
+    // Payloads are copied here, the sink may write to them
+    std::vector<BYTE> m_scratch;
+};
+
+#endif // TRAYRECORDING_H
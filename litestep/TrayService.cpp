@@ -20,6 +20,7 @@
 //
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 #include "TrayService.h"
+#include "MessageManager.h"
 
 #include "../utility/core.hpp"
 #include "../utility/shellhlp.h"
@@ -50,13 +51,175 @@ const GUID CLSID_SysTrayObject = \
 {0x35CEC8A3, 0x2BE6, 0x11D2, {0x87, 0x73, 0x92, 0xE2, 0x20, 0x52, 0x41, 0x53}};
 
 
+//
+// Win32TraySystem
+// Carries out TrayShell's window and system calls through the Win32 API
+//
+class Win32TraySystem : public TrayShell::System
+{
+public:
+    Win32TraySystem() :
+        m_pMessageManager(NULL)
+    {
+        // do nothing
+    }
+
+    void SetMessageManager(MessageManager* pMessageManager)
+    {
+        m_pMessageManager = pMessageManager;
+    }
+
+    LRESULT Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        return ::SendMessage(hWnd, uMsg, wParam, lParam);
+    }
+
+    BOOL Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        return ::PostMessage(hWnd, uMsg, wParam, lParam);
+    }
+
+    bool IsHandled(UINT uMsg)
+    {
+        return !m_pMessageManager || m_pMessageManager->HandlerExists(uMsg);
+    }
+
+    BOOL IsWindow(HWND hWnd)
+    {
+        return ::IsWindow(hWnd);
+    }
+
+    BOOL GetWindowRect(HWND hWnd, RECT& rc)
+    {
+        return ::GetWindowRect(hWnd, &rc);
+    }
+
+    BOOL SetTimer(HWND hWnd, UINT_PTR uID, UINT uElapse)
+    {
+        return ::SetTimer(hWnd, uID, uElapse, NULL) != 0;
+    }
+
+    void KillTimer(HWND hWnd, UINT_PTR uID)
+    {
+        ::KillTimer(hWnd, uID);
+    }
+
+    DWORD GetTickCount()
+    {
+        return ::GetTickCount();
+    }
+
+    HMONITOR MonitorFromRect(const RECT& rc)
+    {
+        return ::MonitorFromRect(&rc, MONITOR_DEFAULTTOPRIMARY);
+    }
+
+    HMONITOR MonitorFromWindow(HWND hWnd)
+    {
+        return ::MonitorFromWindow(hWnd, MONITOR_DEFAULTTOPRIMARY);
+    }
+
+    bool GetMonitorRects(HMONITOR hMon, RECT& rcMonitor, RECT& rcWork)
+    {
+        MONITORINFO mi;
+        mi.cbSize = sizeof(mi);
+
+        if (!GetMonitorInfo(hMon, &mi))
+        {
+            return false;
+        }
+
+        CopyRect(&rcMonitor, &mi.rcMonitor);
+        CopyRect(&rcWork, &mi.rcWork);
+
+        return true;
+    }
+
+    void GetScreenRect(RECT& rc)
+    {
+        SetRect(&rc,
+          0, 0, GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN));
+    }
+
+    void SetWorkArea(const RECT& rc)
+    {
+        RECT rcWorkArea = rc;
+
+        SystemParametersInfo(
+             SPI_SETWORKAREA
+            ,1 // readjust maximized windows
+            ,&rcWorkArea
+            ,0 // SPIF_SENDCHANGE - see BroadcastWorkAreaChange
+        );
+    }
+
+    void BroadcastWorkAreaChange()
+    {
+        SendNotifyMessage(    // used in place of SPIF_SENDCHANGE to avoid lockups
+             HWND_BROADCAST   // see http://blogs.msdn.com/oldnewthing/archive/2005/03/10/392118.aspx
+            ,WM_SETTINGCHANGE
+            ,SPI_SETWORKAREA
+            ,0
+        );
+    }
+
+    LPVOID LockShared(HANDLE hData, DWORD dwProcessId)
+    {
+        return SHLockShared(hData, dwProcessId);
+    }
+
+    void UnlockShared(LPVOID pvData)
+    {
+        SHUnlockShared(pvData);
+    }
+
+    //
+    // Handler for SHLoadInProc and SHEnableServiceObject (where available)
+    //
+    LRESULT LoadInProc(const GUID& clsid, DWORD dwMessage)
+    {
+#if defined(TRACE_ENABLED)
+        WCHAR szBuffer[MAX_PATH] = { 0 };
+        CLSIDToString(clsid, szBuffer, COUNTOF(szBuffer));
+
+        if (dwMessage == 1)
+        {
+            TRACE("SHLoadInProc(\"%ls\")", szBuffer);
+        }
+        else if (dwMessage == 2)
+        {
+            TRACE("SHEnableServiceObject(\"%ls\", FALSE)", szBuffer);
+        }
+        else if (dwMessage == 3)
+        {
+            TRACE("SHEnableServiceObject(\"%ls\", TRUE)", szBuffer);
+        }
+        else
+        {
+            TRACE("Unknown LoadInProc message: %u", dwMessage);
+        }
+#else
+        UNREFERENCED_PARAMETER(clsid);
+        UNREFERENCED_PARAMETER(dwMessage);
+#endif
+
+        // This is not actually implemented
+        return E_NOTIMPL;
+    }
+
+private:
+    MessageManager* m_pMessageManager;
+};
+
+
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
 // TrayService
 //
 TrayService::TrayService() :
-m_uWorkAreaDirty(0), m_hNotifyWnd(NULL), m_hTrayWnd(NULL),
-m_hLiteStep(NULL), m_hInstance(NULL)
+m_hNotifyWnd(NULL), m_hTrayWnd(NULL), m_hLiteStep(NULL), m_hInstance(NULL),
+m_pSystem(new Win32TraySystem()), m_shell(m_pSystem),
+m_hRecordFile(INVALID_HANDLE_VALUE)
 {
     // do nothing
 }
@@ -84,13 +247,20 @@ HRESULT TrayService::Start()
     m_hLiteStep = GetLitestepWnd();
     m_hInstance = GetModuleHandle(NULL);
 
+    // Icon notifications arriving within this many milliseconds are sent
+    // to the systray modules together, with repeated updates merged. AppBars
+    // settle for LSTrayWorkAreaDelay milliseconds before the work area
+    // follows them.
+    m_shell.SetDelays(
+        (UINT)std::max(GetRCIntW(L"LSTrayCoalesceDelay", 16), 0),
+        (DWORD)std::max(GetRCIntW(L"LSTrayWorkAreaDelay", 50), 0));
+
+    openRecording();
+
     if (m_hLiteStep && m_hInstance)
     {
         // clear work area of primary monitor
-        SetRect(&m_rWorkAreaDef,
-          0, 0, GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN));
-        setWorkArea(&m_rWorkAreaDef);
-        CopyRect(&m_rWorkAreaCur, &m_rWorkAreaDef);
+        m_shell.ResetWorkArea();
 
         hr = createWindows();
 
@@ -99,6 +269,8 @@ HRESULT TrayService::Start()
             SetWindowLongPtr(m_hTrayWnd, GWLP_USERDATA, magicDWord);
             SetWindowLongPtr(m_hTrayWnd, 0, (LONG_PTR)this);
 
+            m_shell.SetWindows(m_hLiteStep, m_hTrayWnd, m_hNotifyWnd);
+
             // http://forums.microsoft.com/MSDN/ShowPost.aspx?PostID=1427677&SiteID=1
             //
             // Re: TaskbarCreated message (not working in Vista)
@@ -124,6 +296,10 @@ HRESULT TrayService::Start()
             // tell ITaskbarList which window to communicate with
             m_taskbarListHandler.Start(m_hTrayWnd);
 
+            // catch owners that die without LM_WINDOWDESTROYED
+            SetTimer(m_hTrayWnd, TRAY_VALIDATE_TIMER,
+                TRAY_VALIDATE_INTERVAL, NULL);
+
             if (IsVistaOrAbove())
             {
                 // On Vista and up there's a single SSO responsible for loading
@@ -153,23 +329,37 @@ HRESULT TrayService::Stop()
     unloadShellServiceObjects();
     m_taskbarListHandler.Stop();
     destroyWindows();
+    m_shell.SetWindows(NULL, NULL, NULL);
+    closeRecording();
 
-    while (!m_siVector.empty())
-    {
-        delete m_siVector.back();
-        m_siVector.pop_back();
-    }
+    const TrayNotifyQueue::Statistics& stats = m_shell.GetNotifyStatistics();
 
-    while (!m_abVector.empty())
-    {
-        delete m_abVector.back();
-        m_abVector.pop_back();
-    }
+    LSLogPrintf(LOG_DEBUG, "TrayService",
+        "Icon notifications: %u queued, %u merged, %u dropped, "
+        "%u delivered in %u batches", stats.uQueued, stats.uMerged,
+        stats.uDropped, stats.uDelivered, stats.uBatches);
+
+    const TrayIconCache::Statistics& cacheStats = NotifyIcon::GetCacheStatistics();
+
+    LSLogPrintf(LOG_DEBUG, "TrayService",
+        "Icon cache: %u hits (%u by handle), %u misses", cacheStats.uHits,
+        cacheStats.uSourceHits, cacheStats.uMisses);
+
+    const WorkAreaScheduler& scheduler = m_shell.GetWorkAreaScheduler();
+    const WorkAreaScheduler::Statistics& waStats = scheduler.GetStatistics();
+
+    LSLogPrintf(LOG_DEBUG, "TrayService",
+        "Work area: %u requested, %u suppressed, %u superseded, %u applied, "
+        "%u broadcasts (%u unanswered), %u external changes",
+        waStats.uRequested, waStats.uSuppressed, waStats.uSuperseded,
+        waStats.uApplied, waStats.uBroadcasts,
+        scheduler.GetPendingEchoes(), waStats.uExternal);
+
+    m_shell.Clear();
+    NotifyIcon::DestroyIdleIcons();
 
     // clear the work area of primary monitor
-    SetRect(&m_rWorkAreaDef,
-      0, 0, GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN));
-    setWorkArea(&m_rWorkAreaDef);
+    m_shell.ResetWorkArea();
 
     m_hLiteStep = NULL;
     m_hInstance = NULL;
@@ -429,121 +619,27 @@ LRESULT CALLBACK TrayService::WindowTrayProc(HWND hWnd, UINT uMsg,
                 //
                 COPYDATASTRUCT* pcds = (COPYDATASTRUCT*)lParam;
 
-                switch (pcds->dwData)
-                {
-                case SH_APPBAR_DATA:
-                    {
-                        //
-                        // Application Bar Message
-                        //
-                        lResult = pTrayService->HandleAppBarCopydata(
-                            pcds->cbData, pcds->lpData);
-                    }
-                    break;
-
-                case SH_TRAY_DATA:
-                    {
-                        //
-                        // System Tray Notification
-                        //
-                        PSHELLTRAYDATA pstd = (PSHELLTRAYDATA)pcds->lpData;
-
-                        lResult = (LRESULT)pTrayService->HandleNotification(pstd);
-                    }
-                    break;
-
-                case SH_LOADPROC_DATA:
-                    {
-                        //
-                        // LoadInProc messages
-                        //
-                        if (pcds->cbData == sizeof(CLSID))
-                        {
-                            // Classic SHLoadInProc message
-                            lResult = pTrayService->HandleLoadInProc(
-                                (REFCLSID)pcds->lpData, 1);
-                        }
-                        else if (pcds->cbData == sizeof(SHELLINPROCDATA))
-                        {
-                            PSHELLINPROCDATA pipd = (PSHELLINPROCDATA)pcds->lpData;
-
-                            lResult = pTrayService->HandleLoadInProc(
-                                pipd->clsid, pipd->dwMessage);
-                        }
-                        else
-                        {
-                            TRACE("Unknown SHLoadInProc size: %u", pcds->cbData);
-                            lResult = E_NOTIMPL;
-                        }
-                    }
-                    break;
-
-                case SH_TRAYINFO_DATA:
-                    {
-                        lResult = pTrayService->TrayInfoEvent(pcds->cbData, pcds->lpData);
-                    }
-                    break;
-
-                default:
-                    {
-                        TRACE("Unsupported tray message: %u", pcds->dwData);
-                    }
-                    break;
-                }
+                lResult = pTrayService->handleCopyData(
+                    (DWORD)pcds->dwData, pcds->cbData, pcds->lpData);
             }
             break;
 
         case ABP_NOTIFYPOSCHANGED:
             {
-                const BarVector abTempV = pTrayService->m_abVector;
-                BarVector::const_reverse_iterator rit;
-
-                HMONITOR hMon = (HMONITOR)lParam;
-                HWND hSkip = (HWND)wParam;
-                AppBar* p = NULL;
-
-                for (rit = abTempV.rbegin(); rit != abTempV.rend(); ++rit)
-                {
-                    if (hSkip != (*rit)->hWnd())
-                    {
-                        if((*rit)->hMon() == hMon &&
-                            (!p || p->uEdge() != (*rit)->uEdge()))
-                        {
-                            SendMessage(
-                                 (*rit)->hWnd()
-                                ,(*rit)->uMsg()
-                                ,ABN_POSCHANGED
-                                ,0
-                            );
-                        }
-                    }
-                    else
-                    {
-                        p = *rit;
-                    }
-                }
-
-                pTrayService->adjustWorkArea(hMon);
+                pTrayService->m_shell.OnPosChanged(
+                    (HWND)wParam, (HMONITOR)lParam);
             }
             break;
 
         case ABP_NOTIFYSTATECHANGE:
             {
-                const BarVector abTempV = pTrayService->m_abVector;
-                BarVector::const_reverse_iterator rit;
+                pTrayService->m_shell.OnStateChange();
+            }
+            break;
 
-                for (rit = abTempV.rbegin(); rit != abTempV.rend(); ++rit)
-                {
-                    if (!(*rit)->IsOverLap())
-                    {
-                        SendMessage(
-                             (*rit)->hWnd()
-                            ,(*rit)->uMsg()
-                            ,ABN_STATECHANGE
-                            ,0
-                        );
-                    }
-                }
+        case WM_TIMER:
+            {
+                pTrayService->m_shell.OnTimer(wParam);
             }
             break;
 
@@ -576,31 +672,7 @@ LRESULT CALLBACK TrayService::WindowTrayProc(HWND hWnd, UINT uMsg,
                         ,0
                     );
 
-                    // Always update the Current workarea
-                    CopyRect(&pTrayService->m_rWorkAreaCur, &rc);
-
-                    // This will be the case when we updated the workarea
-                    // ourselves.
-                    if (pTrayService->m_uWorkAreaDirty)
-                    {
-                        --pTrayService->m_uWorkAreaDirty;
-                        break;
-                    }
-
-                    // Only update the Default workarea when set externally.
-                    CopyRect(&pTrayService->m_rWorkAreaDef, &rc);
-
-                    // Clean up any dead app bars before repositioning
-                    pTrayService->removeDeadAppBars();
-
-                    // Now reposition our appbars based on the new default
-                    // workarea.
-                    PostMessage(
-                         pTrayService->m_hTrayWnd
-                        ,ABP_NOTIFYPOSCHANGED
-                        ,(WPARAM)NULL
-                        ,(LPARAM)MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY)
-                    );
+                    pTrayService->m_shell.OnWorkAreaChanged(rc);
                 }
             }
             break;
@@ -635,1716 +707,215 @@ LRESULT CALLBACK TrayService::WindowNotifyProc(HWND hWnd, UINT uMsg, WPARAM wPar
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// HandleLoadInProc
+// handleCopyData
 //
-// Handler for SHLoadInProc and SHEnableServiceObject (where available)
-//
-HRESULT TrayService::HandleLoadInProc(REFCLSID clsid, DWORD dwMessage)
+LRESULT TrayService::handleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData)
 {
-#if defined(TRACE_ENABLED)
-    WCHAR szBuffer[MAX_PATH] = { 0 };
-    CLSIDToString(clsid, szBuffer, COUNTOF(szBuffer));
-
-    if (dwMessage == 1)
-    {
-        TRACE("SHLoadInProc(\"%ls\")", szBuffer);
-    }
-    else if (dwMessage == 2)
+    if (m_hRecordFile != INVALID_HANDLE_VALUE &&
+        (dwData == SH_APPBAR_DATA || dwData == SH_TRAY_DATA))
     {
-        TRACE("SHEnableServiceObject(\"%ls\", FALSE)", szBuffer);
+        // Record the payload as it arrived, before the AppBar handlers
+        // write their results into it
+        recordCopyData(dwData, cbData, lpData);
     }
-    else if (dwMessage == 3)
-    {
-        TRACE("SHEnableServiceObject(\"%ls\", TRUE)", szBuffer);
-    }
-    else
-    {
-        TRACE("Unknown LoadInProc message: %u", dwMessage);
-    }
-#else
-    UNREFERENCED_PARAMETER(clsid);
-    UNREFERENCED_PARAMETER(dwMessage);
-#endif
 
-    // This is not actually implemented
-    return E_NOTIMPL;
+    return m_shell.HandleCopyData(dwData, cbData, lpData);
 }
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// TrayInfoEvent
+// openRecording
 //
-// Handles tray info events
+// Starts recording tray and AppBar messages if LSTrayRecordFile is set.
 //
-LRESULT TrayService::TrayInfoEvent(DWORD /*cbData*/, LPVOID lpData) // size, data
+void TrayService::openRecording()
 {
-    LRESULT lr = 0;
-    LPNOTIFYICONIDENTIFIER_MSGV1 s = (LPNOTIFYICONIDENTIFIER_MSGV1)lpData;
-    SYSTRAYINFOEVENT sEvent;
+    wchar_t wzFile[MAX_PATH] = { 0 };
 
-    // Calling Shell_NotifyIconGetRect will cause two successive calls to this function. The first
-    // (dwMessage 1) should return the top left coordinate of the specified icon. The 2nd should
-    // return the width and height of the icon.
+    if (!GetRCStringW(L"LSTrayRecordFile", wzFile, nullptr, MAX_PATH) ||
+        !*wzFile)
+    {
+        return;
+    }
 
-    // Let registered listeners handle this.
-    sEvent.cbSize = sizeof(SYSTRAYINFOEVENT);
-    sEvent.dwEvent = s->dwMessage;
-    sEvent.guidItem = s->guidItem;
-    sEvent.hWnd = (HWND)s->hWnd;
-    sEvent.uID = s->uID;
+    m_hRecordFile = CreateFileW(wzFile, GENERIC_WRITE, FILE_SHARE_READ,
+        NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-    SendMessage(m_hLiteStep, LM_SYSTRAYINFOEVENT, (WPARAM)&sEvent, (LPARAM)&lr);
+    if (m_hRecordFile == INVALID_HANDLE_VALUE)
+    {
+        LSLogPrintf(LOG_WARNING, "TrayService",
+            "Could not create tray recording %ls (%u)", wzFile, GetLastError());
+        return;
+    }
 
-    return lr;
+    m_recorder.Begin(GetTickCount());
 }
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// HandleAppBarCopydata
+// recordCopyData
 //
-LRESULT TrayService::HandleAppBarCopydata(DWORD cbData, LPVOID lpData)
+void TrayService::recordCopyData(DWORD dwData, DWORD cbData, LPCVOID pvData)
 {
-    LRESULT lr = 0;
+    m_recorder.Append(dwData, cbData, pvData, GetTickCount());
 
-    switch (cbData)
+    // Write in chunks, not once per message
+    if (m_recorder.GetSize() >= TRAY_RECORD_CHUNK)
     {
-    case sizeof(APPBARMSGDATAV3):
-        {
-            PAPPBARMSGDATAV3 pamd = (PAPPBARMSGDATAV3)lpData;
-
-            if (sizeof(APPBARDATAV2) != pamd->abd.cbSize)
-            {
-                TRACE("APPBARMSGDATAV3 - Invalid ABD size: %u. Expected: %u", pamd->abd.cbSize, sizeof(APPBARDATAV2));
-
-                break;
-            }
-
-            SHELLAPPBARDATA sbd((APPBARDATAV1&)(pamd->abd));
-            sbd.dwMessage = pamd->dwMessage;
-            sbd.hSharedMemory = (HANDLE)pamd->hSharedMemory;
-            sbd.dwSourceProcessId = pamd->dwSourceProcessId;
-
-            lr = HandleAppBarMessage(&sbd);
-        }
-        break;
-
-    case sizeof(APPBARMSGDATAV2):
-        {
-            PAPPBARMSGDATAV2 pamd = (PAPPBARMSGDATAV2)lpData;
-
-            if (sizeof(APPBARDATAV2) != pamd->abd.cbSize)
-            {
-                TRACE("APPBARMSGDATAV2 - Invalid ABD size: %u. Expected: %u", pamd->abd.cbSize, sizeof(APPBARDATAV2));
-
-                break;
-            }
+        flushRecording();
+    }
+}
 
-            SHELLAPPBARDATA sbd((APPBARDATAV1&)(pamd->abd));
-            sbd.dwMessage = pamd->dwMessage;
-            sbd.hSharedMemory = (HANDLE)pamd->hSharedMemory;
-            sbd.dwSourceProcessId = pamd->dwSourceProcessId;
 
-            lr = HandleAppBarMessage(&sbd);
-        }
-        break;
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// flushRecording
+//
+void TrayService::flushRecording()
+{
+    if (m_hRecordFile != INVALID_HANDLE_VALUE && m_recorder.GetSize() > 0)
+    {
+        DWORD cbWritten = 0;
 
-    case sizeof(APPBARMSGDATAV1):
+        if (!WriteFile(m_hRecordFile, m_recorder.GetData(),
+            (DWORD)m_recorder.GetSize(), &cbWritten, NULL))
         {
-            PAPPBARMSGDATAV1 pamd = (PAPPBARMSGDATAV1)lpData;
-
-            if (sizeof(APPBARDATAV1) != pamd->abd.cbSize)
-            {
-                TRACE("APPBARMSGDATAV1 - Invalid ABD size: %u. Expected: %u", pamd->abd.cbSize, sizeof(APPBARDATAV1));
-
-                break;
-            }
-
-            SHELLAPPBARDATA sbd((APPBARDATAV1&)(pamd->abd));
-            sbd.dwMessage = pamd->dwMessage;
-            sbd.hSharedMemory = (HANDLE)pamd->hSharedMemory;
-            sbd.dwSourceProcessId = pamd->dwSourceProcessId;
+            LSLogPrintf(LOG_WARNING, "TrayService",
+                "Tray recording stopped, write failed (%u)", GetLastError());
 
-            lr = HandleAppBarMessage(&sbd);
+            closeRecording();
+            return;
         }
-        break;
 
-    default:
-        {
-            TRACE("Unknown APPBARMSGDATA size: %u", cbData);
-        }
-        break;
+        m_recorder.Reset();
     }
-
-    return lr;
 }
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// HandleAppBarMessage
+// closeRecording
 //
-// Handler for all AppBar Messages
-//
-LRESULT TrayService::HandleAppBarMessage(PSHELLAPPBARDATA psad)
+void TrayService::closeRecording()
 {
-    LRESULT lResult = 0;
-
-    removeDeadAppBars();
-
-    TRACE("SHAppBarMessage(%u, ...)", psad->dwMessage);
-
-    switch(psad->dwMessage)
+    if (m_hRecordFile != INVALID_HANDLE_VALUE)
     {
-    case ABM_NEW:
-        lResult = barCreate(psad->abd);
-        break;
-
-    case ABM_REMOVE:
-        lResult = barDestroy(psad->abd);
-        break;
-
-    case ABM_QUERYPOS:
-        lResult = barQueryPos(psad);
-        break;
+        HANDLE hFile = m_hRecordFile;
 
-    case ABM_SETPOS:
-        lResult = barSetPos(psad);
-        break;
+        // Keeps flushRecording from coming back here
+        m_hRecordFile = INVALID_HANDLE_VALUE;
 
-    case ABM_GETSTATE:
-        lResult = barGetTaskBarState();
-        break;
-
-    case ABM_GETTASKBARPOS:
-        lResult = barGetTaskBarPos(psad);
-        break;
-
-    case ABM_ACTIVATE:
-        lResult = barActivate(psad->abd);
-        break;
-
-    case ABM_GETAUTOHIDEBAR:
-        lResult = barGetAutoHide(psad->abd);
-        break;
-
-    case ABM_SETAUTOHIDEBAR:
-        lResult = barSetAutoHide(psad->abd);
-        break;
-
-    case ABM_WINDOWPOSCHANGED:
-        lResult = barPosChanged(psad->abd);
-        break;
-
-    case ABM_SETSTATE:
-        lResult = barSetTaskBarState(psad->abd);
-        break;
+        if (m_recorder.GetSize() > 0)
+        {
+            DWORD cbWritten = 0;
+            WriteFile(hFile, m_recorder.GetData(),
+                (DWORD)m_recorder.GetSize(), &cbWritten, NULL);
+        }
 
-    default:
-        TRACE("ABM unknown: %u", psad->dwMessage);
-        break;
+        CloseHandle(hFile);
+        m_recorder.Reset();
     }
-
-    return lResult;
 }
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// NotifyRudeApp
+// GetWorkAreaStatistics
 //
-// External interface to let us know a window has gone/left full screen mode
+// Backs LM_GETWORKAREASTATISTICS. The counters run from startup, recycles
+// don't reset them.
 //
-void TrayService::NotifyRudeApp(HMONITOR hFullScreenMonitor) const
+void TrayService::GetWorkAreaStatistics(LSWORKAREASTATISTICS& lswas) const
 {
-    const BarVector abTempV = m_abVector;
-    BarVector::const_reverse_iterator rit;
+    const WorkAreaScheduler& scheduler = m_shell.GetWorkAreaScheduler();
+    const WorkAreaScheduler::Statistics& stats = scheduler.GetStatistics();
 
-    for (rit = abTempV.rbegin(); rit != abTempV.rend(); ++rit)
-    {
-        SendMessage(
-             (*rit)->hWnd()
-            ,(*rit)->uMsg()
-            ,ABN_FULLSCREENAPP
-            ,(LPARAM)(hFullScreenMonitor ? 1 : 0)
-        );
-    }
+    lswas.uRequested = stats.uRequested;
+    lswas.uSuppressed = stats.uSuppressed;
+    lswas.uSuperseded = stats.uSuperseded;
+    lswas.uApplied = stats.uApplied;
+    lswas.uBroadcasts = stats.uBroadcasts;
+    lswas.uEchoes = stats.uEchoes;
+    lswas.uPendingEchoes = scheduler.GetPendingEchoes();
+    lswas.uExternal = stats.uExternal;
 }
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// removeDeadAppBars
+// NotifyRudeApp
 //
-// Removes all "dead" appBars.  ie. Those that no longer have a valid HWND
-// associated with them.
+// External interface to let us know a window has gone/left full screen mode
 //
-void TrayService::removeDeadAppBars()
+void TrayService::NotifyRudeApp(HMONITOR hFullScreenMonitor) const
 {
-    BarVector::iterator it = m_abVector.begin();
-
-    while (it != m_abVector.end())
-    {
-        if (IsWindow((*it)->hWnd()))
-        {
-            ++it;
-            continue;
-        }
-
-        delete *it;
-        it = m_abVector.erase(it);
-    }
-
-    return;
+    m_shell.NotifyRudeApp(hFullScreenMonitor);
 }
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// barCreate
-//
-// Creates a new AppBar.
-//
-// ABM_NEW
-//
-// Valid APPBARDATA members:
+// SetMessageManager
 //
-//  cbSize
-//  hWnd
-//  uCallbackMessage
-//
-LRESULT TrayService::barCreate(const APPBARDATAV1& abd)
+void TrayService::SetMessageManager(MessageManager* pMessageManager)
 {
-    LRESULT lResult = 0;
-
-    if (IsWindow((HWND)abd.hWnd) && !isBar((HWND)abd.hWnd))
-    {
-        m_abVector.push_back(new AppBar((HWND)abd.hWnd, abd.uCallbackMessage));
-        lResult = 1;
-    }
-
-    return lResult;
+    m_pSystem->SetMessageManager(pMessageManager);
 }
 
+
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// barDestroy
-//
-// Removes the specified AppBar.
-//
-// ABM_REMOVE
-//
-// Valid APPBARDATA members:
+// SendSystemTray
 //
-//  cbSize
-//  hWnd
+// Resend all icon data; systray modules will request this via LM_SYSTRAYREADY
+// during their startup.
 //
-LRESULT TrayService::barDestroy(const APPBARDATAV1& abd)
+HWND TrayService::SendSystemTray()
 {
-    BarVector::iterator itBar;
-    LRESULT lResult = 0;
-
-    if (getBar((HWND)abd.hWnd, itBar))
-    {
-        lResult = 1;
-
-        HMONITOR hMon = (*itBar)->hMon();
-
-        delete *itBar;
-        m_abVector.erase(itBar);
-
-        PostMessage(
-             m_hTrayWnd
-            ,ABP_NOTIFYPOSCHANGED
-            ,(WPARAM)NULL
-            ,(LPARAM)hMon
-        );
-    }
+    m_shell.SendSystemTray();
 
-    return lResult;
+    return m_hNotifyWnd;
 }
 
+
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// barQueryPos
-//
-// Queries for an acceptable position for the specified appbar
-//
-// ABM_QUERYPOS
+// SendSystemTraySnapshot
 //
-// Valid APPBARDATA members:
+// Like SendSystemTray, but all icons go to hWnd in one LM_SYSTRAYSNAPSHOT,
+// each record carrying its NIM_SETVERSION version in uVersion. Modules that
+// recycle with many icons avoid two or four round trips per icon this way.
+// The records are only valid while the message is being processed.
 //
-//  cbSize
-//  hWnd
-//  uEdge
-//  rc
-//
-LRESULT TrayService::barQueryPos(PSHELLAPPBARDATA psad)
+HWND TrayService::SendSystemTraySnapshot(HWND hWnd)
 {
-    LRESULT lResult = 0;
-    PAPPBARDATAV1 pabd = ABLock(psad);
-    const APPBARDATAV1& abd = psad->abd;
-
-    if (pabd)
-    {
-        AppBar* p;
-
-        if (getBar((HWND)abd.hWnd, p))
-        {
-            lResult = 1;
+    std::vector<LSNOTIFYICONDATA> vecIcons;
+    m_shell.GetIcons(vecIcons);
 
-            if (p->IsOverLap())
-            {
-                modifyOverlapBar(pabd->rc, abd.rc, abd.uEdge);
-            }
-            else
-            {
-                modifyNormalBar(pabd->rc, abd.rc, abd.uEdge, (HWND)abd.hWnd);
-            }
-        }
+    LSSYSTRAYSNAPSHOT snapshot = { 0 };
+    snapshot.cbSize = sizeof(LSSYSTRAYSNAPSHOT);
+    snapshot.dwVersion = LSSYSTRAYSNAPSHOT_VERSION;
+    snapshot.uCount = (UINT)vecIcons.size();
+    snapshot.cbIcon = sizeof(LSNOTIFYICONDATA);
+    snapshot.pvIcons = vecIcons.empty() ? NULL : &vecIcons[0];
 
-        ABUnLock(pabd);
-    }
+    SendMessage(hWnd, LM_SYSTRAYSNAPSHOT, 0, (LPARAM)&snapshot);
 
-    return lResult;
+    return m_hNotifyWnd;
 }
 
+
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 //
-// barSetPos
-//
-// Sets the position of the specified appbar
-//
-// ABM_SETPOS
-//
-// Valid APPBARDATA members:
+// OnWindowDestroyed
 //
-//  cbSize
-//  hWnd
-//  uEdge
-//  rc
+// Drops the icons and the AppBar of a window that went away. Called for
+// LM_WINDOWDESTROYED, which only covers top-level windows; the rest are
+// caught by the validate timer.
 //
-LRESULT TrayService::barSetPos(PSHELLAPPBARDATA psad)
+void TrayService::OnWindowDestroyed(HWND hWnd)
 {
-    LRESULT lResult = 0;
-    PAPPBARDATAV1 pabd = ABLock(psad);
-    const APPBARDATAV1& abd = psad->abd;
-
-    if (pabd)
-    {
-        AppBar* p;
-
-        if (getBar((HWND)abd.hWnd, p))
-        {
-            lResult = 1;
-
-            if (p->IsOverLap())
-            {
-                modifyOverlapBar(pabd->rc, abd.rc, abd.uEdge);
-            }
-            else
-            {
-                modifyNormalBar(pabd->rc, abd.rc, abd.uEdge, (HWND)abd.hWnd);
-
-                // If this is the first time to position the bar or if
-                // the new position is different than the previous, then
-                // notify all other appbars.
-                if ((ABS_CLEANRECT != (ABS_CLEANRECT & p->lParam()))
-                   || !EqualRect(&p->GetRectRef(), &pabd->rc))
-                {
-                    // Notify other bars
-                    PostMessage(
-                         m_hTrayWnd
-                        ,ABP_NOTIFYPOSCHANGED
-                        ,(WPARAM)abd.hWnd
-                        ,(LPARAM)MonitorFromRect(&pabd->rc, MONITOR_DEFAULTTOPRIMARY)
-                    );
-                }
-            }
-
-            // Update the appbar stored parameters
-            CopyRect(&p->GetRectRef(), &pabd->rc);
-            p->lParam(p->lParam() | ABS_CLEANRECT);
-            p->uEdge(abd.uEdge);
-            p->hMon(MonitorFromRect(&p->GetRectRef(), MONITOR_DEFAULTTOPRIMARY));
-        }
-
-        ABUnLock(pabd);
-    }
-
-    return lResult;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barGetTaskBarState
-//
-// Returns the current TaskBar state (autohide, alwaysontop)
-//
-// ABM_GETSTATE
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//
-LRESULT TrayService::barGetTaskBarState()
-{
-    // Zero means neither always-on-top nor autohide,
-    // which is the safest guess for most LS setups
-    return 0;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barGetTaskBarPos
-//
-// Gets the current TaskBar position
-//
-// ABM_GETTASKBARPOS
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//  hWnd
-//  uEdge (undocumented)
-//
-LRESULT TrayService::barGetTaskBarPos(PSHELLAPPBARDATA psad)
-{
-    LRESULT lResult = 0;
-    PAPPBARDATAV1 pabd = ABLock(psad);
-
-    if (pabd)
-    {
-        if (GetWindowRect(m_hNotifyWnd, &pabd->rc))
-        {
-            lResult = 1;
-
-            MONITORINFO mi;
-            mi.cbSize = sizeof(mi);
-
-            if(!GetMonitorInfo(MonitorFromWindow(m_hNotifyWnd, MONITOR_DEFAULTTOPRIMARY), &mi))
-            {
-                SetRect(&mi.rcMonitor, 0, 0,
-                    GetSystemMetrics(SM_CXSCREEN),
-                    GetSystemMetrics(SM_CYSCREEN));
-            }
-
-            INT nHeight, nWidth, nScreenHeight, nScreenWidth;
-
-            nHeight = pabd->rc.bottom - pabd->rc.top;
-            nWidth = pabd->rc.right - pabd->rc.left;
-
-            nScreenHeight = mi.rcMonitor.bottom - mi.rcMonitor.top;
-            nScreenWidth = mi.rcMonitor.right - mi.rcMonitor.left;
-
-            if(nHeight > nWidth)
-            {
-                if(pabd->rc.left > nScreenWidth / 2)
-                {
-                    pabd->uEdge = ABE_RIGHT;
-                }
-                else
-                {
-                    pabd->uEdge = ABE_LEFT;
-                }
-            }
-            else
-            {
-                if(pabd->rc.top > nScreenHeight / 2)
-                {
-                    pabd->uEdge = ABE_BOTTOM;
-                }
-                else
-                {
-                    pabd->uEdge = ABE_TOP;
-                }
-            }
-        }
-
-        ABUnLock(pabd);
-    }
-
-    return lResult;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barActivate
-//
-// Ensures that any autohide appbar has the topmost zOrder when any appbar is
-// activated.
-//
-// ABM_ACTIVATE
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//  hWnd
-//
-LRESULT TrayService::barActivate(const APPBARDATAV1& abd)
-{
-    LRESULT lResult = 0;
-    AppBar* p;
-
-    if (getBar((HWND)abd.hWnd, p))
-    {
-        lResult = 1;
-
-        BarVector::iterator itBar = findBar(p->hMon(), p->uEdge(), ABS_AUTOHIDE);
-
-        if (itBar != m_abVector.end())
-        {
-            PostMessage(
-                 m_hTrayWnd
-                ,ABP_RAISEAUTOHIDEHWND
-                ,(WPARAM)(*itBar)->hWnd()
-                ,(LPARAM)(*itBar)->uEdge()
-            );
-        }
-    }
-
-    return lResult;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barGetAutoHide
-//
-// Returns the HWND of the autohide appbar on the specified screen edge
-//
-// ABM_GETAUTOHIDEBAR
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//  hWnd
-//  uEdge
-//
-LRESULT TrayService::barGetAutoHide(const APPBARDATAV1& abd)
-{
-    LRESULT lResult = 0;
-    BarVector::iterator itBar = findBar(
-        MonitorFromWindow((HWND)abd.hWnd, MONITOR_DEFAULTTOPRIMARY),
-        abd.uEdge, ABS_AUTOHIDE);
-
-    if (itBar != m_abVector.end())
-    {
-        lResult = (LRESULT)(*itBar)->hWnd();
-    }
-
-    return lResult;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barSetAutoHide
-//
-// Sets the specified AppBar to autohide if it already exists, otherwise
-// if the specified AppBar does not exist, it creates it and sets it to as
-// an overlap autohide AppBar.
-//
-// ABM_SETAUTOHIDEBAR
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//  hWnd
-//  uEdge
-//  lParam
-//
-LRESULT TrayService::barSetAutoHide(const APPBARDATAV1& abd)
-{
-    LRESULT lResult = 0;
-
-    BarVector::iterator itBar = findBar((HWND)abd.hWnd);
-    BarVector::iterator itAutoHideBar = findBar(
-        MonitorFromWindow((HWND)abd.hWnd, MONITOR_DEFAULTTOPRIMARY),
-        abd.uEdge, ABS_AUTOHIDE);
-
-    if (abd.lParam) // Set Auto Hide
-    {
-        lResult = 1;
-
-        // Does an autohide bar already exist on this edge?
-        if (itAutoHideBar != m_abVector.end())
-        {
-            // Return true if this appbar is the autohide bar.
-            return (itBar == itAutoHideBar);
-        }
-
-        // if bar doesn't exist, create it and set it as an overlap bar
-        if (itBar == m_abVector.end())
-        {
-            if (!barCreate(abd))
-            {
-                return 0;
-            }
-
-            itBar = m_abVector.end()-1;
-            (*itBar)->lParam((*itBar)->lParam() | ABS_OVERLAPAUTOHIDE);
-        }
-
-        // set its assigned edge, and set it as an autohide bar
-        (*itBar)->uEdge(abd.uEdge);
-        (*itBar)->lParam((*itBar)->lParam() | ABS_AUTOHIDE);
-    }
-    else // Clear Auto Hide
-    {
-        // if the bar was the auto hide bar proceed
-        if (itBar != m_abVector.end() && itBar == itAutoHideBar)
-        {
-            lResult = 1;
-
-            // if bar was overlap, destroy it
-            if ((*itBar)->IsOverLap())
-            {
-                barDestroy(abd);
-            }
-            else
-            {
-                // otherwise clear its autohide status.
-                (*itBar)->lParam((*itBar)->lParam() & ~ABS_AUTOHIDE);
-            }
-        }
-    }
-
-    return lResult;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barPosChanged
-//
-// Ensures that any autohide appbar has the topmost zOrder when any non autohide
-// appbar's position has changed.
-//
-// ABM_WINDOWPOSCHANGED
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//  hWnd
-//
-LRESULT TrayService::barPosChanged(const APPBARDATAV1& abd)
-{
-    LRESULT lResult = 0;
-    AppBar* p;
-
-    if (getBar((HWND)abd.hWnd, p) && !p->IsAutoHide())
-    {
-        lResult = 1;
-
-        BarVector::iterator itBar = findBar(p->hMon(), p->uEdge(), ABS_AUTOHIDE);
-
-        if (itBar != m_abVector.end())
-        {
-            PostMessage(
-                 m_hTrayWnd
-                ,ABP_RAISEAUTOHIDEHWND
-                ,(WPARAM)(*itBar)->hWnd()
-                ,(LPARAM)(*itBar)->uEdge()
-            );
-        }
-    }
-
-    return lResult;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// barSetTaskBarState
-//
-// Sets the current TaskBar state (autohide, alwaysontop)
-//
-// ABM_SETSTATE
-//
-// Valid APPBARDATA members:
-//
-//  cbSize
-//  hWnd
-//  lParam
-//
-LRESULT TrayService::barSetTaskBarState(const APPBARDATAV1& abd)
-{
-    return 0;
-    UNREFERENCED_PARAMETER(abd);
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// modifyOverlapBar
-//
-// Helper function to barSetPos and barQueryPos
-//
-void TrayService::modifyOverlapBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge)
-{
-    // Use entire screen for default rectangle
-    HMONITOR hMon = MonitorFromRect(&rcOrg, MONITOR_DEFAULTTOPRIMARY);
-
-    MONITORINFO mi;
-    mi.cbSize = sizeof(mi);
-
-    if(GetMonitorInfo(hMon, &mi))
-    {
-        CopyRect(&rcDst, &mi.rcMonitor);
-    }
-    else
-    {
-        SetRect(&rcDst,
-          0, 0, GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN));
-    }
-
-    // Set the bar's extent
-    modifyBarExtent(rcDst, rcOrg, uEdge);
-
-    // The bar's position is anchored at the desktop edge - so nothing to do
-
-    // Set the bar's breadth
-    modifyBarBreadth(rcDst, rcOrg, uEdge);
-
-    return;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// modifyNormalBar
-//
-// Helper function to barSetPos and barQueryPos
-//
-void TrayService::modifyNormalBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge, HWND hWnd)
-{
-    BarVector::const_iterator it;
-    AppBar* p;
-    bool bFound = FALSE;
-
-    // Use entire screen for default rectangle
-    HMONITOR hMon = MonitorFromRect(&rcOrg, MONITOR_DEFAULTTOPRIMARY);
-    HMONITOR hMonPrimary = MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY);
-
-    if(hMonPrimary == hMon)
-    {
-        // Use only the original workarea for the default rectangle
-        CopyRect(&rcDst, &m_rWorkAreaDef);
-    }
-    else
-    {
-        MONITORINFO mi;
-        mi.cbSize = sizeof(mi);
-
-        if(GetMonitorInfo(hMon, &mi))
-        {
-            CopyRect(&rcDst, &mi.rcMonitor);
-        }
-        else
-        {
-            ASSERT(FALSE);
-
-            // Use only the original workarea for the default rectangle
-            CopyRect(&rcDst, &m_rWorkAreaDef);
-            hMon = hMonPrimary;
-        }
-    }
-
-    // Set the bar's extent
-    modifyBarExtent(rcDst, rcOrg, uEdge);
-
-    // Set the bar's position
-    for (it = m_abVector.begin(); it != m_abVector.end(); ++it)
-    {
-        p = *it;
-
-        // ignore overlap bars and invalid windows and other monitors
-        if(!p || p->IsOverLap() || hMon != p->hMon())
-        {
-            // do nothing
-        }
-        // if this is our appbar, mark it found and continue
-        else if (hWnd == p->hWnd())
-        {
-            bFound = true;
-        }
-        // ignore bars that haven't been initialized
-        else if (ABS_CLEANRECT != (ABS_CLEANRECT & p->lParam()))
-        {
-            // do nothing
-        }
-        // Ignore other edge appbars for the most part
-        else if (uEdge != p->uEdge())
-        {
-            // Left/Right bars must resize to top/bottom bars
-            if (ABE_HORIZONTAL != (ABE_HORIZONTAL & uEdge)
-                &&
-               ABE_HORIZONTAL == (ABE_HORIZONTAL & p->uEdge()))
-            {
-                RECT rc; // dummy
-
-                // If our destination rectangle currently intersects
-                // then resize it
-                if (IntersectRect(&rc, &p->GetRectRef(), &rcDst))
-                {
-                    if (ABE_TOP == p->uEdge())
-                    {
-                        rcDst.top = p->GetRectRef().bottom;
-                    }
-                    else
-                    {
-                        rcDst.bottom = p->GetRectRef().top;
-                    }
-                }
-            }
-        }
-        // Keep moving the destination appbar while we are looking
-        // at same edge appbars before our own.  Once we find our
-        // own, then we ignore all same edge appbars after ours.
-        else if (!bFound)
-        {
-            switch (uEdge)
-            {
-            case ABE_LEFT:
-                rcDst.left = p->GetRectRef().right;
-                break;
-            case ABE_TOP:
-                rcDst.top = p->GetRectRef().bottom;
-                break;
-            case ABE_RIGHT:
-                rcDst.right = p->GetRectRef().left;
-                break;
-            case ABE_BOTTOM:
-                rcDst.bottom = p->GetRectRef().top;
-                break;
-            }
-        }
-    }
-
-    // Set the bar's breadth
-    modifyBarBreadth(rcDst, rcOrg, uEdge);
-
-    return;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// modifyBarExtent
-//
-// Helper function to modifyNormalBar and modifyOverlapBar
-//
-void TrayService::modifyBarExtent(RECT& rcDst, const RECT& rcOrg, UINT uEdge)
-{
-    switch (uEdge)
-    {
-    case ABE_LEFT:
-    case ABE_RIGHT:
-        rcDst.top = std::max(rcDst.top, rcOrg.top);
-        rcDst.bottom = std::min(rcDst.bottom, rcOrg.bottom);
-        break;
-    case ABE_TOP:
-    case ABE_BOTTOM:
-        rcDst.left = std::max(rcDst.left, rcOrg.left);
-        rcDst.right = std::min(rcDst.right, rcOrg.right);
-        break;
-    }
-
-    return;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// modifyBarBreadth
-//
-// Helper function to modifyBarNormal and modifyBarOverlap
-//
-void TrayService::modifyBarBreadth(RECT& rcDst, const RECT& rcOrg, UINT uEdge)
-{
-    switch (uEdge)
-    {
-    case ABE_LEFT:
-        rcDst.right = rcDst.left + (rcOrg.right - rcOrg.left);
-        break;
-    case ABE_TOP:
-        rcDst.bottom = rcDst.top + (rcOrg.bottom - rcOrg.top);
-        break;
-    case ABE_RIGHT:
-        rcDst.left = rcDst.right - (rcOrg.right - rcOrg.left);
-        break;
-    case ABE_BOTTOM:
-        rcDst.top = rcDst.bottom - (rcOrg.bottom - rcOrg.top);
-        break;
-    }
-
-    return;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// adjustWorkArea
-//
-// Helper function to barSetPos (via ABP_NOTIFYPOSCHANGED)
-//
-void TrayService::adjustWorkArea(HMONITOR hMon)
-{
-    RECT rcWorker, rcMonitor, rcWorkArea;
-
-    HMONITOR hMonPrimary = MonitorFromWindow(NULL, MONITOR_DEFAULTTOPRIMARY);
-
-    if (hMon != hMonPrimary)
-    {
-        MONITORINFO mi;
-        mi.cbSize = sizeof(mi);
-
-        if (!GetMonitorInfo(hMon, &mi))
-        {
-            return;
-        }
-
-        CopyRect(&rcMonitor, &mi.rcMonitor);
-        CopyRect(&rcWorkArea, &mi.rcWork);
-    }
-    else
-    {
-        CopyRect(&rcMonitor, &m_rWorkAreaDef); // yes, we actually want this
-        CopyRect(&rcWorkArea, &m_rWorkAreaCur);
-    }
-
-    CopyRect(&rcWorker, &rcMonitor);
-
-    for (
-         BarVector::iterator it = m_abVector.begin()
-        ;it != m_abVector.end()
-        ;++it
-    )
-    {
-        AppBar* p = *it;
-
-        if(p && !p->IsOverLap() && p->hMon() == hMon &&
-            (ABS_CLEANRECT == (ABS_CLEANRECT & p->lParam())))
-        {
-            if (!IsWindow(p->hWnd()))
-            {
-                continue;
-            }
-
-            RECT rcBarEx;
-
-            CopyRect(&rcBarEx, &rcMonitor);
-
-            switch (p->uEdge())
-            {
-            case ABE_LEFT:
-                rcBarEx.right = p->GetRectRef().right;
-                break;
-            case ABE_RIGHT:
-                rcBarEx.left = p->GetRectRef().left;
-                break;
-            case ABE_TOP:
-                rcBarEx.bottom = p->GetRectRef().bottom;
-                break;
-            case ABE_BOTTOM:
-                rcBarEx.top = p->GetRectRef().top;
-                break;
-            }
-
-            SubtractRect(&rcWorker, &rcWorker, &rcBarEx);
-        }
-    }
-
-    if(!EqualRect(&rcWorker, &rcWorkArea))
-    {
-        setWorkArea(&rcWorker);
-    }
-
-    return;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// setWorkArea
-//
-// Helper function for setting the specified work area
-//
-void TrayService::setWorkArea(LPRECT prcWorkArea)
-{
-    if (m_hTrayWnd)
-    {
-        m_uWorkAreaDirty++;
-    }
-
-    SystemParametersInfo(
-         SPI_SETWORKAREA
-        ,1 // readjust maximized windows
-        ,prcWorkArea
-        ,0 // SPIF_SENDCHANGE - see below
-    );
-    SendNotifyMessage(    // used in place of SPIF_SENDCHANGE above to avoid lockups
-         HWND_BROADCAST   // see http://blogs.msdn.com/oldnewthing/archive/2005/03/10/392118.aspx
-        ,WM_SETTINGCHANGE
-        ,SPI_SETWORKAREA
-        ,0
-    );
-    return;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// ABLock
-//
-// Calls SHLockShared API for the specified Shell AppBar memory
-//
-// Returns a pointer to shared memory location for an AppBarData structure
-//
-PAPPBARDATAV1 TrayService::ABLock(PSHELLAPPBARDATA psad)
-{
-    return (PAPPBARDATAV1)SHLockShared(
-        psad->hSharedMemory, psad->dwSourceProcessId);
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// ABUnlock
-//
-// Calls SHUnlockShared API for the specified AppBarData* memory
-//
-void TrayService::ABUnLock(PAPPBARDATAV1 pabd)
-{
-    SHUnlockShared(pabd);
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// FindAppBarPredicate_hWnd
-//
-// Predicate for std::find_if, used by findBar variants
-// Needs to be at global scope because of mingw issues
-//
-// Find the appbar matching the specified hWnd
-//
-struct FindAppBarPredicate_hWnd
-{
-    FindAppBarPredicate_hWnd(HWND hWnd) :
-        m_hWnd(hWnd)
-    {
-        // do nothing
-    }
-    FindAppBarPredicate_hWnd(const FindAppBarPredicate_hWnd& copy) :
-        m_hWnd(copy.m_hWnd)
-    {
-        // do nothing
-    }
-
-    bool operator() (const AppBar* pab) const
-    {
-        return (pab->hWnd() == m_hWnd);
-    }
-
-private:
-    const HWND m_hWnd;
-
-private:
-    // Not implemented
-    FindAppBarPredicate_hWnd& operator=(const FindAppBarPredicate_hWnd&);
-};
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// FindAppBarPredicate_MatchLParam
-//
-// Predicate for std::find_if, used by findBar variants
-// Needs to be at global scope because of mingw issues
-//
-// Find the appbar on the specified edge that has a matching lParam value
-//
-struct FindAppBarPredicate_MatchLParam
-{
-    FindAppBarPredicate_MatchLParam(HMONITOR hMon, UINT uEdge, LPARAM lParam) :
-        m_hMon(hMon), m_uEdge(uEdge), m_lParam(lParam)
-    {
-        // do nothing
-    }
-    FindAppBarPredicate_MatchLParam(const FindAppBarPredicate_MatchLParam& copy) :
-        m_hMon(copy.m_hMon), m_uEdge(copy.m_uEdge), m_lParam(copy.m_lParam)
-    {
-        // do nothing
-    }
-
-    bool operator() (const AppBar* pab) const
-    {
-        return (pab->hMon() == m_hMon && pab->uEdge() == m_uEdge &&
-             m_lParam == (pab->lParam() & m_lParam));
-    }
-
-private:
-    const HMONITOR m_hMon;
-    const UINT m_uEdge;
-    const LPARAM m_lParam;
-
-private:
-    // Not implemented
-    FindAppBarPredicate_MatchLParam& operator=(const FindAppBarPredicate_MatchLParam&);
-};
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// findBar
-//
-// Looks up an AppBar in the AppBarList
-//
-BarVector::iterator TrayService::findBar(HWND hWnd)
-{
-    return std::find_if(m_abVector.begin(), m_abVector.end(),
-                        FindAppBarPredicate_hWnd(hWnd));
-}
-BarVector::iterator TrayService::findBar(HMONITOR hMon, UINT uEdge, LPARAM lParam)
-{
-    return std::find_if(m_abVector.begin(), m_abVector.end(),
-                        FindAppBarPredicate_MatchLParam(hMon, uEdge, lParam));
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// isBar
-//
-// Determines whether the HWND is associated with any current AppBar.
-//
-bool TrayService::isBar(HWND hWnd)
-{
-    return m_abVector.end() != findBar(hWnd);
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// getBar
-//
-// Looks up an BarVector iterator based on the HWND
-//
-// returns true if found, otherwise false.
-//
-bool TrayService::getBar(HWND hWnd, BarVector::iterator& itBar)
-{
-    bool bReturn = false;
-
-    itBar = findBar(hWnd);
-
-    if (itBar != m_abVector.end())
-    {
-        bReturn = true;
-    }
-
-    return bReturn;
-}
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// getBar
-//
-// Looks up an AppBar* based on the HWND
-//
-// Returns true if found, otherwise false.
-//
-bool TrayService::getBar(HWND hWnd, AppBar*& pBarRef)
-{
-    bool bReturn = false;
-    BarVector::iterator itBar;
-
-    if (getBar(hWnd, itBar))
-    {
-        pBarRef = *itBar;
-        bReturn = true;
-    }
-
-    return bReturn;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// HandleNotification
-//
-// Handler for all system tray notifications
-//
-BOOL TrayService::HandleNotification(PSHELLTRAYDATA pstd)
-{
-    bool bReturn = false;
-
-    switch (pstd->dwMessage)
-    {
-    case NIM_ADD:
-        bReturn = addIcon(pstd->nid);
-        break;
-
-    case NIM_MODIFY:
-        bReturn = modifyIcon(pstd->nid);
-        break;
-
-    case NIM_DELETE:
-        bReturn = deleteIcon(pstd->nid);
-        break;
-
-    case NIM_SETFOCUS:
-        bReturn = setFocusIcon(pstd->nid);
-        break;
-
-    case NIM_SETVERSION:
-        bReturn = setVersionIcon(pstd->nid);
-        break;
-
-    default:
-        TRACE("Unknown NIM: %u", pstd->dwMessage);
-        break;
-    }
-
-    return bReturn ? TRUE : FALSE;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// notify
-//
-// Notify all listeners of a systray event
-//
-bool TrayService::notify(DWORD dwMessage, PCLSNOTIFYICONDATA pclsnid) const
-{
-    LSNOTIFYICONDATAA lsnidA(pclsnid);
-    LRESULT wResult = SendMessage(m_hLiteStep, LM_SYSTRAYW, dwMessage, (LPARAM)pclsnid);
-    LRESULT aResult = SendMessage(m_hLiteStep, LM_SYSTRAYA, dwMessage, (LPARAM)&lsnidA);
-
-    return wResult != 0 || aResult != 0;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// SendSystemTray
-//
-// Resend all icon data; systray modules will request this via LM_SYSTRAYREADY
-// during their startup.
-//
-HWND TrayService::SendSystemTray()
-{
-    removeDeadIcons();
-
-    for (IconVector::const_iterator it = m_siVector.begin();
-         it != m_siVector.end(); ++it)
-    {
-        if ((*it)->IsValid())
-        {
-            LSNOTIFYICONDATA lsnid = { 0 };
-
-            (*it)->CopyLSNID(&lsnid);
-
-            notify(NIM_ADD, &lsnid);
-
-            if ((*it)->GetVersion() != 0)
-            {
-                lsnid.uVersion = (*it)->GetVersion();
-                notify(NIM_SETVERSION, &lsnid);
-            }
-        }
-    }
-
-    return m_hNotifyWnd;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// removeDeadIcons
-//
-// Removes all "dead" icons.  ie. Those that no longer have a valid HWND
-// associated with them.
-//
-void TrayService::removeDeadIcons()
-{
-    IconVector::iterator it = m_siVector.begin();
-
-    while (it != m_siVector.end())
-    {
-        if (IsWindow((*it)->GetHwnd()))
-        {
-            ++it;
-            continue;
-        }
-
-        delete *it;
-        it = m_siVector.erase(it);
-    }
-
-    return;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// extendNIDCopy
-//
-// Copies all non-persistent data that is not stored in NotifyIcon.
-//
-bool TrayService::extendNIDCopy(LSNOTIFYICONDATA& lsnid, const NID_XX& nid) const
-{
-    // Copy Info Tips
-    if (nid.uFlags & NIF_INFO)
-    {
-        switch (nid.cbSize)
-        {
-        case NID_7W_SIZE:
-        case NID_6W_SIZE:
-        case NID_5W_SIZE:
-            {
-                NID_5W* pnid = (NID_5W*)&nid;
-
-                HRESULT hr;
-
-                hr = StringCchCopy(lsnid.szInfo, _countof(lsnid.szInfo), pnid->szInfo);
-                if (FAILED(hr))
-                {
-                    lsnid.szInfo[0] = 0;
-                }
-
-                hr = StringCchCopy(lsnid.szInfoTitle, _countof(lsnid.szInfoTitle), pnid->szInfoTitle);
-                if (FAILED(hr))
-                {
-                    lsnid.szInfoTitle[0] = 0;
-                }
-
-                lsnid.dwInfoFlags = pnid->dwInfoFlags;
-                lsnid.uTimeout = pnid->uTimeout;
-                lsnid.uFlags |= NIF_INFO;
-            }
-            break;
-        case NID_6A_SIZE:
-        case NID_5A_SIZE:
-            {
-                NID_5A* pnid = (NID_5A*)&nid;
-
-                int nResult = MultiByteToWideChar(CP_ACP, 0, pnid->szInfo,
-                    sizeof(pnid->szInfo), lsnid.szInfo, _countof(lsnid.szInfo));
-
-                if (nResult == 0)
-                {
-                    lsnid.szInfo[0] = 0;
-                }
-
-                nResult = MultiByteToWideChar(CP_ACP, 0, pnid->szInfoTitle,
-                    sizeof(pnid->szInfoTitle), lsnid.szInfoTitle, _countof(lsnid.szInfoTitle));
-
-                if (nResult == 0)
-                {
-                    lsnid.szInfoTitle[0] = 0;
-                }
-
-                lsnid.dwInfoFlags = pnid->dwInfoFlags;
-                lsnid.uTimeout = pnid->uTimeout;
-                lsnid.uFlags |= NIF_INFO;
-            }
-            break;
-        default:
-            {
-                // do nothing
-            }
-            break;
-        }
-    }
-
-    // Copy GUID
-    if (nid.uFlags & NIF_GUID)
-    {
-        switch (nid.cbSize)
-        {
-        case NID_7W_SIZE:
-        case NID_6W_SIZE:
-            {
-                NID_6W* pnid = (NID_6W*)&nid;
-
-                lsnid.guidItem = pnid->guidItem;
-                lsnid.uFlags |= NIF_GUID;
-            }
-            break;
-        case NID_6A_SIZE:
-            {
-                NID_6A* pnid = (NID_6A*)&nid;
-
-                lsnid.guidItem = pnid->guidItem;
-                lsnid.uFlags |= NIF_GUID;
-            }
-            break;
-        default:
-            {
-                // do nothing
-            }
-            break;
-        }
-    }
-
-    return true;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// addIcon
-//
-bool TrayService::addIcon(const NID_XX& nid)
-{
-    bool bReturn = false;
-
-    if (m_siVector.end() == findIcon(nid))
-    {
-        NotifyIcon * pni = new NotifyIcon(nid);
-
-        if (pni)
-        {
-            // Fail shared icons, unless a valid hIcon exists
-            if (IsWindow(pni->GetHwnd()) &&
-                (!pni->IsShared() || pni->HasIcon()))
-            {
-                m_siVector.push_back(pni);
-
-                if (pni->IsValid())
-                {
-                    LSNOTIFYICONDATA lsnid = { 0 };
-
-                    pni->CopyLSNID(&lsnid);
-                    extendNIDCopy(lsnid, nid);
-
-                    notify(NIM_ADD, &lsnid);
-                }
-                bReturn = true;
-            }
-            else
-            {
-                delete pni;
-            }
-        }
-    }
-
-    return bReturn;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// modifyIcon
-//
-bool TrayService::modifyIcon(const NID_XX& nid)
-{
-    bool bReturn = false;
-
-    IconVector::iterator it = findIcon(nid);
-
-    if (m_siVector.end() != it && *it)
-    {
-        NotifyIcon * pni = *it;
-
-        bool bWasValid = pni->IsValid();
-
-        // Update stored NotifyIcon
-        pni->Update(nid);
-
-        if (pni->IsValid())
-        {
-            LSNOTIFYICONDATA lsnid = { 0 };
-
-            if (!bWasValid)
-            {
-                // This is a "new" icon, send entire stored NotifyIcon
-                pni->CopyLSNID(&lsnid);
-                extendNIDCopy(lsnid, nid);
-
-                notify(NIM_ADD, &lsnid);
-            }
-            else
-            {
-                // This icon already exists, just send updated flags
-                pni->CopyLSNID(&lsnid, nid.uFlags);
-                extendNIDCopy(lsnid, nid);
-
-                notify(NIM_MODIFY, &lsnid);
-            }
-        }
-        else if (bWasValid)
-        {
-            LSNOTIFYICONDATA lsnid = {
-                 sizeof(LSNOTIFYICONDATA)
-                ,pni->GetHwnd()
-                ,pni->GetuID()
-                ,0
-            };
-            if ((nid.uFlags & NIF_GUID) == NIF_GUID)
-            {
-                lsnid.guidItem = (*it)->GetGUID();
-                lsnid.uFlags |= NIF_GUID;
-            }
-
-            // This icon is no longer visible, remove
-            notify(NIM_DELETE, &lsnid);
-        }
-
-        bReturn = true;
-    }
-
-    return bReturn;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// deleteIcon
-//
-// Remove an icon from the icon list
-//
-bool TrayService::deleteIcon(const NID_XX& nid)
-{
-    bool bReturn = false;
-
-    IconVector::iterator it = findIcon(nid);
-
-    if (m_siVector.end() != it)
-    {
-        LSNOTIFYICONDATA lsnid = {
-             sizeof(LSNOTIFYICONDATA)
-            ,(*it)->GetHwnd()
-            ,(*it)->GetuID()
-            ,0
-        };
-        if ((nid.uFlags & NIF_GUID) == NIF_GUID)
-        {
-            lsnid.guidItem = (*it)->GetGUID();
-            lsnid.uFlags |= NIF_GUID;
-        }
-
-        notify(NIM_DELETE, &lsnid);
-
-        delete *it;
-        m_siVector.erase(it);
-
-        bReturn = true;
-    }
-
-    return bReturn;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// setFocusIcon
-//
-// Sets selection focus to the specified icon
-//
-bool TrayService::setFocusIcon(const NID_XX& nid)
-{
-    bool bReturn = false;
-
-    IconVector::iterator it = findIcon(nid);
-
-    if (m_siVector.end() != it)
-    {
-        LSNOTIFYICONDATA lsnid = {
-             sizeof(LSNOTIFYICONDATA)
-            ,(*it)->GetHwnd()
-            ,(*it)->GetuID()
-            ,0
-        };
-        if ((nid.uFlags & NIF_GUID) == NIF_GUID)
-        {
-            lsnid.guidItem = (*it)->GetGUID();
-            lsnid.uFlags |= NIF_GUID;
-        }
-
-        bReturn = notify(NIM_SETFOCUS, &lsnid);
-    }
-
-    return bReturn;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// setVersionIcon
-//
-// Sets compatibility version for specified icon
-//
-bool TrayService::setVersionIcon(const NID_XX& nid)
-{
-    bool bReturn = false;
-
-    IconVector::iterator it = findIcon(nid);
-
-    if (m_siVector.end() != it)
-    {
-        LSNOTIFYICONDATA lsnid = {
-             sizeof(LSNOTIFYICONDATA)
-            ,(*it)->GetHwnd()
-            ,(*it)->GetuID()
-            ,0
-        };
-
-        switch (nid.cbSize)
-        {
-        case NID_7W_SIZE:
-        case NID_6W_SIZE:
-        case NID_5W_SIZE:
-            lsnid.uVersion = ((NID_5W&)nid).uVersion;
-            (*it)->SetVersion(((NID_5W&)nid).uVersion);
-            break;
-
-        case NID_6A_SIZE:
-        case NID_5A_SIZE:
-            lsnid.uVersion = ((NID_5A&)nid).uVersion;
-            (*it)->SetVersion(((NID_5A&)nid).uVersion);
-            break;
-
-        default:
-            break;
-        }
-
-        bReturn = notify(NIM_SETVERSION, &lsnid);
-    }
-
-    return bReturn;
-}
-
-
-//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-//
-// findIcon
-//
-// Looks up an icon in the SystrayIconList
-//
-IconVector::iterator TrayService::findIcon(const NID_XX& nid)
-{
-    GUID guidItem;
-
-    switch (nid.cbSize)
-    {
-    case NID_7W_SIZE:
-    case NID_6W_SIZE:
-        guidItem = ((NID_6W&)nid).guidItem;
-        break;
-
-    case NID_6A_SIZE:
-        guidItem = ((NID_6A&)nid).guidItem;
-        break;
-
-    default:
-        break;
-    }
-
-    for (IconVector::iterator iter = m_siVector.begin(); iter != m_siVector.end(); iter++)
-    {
-        // If the GUID is valid, we ignore the uID and hWnd
-        if ((nid.uFlags & NIF_GUID) == NIF_GUID)
-        {
-            if (guidItem == (*iter)->GetGUID())
-            {
-                return iter;
-            }
-        }
-        else if((*iter)->GetuID() == nid.uID && (*iter)->GetHwnd() == (HWND)nid.hWnd)
-        {
-            return iter;
-        }
-    }
-
-    return m_siVector.end();
+    m_shell.OnWindowDestroyed(hWnd);
 }
@@ -22,87 +22,16 @@
 #if !defined(TRAYSERVICE_H)
 #define TRAYSERVICE_H
 
-#include "TrayNotifyIcon.h"
-#include "TrayAppBar.h"
+#include "../utility/core.hpp"
+#include "TrayShell.h"
 #include "TaskbarListHandler.h"
-#include "../utility/common.h"
 #include "../utility/IService.h"
 #include <ObjBase.h>
 #include <vector>
 
-// shell copy data types
-#define SH_APPBAR_DATA    (0)
-#define SH_TRAY_DATA      (1)
-#define SH_LOADPROC_DATA  (2)
-#define SH_TRAYINFO_DATA  (3)
+// LSTrayRecordFile is written whenever this many bytes have been recorded
+#define TRAY_RECORD_CHUNK      65536
 
-// internally posted AppBar messages
-#define ABP_NOTIFYPOSCHANGED   (WM_USER+350)
-#define ABP_NOTIFYSTATECHANGE  (WM_USER+351)
-#define ABP_RAISEAUTOHIDEHWND  (WM_USER+360)
-
-// data sent to TrayInfoEvent
-typedef struct _NOTIFYICONIDENTIFIER_MSGV1
-{
-    DWORD dwMagic;
-    DWORD dwMessage;
-    DWORD cbSize;
-    DWORD dwPadding;
-    HWND32 hWnd;
-    UINT uID;
-    GUID guidItem;
-} NOTIFYICONIDENTIFIER_MSGV1, *LPNOTIFYICONIDENTIFIER_MSGV1;
-
-// Used for LM_SYSTRAYINFOEVENT
-typedef struct _SYSTRAYINFOEVENT
-{
-    DWORD cbSize;
-    DWORD dwEvent;
-    HWND hWnd;
-    UINT uID;
-    GUID guidItem;
-} SYSTRAYINFOEVENT, *LPSYSTRAYINFOEVENT;
-
-// data sent by shell via Shell_NotifyIcon
-typedef struct _SHELLTRAYDATA
-{
-    DWORD dwUnknown;
-    DWORD dwMessage;
-    NID_XX nid;
-} *PSHELLTRAYDATA;
-
-// Data sent with AppBar Message
-typedef struct _SHELLAPPBARDATA
-{
-    _SHELLAPPBARDATA(APPBARDATAV1& abdsrc):abd(abdsrc)
-    {
-        // do nothing
-    }
-
-    const APPBARDATAV1& abd;
-    /**/
-    DWORD  dwMessage;
-    HANDLE hSharedMemory;
-    DWORD  dwSourceProcessId;
-    /**/
-
-private:
-    // Not implemented
-    _SHELLAPPBARDATA(const _SHELLAPPBARDATA&);
-    _SHELLAPPBARDATA& operator=(const _SHELLAPPBARDATA&);
-} SHELLAPPBARDATA, *PSHELLAPPBARDATA;
-
-
-// Data sent with SHLoadInProc/SHEnableServiceObject on XP and up
-// Earlier versions don't have SHEnableServiceObject and only send the CLSID
-typedef struct _SHELLINPROCDATA
-{
-    CLSID clsid;
-    DWORD dwMessage;
-} SHELLINPROCDATA, *PSHELLINPROCDATA;
-
-typedef std::vector<NotifyIcon*> IconVector;
-typedef std::vector<AppBar*> BarVector;
 typedef std::vector<struct IOleCommandTarget*> SsoVector;
 
 
@@ -110,10 +39,14 @@ typedef std::vector<struct IOleCommandTarget*> SsoVector;
 //
 // TrayService
 //
-// This is the tray service handler. It keeps track of all systray icons and
-// loads ShellService-objects. If an icon is added/removed/modified/... it
+// This is the tray service handler. It owns the "Shell_TrayWnd" window and
+// loads ShellService-objects. The messages the shell sends to the window go
+// to a TrayShell, which keeps track of all systray icons and AppBars and
 // notifies all listeners (usually the systray module) via LM_SYSTRAY.
 //
+class MessageManager;
+class Win32TraySystem;
+
 class TrayService : public IService
 {
 public:
@@ -130,9 +63,21 @@ public:
     // resend all icon data
     HWND SendSystemTray();
 
+    // send all icon data to one window as a single LM_SYSTRAYSNAPSHOT
+    HWND SendSystemTraySnapshot(HWND hWnd);
+
+    // Notify TrayService that a top-level window was destroyed
+    void OnWindowDestroyed(HWND hWnd);
+
+    // Fills in the counters of the work area scheduler
+    void GetWorkAreaStatistics(LSWORKAREASTATISTICS& lswas) const;
+
     // Notify TrayService of full screen app change
     void NotifyRudeApp(HMONITOR hFullScreenMonitor) const;
 
+    // Lets notify() skip message variants nobody listens to
+    void SetMessageManager(MessageManager* pMessageManager);
+
     // Message Handler
     static LRESULT CALLBACK WindowTrayProc(HWND, UINT, WPARAM, LPARAM);
     static LRESULT CALLBACK WindowNotifyProc(HWND, UINT, WPARAM, LPARAM);
@@ -148,100 +93,31 @@ private:
     void loadShellServiceObjects();
     void unloadShellServiceObjects();
 
-    // Handlers for AppBar messages
-    LRESULT HandleAppBarCopydata(DWORD cbData, LPVOID lpData);
-    LRESULT HandleAppBarMessage(PSHELLAPPBARDATA psad);
-
-    // Handler for tray info event
-    LRESULT TrayInfoEvent(DWORD cbData, LPVOID lpData);
-
-    // Handler for system tray notifications
-    BOOL HandleNotification(PSHELLTRAYDATA pstd);
-
-    // Handler for LoadInProc messages
-    HRESULT HandleLoadInProc(REFCLSID clsid, DWORD dwMessage);
-
-    //
-    // ABM_* Notification handlers
-    //
-    LRESULT barCreate(const APPBARDATAV1& abd);
-    LRESULT barDestroy(const APPBARDATAV1& abd);
-    LRESULT barQueryPos(PSHELLAPPBARDATA psad);
-    LRESULT barSetPos(PSHELLAPPBARDATA psad);
-    LRESULT barGetTaskBarState();
-    LRESULT barGetTaskBarPos(PSHELLAPPBARDATA psad);
-    LRESULT barActivate(const APPBARDATAV1& abd);
-    LRESULT barGetAutoHide(const APPBARDATAV1& abd);
-    LRESULT barSetAutoHide(const APPBARDATAV1& abd);
-    LRESULT barPosChanged(const APPBARDATAV1& abd);
-    LRESULT barSetTaskBarState(const APPBARDATAV1& abd);
-
-    //
-    // barSetPos and barQueryPos helpers
-    //
-    void modifyOverlapBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge);
-    void modifyNormalBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge, HWND hWnd);
-    void modifyBarExtent(RECT& rcDst, const RECT& rcOrg, UINT uEdge);
-    void modifyBarBreadth(RECT& rcDst, const RECT& rcOrg, UINT uEdge);
-    void adjustWorkArea(HMONITOR hMon);
-    void setWorkArea(LPRECT prcWorkArea);
-
-    // Remove any "dead" appbars
-    void removeDeadAppBars();
-
-    //
-    // AppBar Un/Lock handlers for shared data
-    //
-    PAPPBARDATAV1 ABLock(PSHELLAPPBARDATA psad);
-    void ABUnLock(PAPPBARDATAV1 pabd);
-
-    //
-    // findBar variants and wrappers
-    //
-    BarVector::iterator findBar(HWND hWnd);
-    BarVector::iterator findBar(HMONITOR hMon, UINT uEdge, LPARAM lParam);
-    bool isBar(HWND hWnd);
-    bool getBar(HWND hWnd, BarVector::iterator& itAppBar);
-    bool getBar(HWND hWnd, AppBar*& pBarRef);
-
-    //
-    // NIM_* Notification handlers
-    //
-    bool addIcon(const NID_XX& nid);        // NIM_ADD
-    bool modifyIcon(const NID_XX& nid);     // NIM_MODIFY
-    bool deleteIcon(const NID_XX& nid);     // NIM_DELETE
-    bool setFocusIcon(const NID_XX& nid);   // NIM_SETFOCUS
-    bool setVersionIcon(const NID_XX& nid); // NIM_SETVERSION
-
-    //
-    // Send icon notifications on to LiteStep (thus systray modules)
-    //
-    bool notify(DWORD dwMessage, PCLSNOTIFYICONDATA pclsnid) const;
-    bool extendNIDCopy(LSNOTIFYICONDATA& lsnid, const NID_XX& nid) const;
-
-    // Remove any "dead" icons
-    void removeDeadIcons();
+    // Records a shell WM_COPYDATA message, then hands it to m_shell
+    LRESULT handleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData);
 
     //
-    // finds the icon which matches the specified nid
+    // LSTrayRecordFile support
     //
-    IconVector::iterator findIcon(const NID_XX& nid);
+    void openRecording();
+    void recordCopyData(DWORD dwData, DWORD cbData, LPCVOID pvData);
+    void flushRecording();
+    void closeRecording();
 
     //
     //
     //
-    UINT m_uWorkAreaDirty;
-    RECT m_rWorkAreaDef; // The Working Area without any appbars.
-    RECT m_rWorkAreaCur; // The Working Area with the appbars.
     HWND m_hNotifyWnd;
     HWND m_hTrayWnd;
     HWND m_hLiteStep;
     HINSTANCE m_hInstance;
 
     SsoVector m_ssoVector;
-    IconVector m_siVector;
-    BarVector m_abVector;
+    Win32TraySystem* m_pSystem; // owned by m_shell
+    TrayShell m_shell;
     TaskbarListHandler m_taskbarListHandler;
+    TrayRecorder m_recorder;
+    HANDLE m_hRecordFile;
 };
 
 #endif // TRAYSERVICE_H
@@ -0,0 +1,2052 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayShell.h"
+#include "../utility/debug.hpp"
+
+#include <algorithm>
+#include <string.h>
+
+
+//
+// RECT <-> AppBarLayout::Rect
+//
+static AppBarLayout::Rect ToLayoutRect(const RECT& rc)
+{
+    AppBarLayout::Rect rcLayout = { rc.left, rc.top, rc.right, rc.bottom };
+    return rcLayout;
+}
+
+static void FromLayoutRect(RECT& rc, const AppBarLayout::Rect& rcLayout)
+{
+    rc.left = rcLayout.left;
+    rc.top = rcLayout.top;
+    rc.right = rcLayout.right;
+    rc.bottom = rcLayout.bottom;
+}
+
+static bool IsEqualRect(const RECT& rcA, const RECT& rcB)
+{
+    return rcA.left == rcB.left && rcA.top == rcB.top &&
+        rcA.right == rcB.right && rcA.bottom == rcB.bottom;
+}
+
+
+//
+// Copy the strings of the NID_* structures, which need not be terminated.
+// The destination is left empty if the string doesn't fit.
+//
+static void CopyNidString(WCHAR* pwzDest, size_t cchDest,
+    const WCHAR16* pwzSrc, size_t cchSrc)
+{
+    size_t cch = 0;
+
+    while (cch < cchSrc && cch < cchDest && pwzSrc[cch])
+    {
+        pwzDest[cch] = (WCHAR)pwzSrc[cch];
+        ++cch;
+    }
+
+    pwzDest[(cch < cchDest) ? cch : 0] = 0;
+}
+
+static void CopyNidString(WCHAR* pwzDest, size_t cchDest,
+    const CHAR* pszSrc, size_t cchSrc)
+{
+#if defined(_WIN32)
+    if (MultiByteToWideChar(CP_ACP, 0, pszSrc, (int)cchSrc, pwzDest,
+        (int)cchDest) == 0)
+    {
+        pwzDest[0] = 0;
+    }
+#else
+    // No code pages here, the tests only send ASCII
+    size_t cch = 0;
+
+    while (cch < cchSrc && cch < cchDest && pszSrc[cch])
+    {
+        pwzDest[cch] = (WCHAR)(BYTE)pszSrc[cch];
+        ++cch;
+    }
+
+    pwzDest[(cch < cchDest) ? cch : 0] = 0;
+#endif
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayShell
+//
+TrayShell::TrayShell(System* pSystem) :
+m_pSystem(pSystem), m_workAreaScheduler(0), m_hLiteStep(NULL),
+m_hTrayWnd(NULL), m_hNotifyWnd(NULL), m_uCoalesceDelay(0)
+{
+    ASSERT(pSystem != NULL);
+
+    memset(&m_rWorkAreaDef, 0, sizeof(m_rWorkAreaDef));
+    memset(&m_rWorkAreaCur, 0, sizeof(m_rWorkAreaCur));
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// ~TrayShell
+//
+TrayShell::~TrayShell()
+{
+    Clear();
+    delete m_pSystem;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// SetDelays
+//
+void TrayShell::SetDelays(UINT uCoalesceDelay, DWORD dwWorkAreaDelay)
+{
+    m_uCoalesceDelay = uCoalesceDelay;
+    m_workAreaScheduler.SetDelay(dwWorkAreaDelay);
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// SetWindows
+//
+void TrayShell::SetWindows(HWND hLiteStep, HWND hTrayWnd, HWND hNotifyWnd)
+{
+    m_hLiteStep = hLiteStep;
+    m_hTrayWnd = hTrayWnd;
+    m_hNotifyWnd = hNotifyWnd;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// ResetWorkArea
+//
+void TrayShell::ResetWorkArea()
+{
+    // clear work area of primary monitor
+    m_pSystem->GetScreenRect(m_rWorkAreaDef);
+    setWorkArea(m_rWorkAreaDef);
+    m_rWorkAreaCur = m_rWorkAreaDef;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// Clear
+//
+void TrayShell::Clear()
+{
+    // The bars are gone, what they wanted doesn't matter any more
+    m_workAreaScheduler.Clear();
+
+    // Nobody is left to deliver these to
+    m_notifyQueue.Clear();
+    m_siStore.Clear();
+
+    m_abLayout.Clear();
+
+    while (!m_abVector.empty())
+    {
+        delete m_abVector.back();
+        m_abVector.pop_back();
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// OnPosChanged
+//
+// ABP_NOTIFYPOSCHANGED: tells the bars on a monitor that one of them moved,
+// and updates the work area
+//
+void TrayShell::OnPosChanged(HWND hSkip, HMONITOR hMon)
+{
+    AppBar* pMoved = NULL;
+
+    getBar(hSkip, pMoved);
+
+    // Bars stacked before the one that moved on the same edge don't depend
+    // on it. Decide who to tell before telling anyone, since the bars may go
+    // away while we do.
+    std::vector<std::pair<HWND, UINT> > vecNotify;
+
+    for (BarVector::const_iterator it = m_abVector.begin();
+         it != m_abVector.end(); ++it)
+    {
+        const AppBar* p = *it;
+
+        if (p == pMoved || p->hMon() != hMon)
+        {
+            continue;
+        }
+
+        if (pMoved && p->uEdge() == pMoved->uEdge() &&
+            m_abLayout.IsStackedBefore(p, pMoved))
+        {
+            continue;
+        }
+
+        vecNotify.push_back(std::make_pair(p->hWnd(), p->uMsg()));
+    }
+
+    for (size_t st = 0; st < vecNotify.size(); ++st)
+    {
+        m_pSystem->Send(
+             vecNotify[st].first
+            ,vecNotify[st].second
+            ,ABN_POSCHANGED
+            ,0
+        );
+    }
+
+    // Several bars moving at once post several of these; the first one to
+    // arrive after the changes updates the work area
+    if (m_abLayout.TakeDirty(hMon))
+    {
+        adjustWorkArea(hMon);
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// OnStateChange
+//
+// ABP_NOTIFYSTATECHANGE
+//
+void TrayShell::OnStateChange()
+{
+    const BarVector abTempV = m_abVector;
+    BarVector::const_reverse_iterator rit;
+
+    for (rit = abTempV.rbegin(); rit != abTempV.rend(); ++rit)
+    {
+        if (!(*rit)->IsOverLap())
+        {
+            m_pSystem->Send(
+                 (*rit)->hWnd()
+                ,(*rit)->uMsg()
+                ,ABN_STATECHANGE
+                ,0
+            );
+        }
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// OnTimer
+//
+void TrayShell::OnTimer(UINT_PTR uID)
+{
+    if (uID == TRAY_FLUSH_TIMER)
+    {
+        flushNotifications();
+    }
+    else if (uID == TRAY_WORKAREA_TIMER)
+    {
+        flushWorkAreas();
+    }
+    else if (uID == TRAY_VALIDATE_TIMER)
+    {
+        validateOwners();
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// OnWorkAreaChanged
+//
+// WM_SETTINGCHANGE with SPI_SETWORKAREA; rcWorkArea is the new work area of
+// the primary monitor
+//
+void TrayShell::OnWorkAreaChanged(const RECT& rcWorkArea)
+{
+    // Always update the Current workarea
+    m_rWorkAreaCur = rcWorkArea;
+
+    // This will be the case when we updated the workarea ourselves.
+    if (m_workAreaScheduler.TakeEcho())
+    {
+        return;
+    }
+
+    // Only update the Default workarea when set externally.
+    m_rWorkAreaDef = rcWorkArea;
+
+    // Now reposition our appbars based on the new default workarea.
+    HMONITOR hMonPrimary = m_pSystem->MonitorFromWindow(NULL);
+
+    m_abLayout.Invalidate(hMonPrimary);
+
+    m_pSystem->Post(
+         m_hTrayWnd
+        ,ABP_NOTIFYPOSCHANGED
+        ,(WPARAM)NULL
+        ,(LPARAM)hMonPrimary
+    );
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayInfoEvent
+//
+// Handles tray info events
+//
+LRESULT TrayShell::TrayInfoEvent(DWORD /*cbData*/, LPVOID lpData) // size, data
+{
+    LRESULT lr = 0;
+    LPNOTIFYICONIDENTIFIER_MSGV1 s = (LPNOTIFYICONIDENTIFIER_MSGV1)lpData;
+    SYSTRAYINFOEVENT sEvent;
+
+    // Calling Shell_NotifyIconGetRect will cause two successive calls to this function. The first
+    // (dwMessage 1) should return the top left coordinate of the specified icon. The 2nd should
+    // return the width and height of the icon.
+
+    // Let registered listeners handle this.
+    sEvent.cbSize = sizeof(SYSTRAYINFOEVENT);
+    sEvent.dwEvent = s->dwMessage;
+    sEvent.guidItem = s->guidItem;
+    sEvent.hWnd = (HWND)(UINT_PTR)s->hWnd;
+    sEvent.uID = s->uID;
+
+    m_pSystem->Send(m_hLiteStep, LM_SYSTRAYINFOEVENT, (WPARAM)&sEvent, (LPARAM)&lr);
+
+    return lr;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// HandleCopyData
+//
+// Decodes a shell WM_COPYDATA message. Knows nothing about the window it
+// came from, so recordings can be replayed through it.
+//
+LRESULT TrayShell::HandleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData)
+{
+    LRESULT lResult = 0;
+
+    switch (dwData)
+    {
+    case SH_APPBAR_DATA:
+        {
+            //
+            // Application Bar Message
+            //
+            lResult = HandleAppBarCopydata(cbData, lpData);
+        }
+        break;
+
+    case SH_TRAY_DATA:
+        {
+            //
+            // System Tray Notification
+            //
+            PSHELLTRAYDATA pstd = (PSHELLTRAYDATA)lpData;
+
+            lResult = (LRESULT)HandleNotification(pstd);
+        }
+        break;
+
+    case SH_LOADPROC_DATA:
+        {
+            //
+            // LoadInProc messages
+            //
+            if (cbData == sizeof(GUID))
+            {
+                // Classic SHLoadInProc message
+                lResult = m_pSystem->LoadInProc(*(const GUID*)lpData, 1);
+            }
+            else if (cbData == sizeof(SHELLINPROCDATA))
+            {
+                PSHELLINPROCDATA pipd = (PSHELLINPROCDATA)lpData;
+
+                lResult = m_pSystem->LoadInProc(pipd->clsid, pipd->dwMessage);
+            }
+            else
+            {
+                TRACE("Unknown SHLoadInProc size: %u", cbData);
+                lResult = m_pSystem->LoadInProc(GUID(), 0);
+            }
+        }
+        break;
+
+    case SH_TRAYINFO_DATA:
+        {
+            lResult = TrayInfoEvent(cbData, lpData);
+        }
+        break;
+
+    default:
+        {
+            TRACE("Unsupported tray message: %u", dwData);
+        }
+        break;
+    }
+
+    return lResult;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// HandleAppBarCopydata
+//
+LRESULT TrayShell::HandleAppBarCopydata(DWORD cbData, LPVOID lpData)
+{
+    LRESULT lr = 0;
+
+    switch (cbData)
+    {
+    case sizeof(APPBARMSGDATAV3):
+        {
+            PAPPBARMSGDATAV3 pamd = (PAPPBARMSGDATAV3)lpData;
+
+            if (sizeof(APPBARDATAV2) != pamd->abd.cbSize)
+            {
+                TRACE("APPBARMSGDATAV3 - Invalid ABD size: %u. Expected: %u", pamd->abd.cbSize, sizeof(APPBARDATAV2));
+
+                break;
+            }
+
+            // The V2 structure only adds padding at the end
+            APPBARDATAV1 abd;
+            memcpy(&abd, &pamd->abd, sizeof(abd));
+
+            SHELLAPPBARDATA sbd(abd);
+            sbd.dwMessage = pamd->dwMessage;
+            sbd.hSharedMemory = (HANDLE)(UINT_PTR)pamd->hSharedMemory;
+            sbd.dwSourceProcessId = pamd->dwSourceProcessId;
+
+            lr = HandleAppBarMessage(&sbd);
+        }
+        break;
+
+    case sizeof(APPBARMSGDATAV2):
+        {
+            PAPPBARMSGDATAV2 pamd = (PAPPBARMSGDATAV2)lpData;
+
+            if (sizeof(APPBARDATAV2) != pamd->abd.cbSize)
+            {
+                TRACE("APPBARMSGDATAV2 - Invalid ABD size: %u. Expected: %u", pamd->abd.cbSize, sizeof(APPBARDATAV2));
+
+                break;
+            }
+
+            // The V2 structure only adds padding at the end
+            APPBARDATAV1 abd;
+            memcpy(&abd, &pamd->abd, sizeof(abd));
+
+            SHELLAPPBARDATA sbd(abd);
+            sbd.dwMessage = pamd->dwMessage;
+            sbd.hSharedMemory = (HANDLE)(UINT_PTR)pamd->hSharedMemory;
+            sbd.dwSourceProcessId = pamd->dwSourceProcessId;
+
+            lr = HandleAppBarMessage(&sbd);
+        }
+        break;
+
+    case sizeof(APPBARMSGDATAV1):
+        {
+            PAPPBARMSGDATAV1 pamd = (PAPPBARMSGDATAV1)lpData;
+
+            if (sizeof(APPBARDATAV1) != pamd->abd.cbSize)
+            {
+                TRACE("APPBARMSGDATAV1 - Invalid ABD size: %u. Expected: %u", pamd->abd.cbSize, sizeof(APPBARDATAV1));
+
+                break;
+            }
+
+            SHELLAPPBARDATA sbd(pamd->abd);
+            sbd.dwMessage = pamd->dwMessage;
+            sbd.hSharedMemory = (HANDLE)(UINT_PTR)pamd->hSharedMemory;
+            sbd.dwSourceProcessId = pamd->dwSourceProcessId;
+
+            lr = HandleAppBarMessage(&sbd);
+        }
+        break;
+
+    default:
+        {
+            TRACE("Unknown APPBARMSGDATA size: %u", cbData);
+        }
+        break;
+    }
+
+    return lr;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// HandleAppBarMessage
+//
+// Handler for all AppBar Messages
+//
+LRESULT TrayShell::HandleAppBarMessage(PSHELLAPPBARDATA psad)
+{
+    LRESULT lResult = 0;
+
+    TRACE("SHAppBarMessage(%u, ...)", psad->dwMessage);
+
+    switch(psad->dwMessage)
+    {
+    case ABM_NEW:
+        lResult = barCreate(psad->abd);
+        break;
+
+    case ABM_REMOVE:
+        lResult = barDestroy(psad->abd);
+        break;
+
+    case ABM_QUERYPOS:
+        lResult = barQueryPos(psad);
+        break;
+
+    case ABM_SETPOS:
+        lResult = barSetPos(psad);
+        break;
+
+    case ABM_GETSTATE:
+        lResult = barGetTaskBarState();
+        break;
+
+    case ABM_GETTASKBARPOS:
+        lResult = barGetTaskBarPos(psad);
+        break;
+
+    case ABM_ACTIVATE:
+        lResult = barActivate(psad->abd);
+        break;
+
+    case ABM_GETAUTOHIDEBAR:
+        lResult = barGetAutoHide(psad->abd);
+        break;
+
+    case ABM_SETAUTOHIDEBAR:
+        lResult = barSetAutoHide(psad->abd);
+        break;
+
+    case ABM_WINDOWPOSCHANGED:
+        lResult = barPosChanged(psad->abd);
+        break;
+
+    case ABM_SETSTATE:
+        lResult = barSetTaskBarState(psad->abd);
+        break;
+
+    default:
+        TRACE("ABM unknown: %u", psad->dwMessage);
+        break;
+    }
+
+    return lResult;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// NotifyRudeApp
+//
+// External interface to let us know a window has gone/left full screen mode
+//
+void TrayShell::NotifyRudeApp(HMONITOR hFullScreenMonitor) const
+{
+    const BarVector abTempV = m_abVector;
+    BarVector::const_reverse_iterator rit;
+
+    for (rit = abTempV.rbegin(); rit != abTempV.rend(); ++rit)
+    {
+        m_pSystem->Send(
+             (*rit)->hWnd()
+            ,(*rit)->uMsg()
+            ,ABN_FULLSCREENAPP
+            ,(LPARAM)(hFullScreenMonitor ? 1 : 0)
+        );
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// removeBar
+//
+// Deletes an AppBar and lets the others on its monitor take up its space.
+// The last bar takes its slot in the vector; the stacking order is kept by
+// m_abLayout.
+//
+void TrayShell::removeBar(BarVector::iterator itBar)
+{
+    AppBar* pBar = *itBar;
+    HMONITOR hMon = pBar->hMon();
+
+    *itBar = m_abVector.back();
+    m_abVector.pop_back();
+
+    m_abLayout.RemoveBar(pBar);
+    delete pBar;
+
+    m_pSystem->Post(
+         m_hTrayWnd
+        ,ABP_NOTIFYPOSCHANGED
+        ,(WPARAM)NULL
+        ,(LPARAM)hMon
+    );
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barCreate
+//
+// Creates a new AppBar.
+//
+// ABM_NEW
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  uCallbackMessage
+//
+LRESULT TrayShell::barCreate(const APPBARDATAV1& abd)
+{
+    LRESULT lResult = 0;
+    HWND hWnd = (HWND)(UINT_PTR)abd.hWnd;
+
+    if (m_pSystem->IsWindow(hWnd) && !isBar(hWnd))
+    {
+        AppBar* pBar = new AppBar(hWnd, abd.uCallbackMessage);
+
+        m_abVector.push_back(pBar);
+        m_abLayout.AddBar(pBar);
+        lResult = 1;
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barDestroy
+//
+// Removes the specified AppBar.
+//
+// ABM_REMOVE
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//
+LRESULT TrayShell::barDestroy(const APPBARDATAV1& abd)
+{
+    BarVector::iterator itBar;
+    LRESULT lResult = 0;
+
+    if (getBar((HWND)(UINT_PTR)abd.hWnd, itBar))
+    {
+        lResult = 1;
+
+        removeBar(itBar);
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barQueryPos
+//
+// Queries for an acceptable position for the specified appbar
+//
+// ABM_QUERYPOS
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  uEdge
+//  rc
+//
+LRESULT TrayShell::barQueryPos(PSHELLAPPBARDATA psad)
+{
+    LRESULT lResult = 0;
+    PAPPBARDATAV1 pabd = ABLock(psad);
+    const APPBARDATAV1& abd = psad->abd;
+
+    if (pabd)
+    {
+        AppBar* p;
+
+        if (getBar((HWND)(UINT_PTR)abd.hWnd, p))
+        {
+            lResult = 1;
+
+            if (p->IsOverLap())
+            {
+                modifyOverlapBar(pabd->rc, abd.rc, abd.uEdge);
+            }
+            else
+            {
+                modifyNormalBar(pabd->rc, abd.rc, abd.uEdge, p);
+            }
+        }
+
+        ABUnLock(pabd);
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barSetPos
+//
+// Sets the position of the specified appbar
+//
+// ABM_SETPOS
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  uEdge
+//  rc
+//
+LRESULT TrayShell::barSetPos(PSHELLAPPBARDATA psad)
+{
+    LRESULT lResult = 0;
+    PAPPBARDATAV1 pabd = ABLock(psad);
+    const APPBARDATAV1& abd = psad->abd;
+
+    if (pabd)
+    {
+        AppBar* p;
+
+        if (getBar((HWND)(UINT_PTR)abd.hWnd, p))
+        {
+            lResult = 1;
+
+            if (p->IsOverLap())
+            {
+                modifyOverlapBar(pabd->rc, abd.rc, abd.uEdge);
+            }
+            else
+            {
+                modifyNormalBar(pabd->rc, abd.rc, abd.uEdge, p);
+            }
+
+            HMONITOR hMon = m_pSystem->MonitorFromRect(pabd->rc);
+
+            // If this is the first time to position the bar or if
+            // the new position is different than the previous, then
+            // notify all other appbars.
+            bool bMoved = (ABS_CLEANRECT != (ABS_CLEANRECT & p->lParam()))
+                || !IsEqualRect(p->GetRectRef(), pabd->rc);
+
+            // Update the appbar stored parameters
+            p->GetRectRef() = pabd->rc;
+            p->lParam(p->lParam() | ABS_CLEANRECT);
+            p->uEdge(abd.uEdge);
+            p->hMon(hMon);
+
+            if (!p->IsOverLap())
+            {
+                m_abLayout.PlaceBar(p, hMon, abd.uEdge, ToLayoutRect(pabd->rc));
+
+                if (bMoved)
+                {
+                    // Notify other bars
+                    m_pSystem->Post(
+                         m_hTrayWnd
+                        ,ABP_NOTIFYPOSCHANGED
+                        ,(WPARAM)abd.hWnd
+                        ,(LPARAM)hMon
+                    );
+                }
+            }
+        }
+
+        ABUnLock(pabd);
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barGetTaskBarState
+//
+// Returns the current TaskBar state (autohide, alwaysontop)
+//
+// ABM_GETSTATE
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//
+LRESULT TrayShell::barGetTaskBarState()
+{
+    // Zero means neither always-on-top nor autohide,
+    // which is the safest guess for most LS setups
+    return 0;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barGetTaskBarPos
+//
+// Gets the current TaskBar position
+//
+// ABM_GETTASKBARPOS
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  uEdge (undocumented)
+//
+LRESULT TrayShell::barGetTaskBarPos(PSHELLAPPBARDATA psad)
+{
+    LRESULT lResult = 0;
+    PAPPBARDATAV1 pabd = ABLock(psad);
+
+    if (pabd)
+    {
+        if (m_pSystem->GetWindowRect(m_hNotifyWnd, pabd->rc))
+        {
+            lResult = 1;
+
+            RECT rcMonitor, rcWork;
+
+            if (!m_pSystem->GetMonitorRects(
+                m_pSystem->MonitorFromWindow(m_hNotifyWnd), rcMonitor, rcWork))
+            {
+                m_pSystem->GetScreenRect(rcMonitor);
+            }
+
+            LONG nHeight, nWidth, nScreenHeight, nScreenWidth;
+
+            nHeight = pabd->rc.bottom - pabd->rc.top;
+            nWidth = pabd->rc.right - pabd->rc.left;
+
+            nScreenHeight = rcMonitor.bottom - rcMonitor.top;
+            nScreenWidth = rcMonitor.right - rcMonitor.left;
+
+            if(nHeight > nWidth)
+            {
+                if(pabd->rc.left > nScreenWidth / 2)
+                {
+                    pabd->uEdge = ABE_RIGHT;
+                }
+                else
+                {
+                    pabd->uEdge = ABE_LEFT;
+                }
+            }
+            else
+            {
+                if(pabd->rc.top > nScreenHeight / 2)
+                {
+                    pabd->uEdge = ABE_BOTTOM;
+                }
+                else
+                {
+                    pabd->uEdge = ABE_TOP;
+                }
+            }
+        }
+
+        ABUnLock(pabd);
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barActivate
+//
+// Ensures that any autohide appbar has the topmost zOrder when any appbar is
+// activated.
+//
+// ABM_ACTIVATE
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//
+LRESULT TrayShell::barActivate(const APPBARDATAV1& abd)
+{
+    LRESULT lResult = 0;
+    AppBar* p;
+
+    if (getBar((HWND)(UINT_PTR)abd.hWnd, p))
+    {
+        lResult = 1;
+
+        BarVector::iterator itBar = findBar(p->hMon(), p->uEdge(), ABS_AUTOHIDE);
+
+        if (itBar != m_abVector.end())
+        {
+            m_pSystem->Post(
+                 m_hTrayWnd
+                ,ABP_RAISEAUTOHIDEHWND
+                ,(WPARAM)(*itBar)->hWnd()
+                ,(LPARAM)(*itBar)->uEdge()
+            );
+        }
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barGetAutoHide
+//
+// Returns the HWND of the autohide appbar on the specified screen edge
+//
+// ABM_GETAUTOHIDEBAR
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  uEdge
+//
+LRESULT TrayShell::barGetAutoHide(const APPBARDATAV1& abd)
+{
+    LRESULT lResult = 0;
+    BarVector::iterator itBar = findBar(
+        m_pSystem->MonitorFromWindow((HWND)(UINT_PTR)abd.hWnd),
+        abd.uEdge, ABS_AUTOHIDE);
+
+    if (itBar != m_abVector.end())
+    {
+        lResult = (LRESULT)(*itBar)->hWnd();
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barSetAutoHide
+//
+// Sets the specified AppBar to autohide if it already exists, otherwise
+// if the specified AppBar does not exist, it creates it and sets it to as
+// an overlap autohide AppBar.
+//
+// ABM_SETAUTOHIDEBAR
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  uEdge
+//  lParam
+//
+LRESULT TrayShell::barSetAutoHide(const APPBARDATAV1& abd)
+{
+    LRESULT lResult = 0;
+
+    HWND hWnd = (HWND)(UINT_PTR)abd.hWnd;
+    BarVector::iterator itBar = findBar(hWnd);
+    BarVector::iterator itAutoHideBar = findBar(
+        m_pSystem->MonitorFromWindow(hWnd), abd.uEdge, ABS_AUTOHIDE);
+
+    if (abd.lParam) // Set Auto Hide
+    {
+        lResult = 1;
+
+        // Does an autohide bar already exist on this edge?
+        if (itAutoHideBar != m_abVector.end())
+        {
+            // Return true if this appbar is the autohide bar.
+            return (itBar == itAutoHideBar);
+        }
+
+        // if bar doesn't exist, create it and set it as an overlap bar
+        if (itBar == m_abVector.end())
+        {
+            if (!barCreate(abd))
+            {
+                return 0;
+            }
+
+            itBar = m_abVector.end()-1;
+            (*itBar)->lParam((*itBar)->lParam() | ABS_OVERLAPAUTOHIDE);
+        }
+
+        // set its assigned edge, and set it as an autohide bar
+        (*itBar)->uEdge(abd.uEdge);
+        (*itBar)->lParam((*itBar)->lParam() | ABS_AUTOHIDE);
+    }
+    else // Clear Auto Hide
+    {
+        // if the bar was the auto hide bar proceed
+        if (itBar != m_abVector.end() && itBar == itAutoHideBar)
+        {
+            lResult = 1;
+
+            // if bar was overlap, destroy it
+            if ((*itBar)->IsOverLap())
+            {
+                barDestroy(abd);
+            }
+            else
+            {
+                // otherwise clear its autohide status.
+                (*itBar)->lParam((*itBar)->lParam() & ~ABS_AUTOHIDE);
+            }
+        }
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barPosChanged
+//
+// Ensures that any autohide appbar has the topmost zOrder when any non autohide
+// appbar's position has changed.
+//
+// ABM_WINDOWPOSCHANGED
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//
+LRESULT TrayShell::barPosChanged(const APPBARDATAV1& abd)
+{
+    LRESULT lResult = 0;
+    AppBar* p;
+
+    if (getBar((HWND)(UINT_PTR)abd.hWnd, p) && !p->IsAutoHide())
+    {
+        lResult = 1;
+
+        BarVector::iterator itBar = findBar(p->hMon(), p->uEdge(), ABS_AUTOHIDE);
+
+        if (itBar != m_abVector.end())
+        {
+            m_pSystem->Post(
+                 m_hTrayWnd
+                ,ABP_RAISEAUTOHIDEHWND
+                ,(WPARAM)(*itBar)->hWnd()
+                ,(LPARAM)(*itBar)->uEdge()
+            );
+        }
+    }
+
+    return lResult;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// barSetTaskBarState
+//
+// Sets the current TaskBar state (autohide, alwaysontop)
+//
+// ABM_SETSTATE
+//
+// Valid APPBARDATA members:
+//
+//  cbSize
+//  hWnd
+//  lParam
+//
+LRESULT TrayShell::barSetTaskBarState(const APPBARDATAV1& abd)
+{
+    return 0;
+    (void)abd;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// modifyOverlapBar
+//
+// Helper function to barSetPos and barQueryPos
+//
+void TrayShell::modifyOverlapBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge)
+{
+    // Use entire screen for default rectangle
+    HMONITOR hMon = m_pSystem->MonitorFromRect(rcOrg);
+    RECT rcWork;
+
+    if (!m_pSystem->GetMonitorRects(hMon, rcDst, rcWork))
+    {
+        m_pSystem->GetScreenRect(rcDst);
+    }
+
+    AppBarLayout::Rect rcLayout = ToLayoutRect(rcDst);
+    AppBarLayout::Rect rcRequested = ToLayoutRect(rcOrg);
+
+    // Set the bar's extent
+    AppBarLayout::ApplyExtent(rcLayout, rcRequested, uEdge);
+
+    // The bar's position is anchored at the desktop edge - so nothing to do
+
+    // Set the bar's breadth
+    AppBarLayout::ApplyBreadth(rcLayout, rcRequested, uEdge);
+
+    FromLayoutRect(rcDst, rcLayout);
+
+    return;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// modifyNormalBar
+//
+// Helper function to barSetPos and barQueryPos
+//
+void TrayShell::modifyNormalBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge, const AppBar* pBar)
+{
+    RECT rcBase;
+
+    // Use entire screen for default rectangle
+    HMONITOR hMon = m_pSystem->MonitorFromRect(rcOrg);
+    HMONITOR hMonPrimary = m_pSystem->MonitorFromWindow(NULL);
+
+    if(hMonPrimary == hMon)
+    {
+        // Use only the original workarea for the default rectangle
+        rcBase = m_rWorkAreaDef;
+    }
+    else
+    {
+        RECT rcWork;
+
+        if(!m_pSystem->GetMonitorRects(hMon, rcBase, rcWork))
+        {
+            ASSERT(FALSE);
+
+            // Use only the original workarea for the default rectangle
+            rcBase = m_rWorkAreaDef;
+            hMon = hMonPrimary;
+        }
+    }
+
+    // Dock against the bars already on this edge of the monitor
+    FromLayoutRect(rcDst, m_abLayout.QueryPos(pBar, hMon, uEdge,
+        ToLayoutRect(rcBase), ToLayoutRect(rcOrg)));
+
+    return;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// adjustWorkArea
+//
+// Helper function to barSetPos (via ABP_NOTIFYPOSCHANGED)
+//
+void TrayShell::adjustWorkArea(HMONITOR hMon)
+{
+    RECT rcWorker, rcMonitor, rcWorkArea;
+
+    HMONITOR hMonPrimary = m_pSystem->MonitorFromWindow(NULL);
+
+    if (hMon != hMonPrimary)
+    {
+        if (!m_pSystem->GetMonitorRects(hMon, rcMonitor, rcWorkArea))
+        {
+            return;
+        }
+    }
+    else
+    {
+        rcMonitor = m_rWorkAreaDef; // yes, we actually want this
+        rcWorkArea = m_rWorkAreaCur;
+    }
+
+    FromLayoutRect(rcWorker,
+        m_abLayout.GetWorkArea(hMon, ToLayoutRect(rcMonitor)));
+
+    // Applied once it has settled, unless it's no change at all
+    m_workAreaScheduler.Request(hMon, rcWorkArea, rcWorker,
+        m_pSystem->GetTickCount());
+    flushWorkAreas();
+
+    return;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// setWorkArea
+//
+// Helper function for setting the specified work area
+//
+void TrayShell::setWorkArea(const RECT& rcWorkArea)
+{
+    m_pSystem->SetWorkArea(rcWorkArea);
+
+    broadcastWorkAreaChange();
+    return;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// flushWorkAreas
+//
+// Applies the work area changes that have settled, and schedules the timer
+// for the ones that haven't yet
+//
+void TrayShell::flushWorkAreas()
+{
+    DWORD dwNow = m_pSystem->GetTickCount();
+
+    applyWorkAreas(dwNow);
+
+    DWORD dwTimeout = m_workAreaScheduler.GetTimeout(dwNow);
+
+    if (m_hTrayWnd && dwTimeout == INFINITE)
+    {
+        m_pSystem->KillTimer(m_hTrayWnd, TRAY_WORKAREA_TIMER);
+    }
+    else if (!m_hTrayWnd || !m_pSystem->SetTimer(m_hTrayWnd,
+        TRAY_WORKAREA_TIMER, std::max<DWORD>(dwTimeout, USER_TIMER_MINIMUM)))
+    {
+        // Can't wait for them then
+        DWORD dwWhen = dwNow;
+
+        while (dwTimeout != INFINITE)
+        {
+            dwWhen += dwTimeout;
+            applyWorkAreas(dwWhen);
+            dwTimeout = m_workAreaScheduler.GetTimeout(dwWhen);
+        }
+    }
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// applyWorkAreas
+//
+// Sets the work area of every monitor whose change is due by dwNow, then
+// tells everyone about it once
+//
+void TrayShell::applyWorkAreas(DWORD dwNow)
+{
+    WorkAreaScheduler::ChangeList changes;
+    m_workAreaScheduler.TakeSettled(dwNow, changes);
+
+    if (changes.empty())
+    {
+        return;
+    }
+
+    for (WorkAreaScheduler::ChangeList::iterator it = changes.begin();
+         it != changes.end(); ++it)
+    {
+        m_pSystem->SetWorkArea(it->rcWorkArea);
+    }
+
+    broadcastWorkAreaChange();
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// broadcastWorkAreaChange
+//
+// Tells all top-level windows the work area changed
+//
+void TrayShell::broadcastWorkAreaChange()
+{
+    if (m_hTrayWnd)
+    {
+        // so we can recognize it when it comes back to us
+        m_workAreaScheduler.NoteBroadcast();
+    }
+
+    m_pSystem->BroadcastWorkAreaChange();
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// ABLock
+//
+// Locks the shared memory the caller's AppBarData structure is in
+//
+// Returns a pointer to shared memory location for an AppBarData structure
+//
+PAPPBARDATAV1 TrayShell::ABLock(PSHELLAPPBARDATA psad)
+{
+    return (PAPPBARDATAV1)m_pSystem->LockShared(
+        psad->hSharedMemory, psad->dwSourceProcessId);
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// ABUnlock
+//
+// Unlocks the shared memory locked by ABLock
+//
+void TrayShell::ABUnLock(PAPPBARDATAV1 pabd)
+{
+    m_pSystem->UnlockShared(pabd);
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// FindAppBarPredicate_hWnd
+//
+// Predicate for std::find_if, used by findBar variants
+// Needs to be at global scope because of mingw issues
+//
+// Find the appbar matching the specified hWnd
+//
+struct FindAppBarPredicate_hWnd
+{
+    FindAppBarPredicate_hWnd(HWND hWnd) :
+        m_hWnd(hWnd)
+    {
+        // do nothing
+    }
+    FindAppBarPredicate_hWnd(const FindAppBarPredicate_hWnd& copy) :
+        m_hWnd(copy.m_hWnd)
+    {
+        // do nothing
+    }
+
+    bool operator() (const AppBar* pab) const
+    {
+        return (pab->hWnd() == m_hWnd);
+    }
+
+private:
+    const HWND m_hWnd;
+
+private:
+    // Not implemented
+    FindAppBarPredicate_hWnd& operator=(const FindAppBarPredicate_hWnd&);
+};
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// FindAppBarPredicate_MatchLParam
+//
+// Predicate for std::find_if, used by findBar variants
+// Needs to be at global scope because of mingw issues
+//
+// Find the appbar on the specified edge that has a matching lParam value
+//
+struct FindAppBarPredicate_MatchLParam
+{
+    FindAppBarPredicate_MatchLParam(HMONITOR hMon, UINT uEdge, LPARAM lParam) :
+        m_hMon(hMon), m_uEdge(uEdge), m_lParam(lParam)
+    {
+        // do nothing
+    }
+    FindAppBarPredicate_MatchLParam(const FindAppBarPredicate_MatchLParam& copy) :
+        m_hMon(copy.m_hMon), m_uEdge(copy.m_uEdge), m_lParam(copy.m_lParam)
+    {
+        // do nothing
+    }
+
+    bool operator() (const AppBar* pab) const
+    {
+        return (pab->hMon() == m_hMon && pab->uEdge() == m_uEdge &&
+             m_lParam == (pab->lParam() & m_lParam));
+    }
+
+private:
+    const HMONITOR m_hMon;
+    const UINT m_uEdge;
+    const LPARAM m_lParam;
+
+private:
+    // Not implemented
+    FindAppBarPredicate_MatchLParam& operator=(const FindAppBarPredicate_MatchLParam&);
+};
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// findBar
+//
+// Looks up an AppBar in the AppBarList
+//
+BarVector::iterator TrayShell::findBar(HWND hWnd)
+{
+    return std::find_if(m_abVector.begin(), m_abVector.end(),
+                        FindAppBarPredicate_hWnd(hWnd));
+}
+BarVector::iterator TrayShell::findBar(HMONITOR hMon, UINT uEdge, LPARAM lParam)
+{
+    return std::find_if(m_abVector.begin(), m_abVector.end(),
+                        FindAppBarPredicate_MatchLParam(hMon, uEdge, lParam));
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// isBar
+//
+// Determines whether the HWND is associated with any current AppBar.
+//
+bool TrayShell::isBar(HWND hWnd)
+{
+    return m_abVector.end() != findBar(hWnd);
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// getBar
+//
+// Looks up an BarVector iterator based on the HWND
+//
+// returns true if found, otherwise false.
+//
+bool TrayShell::getBar(HWND hWnd, BarVector::iterator& itBar)
+{
+    bool bReturn = false;
+
+    itBar = findBar(hWnd);
+
+    if (itBar != m_abVector.end())
+    {
+        bReturn = true;
+    }
+
+    return bReturn;
+}
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// getBar
+//
+// Looks up an AppBar* based on the HWND
+//
+// Returns true if found, otherwise false.
+//
+bool TrayShell::getBar(HWND hWnd, AppBar*& pBarRef)
+{
+    bool bReturn = false;
+    BarVector::iterator itBar;
+
+    if (getBar(hWnd, itBar))
+    {
+        pBarRef = *itBar;
+        bReturn = true;
+    }
+
+    return bReturn;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// HandleNotification
+//
+// Handler for all system tray notifications
+//
+BOOL TrayShell::HandleNotification(PSHELLTRAYDATA pstd)
+{
+    bool bReturn = false;
+
+    switch (pstd->dwMessage)
+    {
+    case NIM_ADD:
+        bReturn = addIcon(pstd->nid);
+        break;
+
+    case NIM_MODIFY:
+        bReturn = modifyIcon(pstd->nid);
+        break;
+
+    case NIM_DELETE:
+        bReturn = deleteIcon(pstd->nid);
+        break;
+
+    case NIM_SETFOCUS:
+        bReturn = setFocusIcon(pstd->nid);
+        break;
+
+    case NIM_SETVERSION:
+        bReturn = setVersionIcon(pstd->nid);
+        break;
+
+    default:
+        TRACE("Unknown NIM: %u", pstd->dwMessage);
+        break;
+    }
+
+    return bReturn ? TRUE : FALSE;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// notify
+//
+// Notify all listeners of a systray event
+//
+bool TrayShell::notify(DWORD dwMessage, PCLSNOTIFYICONDATA pclsnid) const
+{
+    LRESULT wResult = m_pSystem->Send(m_hLiteStep, LM_SYSTRAYW, dwMessage, (LPARAM)pclsnid);
+    LRESULT aResult = 0;
+
+    // The ANSI copy is only worth making if a legacy module will see it
+    if (m_pSystem->IsHandled(LM_SYSTRAYA))
+    {
+        LSNOTIFYICONDATAA lsnidA(pclsnid);
+        aResult = m_pSystem->Send(m_hLiteStep, LM_SYSTRAYA, dwMessage, (LPARAM)&lsnidA);
+    }
+
+    return wResult != 0 || aResult != 0;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// queueNotify
+//
+// Queues an NIM_ADD, NIM_MODIFY or NIM_DELETE notification for the next
+// flush. Without a coalescing delay notifications are sent right away.
+//
+void TrayShell::queueNotify(const NotifyIcon* pni, DWORD dwMessage, const LSNOTIFYICONDATA& lsnid)
+{
+    if (m_uCoalesceDelay == 0 || !m_hTrayWnd)
+    {
+        notify(dwMessage, &lsnid);
+    }
+    else if (m_notifyQueue.Push(pni, dwMessage, lsnid))
+    {
+        if (!m_pSystem->SetTimer(m_hTrayWnd, TRAY_FLUSH_TIMER, m_uCoalesceDelay))
+        {
+            flushNotifications();
+        }
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// flushNotifications
+//
+// Sends all queued notifications to the systray modules, in order. Called
+// from the flush timer, and before anything that must not overtake them.
+//
+void TrayShell::flushNotifications()
+{
+    if (m_hTrayWnd)
+    {
+        m_pSystem->KillTimer(m_hTrayWnd, TRAY_FLUSH_TIMER);
+    }
+
+    TrayNotifyQueue::EventList events;
+    m_notifyQueue.Take(events);
+
+    for (TrayNotifyQueue::EventList::const_iterator it = events.begin();
+         it != events.end(); ++it)
+    {
+        notify(it->dwMessage, &it->lsnid);
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// SendSystemTray
+//
+// Resend all icon data; systray modules will request this via LM_SYSTRAYREADY
+// during their startup.
+//
+void TrayShell::SendSystemTray()
+{
+    // Modules must not see anything twice
+    flushNotifications();
+
+    for (TrayIconStore::const_iterator it = m_siStore.begin();
+         it != m_siStore.end(); ++it)
+    {
+        if ((*it)->IsValid())
+        {
+            LSNOTIFYICONDATA lsnid = { 0 };
+
+            (*it)->CopyLSNID(&lsnid);
+
+            notify(NIM_ADD, &lsnid);
+
+            if ((*it)->GetVersion() != 0)
+            {
+                lsnid.uVersion = (*it)->GetVersion();
+                notify(NIM_SETVERSION, &lsnid);
+            }
+        }
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// GetIcons
+//
+// Like SendSystemTray, but hands the icons to the caller, each record
+// carrying its NIM_SETVERSION version in uVersion.
+//
+void TrayShell::GetIcons(std::vector<LSNOTIFYICONDATA>& vecIcons)
+{
+    flushNotifications();
+
+    vecIcons.reserve(vecIcons.size() + m_siStore.size());
+
+    for (TrayIconStore::const_iterator it = m_siStore.begin();
+         it != m_siStore.end(); ++it)
+    {
+        if ((*it)->IsValid())
+        {
+            LSNOTIFYICONDATA lsnid = { 0 };
+
+            (*it)->CopyLSNID(&lsnid);
+            lsnid.uVersion = (*it)->GetVersion();
+
+            vecIcons.push_back(lsnid);
+        }
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// removeIcon
+//
+// Deletes an icon whose owner is gone, telling the systray modules. Returns
+// the icon after it.
+//
+TrayIconStore::iterator TrayShell::removeIcon(TrayIconStore::iterator it)
+{
+    NotifyIcon* pni = *it;
+
+    if (pni->IsValid())
+    {
+        LSNOTIFYICONDATA lsnid = {
+             sizeof(LSNOTIFYICONDATA)
+            ,pni->GetHwnd()
+            ,pni->GetuID()
+            ,0
+        };
+        if (pni->HasGUID())
+        {
+            lsnid.guidItem = pni->GetGUID();
+            lsnid.uFlags |= NIF_GUID;
+        }
+
+        queueNotify(pni, NIM_DELETE, lsnid);
+    }
+
+    return m_siStore.Remove(it);
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// OnWindowDestroyed
+//
+// Drops the icons and the AppBar of a window that went away. Called for
+// LM_WINDOWDESTROYED, which only covers top-level windows; the rest are
+// caught by validateOwners.
+//
+void TrayShell::OnWindowDestroyed(HWND hWnd)
+{
+    std::vector<TrayIconStore::iterator> vecIcons;
+    m_siStore.FindOwned(hWnd, vecIcons);
+
+    for (size_t st = 0; st < vecIcons.size(); ++st)
+    {
+        removeIcon(vecIcons[st]);
+    }
+
+    BarVector::iterator itBar;
+
+    if (getBar(hWnd, itBar))
+    {
+        removeBar(itBar);
+    }
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// validateOwners
+//
+// Removes all "dead" icons and AppBars, ie. those that no longer have a valid
+// HWND associated with them. Runs off TRAY_VALIDATE_TIMER, so that request
+// handling never has to check.
+//
+void TrayShell::validateOwners()
+{
+    TrayIconStore::iterator it = m_siStore.begin();
+
+    while (it != m_siStore.end())
+    {
+        if (m_pSystem->IsWindow((*it)->GetHwnd()))
+        {
+            ++it;
+            continue;
+        }
+
+        it = removeIcon(it);
+    }
+
+    // Back to front, so that the bar swapped into a removed slot has
+    // already been checked
+    for (size_t st = m_abVector.size(); st > 0; --st)
+    {
+        if (!m_pSystem->IsWindow(m_abVector[st - 1]->hWnd()))
+        {
+            removeBar(m_abVector.begin() + (st - 1));
+        }
+    }
+
+    return;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// extendNIDCopy
+//
+// Copies all non-persistent data that is not stored in NotifyIcon.
+//
+bool TrayShell::extendNIDCopy(LSNOTIFYICONDATA& lsnid, const NID_XX& nid) const
+{
+    // Copy Info Tips
+    if (nid.uFlags & NIF_INFO)
+    {
+        switch (nid.cbSize)
+        {
+        case NID_7W_SIZE:
+        case NID_6W_SIZE:
+        case NID_5W_SIZE:
+            {
+                NID_5W* pnid = (NID_5W*)&nid;
+
+                CopyNidString(lsnid.szInfo, TRAY_MAX_INFO_LENGTH,
+                    pnid->szInfo, sizeof(pnid->szInfo) / sizeof(WCHAR16));
+
+                CopyNidString(lsnid.szInfoTitle, TRAY_MAX_INFOTITLE_LENGTH,
+                    pnid->szInfoTitle,
+                    sizeof(pnid->szInfoTitle) / sizeof(WCHAR16));
+
+                lsnid.dwInfoFlags = pnid->dwInfoFlags;
+                lsnid.uTimeout = pnid->uTimeout;
+                lsnid.uFlags |= NIF_INFO;
+            }
+            break;
+        case NID_6A_SIZE:
+        case NID_5A_SIZE:
+            {
+                NID_5A* pnid = (NID_5A*)&nid;
+
+                CopyNidString(lsnid.szInfo, TRAY_MAX_INFO_LENGTH,
+                    pnid->szInfo, sizeof(pnid->szInfo));
+
+                CopyNidString(lsnid.szInfoTitle, TRAY_MAX_INFOTITLE_LENGTH,
+                    pnid->szInfoTitle, sizeof(pnid->szInfoTitle));
+
+                lsnid.dwInfoFlags = pnid->dwInfoFlags;
+                lsnid.uTimeout = pnid->uTimeout;
+                lsnid.uFlags |= NIF_INFO;
+            }
+            break;
+        default:
+            {
+                // do nothing
+            }
+            break;
+        }
+    }
+
+    // Copy GUID
+    if (nid.uFlags & NIF_GUID)
+    {
+        switch (nid.cbSize)
+        {
+        case NID_7W_SIZE:
+        case NID_6W_SIZE:
+            {
+                NID_6W* pnid = (NID_6W*)&nid;
+
+                lsnid.guidItem = pnid->guidItem;
+                lsnid.uFlags |= NIF_GUID;
+            }
+            break;
+        case NID_6A_SIZE:
+            {
+                NID_6A* pnid = (NID_6A*)&nid;
+
+                lsnid.guidItem = pnid->guidItem;
+                lsnid.uFlags |= NIF_GUID;
+            }
+            break;
+        default:
+            {
+                // do nothing
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// addIcon
+//
+bool TrayShell::addIcon(const NID_XX& nid)
+{
+    bool bReturn = false;
+
+    if (m_siStore.end() == m_siStore.Find(nid))
+    {
+        NotifyIcon * pni = new NotifyIcon(nid);
+
+        if (pni)
+        {
+            // Fail shared icons, unless a valid hIcon exists
+            if (m_pSystem->IsWindow(pni->GetHwnd()) &&
+                (!pni->IsShared() || pni->HasIcon()))
+            {
+                m_siStore.Add(pni);
+
+                if (pni->IsValid())
+                {
+                    LSNOTIFYICONDATA lsnid = { 0 };
+
+                    pni->CopyLSNID(&lsnid);
+                    extendNIDCopy(lsnid, nid);
+
+                    queueNotify(pni, NIM_ADD, lsnid);
+                }
+                bReturn = true;
+            }
+            else
+            {
+                delete pni;
+            }
+        }
+    }
+
+    return bReturn;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// modifyIcon
+//
+bool TrayShell::modifyIcon(const NID_XX& nid)
+{
+    bool bReturn = false;
+
+    TrayIconStore::iterator it = m_siStore.Find(nid);
+
+    if (m_siStore.end() != it && *it)
+    {
+        NotifyIcon * pni = *it;
+
+        bool bWasValid = pni->IsValid();
+
+        // Update stored NotifyIcon
+        m_siStore.Update(it, nid);
+
+        if (pni->IsValid())
+        {
+            LSNOTIFYICONDATA lsnid = { 0 };
+
+            if (!bWasValid)
+            {
+                // This is a "new" icon, send entire stored NotifyIcon
+                pni->CopyLSNID(&lsnid);
+                extendNIDCopy(lsnid, nid);
+
+                queueNotify(pni, NIM_ADD, lsnid);
+            }
+            else
+            {
+                // This icon already exists, just send updated flags
+                pni->CopyLSNID(&lsnid, nid.uFlags);
+                extendNIDCopy(lsnid, nid);
+
+                queueNotify(pni, NIM_MODIFY, lsnid);
+            }
+        }
+        else if (bWasValid)
+        {
+            LSNOTIFYICONDATA lsnid = {
+                 sizeof(LSNOTIFYICONDATA)
+                ,pni->GetHwnd()
+                ,pni->GetuID()
+                ,0
+            };
+            if ((nid.uFlags & NIF_GUID) == NIF_GUID)
+            {
+                lsnid.guidItem = (*it)->GetGUID();
+                lsnid.uFlags |= NIF_GUID;
+            }
+
+            // This icon is no longer visible, remove
+            queueNotify(pni, NIM_DELETE, lsnid);
+        }
+
+        bReturn = true;
+    }
+
+    return bReturn;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// deleteIcon
+//
+// Remove an icon from the icon list
+//
+bool TrayShell::deleteIcon(const NID_XX& nid)
+{
+    bool bReturn = false;
+
+    TrayIconStore::iterator it = m_siStore.Find(nid);
+
+    if (m_siStore.end() != it)
+    {
+        LSNOTIFYICONDATA lsnid = {
+             sizeof(LSNOTIFYICONDATA)
+            ,(*it)->GetHwnd()
+            ,(*it)->GetuID()
+            ,0
+        };
+        if ((nid.uFlags & NIF_GUID) == NIF_GUID)
+        {
+            lsnid.guidItem = (*it)->GetGUID();
+            lsnid.uFlags |= NIF_GUID;
+        }
+
+        queueNotify(*it, NIM_DELETE, lsnid);
+
+        m_siStore.Remove(it);
+
+        bReturn = true;
+    }
+
+    return bReturn;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// setFocusIcon
+//
+// Sets selection focus to the specified icon
+//
+bool TrayShell::setFocusIcon(const NID_XX& nid)
+{
+    bool bReturn = false;
+
+    TrayIconStore::iterator it = m_siStore.Find(nid);
+
+    if (m_siStore.end() != it)
+    {
+        LSNOTIFYICONDATA lsnid = {
+             sizeof(LSNOTIFYICONDATA)
+            ,(*it)->GetHwnd()
+            ,(*it)->GetuID()
+            ,0
+        };
+        if ((nid.uFlags & NIF_GUID) == NIF_GUID)
+        {
+            lsnid.guidItem = (*it)->GetGUID();
+            lsnid.uFlags |= NIF_GUID;
+        }
+
+        flushNotifications();
+        bReturn = notify(NIM_SETFOCUS, &lsnid);
+    }
+
+    return bReturn;
+}
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// setVersionIcon
+//
+// Sets compatibility version for specified icon
+//
+bool TrayShell::setVersionIcon(const NID_XX& nid)
+{
+    bool bReturn = false;
+
+    TrayIconStore::iterator it = m_siStore.Find(nid);
+
+    if (m_siStore.end() != it)
+    {
+        LSNOTIFYICONDATA lsnid = {
+             sizeof(LSNOTIFYICONDATA)
+            ,(*it)->GetHwnd()
+            ,(*it)->GetuID()
+            ,0
+        };
+
+        switch (nid.cbSize)
+        {
+        case NID_7W_SIZE:
+        case NID_6W_SIZE:
+        case NID_5W_SIZE:
+            lsnid.uVersion = ((NID_5W&)nid).uVersion;
+            (*it)->SetVersion(((NID_5W&)nid).uVersion);
+            break;
+
+        case NID_6A_SIZE:
+        case NID_5A_SIZE:
+            lsnid.uVersion = ((NID_5A&)nid).uVersion;
+            (*it)->SetVersion(((NID_5A&)nid).uVersion);
+            break;
+
+        default:
+            break;
+        }
+
+        flushNotifications();
+        bReturn = notify(NIM_SETVERSION, &lsnid);
+    }
+
+    return bReturn;
+}
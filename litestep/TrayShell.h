@@ -0,0 +1,363 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYSHELL_H)
+#define TRAYSHELL_H
+
+#include "../utility/portable.h"
+#include "TrayNotifyIcon.h"
+#include "TrayIconStore.h"
+#include "TrayNotifyQueue.h"
+#include "TrayAppBar.h"
+#include "TrayAppBarLayout.h"
+#include "TrayWorkAreaScheduler.h"
+#include "TrayRecording.h"
+#include <vector>
+
+#if defined(_WIN32)
+#  include "../lsapi/lsapidefines.h"
+#else
+#  define WM_USER               0x0400
+#  define USER_TIMER_MINIMUM    0x0000000A
+#  define LM_SYSTRAYA           9214
+#  define LM_SYSTRAYINFOEVENT   9216
+#  define LM_SYSTRAYW           33285
+#endif // defined(_WIN32)
+
+// shell copy data types
+#define SH_APPBAR_DATA    (0)
+#define SH_TRAY_DATA      (1)
+#define SH_LOADPROC_DATA  (2)
+#define SH_TRAYINFO_DATA  (3)
+
+// internally posted AppBar messages
+#define ABP_NOTIFYPOSCHANGED   (WM_USER+350)
+#define ABP_NOTIFYSTATECHANGE  (WM_USER+351)
+#define ABP_RAISEAUTOHIDEHWND  (WM_USER+360)
+
+// timer that flushes coalesced icon notifications
+#define TRAY_FLUSH_TIMER       1
+
+// timer that applies debounced work area changes
+#define TRAY_WORKAREA_TIMER    2
+
+// timer that removes icons and AppBars of windows that went away unnoticed
+#define TRAY_VALIDATE_TIMER    3
+#define TRAY_VALIDATE_INTERVAL 30000
+
+// data sent to TrayInfoEvent
+typedef struct _NOTIFYICONIDENTIFIER_MSGV1
+{
+    DWORD dwMagic;
+    DWORD dwMessage;
+    DWORD cbSize;
+    DWORD dwPadding;
+    HWND32 hWnd;
+    UINT uID;
+    GUID guidItem;
+} NOTIFYICONIDENTIFIER_MSGV1, *LPNOTIFYICONIDENTIFIER_MSGV1;
+
+// Used for LM_SYSTRAYINFOEVENT
+typedef struct _SYSTRAYINFOEVENT
+{
+    DWORD cbSize;
+    DWORD dwEvent;
+    HWND hWnd;
+    UINT uID;
+    GUID guidItem;
+} SYSTRAYINFOEVENT, *LPSYSTRAYINFOEVENT;
+
+// data sent by shell via Shell_NotifyIcon
+typedef struct _SHELLTRAYDATA
+{
+    DWORD dwUnknown;
+    DWORD dwMessage;
+    NID_XX nid;
+} *PSHELLTRAYDATA;
+
+// Data sent with AppBar Message
+typedef struct _SHELLAPPBARDATA
+{
+    _SHELLAPPBARDATA(APPBARDATAV1& abdsrc):abd(abdsrc)
+    {
+        // do nothing
+    }
+
+    const APPBARDATAV1& abd;
+    /**/
+    DWORD  dwMessage;
+    HANDLE hSharedMemory;
+    DWORD  dwSourceProcessId;
+    /**/
+
+private:
+    // Not implemented
+    _SHELLAPPBARDATA(const _SHELLAPPBARDATA&);
+    _SHELLAPPBARDATA& operator=(const _SHELLAPPBARDATA&);
+} SHELLAPPBARDATA, *PSHELLAPPBARDATA;
+
+
+// Data sent with SHLoadInProc/SHEnableServiceObject on XP and up
+// Earlier versions don't have SHEnableServiceObject and only send the CLSID
+typedef struct _SHELLINPROCDATA
+{
+    GUID clsid;
+    DWORD dwMessage;
+} SHELLINPROCDATA, *PSHELLINPROCDATA;
+
+typedef std::vector<AppBar*> BarVector;
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// TrayShell
+//
+// Decodes the shell's tray and AppBar messages and keeps the state behind
+// them: the icons, the notifications pending for the systray modules, the
+// AppBars and the work area. TrayService feeds it from the "Shell_TrayWnd"
+// window.
+//
+// Every window and system call goes through a System, so recordings can be
+// replayed into it without any real windows (see tests/TrayReplayBench.cpp).
+//
+class TrayShell : public ITrayMessageSink
+{
+public:
+    //
+    // The calls the shell makes. The Win32 implementation lives with
+    // TrayService; monitor lookups default to the primary monitor.
+    //
+    class System
+    {
+    public:
+        virtual ~System()
+        {
+            // do nothing
+        }
+
+        // SendMessage and PostMessage
+        virtual LRESULT Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) = 0;
+        virtual BOOL Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) = 0;
+
+        // Returns false if no module would see uMsg sent to LiteStep
+        virtual bool IsHandled(UINT uMsg) = 0;
+
+        virtual BOOL IsWindow(HWND hWnd) = 0;
+        virtual BOOL GetWindowRect(HWND hWnd, RECT& rc) = 0;
+
+        virtual BOOL SetTimer(HWND hWnd, UINT_PTR uID, UINT uElapse) = 0;
+        virtual void KillTimer(HWND hWnd, UINT_PTR uID) = 0;
+        virtual DWORD GetTickCount() = 0;
+
+        // MonitorFromRect and MonitorFromWindow; a NULL window gives the
+        // primary monitor
+        virtual HMONITOR MonitorFromRect(const RECT& rc) = 0;
+        virtual HMONITOR MonitorFromWindow(HWND hWnd) = 0;
+
+        // GetMonitorInfo's rcMonitor and rcWork
+        virtual bool GetMonitorRects(HMONITOR hMon, RECT& rcMonitor, RECT& rcWork) = 0;
+
+        // The primary monitor's rectangle, from the screen metrics
+        virtual void GetScreenRect(RECT& rc) = 0;
+
+        // SPI_SETWORKAREA, without telling anyone yet
+        virtual void SetWorkArea(const RECT& rc) = 0;
+
+        // Tells all top-level windows the work area changed
+        virtual void BroadcastWorkAreaChange() = 0;
+
+        // SHLockShared and SHUnlockShared, for the AppBar data
+        virtual LPVOID LockShared(HANDLE hData, DWORD dwProcessId) = 0;
+        virtual void UnlockShared(LPVOID pvData) = 0;
+
+        // SHLoadInProc and SHEnableServiceObject
+        virtual LRESULT LoadInProc(const GUID& clsid, DWORD dwMessage) = 0;
+    };
+
+    //
+    // Takes ownership of pSystem
+    //
+    explicit TrayShell(System* pSystem);
+    ~TrayShell();
+
+    //
+    // Milliseconds icon notifications are held back to merge them, and
+    // milliseconds AppBars settle before the work area follows them
+    //
+    void SetDelays(UINT uCoalesceDelay, DWORD dwWorkAreaDelay);
+
+    //
+    // The windows the shell talks to: LiteStep's, which the notifications
+    // go to, the tray window, which owns the timers and gets the ABP_*
+    // messages, and the notification area. Pass NULLs to detach.
+    //
+    void SetWindows(HWND hLiteStep, HWND hTrayWnd, HWND hNotifyWnd);
+
+    // Resets the primary monitor's work area to the whole screen
+    void ResetWorkArea();
+
+    // Drops all icons, notifications and AppBars
+    void Clear();
+
+    // Decode a shell WM_COPYDATA message
+    virtual LRESULT HandleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData) override;
+
+    //
+    // Tray window messages
+    //
+    void OnPosChanged(HWND hSkip, HMONITOR hMon);   // ABP_NOTIFYPOSCHANGED
+    void OnStateChange();                           // ABP_NOTIFYSTATECHANGE
+    void OnTimer(UINT_PTR uID);                     // WM_TIMER
+    void OnWorkAreaChanged(const RECT& rcWorkArea); // SPI_SETWORKAREA
+
+    // resend all icon data
+    void SendSystemTray();
+
+    // Retrieves all visible icons, each with its NIM_SETVERSION version
+    void GetIcons(std::vector<LSNOTIFYICONDATA>& vecIcons);
+
+    // A top-level window was destroyed
+    void OnWindowDestroyed(HWND hWnd);
+
+    // A window has gone/left full screen mode
+    void NotifyRudeApp(HMONITOR hFullScreenMonitor) const;
+
+    size_t GetIconCount() const
+    {
+        return m_siStore.size();
+    }
+
+    size_t GetBarCount() const
+    {
+        return m_abVector.size();
+    }
+
+    const TrayNotifyQueue::Statistics& GetNotifyStatistics() const
+    {
+        return m_notifyQueue.GetStatistics();
+    }
+
+    const WorkAreaScheduler& GetWorkAreaScheduler() const
+    {
+        return m_workAreaScheduler;
+    }
+
+private:
+    // not implemented
+    TrayShell(const TrayShell& rhs);
+    TrayShell& operator=(const TrayShell& rhs);
+
+    // Handlers for AppBar messages
+    LRESULT HandleAppBarCopydata(DWORD cbData, LPVOID lpData);
+    LRESULT HandleAppBarMessage(PSHELLAPPBARDATA psad);
+
+    // Handler for tray info event
+    LRESULT TrayInfoEvent(DWORD cbData, LPVOID lpData);
+
+    // Handler for system tray notifications
+    BOOL HandleNotification(PSHELLTRAYDATA pstd);
+
+    //
+    // ABM_* Notification handlers
+    //
+    LRESULT barCreate(const APPBARDATAV1& abd);
+    LRESULT barDestroy(const APPBARDATAV1& abd);
+    LRESULT barQueryPos(PSHELLAPPBARDATA psad);
+    LRESULT barSetPos(PSHELLAPPBARDATA psad);
+    LRESULT barGetTaskBarState();
+    LRESULT barGetTaskBarPos(PSHELLAPPBARDATA psad);
+    LRESULT barActivate(const APPBARDATAV1& abd);
+    LRESULT barGetAutoHide(const APPBARDATAV1& abd);
+    LRESULT barSetAutoHide(const APPBARDATAV1& abd);
+    LRESULT barPosChanged(const APPBARDATAV1& abd);
+    LRESULT barSetTaskBarState(const APPBARDATAV1& abd);
+
+    //
+    // barSetPos and barQueryPos helpers
+    //
+    void modifyOverlapBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge);
+    void modifyNormalBar(RECT& rcDst, const RECT& rcOrg, UINT uEdge, const AppBar* pBar);
+    void adjustWorkArea(HMONITOR hMon);
+    void setWorkArea(const RECT& rcWorkArea);
+    void flushWorkAreas();
+    void applyWorkAreas(DWORD dwNow);
+    void broadcastWorkAreaChange();
+
+    // Delete an AppBar
+    void removeBar(BarVector::iterator itBar);
+
+    //
+    // AppBar Un/Lock handlers for shared data
+    //
+    PAPPBARDATAV1 ABLock(PSHELLAPPBARDATA psad);
+    void ABUnLock(PAPPBARDATAV1 pabd);
+
+    //
+    // findBar variants and wrappers
+    //
+    BarVector::iterator findBar(HWND hWnd);
+    BarVector::iterator findBar(HMONITOR hMon, UINT uEdge, LPARAM lParam);
+    bool isBar(HWND hWnd);
+    bool getBar(HWND hWnd, BarVector::iterator& itAppBar);
+    bool getBar(HWND hWnd, AppBar*& pBarRef);
+
+    //
+    // NIM_* Notification handlers
+    //
+    bool addIcon(const NID_XX& nid);        // NIM_ADD
+    bool modifyIcon(const NID_XX& nid);     // NIM_MODIFY
+    bool deleteIcon(const NID_XX& nid);     // NIM_DELETE
+    bool setFocusIcon(const NID_XX& nid);   // NIM_SETFOCUS
+    bool setVersionIcon(const NID_XX& nid); // NIM_SETVERSION
+
+    //
+    // Send icon notifications on to LiteStep (thus systray modules)
+    //
+    bool notify(DWORD dwMessage, PCLSNOTIFYICONDATA pclsnid) const;
+    void queueNotify(const NotifyIcon* pni, DWORD dwMessage, const LSNOTIFYICONDATA& lsnid);
+    void flushNotifications();
+    bool extendNIDCopy(LSNOTIFYICONDATA& lsnid, const NID_XX& nid) const;
+
+    // Delete an icon whose owner is gone
+    TrayIconStore::iterator removeIcon(TrayIconStore::iterator it);
+
+    // Remove any "dead" icons and appbars
+    void validateOwners();
+
+    //
+    //
+    //
+    System* m_pSystem;
+    WorkAreaScheduler m_workAreaScheduler;
+    RECT m_rWorkAreaDef; // The Working Area without any appbars.
+    RECT m_rWorkAreaCur; // The Working Area with the appbars.
+    HWND m_hLiteStep;
+    HWND m_hTrayWnd;
+    HWND m_hNotifyWnd;
+
+    TrayIconStore m_siStore;
+    TrayNotifyQueue m_notifyQueue;
+    UINT m_uCoalesceDelay;
+    BarVector m_abVector;
+    AppBarLayout m_abLayout;
+};
+
+#endif // TRAYSHELL_H
@@ -0,0 +1,174 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TrayWorkAreaScheduler.h"
+#include <string.h>
+
+
+//
+// WorkAreaScheduler
+//
+WorkAreaScheduler::WorkAreaScheduler(DWORD dwDelay)
+    : m_dwDelay(dwDelay)
+    , m_uPendingEchoes(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+//
+// Request
+//
+void WorkAreaScheduler::Request(HMONITOR hMonitor, const RECT& rcCurrent,
+    const RECT& rcWorkArea, DWORD dwNow)
+{
+    ++m_stats.uRequested;
+
+    PendingMap::iterator it = m_mapPending.find(hMonitor);
+
+    if (it == m_mapPending.end())
+    {
+        if (_IsEqual(rcCurrent, rcWorkArea))
+        {
+            ++m_stats.uSuppressed;
+            return;
+        }
+
+        Pending& pending = m_mapPending[hMonitor];
+        pending.rcOriginal = rcCurrent;
+        pending.rcWorkArea = rcWorkArea;
+        pending.dwFirst = dwNow;
+        pending.dwDue = dwNow + m_dwDelay;
+        return;
+    }
+
+    Pending& pending = it->second;
+
+    // The monitor hasn't been touched yet, so back where it started means
+    // nothing to do. The undone change counts as suppressed, not also as
+    // superseded.
+    if (_IsEqual(pending.rcOriginal, rcWorkArea))
+    {
+        ++m_stats.uSuppressed;
+        m_mapPending.erase(it);
+        return;
+    }
+
+    if (_IsEqual(pending.rcWorkArea, rcWorkArea))
+    {
+        ++m_stats.uSuppressed;
+    }
+    else
+    {
+        ++m_stats.uSuperseded;
+        pending.rcWorkArea = rcWorkArea;
+    }
+
+    // Wait for things to calm down, but not forever
+    DWORD dwLatest = pending.dwFirst + 4 * m_dwDelay;
+    DWORD dwSettled = dwNow + m_dwDelay;
+    pending.dwDue = _IsDue(dwLatest, dwSettled) ? dwLatest : dwSettled;
+}
+
+
+//
+// GetTimeout
+//
+DWORD WorkAreaScheduler::GetTimeout(DWORD dwNow) const
+{
+    DWORD dwTimeout = INFINITE;
+
+    for (PendingMap::const_iterator it = m_mapPending.begin();
+        it != m_mapPending.end(); ++it)
+    {
+        DWORD dwDue = it->second.dwDue;
+        DWORD dwWait = _IsDue(dwDue, dwNow) ? 0 : dwDue - dwNow;
+
+        if (dwTimeout == INFINITE || dwWait < dwTimeout)
+        {
+            dwTimeout = dwWait;
+        }
+    }
+
+    return dwTimeout;
+}
+
+
+//
+// TakeSettled
+//
+void WorkAreaScheduler::TakeSettled(DWORD dwNow, ChangeList& changes)
+{
+    PendingMap::iterator it = m_mapPending.begin();
+
+    while (it != m_mapPending.end())
+    {
+        if (!_IsDue(it->second.dwDue, dwNow))
+        {
+            ++it;
+            continue;
+        }
+
+        Change change;
+        change.hMonitor = it->first;
+        change.rcWorkArea = it->second.rcWorkArea;
+        changes.push_back(change);
+
+        ++m_stats.uApplied;
+        m_mapPending.erase(it++);
+    }
+}
+
+
+//
+// Clear
+//
+void WorkAreaScheduler::Clear()
+{
+    m_mapPending.clear();
+}
+
+
+//
+// NoteBroadcast
+//
+void WorkAreaScheduler::NoteBroadcast()
+{
+    ++m_uPendingEchoes;
+    ++m_stats.uBroadcasts;
+}
+
+
+//
+// TakeEcho
+//
+bool WorkAreaScheduler::TakeEcho()
+{
+    if (m_uPendingEchoes > 0)
+    {
+        --m_uPendingEchoes;
+        ++m_stats.uEchoes;
+        return true;
+    }
+
+    ++m_stats.uExternal;
+    return false;
+}
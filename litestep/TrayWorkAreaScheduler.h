@@ -0,0 +1,147 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYWORKAREASCHEDULER_H)
+#define TRAYWORKAREASCHEDULER_H
+
+#include "../utility/portable.h"
+#include <map>
+#include <vector>
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
+//
+// WorkAreaScheduler
+//
+// Debounces work area changes per monitor. Every change made to the work
+// area is announced to all top-level windows with a WM_SETTINGCHANGE
+// broadcast, so while AppBars are still moving around, a monitor's new work
+// area is held back until it has been stable for the debounce delay. A
+// change that ends up where the monitor started is dropped altogether.
+// Monitors that settle at the same time share one broadcast.
+//
+// To keep a steady stream of changes from holding a monitor back forever,
+// no change waits longer than four times the delay.
+//
+// The scheduler also counts the broadcasts the tray service makes, so it
+// can tell its own WM_SETTINGCHANGE from external ones. It makes no system
+// calls.
+//
+class WorkAreaScheduler
+{
+public:
+    struct Change
+    {
+        HMONITOR hMonitor;
+        RECT rcWorkArea;
+    };
+
+    typedef std::vector<Change> ChangeList;
+
+    struct Statistics
+    {
+        UINT uRequested;  // changes requested
+        UINT uSuppressed; // requests that changed nothing, or undid a change
+        UINT uSuperseded; // pending changes replaced before they settled
+        UINT uApplied;    // changes handed out to be applied
+        UINT uBroadcasts; // WM_SETTINGCHANGE broadcasts sent
+        UINT uEchoes;     // broadcasts that came back to us
+        UINT uExternal;   // work area changes made by someone else
+    };
+
+    explicit WorkAreaScheduler(DWORD dwDelay);
+
+    void SetDelay(DWORD dwDelay)
+    {
+        m_dwDelay = dwDelay;
+    }
+
+    //
+    // Requests a new work area for a monitor. rcCurrent is the work area
+    // the monitor has right now, as far as the caller knows.
+    //
+    void Request(HMONITOR hMonitor, const RECT& rcCurrent,
+        const RECT& rcWorkArea, DWORD dwNow);
+
+    //
+    // Returns how long the caller may wait before calling TakeSettled, or
+    // INFINITE if nothing is pending.
+    //
+    DWORD GetTimeout(DWORD dwNow) const;
+
+    //
+    // Moves the changes that are due into changes. The caller applies them
+    // and broadcasts once if there were any.
+    //
+    void TakeSettled(DWORD dwNow, ChangeList& changes);
+
+    // Drops all pending changes
+    void Clear();
+
+    // Notes a WM_SETTINGCHANGE broadcast made by the caller
+    void NoteBroadcast();
+
+    //
+    // Called for every SPI_SETWORKAREA WM_SETTINGCHANGE. Returns true if it
+    // is the echo of one of our own broadcasts.
+    //
+    bool TakeEcho();
+
+    const Statistics& GetStatistics() const
+    {
+        return m_stats;
+    }
+
+    // Broadcasts we made that haven't come back yet
+    UINT GetPendingEchoes() const
+    {
+        return m_uPendingEchoes;
+    }
+
+private:
+    struct Pending
+    {
+        RECT rcOriginal;
+        RECT rcWorkArea;
+        DWORD dwFirst;
+        DWORD dwDue;
+    };
+
+    typedef std::map<HMONITOR, Pending> PendingMap;
+
+    static bool _IsDue(DWORD dwDue, DWORD dwNow)
+    {
+        return (LONG)(dwNow - dwDue) >= 0;
+    }
+
+    static bool _IsEqual(const RECT& rcA, const RECT& rcB)
+    {
+        return rcA.left == rcB.left && rcA.top == rcB.top &&
+            rcA.right == rcB.right && rcA.bottom == rcB.bottom;
+    }
+
+    PendingMap m_mapPending;
+    DWORD m_dwDelay;
+    UINT m_uPendingEchoes;
+    Statistics m_stats;
+};
+
+#endif // TRAYWORKAREASCHEDULER_H
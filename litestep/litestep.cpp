@@ -269,6 +269,7 @@ CLiteStep::CLiteStep()
     m_pTrayService = nullptr;
     m_pFullscreenMonitor = nullptr;
     m_BlockRecycle = 0;
+    m_uMessageTimeout = 0;
 }
 
 
@@ -630,6 +631,22 @@ void CLiteStep::PeekAllMsgs()
 }
 
 
+//
+//
+//
+UINT CLiteStep::GetMessageCount(HINSTANCE hInstance)
+{
+    UINT uCount = 0;
+
+    if (m_pMessageManager)
+    {
+        uCount = m_pMessageManager->GetMessageCount(hInstance);
+    }
+
+    return uCount;
+}
+
+
 //
 //
 //
@@ -843,7 +860,14 @@ LRESULT CLiteStep::InternalWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
         {
             if (m_pTrayService)
             {
-                lReturn = (LRESULT)m_pTrayService->SendSystemTray();
+                if ((wParam & SYSTRAYREADY_SNAPSHOT) && IsWindow((HWND)lParam))
+                {
+                    lReturn = (LRESULT)m_pTrayService->SendSystemTraySnapshot((HWND)lParam);
+                }
+                else
+                {
+                    lReturn = (LRESULT)m_pTrayService->SendSystemTray();
+                }
             }
         }
         break;
@@ -855,10 +879,6 @@ LRESULT CLiteStep::InternalWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
             void *pvData = (void *)lParam;
             if ((pvData != NULL) && (wLength > 0))
             {
-                if (m_pDataStoreManager == NULL)
-                {
-                    m_pDataStoreManager = new DataStore();
-                }
                 if (m_pDataStoreManager)
                 {
                     lReturn = m_pDataStoreManager->StoreData(
@@ -879,13 +899,57 @@ LRESULT CLiteStep::InternalWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
                 {
                     lReturn = m_pDataStoreManager->ReleaseData(
                         wIdent, pvData, wLength);
+                }
+            }
+        }
+        break;
 
-                    if (m_pDataStoreManager->Count() == 0)
-                    {
-                        delete m_pDataStoreManager;
-                        m_pDataStoreManager = NULL;
-                    }
+    case LM_SAVEDATAEX:
+        {
+            LSDATAITEM* pItem = (LSDATAITEM*)lParam;
+
+            if (pItem && pItem->cbSize >= sizeof(LSDATAITEM) &&
+                m_pDataStoreManager)
+            {
+                lReturn = m_pDataStoreManager->StoreData(
+                    pItem->dwIdent, pItem->pvData, pItem->cbData);
+            }
+        }
+        break;
+
+    case LM_RESTOREDATAEX:
+        {
+            LSDATAITEM* pItem = (LSDATAITEM*)lParam;
+
+            if (pItem && pItem->cbSize >= sizeof(LSDATAITEM) &&
+                m_pDataStoreManager)
+            {
+                if (pItem->dwFlags & LSDATA_VIEW)
+                {
+                    const void* pvView = NULL;
+
+                    lReturn = m_pDataStoreManager->AcquireView(
+                        pItem->dwIdent, &pvView, pItem->cbData);
+
+                    pItem->pvData = const_cast<void*>(pvView);
                 }
+                else
+                {
+                    lReturn = m_pDataStoreManager->RestoreData(
+                        pItem->dwIdent, pItem->pvData, pItem->cbData);
+                }
+            }
+        }
+        break;
+
+    case LM_RELEASEDATAVIEW:
+        {
+            LSDATAITEM* pItem = (LSDATAITEM*)lParam;
+
+            if (pItem && pItem->cbSize >= sizeof(LSDATAITEM) &&
+                m_pDataStoreManager)
+            {
+                lReturn = m_pDataStoreManager->ReleaseView(pItem->pvData);
             }
         }
         break;
@@ -931,6 +995,39 @@ LRESULT CLiteStep::InternalWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
         }
         break;
 
+    case LM_ENUMPERFORMANCEEX:
+        {
+            HRESULT hr = E_FAIL;
+
+            if (m_pModuleManager)
+            {
+                hr = m_pModuleManager->EnumPerformanceEx(
+                    (LSENUMPERFORMANCEEXPROCW)wParam, lParam);
+            }
+
+            return hr;
+        }
+        break;
+
+    case LM_GETWORKAREASTATISTICS:
+        {
+            LSWORKAREASTATISTICS* pStats = (LSWORKAREASTATISTICS*)lParam;
+
+            if (pStats && pStats->cbSize >= sizeof(LSWORKAREASTATISTICS) &&
+                m_pTrayService)
+            {
+                m_pTrayService->GetWorkAreaStatistics(*pStats);
+                lReturn = TRUE;
+            }
+        }
+        break;
+
+    case LM_RUNONMAINTHREAD:
+        {
+            LSAPIRunMainThreadWork();
+        }
+        break;
+
     case LM_RECYCLE:
         {
             switch (wParam)
@@ -1173,6 +1270,16 @@ LRESULT CLiteStep::InternalWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
                     wParam = (WPARAM)lParam;
                     lParam = (LPARAM)wExtraBits;
                 }
+
+                if (m_pFullscreenMonitor)
+                {
+                    m_pFullscreenMonitor->OnShellHook(uMsg, (HWND)wParam);
+                }
+
+                if (uMsg == LM_WINDOWDESTROYED && m_pTrayService)
+                {
+                    m_pTrayService->OnWindowDestroyed((HWND)wParam);
+                }
             }
 
             // WM_APP, LM_XYZ, and registered messages are all >= WM_USER
@@ -1181,8 +1288,16 @@ LRESULT CLiteStep::InternalWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
                 if (m_pMessageManager &&
                     m_pMessageManager->HandlerExists(uMsg))
                 {
-                    lReturn = \
-                        m_pMessageManager->SendMessage(uMsg, wParam, lParam);
+                    if (m_uMessageTimeout > 0)
+                    {
+                        lReturn = m_pMessageManager->SendMessageTimeout(
+                            uMsg, wParam, lParam, m_uMessageTimeout);
+                    }
+                    else
+                    {
+                        lReturn = m_pMessageManager->SendMessage(
+                            uMsg, wParam, lParam);
+                    }
                     break;
                 }
             }
@@ -1357,10 +1472,30 @@ HRESULT CLiteStep::_InitManagers()
 
     m_pMessageManager = new MessageManager();
 
+    if (m_pTrayService)
+    {
+        m_pTrayService->SetMessageManager(m_pMessageManager);
+    }
+
     m_pModuleManager = new ModuleManager();
 
+    m_pDataStoreManager = new DataStore();
+
+    // Optional file backing, so saved data survives a crash or restart
+    wchar_t wzDataStoreFile[MAX_PATH];
+
+    if (GetRCStringW(L"LSDataStoreFile", wzDataStoreFile, nullptr, MAX_PATH))
+    {
+        DWORD dwSize = (DWORD)std::max(64, GetRCIntW(L"LSDataStoreSize", 4096));
+
+        if (!m_pDataStoreManager->AttachImage(wzDataStoreFile, dwSize * 1024))
+        {
+            LSLogPrintf(LOG_WARNING, "LiteStep",
+                "Could not map LSDataStoreFile %ls", wzDataStoreFile);
+        }
+    }
+
     // Note:
-    // - The DataStore manager is dynamically initialized/started.
     // - The Bang and Settings managers are located in LSAPI, and
     //   are instantiated via LSAPIInit.
 
@@ -1375,12 +1510,40 @@ HRESULT CLiteStep::_StartManagers()
 {
     HRESULT hr = S_OK;
 
+    // Re-read on every recycle so themes can tune these without a restart
+    m_uMessageTimeout = (UINT)std::max(0, GetRCIntW(L"LSMessageTimeout", 0));
+    LSAPIReloadImageCache();
+
+    // Let the pool decode theme images while modules are being loaded
+    LPVOID f = LCOpenW(nullptr);
+
+    if (f)
+    {
+        wchar_t wzLine[MAX_LINE_LENGTH];
+
+        while (LCReadNextConfigW(f, L"*LSImagePrefetch", wzLine, MAX_LINE_LENGTH))
+        {
+            wchar_t wzToken[MAX_LINE_LENGTH];
+            LPCWSTR pwzNext = wzLine;
+
+            // The first token is the setting's name
+            GetTokenW(pwzNext, wzToken, &pwzNext, FALSE);
+
+            while (pwzNext && GetTokenW(pwzNext, wzToken, &pwzNext, FALSE))
+            {
+                LSPrefetchImagesW(wzToken);
+            }
+        }
+
+        LCClose(f);
+    }
+
     // Load modules
     m_pModuleManager->Start(this);
 
     // Note:
     // - MessageManager has/needs no Start method.
-    // - The DataStore manager is dynamically initialized/started.
+    // - The DataStore manager has/needs no Start method.
 
     return hr;
 }
@@ -1419,6 +1582,11 @@ void CLiteStep::_CleanupManagers()
 
     if (m_pMessageManager)
     {
+        if (m_pTrayService)
+        {
+            m_pTrayService->SetMessageManager(NULL);
+        }
+
         delete m_pMessageManager;
         m_pMessageManager = NULL;
     }
@@ -1445,8 +1613,14 @@ void CLiteStep::_Recycle()
     {
         return;
     }
+
+    m_pModuleManager->PrepareWarmRecycle();
     _StopManagers();
 
+    // Data saved from here on goes into a new arena, the one holding what
+    // the old modules saved is freed once the new modules have drained it
+    m_pDataStoreManager->NextGeneration();
+
     if (GetAsyncKeyState(VK_SHIFT) & 0x8000)
     {
         RESOURCE_MSGBOX(m_hInstance, IDS_LITESTEP_ERROR6,
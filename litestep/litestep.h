@@ -77,6 +77,7 @@ public:
 
     // ILiteStep
     void PeekAllMsgs();
+    UINT GetMessageCount(HINSTANCE hInstance);
 
 private:
     void MessageHandler(MSG &message);
@@ -129,6 +130,9 @@ private:
     bool m_bSignalExit; // = false
     int m_nQuitMsg;
 
+    // Per-window timeout for broadcasts, 0 to wait indefinitely
+    UINT m_uMessageTimeout; // = 0
+
     //
     // Service Related
     //
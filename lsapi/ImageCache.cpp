@@ -0,0 +1,186 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "ImageCache.h"
+#include <functional>
+
+
+//
+// KeyHash
+//
+size_t ImageCache::KeyHash::operator()(const Key& key) const
+{
+    size_t stHash = std::hash<std::wstring>()(key.strPath);
+
+    stHash ^= std::hash<ULONGLONG>()(key.ullWriteTime) + (stHash << 6);
+    stHash ^= std::hash<ULONGLONG>()(key.ullSize) + (stHash << 6);
+    stHash ^= (size_t)key.nIndex + ((size_t)key.dwFlags << 16);
+
+    return stHash;
+}
+
+
+//
+// ImageCache
+//
+ImageCache::ImageCache(size_t cbBudget)
+    : m_cbBudget(cbBudget)
+    , m_cbUsed(0)
+    , m_uHits(0)
+    , m_uMisses(0)
+    , m_uEvictions(0)
+{
+}
+
+
+//
+// ~ImageCache
+//
+ImageCache::~ImageCache()
+{
+    Clear();
+}
+
+
+//
+// SetBudget
+//
+void ImageCache::SetBudget(size_t cbBudget)
+{
+    m_cbBudget = cbBudget;
+    _Trim();
+}
+
+
+//
+// Find
+//
+CachedImage* ImageCache::Find(const Key& key)
+{
+    EntryMap::iterator it = m_map.find(key);
+
+    if (it == m_map.end())
+    {
+        ++m_uMisses;
+        return NULL;
+    }
+
+    ++m_uHits;
+
+    // Move to the front of the LRU list
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+    CachedImage* pImage = it->second->pImage;
+    pImage->AddRef();
+
+    return pImage;
+}
+
+
+//
+// Insert
+//
+ImageCache::InsertResult ImageCache::Insert(const Key& key,
+    CachedImage* pImage, CachedImage** ppExisting)
+{
+    *ppExisting = NULL;
+
+    EntryMap::iterator it = m_map.find(key);
+
+    if (it != m_map.end())
+    {
+        it->second->pImage->AddRef();
+        *ppExisting = it->second->pImage;
+
+        return InsertExisting;
+    }
+
+    if (pImage->GetSize() > m_cbBudget)
+    {
+        return InsertTooLarge;
+    }
+
+    Entry entry = { key, pImage };
+    m_entries.push_front(entry);
+    m_map.insert(EntryMap::value_type(key, m_entries.begin()));
+
+    pImage->AddRef();
+    m_cbUsed += pImage->GetSize();
+
+    _Trim();
+
+    return InsertAdded;
+}
+
+
+//
+// Clear
+//
+void ImageCache::Clear()
+{
+    for (EntryList::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        it->pImage->Release();
+    }
+
+    m_entries.clear();
+    m_map.clear();
+    m_cbUsed = 0;
+}
+
+
+//
+// GetStatistics
+//
+ImageCache::Statistics ImageCache::GetStatistics() const
+{
+    Statistics stats;
+    stats.uHits = m_uHits;
+    stats.uMisses = m_uMisses;
+    stats.uEvictions = m_uEvictions;
+    stats.uImages = (UINT)m_map.size();
+    stats.ullBytes = m_cbUsed;
+    stats.ullBudget = m_cbBudget;
+
+    return stats;
+}
+
+
+//
+// _Trim
+//
+// Evicts the least recently used images until the cache fits its budget.
+//
+void ImageCache::_Trim()
+{
+    while (m_cbUsed > m_cbBudget && !m_entries.empty())
+    {
+        Entry& entry = m_entries.back();
+
+        m_cbUsed -= entry.pImage->GetSize();
+        entry.pImage->Release();
+
+        m_map.erase(entry.key);
+        m_entries.pop_back();
+
+        ++m_uEvictions;
+    }
+}
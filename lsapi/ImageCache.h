@@ -0,0 +1,186 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(IMAGECACHE_H)
+#define IMAGECACHE_H
+
+#include "../utility/portable.h"
+#include "../utility/Base.h"
+#include <list>
+#include <string>
+#include <unordered_map>
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// CachedImage
+//
+// A decoded image held by ImageCache. Derived classes own the actual pixels
+// or handles and free them in their destructor. Images are never modified
+// once they are in the cache.
+//
+class CachedImage : public CountedBase
+{
+public:
+    CachedImage(size_t cbSize, DWORD dwFlags)
+        : m_cbSize(cbSize)
+        , m_dwFlags(dwFlags)
+    {
+    }
+
+    // Memory charged against the cache's budget
+    size_t GetSize() const
+    {
+        return m_cbSize;
+    }
+
+    DWORD GetFlags() const
+    {
+        return m_dwFlags;
+    }
+
+protected:
+    virtual ~CachedImage()
+    {
+        // do nothing
+    }
+
+private:
+    // not implemented
+    CachedImage(const CachedImage& rhs);
+    CachedImage& operator=(const CachedImage& rhs);
+
+    size_t m_cbSize;
+    DWORD m_dwFlags;
+};
+
+
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// ImageCache
+//
+// Keeps decoded images by file and load parameters, so that loading the
+// same image again only costs a copy. Images are evicted least recently used
+// first once the cache holds more than its budget; images still referenced
+// by someone else stay alive until they are released, but no longer count.
+//
+// The cache is not thread safe and makes no system calls. The caller locks
+// and identifies files.
+//
+class ImageCache
+{
+public:
+    struct Key
+    {
+        std::wstring strPath;   // full path, lower case
+        ULONGLONG ullSize;      // file size
+        ULONGLONG ullWriteTime; // last write time
+        int nIndex;             // icon index, 0 for bitmaps
+        DWORD dwFlags;          // load parameters
+
+        bool operator==(const Key& rhs) const
+        {
+            return ullSize == rhs.ullSize &&
+                ullWriteTime == rhs.ullWriteTime && nIndex == rhs.nIndex &&
+                dwFlags == rhs.dwFlags && strPath == rhs.strPath;
+        }
+    };
+
+    struct Statistics
+    {
+        UINT uHits;          // lookups that found an image
+        UINT uMisses;        // lookups that didn't
+        UINT uEvictions;     // images dropped to stay within the budget
+        UINT uImages;        // images in the cache
+        ULONGLONG ullBytes;  // memory used by them
+        ULONGLONG ullBudget; // memory they may use
+    };
+
+    explicit ImageCache(size_t cbBudget);
+    ~ImageCache();
+
+    // Changes the budget, evicting images if it shrank
+    void SetBudget(size_t cbBudget);
+
+    size_t GetBudget() const
+    {
+        return m_cbBudget;
+    }
+
+    //
+    // Returns the image for key with a reference added, or NULL. Counts a
+    // hit or a miss.
+    //
+    CachedImage* Find(const Key& key);
+
+    enum InsertResult
+    {
+        InsertAdded,    // pImage is cached
+        InsertExisting, // another image was added for key in the meantime
+        InsertTooLarge  // pImage is larger than the budget
+    };
+
+    //
+    // Adds an image, taking a reference of its own. On InsertExisting the
+    // image already cached is returned in *ppExisting with a reference added,
+    // and pImage isn't cached; *ppExisting is NULL otherwise.
+    //
+    InsertResult Insert(const Key& key, CachedImage* pImage,
+        CachedImage** ppExisting);
+
+    // Drops all images
+    void Clear();
+
+    Statistics GetStatistics() const;
+
+private:
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        CachedImage* pImage;
+    };
+
+    typedef std::list<Entry> EntryList;
+    typedef std::unordered_map<Key, EntryList::iterator, KeyHash> EntryMap;
+
+    void _Trim();
+
+    // not implemented
+    ImageCache(const ImageCache& rhs);
+    ImageCache& operator=(const ImageCache& rhs);
+
+    // Most recently used first
+    EntryList m_entries;
+    EntryMap m_map;
+
+    size_t m_cbBudget;
+    size_t m_cbUsed;
+    UINT m_uHits;
+    UINT m_uMisses;
+    UINT m_uEvictions;
+};
+
+#endif // IMAGECACHE_H
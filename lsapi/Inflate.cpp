@@ -0,0 +1,958 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "Inflate.h"
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#  define LS_INFLATE_SSE2
+#  include <emmintrin.h>
+#endif
+
+//
+// Error codes, the same picopng has always used:
+//   10  the input ended before the last block did
+//   11  a code that isn't part of the Huffman code
+//   13  a code length repeat runs past the end of the lengths
+//   16  an invalid code length code
+//   18  an invalid distance code
+//   20  an invalid block type
+//   21  a stored block's length doesn't match its complement
+//   23  a stored block runs past the end of the input
+//   24  the zlib header checksum is wrong
+//   25  a compression method other than deflate with a 32K window
+//   26  a preset dictionary, which PNG doesn't allow
+//   52  a stored block or the checksum is missing
+//   53  the zlib stream is too short
+//   54  code length 16 without a previous length
+//   55  over-subscribed or too many code lengths
+//   58  the Adler-32 checksum is wrong
+//   64  the code lengths give the end of block code no code
+// And new ones:
+//   72  more data than fits into the output
+//   73  a distance that points before the start of the output
+//
+
+namespace
+{
+    const unsigned short LENGTH_BASE[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+        59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+
+    const unsigned char LENGTH_EXTRA[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,
+        4, 5, 5, 5, 5, 0 };
+
+    const unsigned short DISTANCE_BASE[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+        513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+        24577 };
+
+    const unsigned char DISTANCE_EXTRA[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+        10, 11, 11, 12, 12, 13, 13 };
+
+    // The order in which code length code lengths are stored
+    const unsigned char CODELENGTH_ORDER[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // Bits looked up in one step. Longer codes take a second lookup.
+    const unsigned int LITLEN_ROOT_BITS = 10;
+    const unsigned int DISTANCE_ROOT_BITS = 8;
+    const unsigned int CODELENGTH_ROOT_BITS = 7;
+
+    const unsigned int MAX_CODE_BITS = 15;
+    const unsigned int INVALID_SYMBOL = 0xFFFF;
+
+
+    //
+    // HuffmanTable
+    //
+    // Lookup table for a canonical Huffman code. It is indexed with the next
+    // bits of the stream; DEFLATE stores codes starting with their first bit,
+    // so the codes are entered bit-reversed.
+    //
+    // An entry holds the symbol in its high 16 bits and the length of the
+    // code in its low byte. Codes longer than the root bits share a root
+    // entry that points to a subtable instead: its high bits are the
+    // subtable's offset, ENTRY_SUBTABLE is set, and the low byte is the
+    // number of bits the subtable is indexed with. Entries no code reaches
+    // are 0.
+    //
+    class HuffmanTable
+    {
+    public:
+        enum
+        {
+            ENTRY_SUBTABLE = 0x100
+        };
+
+        int Build(const unsigned char* pLengths, unsigned int cSymbols,
+            unsigned int uRootBits);
+
+        unsigned int GetRootBits() const
+        {
+            return m_uRootBits;
+        }
+
+        const unsigned int* GetEntries() const
+        {
+            return &m_entries[0];
+        }
+
+    private:
+        std::vector<unsigned int> m_entries;
+        std::vector<unsigned int> m_codes;
+        unsigned int m_uRootBits;
+    };
+
+
+    //
+    // HuffmanTable::Build
+    //
+    int HuffmanTable::Build(const unsigned char* pLengths,
+        unsigned int cSymbols, unsigned int uRootBits)
+    {
+        unsigned int counts[MAX_CODE_BITS + 1] = { 0 };
+
+        for (unsigned int uSymbol = 0; uSymbol < cSymbols; ++uSymbol)
+        {
+            ++counts[pLengths[uSymbol]];
+        }
+
+        counts[0] = 0;
+
+        int nLeft = 1;
+        unsigned int uMaxBits = 0;
+
+        for (unsigned int uBits = 1; uBits <= MAX_CODE_BITS; ++uBits)
+        {
+            nLeft = (nLeft << 1) - (int)counts[uBits];
+
+            if (nLeft < 0)
+            {
+                return 55;
+            }
+
+            if (counts[uBits] != 0)
+            {
+                uMaxBits = uBits;
+            }
+        }
+
+        // Like zlib, only allow an incomplete code if it is a single one-bit
+        // code, as used for blocks with just one distance, or no code at all
+        if (nLeft > 0 && uMaxBits > 1)
+        {
+            return 55;
+        }
+
+        unsigned int nextCode[MAX_CODE_BITS + 1] = { 0 };
+
+        for (unsigned int uBits = 1; uBits <= MAX_CODE_BITS; ++uBits)
+        {
+            nextCode[uBits] = (nextCode[uBits - 1] + counts[uBits - 1]) << 1;
+        }
+
+        m_uRootBits = uRootBits;
+        m_entries.assign((size_t)1 << uRootBits, 0);
+        m_codes.resize(cSymbols);
+
+        const unsigned int uRootMask = (1u << uRootBits) - 1;
+
+        // Assign the codes, and find how many more bits the longest code
+        // behind each root entry needs
+        for (unsigned int uSymbol = 0; uSymbol < cSymbols; ++uSymbol)
+        {
+            unsigned int uBits = pLengths[uSymbol];
+
+            if (uBits == 0)
+            {
+                continue;
+            }
+
+            unsigned int uCode = nextCode[uBits]++;
+            unsigned int uReversed = 0;
+
+            for (unsigned int u = 0; u < uBits; ++u)
+            {
+                uReversed = (uReversed << 1) | ((uCode >> u) & 1);
+            }
+
+            m_codes[uSymbol] = uReversed;
+
+            if (uBits > uRootBits)
+            {
+                unsigned int& uEntry = m_entries[uReversed & uRootMask];
+                unsigned int uSubBits = uBits - uRootBits;
+
+                if ((uEntry & 0xFF) < uSubBits)
+                {
+                    uEntry = ENTRY_SUBTABLE | uSubBits;
+                }
+            }
+        }
+
+        for (unsigned int uRoot = 0; uRoot <= uRootMask; ++uRoot)
+        {
+            if (m_entries[uRoot] & ENTRY_SUBTABLE)
+            {
+                unsigned int uSubBits = m_entries[uRoot] & 0xFF;
+
+                m_entries[uRoot] |= (unsigned int)m_entries.size() << 16;
+                m_entries.resize(m_entries.size() + ((size_t)1 << uSubBits), 0);
+            }
+        }
+
+        // Fill in every entry whose index starts with a code
+        for (unsigned int uSymbol = 0; uSymbol < cSymbols; ++uSymbol)
+        {
+            unsigned int uBits = pLengths[uSymbol];
+
+            if (uBits == 0)
+            {
+                continue;
+            }
+
+            unsigned int uReversed = m_codes[uSymbol];
+
+            if (uBits <= uRootBits)
+            {
+                for (unsigned int u = uReversed; u <= uRootMask; u += 1u << uBits)
+                {
+                    m_entries[u] = (uSymbol << 16) | uBits;
+                }
+            }
+            else
+            {
+                unsigned int uRoot = m_entries[uReversed & uRootMask];
+                unsigned int uOffset = uRoot >> 16;
+                unsigned int uSubBits = uRoot & 0xFF;
+                unsigned int uRest = uBits - uRootBits;
+
+                for (unsigned int u = uReversed >> uRootBits;
+                    u < (1u << uSubBits); u += 1u << uRest)
+                {
+                    m_entries[uOffset + u] = (uSymbol << 16) | uRest;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+
+    //
+    // Inflater
+    //
+    // Decodes raw DEFLATE data. Input is read through a 64-bit bit buffer
+    // that is refilled with one unaligned load, which gives at least 56 bits
+    // - enough for a length, a distance and their extra bits. Past the end
+    // of the input it is filled with zeros, which are counted so that using
+    // them is caught.
+    //
+    class Inflater
+    {
+    public:
+        Inflater(const unsigned char* pIn, size_t cbIn,
+            unsigned char* pOut, size_t cbOut);
+
+        int Run();
+
+        // Where the input continues after the last block, byte aligned
+        int GetInputEnd(const unsigned char** ppEnd);
+
+        size_t GetOutputSize() const
+        {
+            return (size_t)(m_pOut - m_pOutStart);
+        }
+
+    private:
+        void refill();
+        unsigned int getBits(unsigned int uBits);
+        unsigned int decode(const HuffmanTable& table);
+        int alignToByte();
+
+        int inflateStored();
+        int inflateCodes();
+        int readDynamicTables();
+        void buildFixedTables();
+
+        const unsigned char* m_pIn;
+        const unsigned char* m_pInEnd;
+        unsigned long long m_ullBits;
+        unsigned int m_uBitCount;
+        unsigned int m_uOverrun;
+
+        unsigned char* m_pOutStart;
+        unsigned char* m_pOut;
+        unsigned char* m_pOutEnd;
+
+        HuffmanTable m_litlen;
+        HuffmanTable m_distance;
+        HuffmanTable m_codelength;
+    };
+
+
+    //
+    // Inflater constructor
+    //
+    Inflater::Inflater(const unsigned char* pIn, size_t cbIn,
+        unsigned char* pOut, size_t cbOut)
+        : m_pIn(pIn)
+        , m_pInEnd(pIn + cbIn)
+        , m_ullBits(0)
+        , m_uBitCount(0)
+        , m_uOverrun(0)
+        , m_pOutStart(pOut)
+        , m_pOut(pOut)
+        , m_pOutEnd(pOut + cbOut)
+    {
+    }
+
+
+    //
+    // Inflater::refill
+    //
+    inline void Inflater::refill()
+    {
+        if (m_pInEnd - m_pIn >= 8)
+        {
+            // Bits above m_uBitCount are either zero or, after an earlier
+            // load, the same input bits this puts there again. The load is
+            // little endian, as on all targets we build for.
+            unsigned long long ullWord;
+            memcpy(&ullWord, m_pIn, sizeof(ullWord));
+
+            m_ullBits |= ullWord << m_uBitCount;
+            m_pIn += (63 - m_uBitCount) >> 3;
+            m_uBitCount |= 56;
+        }
+        else
+        {
+            while (m_uBitCount <= 56)
+            {
+                if (m_pIn < m_pInEnd)
+                {
+                    m_ullBits |= (unsigned long long)*m_pIn++ << m_uBitCount;
+                }
+                else
+                {
+                    ++m_uOverrun;
+                }
+
+                m_uBitCount += 8;
+            }
+        }
+    }
+
+
+    //
+    // Inflater::getBits
+    //
+    inline unsigned int Inflater::getBits(unsigned int uBits)
+    {
+        unsigned int uValue =
+            (unsigned int)(m_ullBits & ((1ull << uBits) - 1));
+
+        m_ullBits >>= uBits;
+        m_uBitCount -= uBits;
+
+        return uValue;
+    }
+
+
+    //
+    // Inflater::decode
+    //
+    // Reads one symbol, or returns INVALID_SYMBOL. Needs 15 bits in the
+    // buffer.
+    //
+    inline unsigned int Inflater::decode(const HuffmanTable& table)
+    {
+        const unsigned int* pEntries = table.GetEntries();
+        const unsigned int uRootBits = table.GetRootBits();
+
+        unsigned int uEntry =
+            pEntries[m_ullBits & ((1u << uRootBits) - 1)];
+
+        if (uEntry & HuffmanTable::ENTRY_SUBTABLE)
+        {
+            m_ullBits >>= uRootBits;
+            m_uBitCount -= uRootBits;
+
+            uEntry = pEntries[(uEntry >> 16) +
+                (m_ullBits & ((1u << (uEntry & 0xFF)) - 1))];
+        }
+
+        unsigned int uBits = uEntry & 0xFF;
+
+        if (uBits == 0)
+        {
+            return INVALID_SYMBOL;
+        }
+
+        m_ullBits >>= uBits;
+        m_uBitCount -= uBits;
+
+        return uEntry >> 16;
+    }
+
+
+    //
+    // Inflater::alignToByte
+    //
+    // Drops the bits up to the next byte boundary and hands the whole bytes
+    // still in the buffer back to the input.
+    //
+    int Inflater::alignToByte()
+    {
+        getBits(m_uBitCount & 7);
+
+        unsigned int cbBuffered = m_uBitCount >> 3;
+
+        if (cbBuffered < m_uOverrun)
+        {
+            return 10;
+        }
+
+        m_pIn -= cbBuffered - m_uOverrun;
+        m_ullBits = 0;
+        m_uBitCount = 0;
+        m_uOverrun = 0;
+
+        return 0;
+    }
+
+
+    //
+    // Inflater::Run
+    //
+    int Inflater::Run()
+    {
+        unsigned int uFinal = 0;
+
+        while (!uFinal)
+        {
+            refill();
+
+            if (m_uOverrun > 8)
+            {
+                return 10;
+            }
+
+            uFinal = getBits(1);
+
+            int nError = 0;
+
+            switch (getBits(2))
+            {
+            case 0:
+                nError = inflateStored();
+                break;
+
+            case 1:
+                buildFixedTables();
+                nError = inflateCodes();
+                break;
+
+            case 2:
+                nError = readDynamicTables();
+
+                if (nError == 0)
+                {
+                    nError = inflateCodes();
+                }
+                break;
+
+            default:
+                nError = 20;
+                break;
+            }
+
+            if (nError != 0)
+            {
+                return nError;
+            }
+        }
+
+        return 0;
+    }
+
+
+    //
+    // Inflater::GetInputEnd
+    //
+    int Inflater::GetInputEnd(const unsigned char** ppEnd)
+    {
+        int nError = alignToByte();
+
+        if (nError == 0)
+        {
+            *ppEnd = m_pIn;
+        }
+
+        return nError;
+    }
+
+
+    //
+    // Inflater::inflateStored
+    //
+    int Inflater::inflateStored()
+    {
+        int nError = alignToByte();
+
+        if (nError != 0)
+        {
+            return nError;
+        }
+
+        if (m_pInEnd - m_pIn < 4)
+        {
+            return 52;
+        }
+
+        size_t cbLength = m_pIn[0] | (m_pIn[1] << 8);
+        size_t cbComplement = m_pIn[2] | (m_pIn[3] << 8);
+        m_pIn += 4;
+
+        if (cbLength + cbComplement != 65535)
+        {
+            return 21;
+        }
+
+        if (cbLength > (size_t)(m_pInEnd - m_pIn))
+        {
+            return 23;
+        }
+
+        if (cbLength > (size_t)(m_pOutEnd - m_pOut))
+        {
+            return 72;
+        }
+
+        memcpy(m_pOut, m_pIn, cbLength);
+        m_pOut += cbLength;
+        m_pIn += cbLength;
+
+        return 0;
+    }
+
+
+    //
+    // Inflater::buildFixedTables
+    //
+    void Inflater::buildFixedTables()
+    {
+        unsigned char lengths[288 + 32];
+
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        memset(lengths + 288, 5, 32);
+
+        m_litlen.Build(lengths, 288, LITLEN_ROOT_BITS);
+        m_distance.Build(lengths + 288, 32, DISTANCE_ROOT_BITS);
+    }
+
+
+    //
+    // Inflater::readDynamicTables
+    //
+    int Inflater::readDynamicTables()
+    {
+        refill();
+
+        unsigned int cLitLen = getBits(5) + 257;
+        unsigned int cDistance = getBits(5) + 1;
+        unsigned int cCodeLength = getBits(4) + 4;
+
+        if (cLitLen > 286 || cDistance > 30)
+        {
+            return 55;
+        }
+
+        unsigned char lengths[286 + 30] = { 0 };
+
+        for (unsigned int u = 0; u < cCodeLength; ++u)
+        {
+            refill();
+            lengths[CODELENGTH_ORDER[u]] = (unsigned char)getBits(3);
+        }
+
+        int nError = m_codelength.Build(lengths, 19, CODELENGTH_ROOT_BITS);
+
+        if (nError != 0)
+        {
+            return nError;
+        }
+
+        memset(lengths, 0, 19);
+
+        unsigned int cTotal = cLitLen + cDistance;
+
+        for (unsigned int u = 0; u < cTotal; )
+        {
+            refill();
+
+            if (m_uOverrun > 8)
+            {
+                return 10;
+            }
+
+            unsigned int uSymbol = decode(m_codelength);
+            unsigned int cRepeat;
+            unsigned char ucValue = 0;
+
+            if (uSymbol < 16)
+            {
+                lengths[u++] = (unsigned char)uSymbol;
+                continue;
+            }
+            else if (uSymbol == 16)
+            {
+                if (u == 0)
+                {
+                    return 54;
+                }
+
+                ucValue = lengths[u - 1];
+                cRepeat = 3 + getBits(2);
+            }
+            else if (uSymbol == 17)
+            {
+                cRepeat = 3 + getBits(3);
+            }
+            else if (uSymbol == 18)
+            {
+                cRepeat = 11 + getBits(7);
+            }
+            else
+            {
+                return 16;
+            }
+
+            if (cRepeat > cTotal - u)
+            {
+                return 13;
+            }
+
+            memset(lengths + u, ucValue, cRepeat);
+            u += cRepeat;
+        }
+
+        if (lengths[256] == 0)
+        {
+            return 64;
+        }
+
+        nError = m_litlen.Build(lengths, cLitLen, LITLEN_ROOT_BITS);
+
+        if (nError == 0)
+        {
+            nError = m_distance.Build(lengths + cLitLen, cDistance,
+                DISTANCE_ROOT_BITS);
+        }
+
+        return nError;
+    }
+
+
+    //
+    // Inflater::inflateCodes
+    //
+    int Inflater::inflateCodes()
+    {
+        for (;;)
+        {
+            refill();
+
+            if (m_uOverrun > 8)
+            {
+                return 10;
+            }
+
+            unsigned int uSymbol = decode(m_litlen);
+
+            if (uSymbol < 256)
+            {
+                if (m_pOut == m_pOutEnd)
+                {
+                    return 72;
+                }
+
+                *m_pOut++ = (unsigned char)uSymbol;
+                continue;
+            }
+
+            if (uSymbol == 256)
+            {
+                return 0;
+            }
+
+            uSymbol -= 257;
+
+            if (uSymbol >= 29)
+            {
+                return 11;
+            }
+
+            size_t cbLength =
+                LENGTH_BASE[uSymbol] + getBits(LENGTH_EXTRA[uSymbol]);
+
+            unsigned int uDistanceSymbol = decode(m_distance);
+
+            if (uDistanceSymbol >= 30)
+            {
+                return (uDistanceSymbol == INVALID_SYMBOL) ? 11 : 18;
+            }
+
+            size_t cbDistance = DISTANCE_BASE[uDistanceSymbol] +
+                getBits(DISTANCE_EXTRA[uDistanceSymbol]);
+
+            if (cbDistance > (size_t)(m_pOut - m_pOutStart))
+            {
+                return 73;
+            }
+
+            if (cbLength > (size_t)(m_pOutEnd - m_pOut))
+            {
+                return 72;
+            }
+
+            unsigned char* pDest = m_pOut;
+            unsigned char* pDestEnd = m_pOut + cbLength;
+            const unsigned char* pSource = m_pOut - cbDistance;
+
+            if (cbDistance >= 8 && m_pOutEnd - pDestEnd >= 8)
+            {
+                // Eight bytes at a time, which may write up to seven bytes
+                // past the match; they are overwritten by what follows
+                do
+                {
+                    memcpy(pDest, pSource, 8);
+                    pDest += 8;
+                    pSource += 8;
+                }
+                while (pDest < pDestEnd);
+            }
+            else if (cbDistance == 1)
+            {
+                memset(pDest, *pSource, cbLength);
+            }
+            else
+            {
+                do
+                {
+                    *pDest++ = *pSource++;
+                }
+                while (pDest < pDestEnd);
+            }
+
+            m_pOut = pDestEnd;
+        }
+    }
+}
+
+
+//
+// InflateZlib
+//
+int InflateZlib(const unsigned char* pIn, size_t cbIn,
+    unsigned char* pOut, size_t cbOut, size_t* pcbWritten)
+{
+    *pcbWritten = 0;
+
+    if (cbIn < 2)
+    {
+        return 53;
+    }
+
+    if ((pIn[0] * 256 + pIn[1]) % 31 != 0)
+    {
+        return 24;
+    }
+
+    if ((pIn[0] & 15) != 8 || ((pIn[0] >> 4) & 15) > 7)
+    {
+        return 25;
+    }
+
+    if ((pIn[1] >> 5) & 1)
+    {
+        return 26;
+    }
+
+    Inflater inflater(pIn + 2, cbIn - 2, pOut, cbOut);
+
+    int nError = inflater.Run();
+
+    const unsigned char* pEnd = NULL;
+
+    if (nError == 0)
+    {
+        nError = inflater.GetInputEnd(&pEnd);
+    }
+
+    if (nError != 0)
+    {
+        return nError;
+    }
+
+    if (pIn + cbIn - pEnd < 4)
+    {
+        return 52;
+    }
+
+    unsigned int uAdler = ((unsigned int)pEnd[0] << 24) |
+        (pEnd[1] << 16) | (pEnd[2] << 8) | pEnd[3];
+
+    *pcbWritten = inflater.GetOutputSize();
+
+    if (Adler32(1, pOut, *pcbWritten) != uAdler)
+    {
+        return 58;
+    }
+
+    return 0;
+}
+
+
+//
+// Adler-32 sums are reduced modulo 65521 at least every 5552 bytes, the
+// most that can be added before the sums could overflow 32 bits.
+//
+#define ADLER_BASE 65521
+#define ADLER_NMAX 5552
+
+
+//
+// Adler32Scalar
+//
+unsigned int Adler32Scalar(unsigned int uAdler, const unsigned char* pData,
+    size_t cbData)
+{
+    unsigned int a = uAdler & 0xFFFF;
+    unsigned int b = uAdler >> 16;
+
+    while (cbData > 0)
+    {
+        size_t cbChunk = (cbData < ADLER_NMAX) ? cbData : ADLER_NMAX;
+        cbData -= cbChunk;
+
+        for (; cbChunk >= 8; cbChunk -= 8, pData += 8)
+        {
+            a += pData[0]; b += a;
+            a += pData[1]; b += a;
+            a += pData[2]; b += a;
+            a += pData[3]; b += a;
+            a += pData[4]; b += a;
+            a += pData[5]; b += a;
+            a += pData[6]; b += a;
+            a += pData[7]; b += a;
+        }
+
+        for (; cbChunk > 0; --cbChunk)
+        {
+            a += *pData++;
+            b += a;
+        }
+
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+
+//
+// Adler32
+//
+// For a block of 16 bytes x0..x15, a grows by their sum and b by 16 times
+// the old a plus 16*x0 + 15*x1 + ... + 1*x15. The SSE2 loop keeps the byte
+// sums, the sum of the byte sums of all earlier blocks, and the weighted
+// sums in separate lanes and combines them once per chunk.
+//
+unsigned int Adler32(unsigned int uAdler, const unsigned char* pData,
+    size_t cbData)
+{
+#if defined(LS_INFLATE_SSE2)
+    unsigned int a = uAdler & 0xFFFF;
+    unsigned int b = uAdler >> 16;
+
+    const __m128i xmmZero = _mm_setzero_si128();
+    const __m128i xmmWeightsLow = _mm_set_epi16(9, 10, 11, 12, 13, 14, 15, 16);
+    const __m128i xmmWeightsHigh = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+
+    while (cbData >= 16)
+    {
+        // Whole blocks only; what's left goes through the scalar version
+        size_t cbChunk = (cbData < ADLER_NMAX) ? cbData : ADLER_NMAX;
+        cbChunk &= ~(size_t)15;
+        cbData -= cbChunk;
+
+        size_t cBlocks = cbChunk / 16;
+
+        __m128i xmmSum = xmmZero;
+        __m128i xmmPrefix = xmmZero;
+        __m128i xmmWeighted = xmmZero;
+
+        for (size_t i = 0; i < cBlocks; ++i, pData += 16)
+        {
+            __m128i xmmBytes = _mm_loadu_si128((const __m128i*)pData);
+
+            xmmPrefix = _mm_add_epi32(xmmPrefix, xmmSum);
+            xmmSum = _mm_add_epi32(xmmSum, _mm_sad_epu8(xmmBytes, xmmZero));
+
+            xmmWeighted = _mm_add_epi32(xmmWeighted, _mm_add_epi32(
+                _mm_madd_epi16(_mm_unpacklo_epi8(xmmBytes, xmmZero),
+                    xmmWeightsLow),
+                _mm_madd_epi16(_mm_unpackhi_epi8(xmmBytes, xmmZero),
+                    xmmWeightsHigh)));
+        }
+
+        unsigned int lanes[4];
+
+        _mm_storeu_si128((__m128i*)lanes, xmmSum);
+        unsigned int uSum = lanes[0] + lanes[2];
+
+        _mm_storeu_si128((__m128i*)lanes, xmmPrefix);
+        unsigned int uPrefix = lanes[0] + lanes[2];
+
+        _mm_storeu_si128((__m128i*)lanes, xmmWeighted);
+        unsigned int uWeighted = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+        b += (unsigned int)cbChunk * a + 16 * uPrefix + uWeighted;
+        a += uSum;
+
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    return Adler32Scalar((b << 16) | a, pData, cbData);
+#else
+    return Adler32Scalar(uAdler, pData, cbData);
+#endif // LS_INFLATE_SSE2
+}
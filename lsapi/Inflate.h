@@ -0,0 +1,57 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(INFLATE_H)
+#define INFLATE_H
+
+#include <cstddef>
+
+//
+// DEFLATE and zlib decompression (RFC 1950 and 1951) for the PNG decoder,
+// plus the Adler-32 checksum of zlib streams. The CRC-32 of PNG chunks is in
+// utility/crc32.h. Errors are reported with picopng's
+// error codes, listed in Inflate.cpp.
+//
+
+//
+// InflateZlib
+//
+// Decompresses the zlib stream at pIn into pOut, which must have room for
+// all of the data; a stream that doesn't fit is an error. Checks the stream's
+// Adler-32 checksum. Returns 0 on success, and the number of bytes written in
+// *pcbWritten.
+//
+int InflateZlib(const unsigned char* pIn, size_t cbIn,
+    unsigned char* pOut, size_t cbOut, size_t* pcbWritten);
+
+//
+// Adler32
+//
+// Continues the Adler-32 checksum uAdler, which starts as 1, over pData.
+// Uses SSE2 where the target guarantees it; Adler32Scalar is the reference.
+//
+unsigned int Adler32(unsigned int uAdler, const unsigned char* pData,
+    size_t cbData);
+
+unsigned int Adler32Scalar(unsigned int uAdler, const unsigned char* pData,
+    size_t cbData);
+
+#endif // INFLATE_H
@@ -0,0 +1,265 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "PixelConvert.h"
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#  define LS_PIXEL_SSE2
+#  include <emmintrin.h>
+#endif
+
+
+//
+// _Load32
+//
+static inline unsigned int _Load32(const unsigned char* p)
+{
+    unsigned int u;
+    memcpy(&u, p, sizeof(u));
+    return u;
+}
+
+
+//
+// _Store32
+//
+static inline void _Store32(unsigned char* p, unsigned int u)
+{
+    memcpy(p, &u, sizeof(u));
+}
+
+
+//
+// SwizzleRGBAToBGRAScalar
+//
+void SwizzleRGBAToBGRAScalar(unsigned char* pDest,
+    const unsigned char* pSource, size_t cPixels)
+{
+    for (size_t i = 0; i < cPixels * 4; i += 4)
+    {
+        unsigned char r = pSource[i];
+        unsigned char g = pSource[i + 1];
+        unsigned char b = pSource[i + 2];
+        unsigned char a = pSource[i + 3];
+
+        pDest[i] = b;
+        pDest[i + 1] = g;
+        pDest[i + 2] = r;
+        pDest[i + 3] = a;
+    }
+}
+
+
+//
+// SwizzleRGBAToBGRA
+//
+// Works on little endian 32-bit words, 0xAABBGGRR, keeping alpha and green
+// in place and swapping the two bytes between them. Without SSSE3's pshufb
+// that is two shifts and three masks per four pixels.
+//
+void SwizzleRGBAToBGRA(unsigned char* pDest, const unsigned char* pSource,
+    size_t cPixels)
+{
+    size_t i = 0;
+
+#if defined(LS_PIXEL_SSE2)
+    const __m128i xmmKeep = _mm_set1_epi32(0xFF00FF00);
+    const __m128i xmmLow = _mm_set1_epi32(0x000000FF);
+    const __m128i xmmHigh = _mm_set1_epi32(0x00FF0000);
+
+    for (; i + 4 <= cPixels; i += 4)
+    {
+        __m128i xmmPixels =
+            _mm_loadu_si128((const __m128i*)(pSource + i * 4));
+
+        __m128i xmmResult = _mm_or_si128(
+            _mm_and_si128(xmmPixels, xmmKeep),
+            _mm_or_si128(
+                _mm_and_si128(_mm_srli_epi32(xmmPixels, 16), xmmLow),
+                _mm_and_si128(_mm_slli_epi32(xmmPixels, 16), xmmHigh)));
+
+        _mm_storeu_si128((__m128i*)(pDest + i * 4), xmmResult);
+    }
+#endif // LS_PIXEL_SSE2
+
+    for (; i < cPixels; ++i)
+    {
+        unsigned int u = _Load32(pSource + i * 4);
+
+        _Store32(pDest + i * 4, (u & 0xFF00FF00) |
+            ((u >> 16) & 0x000000FF) | ((u << 16) & 0x00FF0000));
+    }
+}
+
+
+//
+// _Premultiply
+//
+// c * a / 255, rounded, without a division.
+//
+static inline unsigned int _Premultiply(unsigned int c, unsigned int a)
+{
+    unsigned int t = c * a + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+
+//
+// PremultiplyAlphaScalar
+//
+void PremultiplyAlphaScalar(unsigned char* pPixels, size_t cPixels)
+{
+    for (size_t i = 0; i < cPixels * 4; i += 4)
+    {
+        unsigned int a = pPixels[i + 3];
+
+        pPixels[i] = (unsigned char)_Premultiply(pPixels[i], a);
+        pPixels[i + 1] = (unsigned char)_Premultiply(pPixels[i + 1], a);
+        pPixels[i + 2] = (unsigned char)_Premultiply(pPixels[i + 2], a);
+    }
+}
+
+
+//
+// PremultiplyAlpha
+//
+// Four pixels at a time, widened to 16-bit lanes where c * a + 128 still
+// fits. Runs of opaque pixels, the bulk of most skins, are skipped.
+//
+void PremultiplyAlpha(unsigned char* pPixels, size_t cPixels)
+{
+    size_t i = 0;
+
+#if defined(LS_PIXEL_SSE2)
+    const __m128i xmmZero = _mm_setzero_si128();
+    const __m128i xmmAlpha = _mm_set1_epi32(0xFF000000);
+    const __m128i xmmRound = _mm_set1_epi16(128);
+
+    for (; i + 4 <= cPixels; i += 4)
+    {
+        __m128i* pxmm = (__m128i*)(pPixels + i * 4);
+        __m128i xmmPixels = _mm_loadu_si128(pxmm);
+
+        __m128i xmmOpaque = _mm_cmpeq_epi32(
+            _mm_and_si128(xmmPixels, xmmAlpha), xmmAlpha);
+
+        if (_mm_movemask_epi8(xmmOpaque) == 0xFFFF)
+        {
+            continue;
+        }
+
+        __m128i xmmLow = _mm_unpacklo_epi8(xmmPixels, xmmZero);
+        __m128i xmmHigh = _mm_unpackhi_epi8(xmmPixels, xmmZero);
+
+        __m128i xmmLowAlpha = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(xmmLow, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i xmmHighAlpha = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(xmmHigh, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+
+        xmmLow = _mm_add_epi16(_mm_mullo_epi16(xmmLow, xmmLowAlpha),
+            xmmRound);
+        xmmHigh = _mm_add_epi16(_mm_mullo_epi16(xmmHigh, xmmHighAlpha),
+            xmmRound);
+
+        xmmLow = _mm_srli_epi16(
+            _mm_add_epi16(xmmLow, _mm_srli_epi16(xmmLow, 8)), 8);
+        xmmHigh = _mm_srli_epi16(
+            _mm_add_epi16(xmmHigh, _mm_srli_epi16(xmmHigh, 8)), 8);
+
+        // The alpha lanes got multiplied too, put the originals back
+        __m128i xmmResult = _mm_or_si128(
+            _mm_andnot_si128(xmmAlpha, _mm_packus_epi16(xmmLow, xmmHigh)),
+            _mm_and_si128(xmmPixels, xmmAlpha));
+
+        _mm_storeu_si128(pxmm, xmmResult);
+    }
+#endif // LS_PIXEL_SSE2
+
+    PremultiplyAlphaScalar(pPixels + i * 4, cPixels - i);
+}
+
+
+//
+// ColorKeyToAlphaScalar
+//
+void ColorKeyToAlphaScalar(unsigned char* pPixels, size_t cPixels,
+    unsigned int uKey)
+{
+    uKey &= 0x00FFFFFF;
+
+    for (size_t i = 0; i < cPixels; ++i)
+    {
+        unsigned int u = _Load32(pPixels + i * 4);
+
+        _Store32(pPixels + i * 4,
+            ((u & 0x00FFFFFF) == uKey) ? 0 : (u | 0xFF000000));
+    }
+}
+
+
+//
+// ColorKeyToAlpha
+//
+void ColorKeyToAlpha(unsigned char* pPixels, size_t cPixels,
+    unsigned int uKey)
+{
+    size_t i = 0;
+
+#if defined(LS_PIXEL_SSE2)
+    const __m128i xmmColor = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i xmmAlpha = _mm_set1_epi32(0xFF000000);
+    const __m128i xmmKey = _mm_set1_epi32((int)(uKey & 0x00FFFFFF));
+
+    for (; i + 4 <= cPixels; i += 4)
+    {
+        __m128i* pxmm = (__m128i*)(pPixels + i * 4);
+        __m128i xmmPixels = _mm_loadu_si128(pxmm);
+
+        __m128i xmmKeyed = _mm_cmpeq_epi32(
+            _mm_and_si128(xmmPixels, xmmColor), xmmKey);
+
+        _mm_storeu_si128(pxmm, _mm_andnot_si128(xmmKeyed,
+            _mm_or_si128(xmmPixels, xmmAlpha)));
+    }
+#endif // LS_PIXEL_SSE2
+
+    ColorKeyToAlphaScalar(pPixels + i * 4, cPixels - i, uKey);
+}
+
+
+//
+// HasAlpha
+//
+bool HasAlpha(const unsigned char* pPixels, size_t cPixels)
+{
+    for (size_t i = 0; i < cPixels; ++i)
+    {
+        if (pPixels[i * 4 + 3] != 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,75 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(PIXELCONVERT_H)
+#define PIXELCONVERT_H
+
+#include <cstddef>
+
+//
+// Pixel format conversions used when decoding images into 32-bit DIBs.
+// Pixels are 4 bytes each. The SSE2 versions are used where the target
+// guarantees SSE2; the Scalar versions are their reference.
+//
+
+//
+// SwizzleRGBAToBGRA
+//
+// Swaps the first and third byte of each pixel, turning RGBA as PNG stores
+// it into BGRA as DIBs want it, and vice versa. pDest may equal pSource.
+//
+void SwizzleRGBAToBGRA(unsigned char* pDest, const unsigned char* pSource,
+    size_t cPixels);
+
+void SwizzleRGBAToBGRAScalar(unsigned char* pDest,
+    const unsigned char* pSource, size_t cPixels);
+
+//
+// PremultiplyAlpha
+//
+// Multiplies the color of each BGRA pixel by its alpha, rounded to nearest,
+// which is what AlphaBlend with AC_SRC_ALPHA expects. Works in place.
+//
+void PremultiplyAlpha(unsigned char* pPixels, size_t cPixels);
+
+void PremultiplyAlphaScalar(unsigned char* pPixels, size_t cPixels);
+
+//
+// ColorKeyToAlpha
+//
+// Turns pixels whose color is uKey (0x00RRGGBB, alpha ignored) into
+// transparent black and makes all others opaque. Works in place.
+//
+void ColorKeyToAlpha(unsigned char* pPixels, size_t cPixels,
+    unsigned int uKey);
+
+void ColorKeyToAlphaScalar(unsigned char* pPixels, size_t cPixels,
+    unsigned int uKey);
+
+//
+// HasAlpha
+//
+// True if any pixel has a non-zero alpha byte. Bitmaps that never had an
+// alpha channel come out of GetDIBits with all of them zero.
+//
+bool HasAlpha(const unsigned char* pPixels, size_t cPixels);
+
+#endif // PIXELCONVERT_H
@@ -0,0 +1,251 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "RegionScan.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#  define LS_REGION_SSE2
+#  include <emmintrin.h>
+#endif
+
+
+//
+// _IsTransparent
+//
+static inline bool _IsTransparent(DWORD dwPixel, const RegionKey& key)
+{
+    if (key.bExact)
+    {
+        return dwPixel == key.dwLow;
+    }
+
+    for (int nShift = 0; nShift < 24; nShift += 8)
+    {
+        DWORD dwByte = (dwPixel >> nShift) & 0xFF;
+
+        if (dwByte < ((key.dwLow >> nShift) & 0xFF) ||
+            dwByte > ((key.dwHigh >> nShift) & 0xFF))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+//
+// _Step
+//
+// Opens or closes a run at x.
+//
+static inline void _Step(bool bTransparent, int x, bool& bInSpan,
+    int* pSpans, int& nSpans)
+{
+    if (bTransparent == bInSpan)
+    {
+        if (bInSpan)
+        {
+            pSpans[2 * nSpans + 1] = x;
+            ++nSpans;
+        }
+        else
+        {
+            pSpans[2 * nSpans] = x;
+        }
+
+        bInSpan = !bInSpan;
+    }
+}
+
+
+#if defined(LS_REGION_SSE2)
+//
+// _TransparentMask4
+//
+// Bit n is set if pixel n of the four at pPixels is transparent.
+//
+static inline int _TransparentMask4(const DWORD* pPixels, bool bExact,
+    __m128i xmmLow, __m128i xmmHigh)
+{
+    __m128i xmmPixels = _mm_loadu_si128((const __m128i*)pPixels);
+    __m128i xmmMatch;
+
+    if (bExact)
+    {
+        xmmMatch = _mm_cmpeq_epi32(xmmPixels, xmmLow);
+    }
+    else
+    {
+        // Per byte: low <= pixel <= high, ie. max(pixel, low) == pixel and
+        // min(pixel, high) == pixel
+        __m128i xmmInRange = _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_max_epu8(xmmPixels, xmmLow), xmmPixels),
+            _mm_cmpeq_epi8(_mm_min_epu8(xmmPixels, xmmHigh), xmmPixels));
+
+        xmmMatch = _mm_cmpeq_epi32(xmmInRange, _mm_set1_epi32(-1));
+    }
+
+    return _mm_movemask_ps(_mm_castsi128_ps(xmmMatch));
+}
+#endif // LS_REGION_SSE2
+
+
+//
+// ScanOpaqueSpansScalar
+//
+int ScanOpaqueSpansScalar(const DWORD* pRow, int nWidth, const RegionKey& key,
+    int* pSpans)
+{
+    int nSpans = 0;
+    bool bInSpan = false;
+
+    for (int x = 0; x < nWidth; ++x)
+    {
+        _Step(_IsTransparent(pRow[x], key), x, bInSpan, pSpans, nSpans);
+    }
+
+    if (bInSpan)
+    {
+        pSpans[2 * nSpans + 1] = nWidth;
+        ++nSpans;
+    }
+
+    return nSpans;
+}
+
+
+//
+// ScanOpaqueSpans
+//
+int ScanOpaqueSpans(const DWORD* pRow, int nWidth, const RegionKey& key,
+    int* pSpans)
+{
+#if defined(LS_REGION_SSE2)
+    int nSpans = 0;
+    bool bInSpan = false;
+    int x = 0;
+
+    __m128i xmmLow = _mm_set1_epi32((int)key.dwLow);
+    __m128i xmmHigh = _mm_set1_epi32((int)key.dwHigh);
+
+    // 16 pixels at a time. Blocks that are all one kind, which is most of
+    // them, cost at most one step
+    for (; x + 16 <= nWidth; x += 16)
+    {
+        int nMask =
+            _TransparentMask4(pRow + x,      key.bExact, xmmLow, xmmHigh)       |
+            _TransparentMask4(pRow + x + 4,  key.bExact, xmmLow, xmmHigh) << 4  |
+            _TransparentMask4(pRow + x + 8,  key.bExact, xmmLow, xmmHigh) << 8  |
+            _TransparentMask4(pRow + x + 12, key.bExact, xmmLow, xmmHigh) << 12;
+
+        if (nMask == 0xFFFF || nMask == 0)
+        {
+            _Step(nMask != 0, x, bInSpan, pSpans, nSpans);
+            continue;
+        }
+
+        for (int i = 0; i < 16; ++i)
+        {
+            _Step((nMask & (1 << i)) != 0, x + i, bInSpan, pSpans, nSpans);
+        }
+    }
+
+    for (; x < nWidth; ++x)
+    {
+        _Step(_IsTransparent(pRow[x], key), x, bInSpan, pSpans, nSpans);
+    }
+
+    if (bInSpan)
+    {
+        pSpans[2 * nSpans + 1] = nWidth;
+        ++nSpans;
+    }
+
+    return nSpans;
+#else
+    return ScanOpaqueSpansScalar(pRow, nWidth, key, pSpans);
+#endif // LS_REGION_SSE2
+}
+
+
+//
+// RegionRectList
+//
+RegionRectList::RegionRectList(int xOffset, int yOffset)
+    : m_stLastFirst(0)
+    , m_yLast(0)
+    , m_xOffset(xOffset)
+    , m_yOffset(yOffset)
+{
+    memset(&m_rcBounds, 0, sizeof(m_rcBounds));
+}
+
+
+//
+// AddRow
+//
+void RegionRectList::AddRow(int y, const int* pSpans, int nSpans)
+{
+    size_t stInts = 2 * (size_t)nSpans;
+
+    if (nSpans > 0 && !m_rects.empty() && y == m_yLast + 1 &&
+        m_lastSpans.size() == stInts &&
+        std::equal(m_lastSpans.begin(), m_lastSpans.end(), pSpans))
+    {
+        for (size_t st = m_stLastFirst; st < m_rects.size(); ++st)
+        {
+            ++m_rects[st].bottom;
+        }
+
+        m_rcBounds.bottom = y + 1 + m_yOffset;
+        m_yLast = y;
+        return;
+    }
+
+    m_lastSpans.assign(pSpans, pSpans + stInts);
+    m_stLastFirst = m_rects.size();
+    m_yLast = y;
+
+    for (int n = 0; n < nSpans; ++n)
+    {
+        RECT rc;
+        rc.left = pSpans[2 * n] + m_xOffset;
+        rc.top = y + m_yOffset;
+        rc.right = pSpans[2 * n + 1] + m_xOffset;
+        rc.bottom = y + 1 + m_yOffset;
+
+        if (m_rects.empty())
+        {
+            m_rcBounds = rc;
+        }
+        else
+        {
+            m_rcBounds.left = std::min(m_rcBounds.left, rc.left);
+            m_rcBounds.right = std::max(m_rcBounds.right, rc.right);
+            m_rcBounds.bottom = rc.bottom;
+        }
+
+        m_rects.push_back(rc);
+    }
+}
@@ -0,0 +1,114 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(REGIONSCAN_H)
+#define REGIONSCAN_H
+
+#include "../utility/portable.h"
+#include <vector>
+
+//
+// Pixels are 32-bit DIB pixels, 0xAARRGGBB, as BitmapToRegion reads them.
+//
+
+//
+// RegionKey
+//
+// Describes which pixels are transparent. An exact key matches one 32-bit
+// value, alpha included. A range key matches pixels whose blue, green and red
+// bytes each lie within [dwLow, dwHigh]; alpha is ignored.
+//
+struct RegionKey
+{
+    DWORD dwLow;
+    DWORD dwHigh;
+    bool bExact;
+
+    static RegionKey Exact(DWORD dwPixel)
+    {
+        RegionKey key = { dwPixel, dwPixel, true };
+        return key;
+    }
+
+    static RegionKey Range(DWORD dwLow, DWORD dwHigh)
+    {
+        RegionKey key = { dwLow & 0x00FFFFFF, dwHigh | 0xFF000000, false };
+        return key;
+    }
+};
+
+
+//
+// ScanOpaqueSpans
+//
+// Finds the runs of non-transparent pixels in one row. Each run is stored as
+// a pair of start and end (exclusive) x coordinates in pSpans, which must
+// have room for nWidth + 1 ints. Returns the number of runs. Uses SSE2 where
+// the target guarantees it.
+//
+int ScanOpaqueSpans(const DWORD* pRow, int nWidth, const RegionKey& key,
+    int* pSpans);
+
+// Plain C version of ScanOpaqueSpans, the reference for the SSE2 one
+int ScanOpaqueSpansScalar(const DWORD* pRow, int nWidth, const RegionKey& key,
+    int* pSpans);
+
+
+//
+// RegionRectList
+//
+// Collects the runs of each row as rectangles in the y-x banded order
+// RGNDATA wants. A row with exactly the same runs as the row above it
+// extends that row's rectangles instead of adding new ones. Rows must be
+// added top to bottom.
+//
+class RegionRectList
+{
+public:
+    RegionRectList(int xOffset, int yOffset);
+
+    void AddRow(int y, const int* pSpans, int nSpans);
+
+    const std::vector<RECT>& GetRects() const
+    {
+        return m_rects;
+    }
+
+    // Bounding rectangle of all rects, empty if there are none
+    const RECT& GetBounds() const
+    {
+        return m_rcBounds;
+    }
+
+private:
+    std::vector<RECT> m_rects;
+    RECT m_rcBounds;
+
+    // Runs of the last row added, and where its rects start
+    std::vector<int> m_lastSpans;
+    size_t m_stLastFirst;
+    int m_yLast;
+
+    int m_xOffset;
+    int m_yOffset;
+};
+
+#endif // REGIONSCAN_H
@@ -20,6 +20,10 @@
 //
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 #include "../utility/core.hpp"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
 
 
 extern DWORD WINAPI AboutBoxThread(LPVOID);
@@ -28,6 +32,7 @@ static void BangAbout(HWND hCaller, LPCWSTR pwzArgs);
 static void BangAlert(HWND hCaller, LPCWSTR pwzArgs);
 static void BangCascadeWindows(HWND hCaller, LPCWSTR pwzArgs);
 static void BangConfirm(HWND hCaller, LPCWSTR pwzArgs);
+static void BangDumpPerformance(HWND hCaller, LPCWSTR pwzArgs);
 static void BangExecute(HWND hCaller, LPCWSTR pwzArgs);
 static void BangHideModules (HWND hCaller, LPCWSTR pwzArgs);
 static void BangLogoff(HWND hCaller, LPCWSTR pwzArgs);
@@ -54,6 +59,7 @@ void SetupBangs(void)
     AddBangCommandW(L"!Alert",            BangAlert);
     AddBangCommandW(L"!CascadeWindows",   BangCascadeWindows);
     AddBangCommandW(L"!Confirm",          BangConfirm);
+    AddBangCommandW(L"!DumpPerformance",  BangDumpPerformance);
     AddBangCommandW(L"!Execute",          BangExecute);
     AddBangCommandW(L"!HideModules",      BangHideModules);
     AddBangCommandW(L"!Logoff",           BangLogoff);
@@ -155,6 +161,162 @@ static void BangConfirm(HWND hCaller, LPCWSTR pwzArgs)
 }
 
 
+//
+// State shared by the DumpPerformance callbacks
+//
+struct DumpPerformanceInfo
+{
+    FILE* pFile;
+    bool bFirst;
+};
+
+
+//
+// WriteUTF8
+// Formats like fwprintf, but writes UTF-8 itself since msvcrt's wide streams
+// don't support ccs=UTF-8
+//
+static void WriteUTF8(FILE* pFile, LPCWSTR pwzFormat, ...)
+{
+    va_list args;
+
+    va_start(args, pwzFormat);
+    int nLength = _vscwprintf(pwzFormat, args);
+    va_end(args);
+
+    if (nLength > 0)
+    {
+        std::vector<wchar_t> vecBuffer(nLength + 1);
+
+        va_start(args, pwzFormat);
+        _vsnwprintf(&vecBuffer[0], vecBuffer.size(), pwzFormat, args);
+        va_end(args);
+
+        int cbUTF8 = WideCharToMultiByte(CP_UTF8, 0,
+            &vecBuffer[0], nLength, nullptr, 0, nullptr, nullptr);
+
+        if (cbUTF8 > 0)
+        {
+            std::vector<char> vecUTF8(cbUTF8);
+
+            WideCharToMultiByte(CP_UTF8, 0, &vecBuffer[0], nLength,
+                &vecUTF8[0], cbUTF8, nullptr, nullptr);
+
+            fwrite(&vecUTF8[0], 1, vecUTF8.size(), pFile);
+        }
+    }
+}
+
+
+//
+// DumpPerformanceText
+// Writes one module per line, times in microseconds
+//
+static BOOL CALLBACK DumpPerformanceText(LPCWSTR pwzPath,
+    const LSMODULEPERFORMANCE* plsmp, LPARAM lParam)
+{
+    DumpPerformanceInfo* pInfo = (DumpPerformanceInfo*)lParam;
+
+    WriteUTF8(pInfo->pFile,
+        L"%-24ls %10llu %10llu %10llu %10llu %10llu %10lu %10lu %6u %6u\n",
+        PathFindFileNameW(pwzPath),
+        plsmp->ullLibraryTime / 1000, plsmp->ullResolveTime / 1000,
+        plsmp->ullInitTime / 1000, plsmp->ullInitEventLatency / 1000,
+        plsmp->ullQuitTime / 1000, plsmp->dwWallTime,
+        plsmp->dwCriticalPathTime, plsmp->uBangCount, plsmp->uMessageCount);
+
+    return TRUE;
+}
+
+
+//
+// DumpPerformanceJSON
+// Writes one JSON object per module, times in nanoseconds
+//
+static BOOL CALLBACK DumpPerformanceJSON(LPCWSTR pwzPath,
+    const LSMODULEPERFORMANCE* plsmp, LPARAM lParam)
+{
+    DumpPerformanceInfo* pInfo = (DumpPerformanceInfo*)lParam;
+
+    std::wstring sPath;
+
+    for (LPCWSTR pwzCurrent = pwzPath; *pwzCurrent; ++pwzCurrent)
+    {
+        if (*pwzCurrent == L'\\' || *pwzCurrent == L'"')
+        {
+            sPath += L'\\';
+        }
+
+        sPath += *pwzCurrent;
+    }
+
+    WriteUTF8(pInfo->pFile,
+        L"%ls\n    { \"module\": \"%ls\", \"threaded\": %ls, "
+        L"\"library_ns\": %I64u, \"resolve_ns\": %I64u, \"init_ns\": %I64u, "
+        L"\"init_event_ns\": %I64u, \"quit_ns\": %I64u, "
+        L"\"wall_ms\": %lu, \"critical_path_ms\": %lu, "
+        L"\"bangs\": %u, \"messages\": %u }",
+        pInfo->bFirst ? L"" : L",", sPath.c_str(),
+        (plsmp->dwFlags & LS_MODULE_THREADED) ? L"true" : L"false",
+        plsmp->ullLibraryTime, plsmp->ullResolveTime, plsmp->ullInitTime,
+        plsmp->ullInitEventLatency, plsmp->ullQuitTime,
+        plsmp->dwWallTime, plsmp->dwCriticalPathTime,
+        plsmp->uBangCount, plsmp->uMessageCount);
+
+    pInfo->bFirst = false;
+
+    return TRUE;
+}
+
+
+//
+// BangDumpPerformance(HWND hCaller, LPCWSTR pwzArgs)
+//
+static void BangDumpPerformance(HWND /* hCaller */, LPCWSTR pwzArgs)
+{
+    wchar_t wzFile[MAX_PATH] = { 0 };
+    LPWSTR awzTokens[] = { wzFile };
+
+    if (LCTokenizeW(pwzArgs, awzTokens, 1, nullptr) < 1)
+    {
+        LSGetLitestepPathW(wzFile, MAX_PATH);
+        PathAppendW(wzFile, L"performance.txt");
+    }
+
+    bool bJSON = (_wcsicmp(PathFindExtensionW(wzFile), L".json") == 0);
+
+    FILE* pFile = nullptr;
+
+    if (_wfopen_s(&pFile, wzFile, L"wt") == 0 && pFile)
+    {
+        DumpPerformanceInfo info = { pFile, true };
+
+        if (bJSON)
+        {
+            WriteUTF8(pFile, L"{\n  \"modules\": [");
+            EnumLSDataW(ELD_PERFORMANCE_EX,
+                (FARPROC)DumpPerformanceJSON, (LPARAM)&info);
+            WriteUTF8(pFile, L"\n  ]\n}\n");
+        }
+        else
+        {
+            WriteUTF8(pFile,
+                L"%-24ls %10ls %10ls %10ls %10ls %10ls %10ls %10ls %6ls %6ls\n",
+                L"Module", L"Load(us)", L"Resolve", L"Init", L"InitEvent",
+                L"Quit", L"Wall(ms)", L"Critical", L"Bangs", L"Msgs");
+            EnumLSDataW(ELD_PERFORMANCE_EX,
+                (FARPROC)DumpPerformanceText, (LPARAM)&info);
+        }
+
+        fclose(pFile);
+    }
+    else
+    {
+        TRACE("!DumpPerformance: Unable to open %ls", wzFile);
+    }
+}
+
+
 //
 // BangExecute(HWND hCaller, LPCWSTR pwzArgs)
 //
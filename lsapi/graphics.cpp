@@ -23,6 +23,13 @@
 #include "../utility/core.hpp"
 #include <algorithm>
 #include "../utility/stringutility.h"
+#include "RegionScan.h"
+#include "ImageCache.h"
+#include "PixelConvert.h"
+#include "../utility/criticalsection.h"
+#include <atomic>
+#include <map>
+#include <vector>
 
 
 static void TransparentBltLSWorker(
@@ -31,6 +38,642 @@ static void TransparentBltLSWorker(
     COLORREF colorTransparent);
 
 
+// Load parameters in ImageCache keys
+#define IMAGECACHE_BITMAP  0x0001
+#define IMAGECACHE_ICON    0x0002
+#define IMAGECACHE_PREMULTIPLIED  0x0004  // ready for LSAlphaBlendImage
+
+// The color that is transparent in images without an alpha channel, as it
+// appears in a 32-bit DIB (0x00RRGGBB)
+#define IMAGE_COLORKEY  0x00FF00FF
+
+
+//
+// CachedBitmap
+//
+// An image in the cache, as a 32-bit bottom-up DIB section.
+//
+class CachedBitmap : public CachedImage
+{
+public:
+    CachedBitmap(HBITMAP hbm, LPVOID pvBits, int nWidth, int nHeight,
+        DWORD dwFlags)
+        : CachedImage((size_t)nWidth * nHeight * 4, dwFlags)
+        , m_hbm(hbm)
+        , m_pvBits(pvBits)
+        , m_nWidth(nWidth)
+        , m_nHeight(nHeight)
+    {
+    }
+
+    HBITMAP GetBitmap() const
+    {
+        return m_hbm;
+    }
+
+    LPCVOID GetBits() const
+    {
+        return m_pvBits;
+    }
+
+    int GetWidth() const
+    {
+        return m_nWidth;
+    }
+
+    int GetHeight() const
+    {
+        return m_nHeight;
+    }
+
+protected:
+    virtual ~CachedBitmap()
+    {
+        DeleteObject(m_hbm);
+    }
+
+private:
+    HBITMAP m_hbm;
+    LPVOID m_pvBits;
+    int m_nWidth;
+    int m_nHeight;
+};
+
+
+//
+// CachedIcon
+//
+class CachedIcon : public CachedImage
+{
+public:
+    CachedIcon(HICON hIcon, size_t cbSize)
+        : CachedImage(cbSize, IMAGECACHE_ICON)
+        , m_hIcon(hIcon)
+    {
+    }
+
+    HICON GetIcon() const
+    {
+        return m_hIcon;
+    }
+
+protected:
+    virtual ~CachedIcon()
+    {
+        DestroyIcon(m_hIcon);
+    }
+
+private:
+    HICON m_hIcon;
+};
+
+
+//
+// A bitmap handed out by LSLoadSharedImage. pImage is NULL for bitmaps that
+// aren't in the cache, they are deleted with their last reference.
+//
+struct SharedImage
+{
+    CachedImage* pImage;
+    UINT uRefs;
+};
+
+typedef std::map<HBITMAP, SharedImage> SharedImageMap;
+
+// Guards s_imageCache and s_sharedImages
+static CriticalSection s_csImageCache;
+static ImageCache s_imageCache(0);
+static SharedImageMap s_sharedImages;
+
+// False while LSImageCacheSize is 0, set by LSAPIReloadImageCache
+static std::atomic<bool> s_bImageCacheOn(false);
+
+// The memory DC LSAlphaBlendImage selects its source into. Created on first
+// use and kept as long as lsapi.dll is loaded.
+static CriticalSection s_csBlendDC;
+static HDC s_hdcBlend = NULL;
+
+
+//
+// LSAPIReloadImageCache
+//
+// Applies LSImageCacheSize, which is in MB. litestep.exe calls this on
+// startup and every recycle, before any module loads an image.
+//
+void LSAPIReloadImageCache(void)
+{
+    int nSize = std::min(std::max(GetRCIntW(L"LSImageCacheSize", 32), 0), 2047);
+    size_t cbBudget = (size_t)nSize * 1024 * 1024;
+
+    Lock lock(s_csImageCache);
+
+    s_imageCache.SetBudget(cbBudget);
+    s_bImageCacheOn = (cbBudget != 0);
+}
+
+
+//
+// GetImageCacheKey
+//
+// Identifies an image file for the cache. Returns false if the file doesn't
+// exist or the cache is disabled.
+//
+static bool GetImageCacheKey(LPCWSTR pwzFile, int nIndex, DWORD dwFlags,
+    ImageCache::Key& key)
+{
+    if (!s_bImageCacheOn)
+    {
+        return false;
+    }
+
+    wchar_t wzFullPath[MAX_PATH];
+    DWORD cchFullPath = GetFullPathNameW(pwzFile, _countof(wzFullPath),
+        wzFullPath, NULL);
+
+    if (cchFullPath == 0 || cchFullPath >= _countof(wzFullPath))
+    {
+        return false;
+    }
+
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+
+    if (!GetFileAttributesExW(wzFullPath, GetFileExInfoStandard, &fad) ||
+        (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        return false;
+    }
+
+    CharLowerW(wzFullPath);
+
+    key.strPath = wzFullPath;
+    key.ullSize = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    key.ullWriteTime = ((ULONGLONG)fad.ftLastWriteTime.dwHighDateTime << 32) |
+        fad.ftLastWriteTime.dwLowDateTime;
+    key.nIndex = nIndex;
+    key.dwFlags = dwFlags;
+
+    return true;
+}
+
+
+//
+// DecodeImageFile
+//
+static HBITMAP DecodeImageFile(LPCWSTR pwzFile)
+{
+    HBITMAP hbm = NULL;
+
+    if (PathMatchSpecW(pwzFile, L"*.png"))
+    {
+        hbm = LoadFromPNG(pwzFile);
+    }
+    else
+    {
+        hbm = (HBITMAP)LoadImageW(NULL, pwzFile, IMAGE_BITMAP, 0, 0,
+            LR_DEFAULTCOLOR | LR_LOADFROMFILE);
+    }
+
+    return hbm;
+}
+
+
+//
+// PrepareForBlending
+//
+// Premultiplies a 32-bit image for LSAlphaBlendImage. Images without an
+// alpha channel get one from the color key, so they blend the way
+// TransparentBltLS would draw them.
+//
+static void PrepareForBlending(LPBYTE pbBits, size_t cPixels,
+    bool bAlphaChannel)
+{
+    if (bAlphaChannel && HasAlpha(pbBits, cPixels))
+    {
+        PremultiplyAlpha(pbBits, cPixels);
+    }
+    else
+    {
+        ColorKeyToAlpha(pbBits, cPixels, IMAGE_COLORKEY);
+    }
+}
+
+
+//
+// AdoptCachedBitmap
+//
+// Wraps a decoded bitmap that already is a 32-bit bottom-up DIB section, as
+// PNG files decode to, in a CachedBitmap without copying it. Returns NULL
+// and leaves the bitmap alone if it's anything else.
+//
+static CachedBitmap* AdoptCachedBitmap(HBITMAP hbm, DWORD dwFlags)
+{
+    DIBSECTION ds;
+
+    if (GetObject(hbm, sizeof(ds), &ds) != sizeof(ds) ||
+        ds.dsBm.bmBitsPixel != 32 || ds.dsBmih.biHeight <= 0 ||
+        ds.dsBmih.biCompression != BI_RGB || !ds.dsBm.bmBits)
+    {
+        return NULL;
+    }
+
+    if (dwFlags & IMAGECACHE_PREMULTIPLIED)
+    {
+        PrepareForBlending((LPBYTE)ds.dsBm.bmBits,
+            (size_t)ds.dsBm.bmWidth * ds.dsBm.bmHeight, true);
+    }
+
+    return new CachedBitmap(hbm, ds.dsBm.bmBits, ds.dsBm.bmWidth,
+        ds.dsBm.bmHeight, dwFlags);
+}
+
+
+//
+// CreateCachedBitmap
+//
+// Copies any bitmap into a new CachedBitmap, premultiplied if dwFlags has
+// IMAGECACHE_PREMULTIPLIED.
+//
+static CachedBitmap* CreateCachedBitmap(HBITMAP hbmSource, DWORD dwFlags)
+{
+    BITMAP bm;
+
+    if (!GetObject(hbmSource, sizeof(bm), &bm) ||
+        bm.bmWidth <= 0 || bm.bmHeight <= 0)
+    {
+        return NULL;
+    }
+
+    BITMAPINFO bmi = { {0} };
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = bm.bmWidth;
+    bmi.bmiHeader.biHeight = bm.bmHeight;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    LPVOID pvBits = NULL;
+    HBITMAP hbm = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+
+    if (!hbm)
+    {
+        return NULL;
+    }
+
+    HDC hdc = CreateCompatibleDC(NULL);
+    int nLines = GetDIBits(hdc, hbmSource, 0, bm.bmHeight, pvBits, &bmi,
+        DIB_RGB_COLORS);
+    DeleteDC(hdc);
+
+    if (nLines != bm.bmHeight)
+    {
+        DeleteObject(hbm);
+        return NULL;
+    }
+
+    if (dwFlags & IMAGECACHE_PREMULTIPLIED)
+    {
+        PrepareForBlending((LPBYTE)pvBits, (size_t)bm.bmWidth * bm.bmHeight,
+            bm.bmBitsPixel == 32);
+    }
+
+    return new CachedBitmap(hbm, pvBits, bm.bmWidth, bm.bmHeight, dwFlags);
+}
+
+
+//
+// CopyCachedBitmap
+//
+// Returns a new DIB section with the pixels of a cached image, and its bits
+// in *ppvBits if that isn't NULL.
+//
+static HBITMAP CopyCachedBitmap(const CachedBitmap* pImage,
+    LPVOID* ppvBits = NULL)
+{
+    BITMAPINFO bmi = { {0} };
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = pImage->GetWidth();
+    bmi.bmiHeader.biHeight = pImage->GetHeight();
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    LPVOID pvBits = NULL;
+    HBITMAP hbm = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &pvBits, NULL, 0);
+
+    if (hbm)
+    {
+        memcpy(pvBits, pImage->GetBits(), pImage->GetSize());
+    }
+
+    if (ppvBits)
+    {
+        *ppvBits = pvBits;
+    }
+
+    return hbm;
+}
+
+
+//
+// PremultiplyCachedBitmap
+//
+// Builds the IMAGECACHE_PREMULTIPLIED variant of a plain cached image from
+// its pixels, without decoding the file again.
+//
+static CachedBitmap* PremultiplyCachedBitmap(const CachedBitmap* pImage)
+{
+    LPVOID pvBits = NULL;
+    HBITMAP hbm = CopyCachedBitmap(pImage, &pvBits);
+
+    if (!hbm)
+    {
+        return NULL;
+    }
+
+    // Plain images decoded from files without alpha have it all zero
+    PrepareForBlending((LPBYTE)pvBits,
+        (size_t)pImage->GetWidth() * pImage->GetHeight(), true);
+
+    return new CachedBitmap(hbm, pvBits, pImage->GetWidth(),
+        pImage->GetHeight(), pImage->GetFlags() | IMAGECACHE_PREMULTIPLIED);
+}
+
+
+//
+// AcquireCachedBitmap
+//
+// Returns the cached image for key, decoding pwzFile if it isn't cached
+// yet. The caller releases the image.
+//
+static CachedBitmap* AcquireCachedBitmap(LPCWSTR pwzFile,
+    const ImageCache::Key& key)
+{
+    {
+        Lock lock(s_csImageCache);
+
+        CachedImage* pCached = s_imageCache.Find(key);
+
+        if (pCached)
+        {
+            return static_cast<CachedBitmap*>(pCached);
+        }
+    }
+
+    // Decode without holding the lock
+    HBITMAP hbmDecoded = DecodeImageFile(pwzFile);
+
+    if (!hbmDecoded)
+    {
+        return NULL;
+    }
+
+    CachedBitmap* pImage = AdoptCachedBitmap(hbmDecoded, key.dwFlags);
+
+    if (!pImage)
+    {
+        // A device dependent bitmap from a .bmp file
+        pImage = CreateCachedBitmap(hbmDecoded, key.dwFlags);
+        DeleteObject(hbmDecoded);
+    }
+
+    if (pImage)
+    {
+        Lock lock(s_csImageCache);
+
+        CachedImage* pExisting;
+
+        if (s_imageCache.Insert(key, pImage, &pExisting) ==
+            ImageCache::InsertExisting)
+        {
+            // Someone else was faster
+            pImage->Release();
+            pImage = static_cast<CachedBitmap*>(pExisting);
+        }
+    }
+
+    return pImage;
+}
+
+
+//
+// LoadImageFile
+//
+// Loads a bitmap or PNG file through the image cache.
+//
+static HBITMAP LoadImageFile(LPCWSTR pwzFile)
+{
+    ImageCache::Key key;
+
+    if (!GetImageCacheKey(pwzFile, 0, IMAGECACHE_BITMAP, key))
+    {
+        return DecodeImageFile(pwzFile);
+    }
+
+    HBITMAP hbm = NULL;
+    CachedBitmap* pImage = AcquireCachedBitmap(pwzFile, key);
+
+    if (pImage)
+    {
+        hbm = CopyCachedBitmap(pImage);
+        pImage->Release();
+    }
+
+    return hbm;
+}
+
+
+//
+// GetImageFilePaths
+//
+// The two places LoadLSImage looks for an image file: relative to the
+// LiteStep image folder, and as given. pwzImage may be the same buffer as
+// pwzInImageFolder.
+//
+static void GetImageFilePaths(LPCWSTR pwzImage, LPWSTR pwzInImageFolder,
+    LPWSTR pwzExpanded)
+{
+    VarExpansionExW(pwzExpanded, pwzImage, MAX_PATH);
+    LSGetImagePathW(pwzInImageFolder, MAX_PATH);
+    PathAppendW(pwzInImageFolder, pwzExpanded);
+}
+
+
+//
+// GetIconMemorySize
+//
+// Roughly what an icon costs, for the cache budget.
+//
+static size_t GetIconMemorySize(HICON hIcon)
+{
+    size_t cbSize = 0;
+    ICONINFO ii;
+
+    if (GetIconInfo(hIcon, &ii))
+    {
+        BITMAP bm;
+
+        if (ii.hbmColor && GetObject(ii.hbmColor, sizeof(bm), &bm))
+        {
+            cbSize += (size_t)bm.bmWidthBytes * bm.bmHeight;
+        }
+
+        if (ii.hbmMask && GetObject(ii.hbmMask, sizeof(bm), &bm))
+        {
+            cbSize += (size_t)bm.bmWidthBytes * bm.bmHeight;
+        }
+
+        if (ii.hbmColor)
+        {
+            DeleteObject(ii.hbmColor);
+        }
+
+        if (ii.hbmMask)
+        {
+            DeleteObject(ii.hbmMask);
+        }
+    }
+
+    return cbSize;
+}
+
+
+//
+// DecodeIconFile
+//
+static HICON DecodeIconFile(LPCWSTR pwzFile, int nIcon)
+{
+    HICON hIcon = NULL;
+
+    // if it's an .ico file we want to do an LoadImage() thing, otherwise
+    // it's extracticon
+    if (PathMatchSpecW(pwzFile, L"*.ico"))
+    {
+        hIcon = (HICON)LoadImageW(
+            NULL, pwzFile, IMAGE_ICON, 0, 0, LR_LOADFROMFILE);
+    }
+    else
+    {
+        hIcon = ExtractIconW(GetModuleHandle(NULL), pwzFile, nIcon);
+
+        if (hIcon == (HICON)1)
+        {
+            hIcon = NULL;
+        }
+    }
+
+    return hIcon;
+}
+
+
+//
+// LoadIconFile
+//
+// Loads an icon file or an icon from a library through the image cache.
+//
+static HICON LoadIconFile(LPCWSTR pwzFile, int nIcon)
+{
+    ImageCache::Key key;
+
+    if (!GetImageCacheKey(pwzFile, nIcon, IMAGECACHE_ICON, key))
+    {
+        return DecodeIconFile(pwzFile, nIcon);
+    }
+
+    CachedImage* pImage = NULL;
+
+    {
+        Lock lock(s_csImageCache);
+        pImage = s_imageCache.Find(key);
+    }
+
+    if (!pImage)
+    {
+        HICON hDecoded = DecodeIconFile(pwzFile, nIcon);
+
+        if (!hDecoded)
+        {
+            return NULL;
+        }
+
+        pImage = new CachedIcon(hDecoded, GetIconMemorySize(hDecoded));
+
+        Lock lock(s_csImageCache);
+
+        CachedImage* pExisting;
+
+        if (s_imageCache.Insert(key, pImage, &pExisting) ==
+            ImageCache::InsertExisting)
+        {
+            pImage->Release();
+            pImage = pExisting;
+        }
+    }
+
+    HICON hIcon = CopyIcon(static_cast<CachedIcon*>(pImage)->GetIcon());
+    pImage->Release();
+
+    return hIcon;
+}
+
+
+//
+// CreateRegionFromRects
+//
+// Builds a region from rectangles in y-x banded order, as produced by
+// RegionRectList. Returns NULL if there are none.
+//
+static HRGN CreateRegionFromRects(const std::vector<RECT>& rects,
+    const RECT& rcBounds)
+{
+    // ExtCreateRegion is known to fail for very large RGNDATA on some
+    // systems, so larger lists are built in pieces
+    const size_t stChunk = 4000;
+
+    HRGN hRgn = NULL;
+    std::vector<BYTE> buffer;
+
+    for (size_t stFirst = 0; stFirst < rects.size(); stFirst += stChunk)
+    {
+        size_t stCount = std::min(stChunk, rects.size() - stFirst);
+
+        buffer.resize(sizeof(RGNDATAHEADER) + stCount * sizeof(RECT));
+
+        RGNDATA* prd = (RGNDATA*)&buffer[0];
+        prd->rdh.dwSize = sizeof(RGNDATAHEADER);
+        prd->rdh.iType = RDH_RECTANGLES;
+        prd->rdh.nCount = (DWORD)stCount;
+        prd->rdh.nRgnSize = (DWORD)(stCount * sizeof(RECT));
+        prd->rdh.rcBound = rcBounds;
+
+        memcpy(prd->Buffer, &rects[stFirst], stCount * sizeof(RECT));
+
+        HRGN hPartRgn = ExtCreateRegion(NULL, (DWORD)buffer.size(), prd);
+
+        if (!hPartRgn)
+        {
+            if (hRgn)
+            {
+                DeleteObject(hRgn);
+            }
+
+            return NULL;
+        }
+
+        if (hRgn)
+        {
+            CombineRgn(hRgn, hRgn, hPartRgn, RGN_OR);
+            DeleteObject(hPartRgn);
+        }
+        else
+        {
+            hRgn = hPartRgn;
+        }
+    }
+
+    return hRgn;
+}
+
+
 //
 // Since the transparent color for all LiteStep modules should be 0xFF00FF and
 // we are going to assume a tolerance of 0x000000, we can ignore the clrTransp
@@ -108,6 +751,13 @@ HRGN BitmapToRegion(
                         GetGValue(clrTransp) - GetGValue(clrTolerance) : 0x00;
                     BYTE clrLoB = GetBValue(clrTolerance) < GetBValue(clrTransp) ?
                         GetBValue(clrTransp) - GetBValue(clrTolerance) : 0x00;
+
+                    // DIB pixels are laid out as 0xAARRGGBB
+                    RegionKey key = RegionKey::Range(
+                        (clrLoR << 16) | (clrLoG << 8) | clrLoB,
+                        (clrHiR << 16) | (clrHiG << 8) | clrHiB);
+#else
+                    RegionKey key = RegionKey::Exact(0xFF00FF);
 #endif // LS_COMPAT_TRANSPTOL
 
                     // Copy the bitmap into the memory D
@@ -118,103 +768,32 @@ HRGN BitmapToRegion(
 
                     // Scan each bitmap row from bottom to top
                     // (the bitmap is inverted vertically)
-#if defined(LS_COMPAT_TRANSPTOL)
-                    BYTE *p;
-#else
-                    DWORD *p;
-#endif // LS_COMPAT_TRANSPTOL
                     BYTE *p32 = (BYTE *)bm32.bmBits + \
                         (bm32.bmHeight - 1) * bm32.bmWidthBytes;
 
-                    int y = 0;
+                    // Collect the non-transparent runs of all rows, then
+                    // build the region in one go. Merging them one by one
+                    // with CombineRgn is quadratic in the number of runs.
+                    RegionRectList rects(xoffset, yoffset);
+                    std::vector<int> vecSpans(bm.bmWidth + 1);
 
-                    while (y < bm.bmHeight)
+                    for (int y = 0; y < bm.bmHeight; ++y)
                     {
-                        int x = 0, x0;
-
-                        while (x < bm.bmWidth)
-                        {
-                            // loop through all transparent pixels...
-                            while (x < bm.bmWidth)
-                            {
-#if defined(LS_COMPAT_TRANSPTOL)
-                                p = p32 + 4 * x;
-
-                                // if the pixel is non-transparent, then break
-                                if (*p < clrLoB || *p > clrHiB)
-                                {
-                                    break;
-                                }
-                                ++p;
-                                if (*p < clrLoG || *p > clrHiG)
-                                {
-                                    break;
-                                }
-                                ++p;
-                                if (*p < clrLoR || *p > clrHiR)
-                                {
-                                    break;
-                                }
-#else
-                                p = (DWORD*)(p32 + 4 * x);
-                                if (*p != 0xFF00FF)
-                                {
-                                    break;
-                                }
-#endif // LS_COMPAT_TRANSPTOL
-
-                                ++x;
-                            }
-
-                            // save first non transparent pixel offset
-                            x0 = x;
+                        int nSpans = ScanOpaqueSpans((const DWORD*)p32,
+                            bm.bmWidth, key, &vecSpans[0]);
 
-                            // loop through all non transparent pixels
-                            while (x < bm.bmWidth)
-                            {
-#if defined(LS_COMPAT_TRANSPTOL)
-                                p = p32 + 4 * x;
-
-                                // if the pixel is transparent, then break
-                                if (*p >= clrLoB && *p <= clrHiB)
-                                {
-                                    ++p;
-                                    if (*p >= clrLoG && *p <= clrHiG)
-                                    {
-                                        ++p;
-                                        if (*p >= clrLoR && *p <= clrHiR)
-                                        {
-                                            break;
-                                        }
-                                    }
-                                }
-#else
-                                p = (DWORD*)(p32 + 4 * x);
-                                if (*p == 0xFF00FF)
-                                {
-                                    break;
-                                }
-#endif // LS_COMPAT_TRANSPTOL
+                        rects.AddRow(y, &vecSpans[0], nSpans);
 
-                                ++x;
-                            }
-
-                            // if found one or more non-transparent pixels in a
-                            // row, add them to the rgn...
-                            if ((x - x0) > 0)
-                            {
-                                HRGN hTempRgn = CreateRectRgn(
-                                    x0 + xoffset, y + yoffset,
-                                    x + xoffset, y + 1 + yoffset);
-                                CombineRgn(hRgn, hRgn, hTempRgn, RGN_OR);
-                                DeleteObject(hTempRgn);
-                            }
+                        p32 -= bm32.bmWidthBytes;
+                    }
 
-                            ++x;
-                        }
+                    HRGN hRectsRgn = CreateRegionFromRects(
+                        rects.GetRects(), rects.GetBounds());
 
-                        ++y;
-                        p32 -= bm32.bmWidthBytes;
+                    if (hRectsRgn)
+                    {
+                        DeleteObject(hRgn);
+                        hRgn = hRectsRgn;
                     }
 
                     // Clean up
@@ -371,35 +950,15 @@ HBITMAP LoadLSImageW(LPCWSTR pwzImage, LPCWSTR pwzFile)
                     // attempt to load the image.
                     wchar_t wzExpandedImage[MAX_PATH];
 
-                    VarExpansionExW(wzExpandedImage, wzImage, _countof(wzExpandedImage));
-                    LSGetImagePathW(wzImage, _countof(wzImage));
-                    PathAppendW(wzImage, wzExpandedImage);
+                    GetImageFilePaths(wzImage, wzImage, wzExpandedImage);
 
-                    if (PathMatchSpecW(wzImage, L"*.png"))
-                    {
-                        hbmReturn = LoadFromPNG(wzImage);
-                    }
-                    else
-                    {
-                        hbmReturn = (HBITMAP)LoadImageW(
-                            NULL, wzImage, IMAGE_BITMAP, 0, 0,
-                            LR_DEFAULTCOLOR | LR_LOADFROMFILE);
-                    }
+                    hbmReturn = LoadImageFile(wzImage);
 
                     // If that fails, treat the image as a fully qualified path
                     // and try loading it
                     if (hbmReturn == NULL)
                     {
-                        if (PathMatchSpecW(wzExpandedImage, L"*.png"))
-                        {
-                            hbmReturn = LoadFromPNG(wzExpandedImage);
-                        }
-                        else
-                        {
-                            hbmReturn = (HBITMAP)LoadImageW(
-                                NULL, wzExpandedImage, IMAGE_BITMAP, 0, 0,
-                                LR_DEFAULTCOLOR | LR_LOADFROMFILE);
-                        }
+                        hbmReturn = LoadImageFile(wzExpandedImage);
                     }
                 }
             }
@@ -422,6 +981,430 @@ HBITMAP LoadLSImageA(LPCSTR pszImage, LPCSTR pszFile)
 }
 
 
+// Work for LSLoadImageAsync
+struct AsyncImageLoad
+{
+    std::wstring strImage;
+    std::wstring strFile;
+    HWND hwndNotify;
+    UINT uMsg;
+    LPARAM lParam;
+};
+
+
+//
+// _LoadImageWork
+//
+static void CALLBACK _LoadImageWork(LPVOID pvContext)
+{
+    AsyncImageLoad* pLoad = (AsyncImageLoad*)pvContext;
+
+    HBITMAP hbm = LoadLSImageW(pLoad->strImage.c_str(),
+        pLoad->strFile.empty() ? NULL : pLoad->strFile.c_str());
+
+    if (!PostMessage(pLoad->hwndNotify, pLoad->uMsg, (WPARAM)hbm,
+        pLoad->lParam))
+    {
+        // The window is gone, nobody is going to take the bitmap
+        if (hbm)
+        {
+            DeleteObject(hbm);
+        }
+    }
+
+    delete pLoad;
+}
+
+
+//
+// PrefetchPremultiplied
+//
+// Caches the premultiplied variant of pImage under key, unless it already
+// is cached.
+//
+static void PrefetchPremultiplied(const ImageCache::Key& key,
+    const CachedBitmap* pImage)
+{
+    {
+        Lock lock(s_csImageCache);
+
+        CachedImage* pCached = s_imageCache.Find(key);
+
+        if (pCached)
+        {
+            pCached->Release();
+            return;
+        }
+    }
+
+    CachedBitmap* pPremultiplied = PremultiplyCachedBitmap(pImage);
+
+    if (pPremultiplied)
+    {
+        CachedImage* pExisting;
+
+        {
+            Lock lock(s_csImageCache);
+            s_imageCache.Insert(key, pPremultiplied, &pExisting);
+        }
+
+        if (pExisting)
+        {
+            pExisting->Release();
+        }
+
+        pPremultiplied->Release();
+    }
+}
+
+
+//
+// _PrefetchImageWork
+//
+// Caches both the plain image, for LoadLSImage and LSLoadSharedImage, and
+// the premultiplied one, for LSLoadSharedImageEx with LSIMAGE_PREMULTIPLIED.
+// The file is decoded once.
+//
+static void CALLBACK _PrefetchImageWork(LPVOID pvContext)
+{
+    LPWSTR pwzPath = (LPWSTR)pvContext;
+    ImageCache::Key key;
+
+    if (GetImageCacheKey(pwzPath, 0, IMAGECACHE_BITMAP, key))
+    {
+        CachedBitmap* pImage = AcquireCachedBitmap(pwzPath, key);
+
+        if (pImage)
+        {
+            key.dwFlags |= IMAGECACHE_PREMULTIPLIED;
+            PrefetchPremultiplied(key, pImage);
+
+            pImage->Release();
+        }
+    }
+
+    delete [] pwzPath;
+}
+
+
+//
+// LSLoadImageAsyncW
+//
+// Loads an image like LoadLSImageW on the thread pool. When done, uMsg is
+// posted to hwndNotify with the bitmap, or NULL, as wParam and lParam passed
+// through. The window owns the bitmap once it gets the message.
+//
+BOOL LSLoadImageAsyncW(LPCWSTR pwzImage, LPCWSTR pwzFile, HWND hwndNotify,
+    UINT uMsg, LPARAM lParam)
+{
+    if (pwzImage == NULL || !IsWindow(hwndNotify))
+    {
+        return FALSE;
+    }
+
+    AsyncImageLoad* pLoad = new AsyncImageLoad;
+    pLoad->strImage = pwzImage;
+    pLoad->strFile = pwzFile ? pwzFile : L"";
+    pLoad->hwndNotify = hwndNotify;
+    pLoad->uMsg = uMsg;
+    pLoad->lParam = lParam;
+
+    if (!LSQueueWorkItem(_LoadImageWork, pLoad, 0))
+    {
+        delete pLoad;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+//
+// LSLoadImageAsyncA
+//
+BOOL LSLoadImageAsyncA(LPCSTR pszImage, LPCSTR pszFile, HWND hwndNotify,
+    UINT uMsg, LPARAM lParam)
+{
+    return LSLoadImageAsyncW(
+        std::unique_ptr<wchar_t>(WCSFromMBS(pszImage)).get(),
+        std::unique_ptr<wchar_t>(WCSFromMBS(pszFile)).get(),
+        hwndNotify, uMsg, lParam
+        );
+}
+
+
+//
+// LSPrefetchImagesW(LPCWSTR pwzPattern)
+//
+// Decodes all BMP and PNG files matching a wildcard pattern into the image
+// cache, in parallel on the thread pool. Relative patterns refer to the
+// LiteStep image folder. Returns the number of files queued.
+//
+UINT LSPrefetchImagesW(LPCWSTR pwzPattern)
+{
+    if (pwzPattern == NULL)
+    {
+        return 0;
+    }
+
+    // Nowhere to put them
+    if (!s_bImageCacheOn)
+    {
+        return 0;
+    }
+
+    wchar_t wzInImageFolder[MAX_PATH];
+    wchar_t wzExpanded[MAX_PATH];
+
+    GetImageFilePaths(pwzPattern, wzInImageFolder, wzExpanded);
+
+    LPCWSTR pwzSearch =
+        PathIsRelativeW(wzExpanded) ? wzInImageFolder : wzExpanded;
+
+    // The directory part, to build the full path of each match
+    wchar_t wzDirectory[MAX_PATH];
+    StringCchCopyW(wzDirectory, _countof(wzDirectory), pwzSearch);
+    PathRemoveFileSpecW(wzDirectory);
+
+    UINT uQueued = 0;
+    WIN32_FIND_DATAW wfd;
+    HANDLE hFind = FindFirstFileW(pwzSearch, &wfd);
+
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if ((wfd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+                !PathMatchSpecW(wfd.cFileName, L"*.png;*.bmp"))
+            {
+                continue;
+            }
+
+            LPWSTR pwzPath = new wchar_t[MAX_PATH];
+            StringCchCopyW(pwzPath, MAX_PATH, wzDirectory);
+
+            if (!PathAppendW(pwzPath, wfd.cFileName) ||
+                !LSQueueWorkItem(_PrefetchImageWork, pwzPath, 0))
+            {
+                delete [] pwzPath;
+                continue;
+            }
+
+            ++uQueued;
+        }
+        while (FindNextFileW(hFind, &wfd));
+
+        FindClose(hFind);
+    }
+
+    return uQueued;
+}
+
+
+//
+// LSPrefetchImagesA
+//
+UINT LSPrefetchImagesA(LPCSTR pszPattern)
+{
+    return LSPrefetchImagesW(
+        std::unique_ptr<wchar_t>(WCSFromMBS(pszPattern)).get());
+}
+
+
+//
+// LSLoadSharedImageExW(LPCWSTR pwzImage, LPCWSTR pwzFile, DWORD dwFlags)
+//
+// Like LoadLSImageW, but image files come straight out of the image cache
+// instead of as a copy. The bitmap is shared with everyone else who loads
+// the same file, so it must not be modified or deleted; it goes back with
+// LSReleaseSharedImage.
+//
+// With LSIMAGE_PREMULTIPLIED the bitmap is premultiplied once when it is
+// decoded, and cached separately from the plain one.
+//
+HBITMAP LSLoadSharedImageExW(LPCWSTR pwzImage, LPCWSTR pwzFile, DWORD dwFlags)
+{
+    if (pwzImage == NULL || _wcsicmp(pwzImage, L".none") == 0 ||
+        (dwFlags & ~LSIMAGE_PREMULTIPLIED))
+    {
+        return NULL;
+    }
+
+    DWORD dwCacheFlags = IMAGECACHE_BITMAP;
+
+    if (dwFlags & LSIMAGE_PREMULTIPLIED)
+    {
+        dwCacheFlags |= IMAGECACHE_PREMULTIPLIED;
+    }
+
+    HBITMAP hbmReturn = NULL;
+    CachedImage* pImage = NULL;
+
+    // Merged and extracted images are built on the fly and can't be shared
+    if (wcschr(pwzImage, L'|') == NULL &&
+        _wcsnicmp(pwzImage, L".extract", 8 /*wcslen(L".extract")*/) != 0)
+    {
+        wchar_t wzImage[MAX_PATH];
+        wchar_t wzExpandedImage[MAX_PATH];
+
+        GetImageFilePaths(pwzImage, wzImage, wzExpandedImage);
+
+        LPCWSTR apwzPaths[] = { wzImage, wzExpandedImage };
+
+        for (size_t st = 0; st < _countof(apwzPaths) && !pImage; ++st)
+        {
+            ImageCache::Key key;
+
+            if (GetImageCacheKey(apwzPaths[st], 0, dwCacheFlags, key))
+            {
+                pImage = AcquireCachedBitmap(apwzPaths[st], key);
+            }
+        }
+    }
+
+    if (pImage)
+    {
+        hbmReturn = static_cast<CachedBitmap*>(pImage)->GetBitmap();
+    }
+    else
+    {
+        hbmReturn = LoadLSImageW(pwzImage, pwzFile);
+
+        if (hbmReturn && (dwCacheFlags & IMAGECACHE_PREMULTIPLIED))
+        {
+            // Converted outside of the cache; the map owns the only
+            // reference and deletes it on release
+            CachedBitmap* pConverted =
+                CreateCachedBitmap(hbmReturn, dwCacheFlags);
+            DeleteObject(hbmReturn);
+
+            pImage = pConverted;
+            hbmReturn = pConverted ? pConverted->GetBitmap() : NULL;
+        }
+    }
+
+    if (hbmReturn)
+    {
+        Lock lock(s_csImageCache);
+
+        SharedImageMap::iterator it = s_sharedImages.find(hbmReturn);
+
+        if (it == s_sharedImages.end())
+        {
+            SharedImage shared = { pImage, 1 };
+            s_sharedImages.insert(SharedImageMap::value_type(hbmReturn, shared));
+        }
+        else
+        {
+            // The map already holds a reference to this image
+            ++it->second.uRefs;
+
+            if (pImage)
+            {
+                pImage->Release();
+            }
+        }
+    }
+
+    return hbmReturn;
+}
+
+
+//
+// LSLoadSharedImageExA
+//
+HBITMAP LSLoadSharedImageExA(LPCSTR pszImage, LPCSTR pszFile, DWORD dwFlags)
+{
+    return LSLoadSharedImageExW(
+        std::unique_ptr<wchar_t>(WCSFromMBS(pszImage)).get(),
+        std::unique_ptr<wchar_t>(WCSFromMBS(pszFile)).get(),
+        dwFlags
+        );
+}
+
+
+//
+// LSLoadSharedImageW
+//
+HBITMAP LSLoadSharedImageW(LPCWSTR pwzImage, LPCWSTR pwzFile)
+{
+    return LSLoadSharedImageExW(pwzImage, pwzFile, 0);
+}
+
+
+//
+// LSLoadSharedImageA
+//
+HBITMAP LSLoadSharedImageA(LPCSTR pszImage, LPCSTR pszFile)
+{
+    return LSLoadSharedImageExA(pszImage, pszFile, 0);
+}
+
+
+//
+// LSReleaseSharedImage(HBITMAP hbmImage)
+//
+void LSReleaseSharedImage(HBITMAP hbmImage)
+{
+    CachedImage* pImage = NULL;
+    bool bDelete = false;
+
+    {
+        Lock lock(s_csImageCache);
+
+        SharedImageMap::iterator it = s_sharedImages.find(hbmImage);
+
+        if (it == s_sharedImages.end())
+        {
+            TRACE("LSReleaseSharedImage: %p is not a shared image", hbmImage);
+            return;
+        }
+
+        if (--it->second.uRefs == 0)
+        {
+            pImage = it->second.pImage;
+            bDelete = (pImage == NULL);
+            s_sharedImages.erase(it);
+        }
+    }
+
+    if (pImage)
+    {
+        pImage->Release();
+    }
+    else if (bDelete)
+    {
+        DeleteObject(hbmImage);
+    }
+}
+
+
+//
+// LSGetImageCacheStatistics(LSIMAGECACHESTATISTICS* pStats)
+//
+BOOL LSGetImageCacheStatistics(LSIMAGECACHESTATISTICS* pStats)
+{
+    if (pStats == NULL || pStats->cbSize < sizeof(LSIMAGECACHESTATISTICS))
+    {
+        return FALSE;
+    }
+
+    Lock lock(s_csImageCache);
+
+    ImageCache::Statistics stats = s_imageCache.GetStatistics();
+
+    pStats->uHits = stats.uHits;
+    pStats->uMisses = stats.uMisses;
+    pStats->uEvictions = stats.uEvictions;
+    pStats->uImages = stats.uImages;
+    pStats->uShared = (UINT)s_sharedImages.size();
+    pStats->ullBytes = stats.ullBytes;
+    pStats->ullBudget = stats.ullBudget;
+
+    return TRUE;
+}
+
+
 //
 // BitmapFromIcon(HICON hIcon)
 //
@@ -524,23 +1507,8 @@ HICON LoadLSIconW(LPCWSTR pwzIconPath, LPCWSTR pwzFile)
                 StringCchCopyW(pwzIconFile, MAX_PATH, wzTemp);
             }
 
-            // okay, now it's really time to load the icon... if it's an .ico
-            // file we want to do an LoadImage() thing, otherwise it's
-            // extracticon so lets find out the extension
-            if (PathMatchSpecW(pwzIconFile, L"*.ico"))
-            {
-                hIcon = (HICON)LoadImageW(
-                    NULL, pwzIconFile, IMAGE_ICON, 0, 0, LR_LOADFROMFILE);
-            }
-            else
-            {
-                hIcon = ExtractIconW(GetModuleHandle(NULL), pwzIconFile, nIcon);
-
-                if (hIcon == (HICON)1)
-                {
-                    hIcon = NULL;
-                }
-            }
+            // okay, now it's really time to load the icon...
+            hIcon = LoadIconFile(pwzIconFile, nIcon);
         }
     }
 
@@ -592,6 +1560,55 @@ void GetLSBitmapSize(HBITMAP hBitmap, LPINT nWidth, LPINT nHeight)
 }
 
 
+//
+// LSAlphaBlendImage
+//
+// Draws a premultiplied 32-bit bitmap, as LSLoadSharedImageEx returns with
+// LSIMAGE_PREMULTIPLIED, in a single blend. The source goes through one
+// memory DC shared by all callers instead of a new DC per call, so blits
+// from different threads take turns.
+//
+BOOL LSAlphaBlendImage(
+    HDC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight,
+    HBITMAP hbmImage, int nXSrc, int nYSrc, int nSrcWidth, int nSrcHeight,
+    BYTE bAlpha)
+{
+    if (hdcDest == NULL || hbmImage == NULL)
+    {
+        return FALSE;
+    }
+
+    Lock lock(s_csBlendDC);
+
+    if (s_hdcBlend == NULL)
+    {
+        s_hdcBlend = CreateCompatibleDC(NULL);
+
+        if (s_hdcBlend == NULL)
+        {
+            return FALSE;
+        }
+    }
+
+    // Fails if the bitmap is selected into another DC right now
+    HGDIOBJ hbmOld = SelectObject(s_hdcBlend, hbmImage);
+
+    if (hbmOld == NULL)
+    {
+        return FALSE;
+    }
+
+    BLENDFUNCTION bf = { AC_SRC_OVER, 0, bAlpha, AC_SRC_ALPHA };
+
+    BOOL bResult = GdiAlphaBlend(hdcDest, nXDest, nYDest, nWidth, nHeight,
+        s_hdcBlend, nXSrc, nYSrc, nSrcWidth, nSrcHeight, bf);
+
+    SelectObject(s_hdcBlend, hbmOld);
+
+    return bResult;
+}
+
+
 void TransparentBltLS(
     HDC hdcDst, int nXDest, int nYDest, int nWidth, int nHeight,
     HDC hdcSrc, int nXSrc, int nYSrc,
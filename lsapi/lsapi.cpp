@@ -1166,6 +1166,13 @@ HRESULT EnumLSDataW(UINT uInfo, FARPROC pfnCallback, LPARAM lParam)
             }
             break;
 
+        case ELD_PERFORMANCE_EX:
+            {
+                hr = (HRESULT)SendMessage(GetLitestepWnd(), LM_ENUMPERFORMANCEEX,
+                    (WPARAM)pfnCallback, lParam);
+            }
+            break;
+
         default:
             {
                 // do nothing
@@ -1212,6 +1219,11 @@ static BOOL CALLBACK EnumLSDataPerformanceANSIIWrapper(LPCWSTR pwzModule, DWORD
     LPENUM_DATA pData = (LPENUM_DATA)lParam;
     return LSENUMPERFORMANCEPROCA(pData->fnCallback)(std::unique_ptr<char>(MBSFromWCS(pwzModule)).get(), dwLoadTime, pData->lParam);
 }
+static BOOL CALLBACK EnumLSDataPerformanceExANSIIWrapper(LPCWSTR pwzModule, const LSMODULEPERFORMANCE* plsmp, LPARAM lParam)
+{
+    LPENUM_DATA pData = (LPENUM_DATA)lParam;
+    return LSENUMPERFORMANCEEXPROCA(pData->fnCallback)(std::unique_ptr<char>(MBSFromWCS(pwzModule)).get(), plsmp, pData->lParam);
+}
 
 
 //
@@ -1268,6 +1280,12 @@ HRESULT EnumLSDataA(UINT uInfo, FARPROC pfnCallback, LPARAM lParam)
                 pfnCallback = FARPROC(EnumLSDataPerformanceANSIIWrapper);
             }
             break;
+
+        case ELD_PERFORMANCE_EX:
+            {
+                pfnCallback = FARPROC(EnumLSDataPerformanceExANSIIWrapper);
+            }
+            break;
         }
 
         if (nullptr != pfnCallback)
@@ -1284,6 +1302,25 @@ HRESULT EnumLSDataA(UINT uInfo, FARPROC pfnCallback, LPARAM lParam)
 }
 
 
+//
+// LSGetWorkAreaStatistics
+//
+// Return values:
+//   TRUE  - pStats was filled in
+//   FALSE - Invalid pStats, or the tray service isn't running
+//
+BOOL LSGetWorkAreaStatistics(LSWORKAREASTATISTICS* pStats)
+{
+    if (pStats == nullptr || pStats->cbSize < sizeof(LSWORKAREASTATISTICS))
+    {
+        return FALSE;
+    }
+
+    return (BOOL)SendMessage(GetLitestepWnd(), LM_GETWORKAREASTATISTICS,
+        0, (LPARAM)pStats);
+}
+
+
 HRESULT LSCoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter,
     DWORD dwClsContext, REFIID riid, LPVOID *ppv)
 {
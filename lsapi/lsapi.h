@@ -102,6 +102,17 @@ extern "C"
     LSAPI HICON LoadLSIconA(LPCSTR pszImage, LPCSTR pszFile);
     LSAPI HICON LoadLSIconW(LPCWSTR pwzImage, LPCWSTR pwzFile);
     LSAPI void GetLSBitmapSize(HBITMAP hBitmap, LPINT nWidth, LPINT nHeight);
+    LSAPI HBITMAP LSLoadSharedImageA(LPCSTR pszImage, LPCSTR pszFile);
+    LSAPI HBITMAP LSLoadSharedImageW(LPCWSTR pwzImage, LPCWSTR pwzFile);
+    LSAPI HBITMAP LSLoadSharedImageExA(LPCSTR pszImage, LPCSTR pszFile, DWORD dwFlags);
+    LSAPI HBITMAP LSLoadSharedImageExW(LPCWSTR pwzImage, LPCWSTR pwzFile, DWORD dwFlags);
+    LSAPI void LSReleaseSharedImage(HBITMAP hbmImage);
+    LSAPI BOOL LSGetImageCacheStatistics(LSIMAGECACHESTATISTICS* pStats);
+    LSAPI BOOL LSLoadImageAsyncA(LPCSTR pszImage, LPCSTR pszFile, HWND hwndNotify, UINT uMsg, LPARAM lParam);
+    LSAPI BOOL LSLoadImageAsyncW(LPCWSTR pwzImage, LPCWSTR pwzFile, HWND hwndNotify, UINT uMsg, LPARAM lParam);
+    LSAPI UINT LSPrefetchImagesA(LPCSTR pszPattern);
+    LSAPI UINT LSPrefetchImagesW(LPCWSTR pwzPattern);
+    LSAPI BOOL LSAlphaBlendImage(HDC hdcDest, int nXDest, int nYDest, int nWidth, int nHeight, HBITMAP hbmImage, int nXSrc, int nYSrc, int nSrcWidth, int nSrcHeight, BYTE bAlpha);
     LSAPI void TransparentBltLS(HDC dc, int nXDest, int nYDest, int nWidth, int nHeight, HDC tempDC, int nXSrc, int nYSrc, COLORREF colorTransparent);
 
     LSAPI int CommandTokenizeA(LPCSTR szString, LPSTR * lpszBuffers, DWORD dwNumBuffers, LPSTR szExtraParameters);
@@ -158,9 +169,16 @@ extern "C"
     LSAPI HRESULT EnumLSDataA(UINT uInfo, FARPROC pfnCallback, LPARAM lParam);
     LSAPI HRESULT EnumLSDataW(UINT uInfo, FARPROC pfnCallback, LPARAM lParam);
 
+    LSAPI BOOL LSGetWorkAreaStatistics(LSWORKAREASTATISTICS* pStats);
+
     LSAPI HRESULT LSCoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter, DWORD dwClsContext,
         REFIID riid, LPVOID *ppv);
 
+    LSAPI BOOL LSQueueWorkItem(LSWORKPROC pfnWork, LPVOID pvContext, DWORD dwFlags);
+    LSAPI HANDLE LSCreateWorkTimer(LSWORKPROC pfnWork, LPVOID pvContext, DWORD dwDueTime, DWORD dwPeriod);
+    LSAPI void LSCloseWorkTimer(HANDLE hTimer);
+    LSAPI BOOL LSRunOnMainThread(LSWORKPROC pfnWork, LPVOID pvContext);
+
 #if defined(LSAPI_PRIVATE)
     LSAPI BOOL LSAPIInitialize(LPCWSTR pwzLitestepPath, LPCWSTR pwzRcPath);
     LSAPI void LSAPIReloadBangs(void);
@@ -168,6 +186,8 @@ extern "C"
     LSAPI void LSAPISetLitestepWindow(HWND hLitestepWnd);
     LSAPI void LSAPISetCOMFactory(IClassFactory *pFactory);
     LSAPI BOOL InternalExecuteBangCommand(HWND hCaller, LPCWSTR pszCommand, LPCWSTR pwzArgs);
+    LSAPI void LSAPIRunMainThreadWork(void);
+    LSAPI void LSAPIReloadImageCache(void);
 #endif /* LSAPI_PRIVATE */
 
 #if defined(__cplusplus)
@@ -62,6 +62,9 @@
 #define LM_BRINGTOFRONT             8891
 #define LM_SAVEDATA                 8892
 #define LM_RESTOREDATA              8893
+#define LM_SAVEDATAEX               8894
+#define LM_RESTOREDATAEX            8895
+#define LM_RELEASEDATAVIEW          8896
 #define LM_POPUP                    9182
 #define LM_HIDEPOPUP                9183
 #define LM_FIRSTDESKTOPPAINT        9184 // Deprecated
@@ -74,6 +77,7 @@
 #define LM_SYSTRAYA                 9214
 #define LM_SYSTRAYREADY             9215
 #define LM_SYSTRAYINFOEVENT         9216
+#define LM_SYSTRAYSNAPSHOT          9217
 
 // Shell Hook Messages (obsolete!)
 #define LM_SHELLMESSAGE             9219
@@ -130,6 +134,9 @@
 #define LM_ENUMREVIDS               9430
 #define LM_ENUMMODULES              9431
 #define LM_ENUMPERFORMANCE          9432
+#define LM_ENUMPERFORMANCEEX        9433
+#define LM_RUNONMAINTHREAD          9434
+#define LM_GETWORKAREASTATISTICS    9435
 #endif
 
 
@@ -178,6 +185,25 @@
 #define LM_BANGCOMMANDW               33284
 #define LM_SYSTRAYW                   33285
 #define LM_WALLPAPERCHANGE            33286
+#define LM_MESSAGETIMEOUT             33287
+
+
+//-----------------------------------------------------------------------------
+// DataStore DEFINES
+//-----------------------------------------------------------------------------
+
+// LM_RESTOREDATAEX returns a pointer into the store instead of copying
+#define LSDATA_VIEW  0x0001
+
+// Sent by LM_SAVEDATAEX, LM_RESTOREDATAEX and LM_RELEASEDATAVIEW
+typedef struct LSDATAITEM
+{
+    UINT cbSize;
+    DWORD dwIdent;              // shared with the HIWORD idents of LM_SAVEDATA
+    DWORD dwFlags;              // LSDATA_* flags
+    LPVOID pvData;
+    DWORD cbData;
+} LSDATAITEM, *LPLSDATAITEM;
 
 
 //-----------------------------------------------------------------------------
@@ -228,6 +254,7 @@ typedef struct THUMBBUTTONLIST {
 typedef int  (__cdecl* initModuleProc)(HWND, HINSTANCE, LPCWSTR);
 typedef int  (__cdecl* initModuleProcA)(HWND, HINSTANCE, LPCSTR);
 typedef void (__cdecl* quitModuleProc)(HINSTANCE);
+typedef LPCWSTR (__cdecl* getModuleDependenciesProc)(void);
 
 
 //-----------------------------------------------------------------------------
@@ -274,6 +301,26 @@ typedef struct _LMBANGCOMMANDW
 #define TRAYEVENT_GETICONSIZE       2
 
 
+//-----------------------------------------------------------------------------
+// LM_SYSTRAYSNAPSHOT DEFINES
+//-----------------------------------------------------------------------------
+
+// LM_SYSTRAYREADY wParam: send all icons as one LM_SYSTRAYSNAPSHOT to the
+// window in lParam instead of one LM_SYSTRAY per icon
+#define SYSTRAYREADY_SNAPSHOT       0x0001
+
+#define LSSYSTRAYSNAPSHOT_VERSION   1
+
+typedef struct LSSYSTRAYSNAPSHOT
+{
+    UINT cbSize;
+    DWORD dwVersion;            // LSSYSTRAYSNAPSHOT_VERSION
+    UINT uCount;                // number of records at pvIcons
+    UINT cbIcon;                // distance between two records, in bytes
+    LPCVOID pvIcons;            // LSNOTIFYICONDATA (Unicode) records
+} LSSYSTRAYSNAPSHOT, *LPLSSYSTRAYSNAPSHOT;
+
+
 //-----------------------------------------------------------------------------
 // VWM DEFINES
 //-----------------------------------------------------------------------------
@@ -322,6 +369,7 @@ typedef struct LSDESKTOPINFO
 #define ELD_REVIDS                  3
 #define ELD_BANGS_V2                4
 #define ELD_PERFORMANCE             5
+#define ELD_PERFORMANCE_EX          6
 
 // ELD_MODULES: possible dwFlags values
 #define LS_MODULE_THREADED          0x0001
@@ -338,4 +386,60 @@ typedef BOOL (CALLBACK* LSENUMMODULESPROCW)(LPCWSTR, DWORD, LPARAM);
 typedef BOOL (CALLBACK* LSENUMPERFORMANCEPROCA)(LPCSTR, DWORD, LPARAM);
 typedef BOOL (CALLBACK* LSENUMPERFORMANCEPROCW)(LPCWSTR, DWORD, LPARAM);
 
+// ELD_PERFORMANCE_EX: statistics passed for each module
+typedef struct LSMODULEPERFORMANCE
+{
+    UINT cbSize;
+    DWORD dwFlags;              // LS_MODULE_* flags
+    DWORD dwLoadTime;           // same as ELD_PERFORMANCE
+    DWORD dwWallTime;           // load and init, without dependency waits
+    DWORD dwCriticalPathTime;   // time added to the startup critical path
+    ULONGLONG ullLibraryTime;   // nanoseconds spent in LoadLibrary
+    ULONGLONG ullResolveTime;   // nanoseconds spent resolving entry points
+    ULONGLONG ullInitTime;      // nanoseconds spent in initModuleEx
+    ULONGLONG ullInitEventLatency; // threaded: thread start to init event
+    ULONGLONG ullQuitTime;      // nanoseconds spent in the last quitModule
+    UINT uBangCount;            // bang commands registered during init
+    UINT uMessageCount;         // messages registered during init
+} LSMODULEPERFORMANCE;
+
+typedef BOOL (CALLBACK* LSENUMPERFORMANCEEXPROCA)(LPCSTR, const LSMODULEPERFORMANCE*, LPARAM);
+typedef BOOL (CALLBACK* LSENUMPERFORMANCEEXPROCW)(LPCWSTR, const LSMODULEPERFORMANCE*, LPARAM);
+
+// LSQueueWorkItem, LSCreateWorkTimer, LSRunOnMainThread
+typedef void (CALLBACK* LSWORKPROC)(LPVOID);
+
+// LSQueueWorkItem flags
+#define LSWORK_LONG  0x0001 // the work blocks or runs for a long time
+
+// LSGetImageCacheStatistics
+typedef struct LSIMAGECACHESTATISTICS
+{
+    UINT cbSize;
+    UINT uHits;                 // loads served from the cache
+    UINT uMisses;               // loads that had to decode the file
+    UINT uEvictions;            // images dropped to stay within the budget
+    UINT uImages;               // images in the cache
+    UINT uShared;               // LSLoadSharedImage bitmaps not released yet
+    ULONGLONG ullBytes;         // memory used by the cached images
+    ULONGLONG ullBudget;        // LSImageCacheSize, in bytes
+} LSIMAGECACHESTATISTICS;
+
+// LSGetWorkAreaStatistics
+typedef struct LSWORKAREASTATISTICS
+{
+    UINT cbSize;
+    UINT uRequested;            // work area changes asked for by AppBars
+    UINT uSuppressed;           // requests that changed nothing
+    UINT uSuperseded;           // pending changes replaced before they settled
+    UINT uApplied;              // changes made to the work area
+    UINT uBroadcasts;           // WM_SETTINGCHANGE broadcasts sent
+    UINT uEchoes;               // broadcasts that came back to LiteStep
+    UINT uPendingEchoes;        // broadcasts that haven't come back yet
+    UINT uExternal;             // work area changes made by someone else
+} LSWORKAREASTATISTICS;
+
+// LSLoadSharedImageEx flags
+#define LSIMAGE_PREMULTIPLIED  0x0001 // premultiplied alpha, for LSAlphaBlendImage
+
 #endif // LSAPIDEFINES_H
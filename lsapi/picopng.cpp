@@ -24,17 +24,15 @@
 
 #if defined(LS_USE_PICOPNG)
 
+#include "Inflate.h"
+#include "PixelConvert.h"
+#include "../utility/crc32.h"
+#include <cstddef>
 #include <vector>
 
-// These were moved outside of "decodePNG()" for VC7.1/8 compiler support
-static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
-static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
-static const unsigned long DISTBASE[30] =  {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
-static const unsigned long DISTEXTRA[30] = {0,0,0,0,1,1,2, 2, 3, 3, 4, 4, 5, 5,  6,  6,  7,  7,  8,  8,   9,   9,  10,  10,  11,  11,  12,   12,   13,   13};
-static const unsigned long CLCL[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; //code length code lengths
-
-//int decodePNG(std::vector<unsigned char>& out_image_32bit, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, unsigned long in_size)
-int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, unsigned long in_size)
+// The decoder used to be local to decodePNG; it is shared by decodePNG and
+// decodePNGToBGRA now.
+namespace
 {
   // picoPNG version 20101224
   // Copyright (c) 2005-2010 Lode Vandevenne
@@ -62,194 +60,14 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
   // is available: LodePNG (lodepng.c(pp)), which is a single source and header file.
   // Apologies for the compact code style, it's to make this tiny.
 
-  struct Zlib //nested functions for zlib decompression
+  struct Zlib //zlib decompression, done by the table driven decoder in Inflate.cpp
   {
-    static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result;}
-    static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
+    int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value, out must be the size of the uncompressed data
     {
-      unsigned long result = 0;
-      for(size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-      return result;
-    }
-    struct HuffmanTree
-    {
-      int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-      { //make tree given the lengths
-        unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-        std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-        for(unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
-        for(unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-        for(unsigned long n = 0; n < numcodes; n++) if(bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-        tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-        for(unsigned long n = 0; n < numcodes; n++) //the codes
-        for(unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
-        {
-          unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-          if(treepos > numcodes - 2) return 55;
-          if(tree2d[2 * treepos + bit] == 32767) //not yet filled in
-          {
-            if(i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-            else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-          }
-          else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
-        }
-        return 0;
-      }
-      int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-      { //Decodes a symbol from the tree
-        unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-        if(treepos >= numcodes) return 11; //error: you appeared outside the codetree
-        result = tree2d[2 * treepos + bit];
-        decoded = (result < numcodes);
-        treepos = decoded ? 0 : result - numcodes;
-        return 0;
-      }
-      std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
-    };
-    struct Inflator
-    {
-      int error;
-      void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
-      {
-        size_t bp = 0, pos = 0; //bit pointer and byte pointer
-        error = 0;
-        unsigned long BFINAL = 0;
-        while(!BFINAL && !error)
-        {
-          if(bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-          BFINAL = readBitFromStream(bp, &in[inpos]);
-          unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
-          if(BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-          else if(BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-          else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
-        }
-        if(!error) out.resize(pos); //Only now we know the true size of out, resize it to that
-      }
-      void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
-      {
-        std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
-        for(size_t i = 144; i <= 255; i++) bitlen[i] = 9;
-        for(size_t i = 256; i <= 279; i++) bitlen[i] = 7;
-        tree.makeFromLengths(bitlen, 15);
-        treeD.makeFromLengths(bitlenD, 15);
-      }
-      HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-      unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
-      { //decode a single symbol from given list of bits with given code tree. return value is the symbol
-        bool decoded; unsigned long ct;
-        for(size_t treepos = 0;;)
-        {
-          if((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-          error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if(error) return 0; //stop, an error happened
-          if(decoded) return ct;
-        }
-      }
-      void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
-      { //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
-        std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-        if(bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-        size_t HLIT =  readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-        size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-        size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
-        std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-        for(size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-        error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if(error) return;
-        size_t i = 0, replength;
-        while(i < HLIT + HDIST)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if(error) return;
-          if(code <= 15)  { if(i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
-          else if(code == 16) //repeat previous
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 2);
-            unsigned long value; //set value to the previous code
-            if((i - 1) < HLIT) value = bitlen[i - 1];
-            else value = bitlenD[i - HLIT - 1];
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = value; else bitlenD[i++ - HLIT] = value;
-            }
-          }
-          else if(code == 17) //repeat "0" 3-10 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 3);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else if(code == 18) //repeat "0" 11-138 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 11 + readBitsFromStream(bp, in, 7);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
-        }
-        if(bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
-        error = tree.makeFromLengths(bitlen, 15); if(error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
-        error = treeD.makeFromLengths(bitlenD, 15); if(error) return;
-      }
-      void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype)
-      {
-        if(btype == 1) { generateFixedTrees(codetree, codetreeD); }
-        else if(btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if(error) return; }
-        for(;;)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if(error) return;
-          if(code == 256) return; //end code
-          else if(code <= 255) //literal symbol
-          {
-            if(pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
-            out[pos++] = (unsigned char)(code);
-          }
-          else if(code >= 257 && code <= 285) //length code
-          {
-            size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            length += readBitsFromStream(bp, in, numextrabits);
-            unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if(error) return;
-            if(codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-            unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            dist += readBitsFromStream(bp, in, numextrabitsD);
-            size_t start = pos, back = start - dist; //backwards
-            if(pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-            for(size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if(back >= start) back = start - dist; }
-          }
-        }
-      }
-      void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
-      {
-        while((bp & 0x7) != 0) bp++; //go to first boundary of byte
-        size_t p = bp / 8;
-        if(p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
-        unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
-        if(LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
-        if(pos + LEN >= out.size()) out.resize(pos + LEN);
-        if(p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-        for(unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-        bp = p * 8;
-      }
-    };
-    int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
-    {
-      Inflator inflator;
-      if(in.size() < 2) { return 53; } //error, size of zlib data too small
-      if((in[0] * 256 + in[1]) % 31 != 0) { return 24; } //error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way
-      unsigned long CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
-      if(CM != 8 || CINFO > 7) { return 25; } //error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec
-      if(FDICT != 0) { return 26; } //error: the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary."
-      inflator.inflate(out, in, 2);
-      return inflator.error; //note: adler32 checksum was skipped and ignored
+      size_t written = 0;
+      int error = InflateZlib(in.empty() ? 0 : &in[0], in.size(), out.empty() ? 0 : &out[0], out.size(), &written);
+      out.resize(written);
+      return error;
     }
   };
   struct PNG //nested functions for PNG decoding
@@ -262,6 +80,43 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
     } info;
     int error;
     void decode(std::vector<unsigned char>& out, const unsigned char* in, size_t size, bool convert_to_rgba32)
+    {
+      std::vector<unsigned char> scanlines;
+      readImageData(scanlines, in, size); if(error) return;
+      unfilter(out, scanlines); if(error) return;
+      if(convert_to_rgba32 && (info.colorType != 6 || info.bitDepth != 8)) //conversion needed
+      {
+        std::vector<unsigned char> data = out;
+        error = convert(out, &data[0], info, info.width, info.height);
+      }
+    }
+    void decodeBGRA(unsigned char* out, long stride, unsigned long w, unsigned long h, const unsigned char* in, size_t size)
+    { //decodes to 32-bit BGRA rows that are stride bytes apart, e.g. straight into a DIB section
+      std::vector<unsigned char> scanlines;
+      readImageData(scanlines, in, size); if(error) return;
+      if(info.width != w || info.height != h) { error = 70; return; } //error: the image is not the size the output was made for
+      if(info.interlaceMethod == 0 && info.colorType == 6 && info.bitDepth == 8) //RGBA, nothing to convert
+      { //unfiltering treats each channel on its own, so red and blue can be swapped before rather than after it. That lets it write straight to out, with the row above in out as the previous line
+        size_t linestart = 0, linelength = info.width * 4;
+        if(scanlines.size() < info.height * (1 + linelength)) { error = 71; return; } //error: the image data is too short for the image size
+        for(unsigned long y = 0; y < info.height; y++)
+        {
+          unsigned char* line = &scanlines[linestart + 1], *recon = out + (ptrdiff_t)y * stride;
+          SwizzleRGBAToBGRA(line, line, info.width);
+          unFilterScanline(recon, line, (y == 0) ? 0 : recon - stride, 4, scanlines[linestart], linelength); if(error) return;
+          linestart += (1 + linelength); //go to start of next scanline
+        }
+      }
+      else //anything else goes through the 32-bit RGBA conversion first
+      {
+        std::vector<unsigned char> raw, rgba;
+        unfilter(raw, scanlines); if(error) return;
+        if(info.colorType != 6 || info.bitDepth != 8) { error = convert(rgba, raw.empty() ? 0 : &raw[0], info, info.width, info.height); if(error) return; }
+        else rgba.swap(raw);
+        for(unsigned long y = 0; y < info.height; y++) SwizzleRGBAToBGRA(out + (ptrdiff_t)y * stride, &rgba[y * info.width * 4], info.width);
+      }
+    }
+    void readImageData(std::vector<unsigned char>& scanlines, const unsigned char* in, size_t size) //reads the chunks and inflates the filtered scanlines
     {
       error = 0;
       if(size == 0 || in == 0) { error = 48; return; } //the given data is empty
@@ -275,7 +130,13 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
         if(pos + 8 >= size) { error = 30; return; } //error: size of the in buffer too small to contain next chunk
         size_t chunkLength = read32bitInt(&in[pos]); pos += 4;
         if(chunkLength > 2147483647) { error = 63; return; }
-        if(pos + chunkLength >= size) { error = 35; return; } //error: size of the in buffer too small to contain next chunk
+        if(pos + chunkLength + 8 > size) { error = 35; return; } //error: size of the in buffer too small to contain next chunk
+        size_t next = pos + 4 + chunkLength + 4; //the next chunk, after the type, the data and the CRC
+        if(Crc32(0, &in[pos], 4 + chunkLength) != (unsigned int)read32bitInt(&in[pos + 4 + chunkLength])) //the CRC covers the type and the data
+        {
+          if(!(in[pos + 0] & 32)) { error = 57; return; } //error: a critical chunk is damaged
+          pos = next; continue; //a damaged ancillary chunk is ignored
+        }
         if(in[pos + 0] == 'I' && in[pos + 1] == 'D' && in[pos + 2] == 'A' && in[pos + 3] == 'T') //IDAT chunk, containing compressed image data
         {
           idat.insert(idat.end(), &in[pos + 4], &in[pos + 4 + chunkLength]);
@@ -322,18 +183,35 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
           pos += (chunkLength + 4); //skip 4 letters and uninterpreted data of unimplemented chunk
           known_type = false;
         }
-        pos += 4; //step over CRC (which is ignored)
+        pos = next;
       }
       unsigned long bpp = getBpp(info);
-      std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
+      scanlines.resize(getRawSize(bpp)); //now the out buffer will be filled
       Zlib zlib; //decompress with the Zlib decompressor
       error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
+    }
+    size_t getRawSize(unsigned long bpp) //size of the filtered scanlines, each with its filter type byte
+    {
+      if(info.interlaceMethod == 0) return info.height * (1 + (info.width * bpp + 7) / 8);
+      static const size_t left[7] = {0, 4, 0, 2, 0, 1, 0}, top[7] = {0, 0, 4, 0, 2, 0, 1}, spacex[7] = {8, 8, 4, 4, 2, 2, 1}, spacey[7] = {8, 8, 8, 4, 4, 2, 2}; //the adam7 passes
+      size_t total = 0;
+      for(int i = 0; i < 7; i++)
+      {
+        size_t passw = (info.width + spacex[i] - left[i] - 1) / spacex[i], passh = (info.height + spacey[i] - top[i] - 1) / spacey[i];
+        if(passw != 0) total += passh * (1 + (passw * bpp + 7) / 8);
+      }
+      return total;
+    }
+    void unfilter(std::vector<unsigned char>& out, std::vector<unsigned char>& scanlines) //undoes the filters and interlacing, without color conversion
+    {
+      unsigned long bpp = getBpp(info);
       size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
       out.resize(outlength); //time to fill the out buffer
       unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
       if(info.interlaceMethod == 0) //no interlace, just filter
       {
         size_t linestart = 0, linelength = (info.width * bpp + 7) / 8; //length in bytes of a scanline, excluding the filtertype byte
+        if(scanlines.size() < info.height * (1 + linelength)) { error = 71; return; } //error: the image data is too short for the image size
         if(bpp >= 8) //byte per byte
         for(unsigned long y = 0; y < info.height; y++)
         {
@@ -344,13 +222,13 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
         }
         else //less than 8 bits per pixel, so fill it up bit per bit
         {
-          std::vector<unsigned char> templine((info.width * bpp + 7) >> 3); //only used if bpp < 8
+          std::vector<unsigned char> templine((info.width * bpp + 7) >> 3), prevline(templine.size()); //only used if bpp < 8. The filters work on the packed lines, so the previous one is kept
           for(size_t y = 0, obp = 0; y < info.height; y++)
           {
             unsigned long filterType = scanlines[linestart];
-            const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
-            unFilterScanline(&templine[0], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if(error) return;
+            unFilterScanline(&templine[0], &scanlines[linestart + 1], (y == 0) ? 0 : &prevline[0], bytewidth, filterType, linelength); if(error) return;
             for(size_t bp = 0; bp < info.width * bpp;) setBitOfReversedStream(obp, out_, readBitFromReversedStream(bp, &templine[0]));
+            templine.swap(prevline);
             linestart += (1 + linelength); //go to start of next scanline
           }
         }
@@ -359,17 +237,15 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
       {
         size_t passw[7] = { (info.width + 7) / 8, (info.width + 3) / 8, (info.width + 3) / 4, (info.width + 1) / 4, (info.width + 1) / 2, (info.width + 0) / 2, (info.width + 0) / 1 };
         size_t passh[7] = { (info.height + 7) / 8, (info.height + 7) / 8, (info.height + 3) / 8, (info.height + 3) / 4, (info.height + 1) / 4, (info.height + 1) / 2, (info.height + 0) / 2 };
-        size_t passstart[7] = {0};
+        size_t passstart[8] = {0};
         size_t pattern[28] = {0,4,0,2,0,1,0,0,0,4,0,2,0,1,8,8,4,4,2,2,1,8,8,8,4,4,2,2}; //values for the adam7 passes
-        for(int i = 0; i < 6; i++) passstart[i + 1] = passstart[i] + passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
+        for(int i = 0; i < 7; i++) passstart[i + 1] = passstart[i] + passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
+        if(scanlines.size() < passstart[7]) { error = 71; return; } //error: the image data is too short for the image size
         std::vector<unsigned char> scanlineo((info.width * bpp + 7) / 8), scanlinen((info.width * bpp + 7) / 8); //"old" and "new" scanline
         for(int i = 0; i < 7; i++)
-          adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0], &scanlines[passstart[i]], info.width, pattern[i], pattern[i + 7], pattern[i + 14], pattern[i + 21], passw[i], passh[i], bpp);
-      }
-      if(convert_to_rgba32 && (info.colorType != 6 || info.bitDepth != 8)) //conversion needed
-      {
-        std::vector<unsigned char> data = out;
-        error = convert(out, &data[0], info, info.width, info.height);
+        {
+          adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0], &scanlines[0] + passstart[i], info.width, pattern[i], pattern[i + 7], pattern[i + 14], pattern[i + 21], passw[i], passh[i], bpp); if(error) return;
+        }
       }
     }
     void readPngHeader(const unsigned char* in, size_t inlength) //read the information from the header and store it in the Info
@@ -431,7 +307,7 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
       for(unsigned long y = 0; y < passh; y++)
       {
         unsigned char filterType = in[y * linelength], *prevline = (y == 0) ? 0 : lineo;
-        unFilterScanline(linen, &in[y * linelength + 1], prevline, bytewidth, filterType, (w * bpp + 7) / 8); if(error) return;
+        unFilterScanline(linen, &in[y * linelength + 1], prevline, bytewidth, filterType, linelength - 1); if(error) return;
         if(bpp >= 8) for(size_t i = 0; i < passw; i++) for(size_t b = 0; b < bytewidth; b++) //b = current byte of this pixel
           out[bytewidth * w * (passtop + spacey * y) + bytewidth * (passleft + spacex * i) + b] = linen[bytewidth * i + b];
         else for(size_t i = 0; i < passw; i++)
@@ -535,9 +411,28 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
       return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
     }
   };
+}
+
+int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, unsigned long in_size)
+{
   PNG decoder; decoder.decode(out_image, in_png, in_size, true);
   image_width = decoder.info.width; image_height = decoder.info.height;
   return decoder.error;
 }
 
+int readPNGSize(unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, unsigned long in_size)
+{
+  PNG decoder; decoder.error = 0;
+  if(in_png == 0) return 48;
+  decoder.readPngHeader(in_png, in_size); if(decoder.error) return decoder.error;
+  image_width = decoder.info.width; image_height = decoder.info.height;
+  return 0;
+}
+
+int decodePNGToBGRA(unsigned char* out_bgra, long out_stride, unsigned long image_width, unsigned long image_height, const unsigned char* in_png, unsigned long in_size)
+{
+  PNG decoder; decoder.decodeBGRA(out_bgra, out_stride, image_width, image_height, in_png, in_size);
+  return decoder.error;
+}
+
 #endif // LS_USE_PICOPNG
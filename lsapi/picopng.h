@@ -28,4 +28,16 @@ int decodePNG(std::vector<unsigned char>& out_image_32bit,
               unsigned long& image_width, unsigned long& image_height,
               const unsigned char* in_png, unsigned long in_size);
 
+// Reads the image size from the PNG header without decoding anything
+int readPNGSize(unsigned long& image_width, unsigned long& image_height,
+                const unsigned char* in_png, unsigned long in_size);
+
+// Decodes into 32-bit BGRA pixels without intermediate pixel buffers. Row n
+// is written to out_bgra + n * out_stride, so a negative stride starting at
+// the last row gives a bottom-up DIB. The image must be image_width by
+// image_height pixels, as returned by readPNGSize.
+int decodePNGToBGRA(unsigned char* out_bgra, long out_stride,
+                    unsigned long image_width, unsigned long image_height,
+                    const unsigned char* in_png, unsigned long in_size);
+
 #endif // PICOPNG_H
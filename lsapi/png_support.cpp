@@ -25,6 +25,7 @@
 #if defined(LS_USE_PICOPNG)
 
 #include "picopng.h"
+#include <climits>
 #include <vector>
 #include <fstream>
 
@@ -69,7 +70,7 @@ HBITMAP LoadFromPNG(LPCWSTR pwzFilename)
     }
 
     //load and decode
-    std::vector<unsigned char> buffer, image, palette;
+    std::vector<unsigned char> buffer;
 
     loadFile(buffer, pwzFilename);
 
@@ -79,15 +80,16 @@ HBITMAP LoadFromPNG(LPCWSTR pwzFilename)
     }
 
     unsigned long w, h;
-    int error = decodePNG(image, w, h, &buffer[0],
-        static_cast<unsigned long>(buffer.size()));
+    unsigned long size = static_cast<unsigned long>(buffer.size());
 
-    if (error != 0)
+    if (readPNGSize(w, h, &buffer[0], size) != 0)
     {
         return NULL;
     }
 
-    if (image.size() <= 4)
+    // Rows of a 32-bit DIB need no padding, but the whole image must fit
+    // into a LONG
+    if (w == 0 || h == 0 || (unsigned long long)w * h * 4 > LONG_MAX)
     {
         return NULL;
     }
@@ -101,23 +103,25 @@ HBITMAP LoadFromPNG(LPCWSTR pwzFilename)
     bmi.bmiHeader.biCompression = BI_RGB;
 
     unsigned char* bits;
-    std::vector<unsigned char> bgra;
 
     HBITMAP hDibSection = CreateDIBSection(
         NULL, &bmi, 0, reinterpret_cast<LPVOID*>(&bits), NULL, 0);
 
-    for (int i = static_cast<int>(image.size()) - w*4; i >= 0; i -= w*4)
+    if (hDibSection == NULL)
     {
-        for (unsigned long j = 0; j < w*4; j += 4)
-        {
-            bgra.push_back(image[i + j + 2]); // blue
-            bgra.push_back(image[i + j + 1]); // green
-            bgra.push_back(image[i + j]);     // red
-            bgra.push_back(image[i + j + 3]); // alpha
-        }
+        return NULL;
     }
 
-    memcpy(bits, &(bgra[0]), bgra.size());
+    // The DIB is bottom-up, so decode the top row into the last one and
+    // walk backwards
+    const long stride = static_cast<long>(w * 4);
+
+    if (decodePNGToBGRA(bits + (h - 1) * stride, -stride, w, h,
+        &buffer[0], size) != 0)
+    {
+        DeleteObject(hDibSection);
+        return NULL;
+    }
 
     return hDibSection;
 }
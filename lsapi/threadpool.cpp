@@ -0,0 +1,267 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "lsapi.h"
+#include "../utility/core.hpp"
+#include "../utility/criticalsection.h"
+#include <deque>
+
+
+// Work handed to the pool or the main thread
+struct WorkItem
+{
+    LSWORKPROC pfnWork;
+    LPVOID pvContext;
+    HMODULE hModule;
+};
+
+// Timer handed out by LSCreateWorkTimer
+struct TimerItem
+{
+    LSWORKPROC pfnWork;
+    LPVOID pvContext;
+    HANDLE hTimer;
+    HMODULE hModule;
+};
+
+// Work waiting for LiteStep's main thread
+static CriticalSection s_csMainThreadWork;
+static std::deque<WorkItem> s_dqMainThreadWork;
+
+
+//
+// _PinModule
+//
+// Adds a reference to the DLL that pfnWork lives in, so a module that
+// unloads with work in flight doesn't pull the code out from under the pool
+//
+static HMODULE _PinModule(LSWORKPROC pfnWork)
+{
+    HMODULE hModule = nullptr;
+
+    GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+        (LPCWSTR)pfnWork, &hModule);
+
+    return hModule;
+}
+
+
+//
+// _WorkCallback
+//
+static DWORD WINAPI _WorkCallback(LPVOID pvItem)
+{
+    WorkItem item = *(WorkItem*)pvItem;
+    delete (WorkItem*)pvItem;
+
+    item.pfnWork(item.pvContext);
+
+    // Safe, since this code lives in lsapi.dll and not in the module
+    if (item.hModule)
+    {
+        FreeLibrary(item.hModule);
+    }
+
+    return 0;
+}
+
+
+//
+// _TimerCallback
+//
+static void CALLBACK _TimerCallback(PVOID pvItem, BOOLEAN)
+{
+    TimerItem* pItem = (TimerItem*)pvItem;
+    pItem->pfnWork(pItem->pvContext);
+}
+
+
+//
+// LSQueueWorkItem
+//
+BOOL LSQueueWorkItem(LSWORKPROC pfnWork, LPVOID pvContext, DWORD dwFlags)
+{
+    if (pfnWork == nullptr)
+    {
+        return FALSE;
+    }
+
+    WorkItem* pItem = new WorkItem;
+    pItem->pfnWork = pfnWork;
+    pItem->pvContext = pvContext;
+    pItem->hModule = _PinModule(pfnWork);
+
+    // Long running work makes the pool add threads instead of letting it
+    // hold up everything queued behind it
+    ULONG ulFlags = WT_EXECUTEDEFAULT;
+
+    if (dwFlags & LSWORK_LONG)
+    {
+        ulFlags |= WT_EXECUTELONGFUNCTION;
+    }
+
+    BOOL bReturn = QueueUserWorkItem(_WorkCallback, pItem, ulFlags);
+
+    if (!bReturn)
+    {
+        if (pItem->hModule)
+        {
+            FreeLibrary(pItem->hModule);
+        }
+
+        delete pItem;
+    }
+
+    return bReturn;
+}
+
+
+//
+// LSCreateWorkTimer
+//
+HANDLE LSCreateWorkTimer(LSWORKPROC pfnWork, LPVOID pvContext, DWORD dwDueTime, DWORD dwPeriod)
+{
+    if (pfnWork == nullptr)
+    {
+        return nullptr;
+    }
+
+    TimerItem* pItem = new TimerItem;
+    pItem->pfnWork = pfnWork;
+    pItem->pvContext = pvContext;
+    pItem->hTimer = nullptr;
+
+    // Held until the timer is closed, so a module that forgets to close its
+    // timer doesn't leave it firing into unmapped code
+    pItem->hModule = _PinModule(pfnWork);
+
+    // Timers live on the default timer queue, so they need neither a window
+    // nor a message loop
+    if (!CreateTimerQueueTimer(&pItem->hTimer, nullptr, _TimerCallback,
+        pItem, dwDueTime, dwPeriod, WT_EXECUTEDEFAULT))
+    {
+        if (pItem->hModule)
+        {
+            FreeLibrary(pItem->hModule);
+        }
+
+        delete pItem;
+        pItem = nullptr;
+    }
+
+    return (HANDLE)pItem;
+}
+
+
+//
+// LSCloseWorkTimer
+//
+void LSCloseWorkTimer(HANDLE hTimer)
+{
+    TimerItem* pItem = (TimerItem*)hTimer;
+
+    if (pItem != nullptr)
+    {
+        // INVALID_HANDLE_VALUE waits for a running callback, so the context
+        // may be freed as soon as we return
+        DeleteTimerQueueTimer(nullptr, pItem->hTimer, INVALID_HANDLE_VALUE);
+
+        if (pItem->hModule)
+        {
+            FreeLibrary(pItem->hModule);
+        }
+
+        delete pItem;
+    }
+}
+
+
+//
+// LSRunOnMainThread
+//
+BOOL LSRunOnMainThread(LSWORKPROC pfnWork, LPVOID pvContext)
+{
+    HWND hLitestepWnd = GetLitestepWnd();
+
+    if (pfnWork == nullptr || hLitestepWnd == nullptr)
+    {
+        return FALSE;
+    }
+
+    WorkItem item = { pfnWork, pvContext, _PinModule(pfnWork) };
+
+    {
+        Lock lock(s_csMainThreadWork);
+        s_dqMainThreadWork.push_back(item);
+    }
+
+    // The message carries no pointers, so nobody outside can make the core
+    // call into arbitrary code. Each message drains the whole queue.
+    if (!PostMessage(hLitestepWnd, LM_RUNONMAINTHREAD, 0, 0))
+    {
+        Lock lock(s_csMainThreadWork);
+
+        std::deque<WorkItem>::reverse_iterator iter = s_dqMainThreadWork.rbegin();
+
+        while (iter != s_dqMainThreadWork.rend())
+        {
+            if (iter->pfnWork == pfnWork && iter->pvContext == pvContext)
+            {
+                if (iter->hModule)
+                {
+                    FreeLibrary(iter->hModule);
+                }
+
+                s_dqMainThreadWork.erase(--(iter.base()));
+                return FALSE;
+            }
+
+            ++iter;
+        }
+    }
+
+    return TRUE;
+}
+
+
+//
+// LSAPIRunMainThreadWork
+//
+void LSAPIRunMainThreadWork(void)
+{
+    std::deque<WorkItem> dqWork;
+
+    {
+        Lock lock(s_csMainThreadWork);
+        dqWork.swap(s_dqMainThreadWork);
+    }
+
+    for (std::deque<WorkItem>::iterator iter = dqWork.begin();
+         iter != dqWork.end(); ++iter)
+    {
+        iter->pfnWork(iter->pvContext);
+
+        if (iter->hModule)
+        {
+            FreeLibrary(iter->hModule);
+        }
+    }
+}
@@ -24,6 +24,7 @@
 #define ELD_REVIDS      3
 #define ELD_BANGS_V2    4
 #define ELD_PERFORMANCE 5
+#define ELD_PERFORMANCE_EX 6
 
 // EnumModulesProc
 #define LS_MODULE_THREADED 0x0001
@@ -116,12 +117,40 @@ typedef struct _SYSTRAYINFOEVENT {
     GUID guidItem;
 } SYSTRAYINFOEVENT, *LPSYSTRAYINFOEVENT;
 
+// LM_SYSTRAYREADY, LM_SYSTRAYSNAPSHOT
+#define SYSTRAYREADY_SNAPSHOT     0x0001  // deliver the icons as one LM_SYSTRAYSNAPSHOT
+#define LSSYSTRAYSNAPSHOT_VERSION 1
+
+typedef struct LSSYSTRAYSNAPSHOT {
+    UINT cbSize;
+    DWORD dwVersion;            // LSSYSTRAYSNAPSHOT_VERSION
+    UINT uCount;                // number of records at pvIcons
+    UINT cbIcon;                // distance between two records, in bytes
+    LPCVOID pvIcons;            // LSNOTIFYICONDATAW records
+} LSSYSTRAYSNAPSHOT, *LPLSSYSTRAYSNAPSHOT;
+
+// LM_SAVEDATAEX, LM_RESTOREDATAEX, LM_RELEASEDATAVIEW
+#define LSDATA_VIEW           0x0001  // LM_RESTOREDATAEX returns a pointer into the store
+
+typedef struct LSDATAITEM
+{
+    UINT cbSize;
+    DWORD dwIdent;              // shared with the HIWORD idents of LM_SAVEDATA
+    DWORD dwFlags;              // LSDATA_* flags
+    LPVOID pvData;
+    DWORD cbData;
+} LSDATAITEM, *LPLSDATAITEM;
+
 // Messages
 #define LM_SAVEDATA                   8892  // Module -> Core
 #define LM_RESTOREDATA                8893  // Module -> Core
+#define LM_SAVEDATAEX                 8894  // Module -> Core
+#define LM_RESTOREDATAEX              8895  // Module -> Core
+#define LM_RELEASEDATAVIEW            8896  // Module -> Core
 #define LM_SYSTRAYA                   9214  // Core   -> Module
 #define LM_SYSTRAYREADY               9215  // Module -> Core
 #define LM_SYSTRAYINFOEVENT           9216  // Core   -> Module
+#define LM_SYSTRAYSNAPSHOT            9217  // Core   -> Module
 #define LM_REGISTERMESSAGE            9263  // Module -> Core
 #define LM_UNREGISTERMESSAGE          9264  // Module -> Core
 #define LM_GETREVIDA                  9265  // Core   -> Module
@@ -165,6 +194,7 @@ typedef struct _SYSTRAYINFOEVENT {
 #define LM_GETREVIDW                  33283 // Core   -> Module
 #define LM_SYSTRAYW                   33285 // Core   -> Module
 #define LM_WALLPAPERCHANGE            33286 // Core   -> Module
+#define LM_MESSAGETIMEOUT             33287 // Core   -> Module
 
 #if defined(_UNICODE)
 #   define LM_UNLOADMODULE LM_UNLOADMODULEW
@@ -204,6 +234,63 @@ typedef BOOL (__stdcall * ENUMBANGSV2PROCW)(HINSTANCE hinstModule, LPCWSTR pszBa
 typedef BOOL (__stdcall * ENUMPERFORMANCEPROCA)(LPCSTR pszPath, DWORD dwLoadTime, LPARAM lParam);
 typedef BOOL (__stdcall * ENUMPERFORMANCEPROCW)(LPCWSTR pszPath, DWORD dwLoadTime, LPARAM lParam);
 
+typedef struct LSMODULEPERFORMANCE
+{
+    UINT cbSize;
+    DWORD dwFlags;
+    DWORD dwLoadTime;
+    DWORD dwWallTime;
+    DWORD dwCriticalPathTime;
+    ULONGLONG ullLibraryTime;
+    ULONGLONG ullResolveTime;
+    ULONGLONG ullInitTime;
+    ULONGLONG ullInitEventLatency;
+    ULONGLONG ullQuitTime;
+    UINT uBangCount;
+    UINT uMessageCount;
+} LSMODULEPERFORMANCE;
+
+typedef BOOL (__stdcall * ENUMPERFORMANCEEXPROCA)(LPCSTR pszPath, const LSMODULEPERFORMANCE* pPerformance, LPARAM lParam);
+typedef BOOL (__stdcall * ENUMPERFORMANCEEXPROCW)(LPCWSTR pszPath, const LSMODULEPERFORMANCE* pPerformance, LPARAM lParam);
+
+// Optional module export, returns a double null terminated list of modules
+// that must be initialized first
+typedef LPCWSTR (__cdecl * GETMODULEDEPENDENCIESPROC)(void);
+
+// LSQueueWorkItem, LSCreateWorkTimer, LSRunOnMainThread
+typedef VOID (__stdcall * LSWORKPROC)(LPVOID pvContext);
+
+// LSQueueWorkItem flags
+#define LSWORK_LONG           0x0001  // the work blocks or runs for a long time
+
+// LSGetImageCacheStatistics
+typedef struct LSIMAGECACHESTATISTICS {
+    UINT cbSize;
+    UINT uHits;                 // loads served from the cache
+    UINT uMisses;               // loads that had to decode the file
+    UINT uEvictions;            // images dropped to stay within the budget
+    UINT uImages;               // images in the cache
+    UINT uShared;               // LSLoadSharedImage bitmaps not released yet
+    ULONGLONG ullBytes;         // memory used by the cached images
+    ULONGLONG ullBudget;        // LSImageCacheSize, in bytes
+} LSIMAGECACHESTATISTICS, *LPLSIMAGECACHESTATISTICS;
+
+// LSGetWorkAreaStatistics
+typedef struct LSWORKAREASTATISTICS {
+    UINT cbSize;
+    UINT uRequested;            // work area changes asked for by AppBars
+    UINT uSuppressed;           // requests that changed nothing
+    UINT uSuperseded;           // pending changes replaced before they settled
+    UINT uApplied;              // changes made to the work area
+    UINT uBroadcasts;           // WM_SETTINGCHANGE broadcasts sent
+    UINT uEchoes;               // broadcasts that came back to LiteStep
+    UINT uPendingEchoes;        // broadcasts that haven't come back yet
+    UINT uExternal;             // work area changes made by someone else
+} LSWORKAREASTATISTICS, *LPLSWORKAREASTATISTICS;
+
+// LSLoadSharedImageEx flags
+#define LSIMAGE_PREMULTIPLIED 0x0001  // premultiplied alpha, for LSAlphaBlendImage
+
 #if defined(_UNICODE)
 #   define BANGCOMMANDPROC BANGCOMMANDPROCW
 #   define BANGCOMMANDPROCEX BANGCOMMANDPROCEXW
@@ -212,6 +299,7 @@ typedef BOOL (__stdcall * ENUMPERFORMANCEPROCW)(LPCWSTR pszPath, DWORD dwLoadTim
 #   define ENUMREVIDSPROC ENUMREVIDSPROCW
 #   define ENUMBANGSV2PROC ENUMBANGSV2PROCW
 #   define ENUMPERFORMANCEPROC ENUMPERFORMANCEPROCW
+#   define ENUMPERFORMANCEEXPROC ENUMPERFORMANCEEXPROCW
 #else
 #   define BANGCOMMANDPROC BANGCOMMANDPROCA
 #   define BANGCOMMANDPROCEX BANGCOMMANDPROCEXA
@@ -220,6 +308,7 @@ typedef BOOL (__stdcall * ENUMPERFORMANCEPROCW)(LPCWSTR pszPath, DWORD dwLoadTim
 #   define ENUMREVIDSPROC ENUMREVIDSPROCA
 #   define ENUMBANGSV2PROC ENUMBANGSV2PROCA
 #   define ENUMPERFORMANCEPROC ENUMPERFORMANCEPROCA
+#   define ENUMPERFORMANCEEXPROC ENUMPERFORMANCEEXPROCA
 #endif
 
 // Functions
@@ -283,15 +372,20 @@ EXTERN_CDECL(HICON) LoadLSIconA(LPCSTR pszPath, LPVOID pReserved);
 EXTERN_CDECL(HICON) LoadLSIconW(LPCWSTR pszPath, LPVOID pReserved);
 EXTERN_CDECL(HBITMAP) LoadLSImageA(LPCSTR pszPath, LPVOID pReserved);
 EXTERN_CDECL(HBITMAP) LoadLSImageW(LPCWSTR pszPath, LPVOID pReserved);
+EXTERN_CDECL(BOOL) LSAlphaBlendImage(HDC hdcDest, INT nXDest, INT nYDest, INT nWidth, INT nHeight, HBITMAP hbmImage, INT nXSrc, INT nYSrc, INT nSrcWidth, INT nSrcHeight, BYTE bAlpha);
+EXTERN_CDECL(VOID) LSCloseWorkTimer(HANDLE hTimer);
 EXTERN_CDECL(HRESULT) LSCoCreateInstance(REFCLSID rclsid, LPUNKNOWN pUnkOuter, DWORD dwClsContext, REFIID riid, LPVOID *ppv);
+EXTERN_CDECL(HANDLE) LSCreateWorkTimer(LSWORKPROC pfnWork, LPVOID pvContext, DWORD dwDueTime, DWORD dwPeriod);
 EXTERN_CDECL(HINSTANCE) LSExecuteA(HWND hwndOwner, LPCSTR pszCommandLine, INT nShowCmd);
 EXTERN_CDECL(HINSTANCE) LSExecuteW(HWND hwndOwner, LPCWSTR pszCommandLine, INT nShowCmd);
 EXTERN_CDECL(HINSTANCE) LSExecuteExA(HWND hwndOwner, LPCSTR pszOperation, LPCSTR pszCommand, LPCSTR pszArgs, LPCSTR pszDirectory, INT nShowCmd);
 EXTERN_CDECL(HINSTANCE) LSExecuteExW(HWND hwndOwner, LPCWSTR pszOperation, LPCWSTR pszCommand, LPCWSTR pszArgs, LPCWSTR pszDirectory, INT nShowCmd);
+EXTERN_CDECL(BOOL) LSGetImageCacheStatistics(LSIMAGECACHESTATISTICS *pStats);
 EXTERN_STDCALL(BOOL) LSGetImagePathA(LPSTR pszBuffer, UINT cchBuffer);
 EXTERN_STDCALL(BOOL) LSGetImagePathW(LPWSTR pszBuffer, UINT cchBuffer);
 EXTERN_STDCALL(BOOL) LSGetLitestepPathA(LPSTR pszBuffer, UINT cchBuffer);
 EXTERN_STDCALL(BOOL) LSGetLitestepPathW(LPWSTR pszBuffer, UINT cchBuffer);
+EXTERN_CDECL(BOOL) LSGetWorkAreaStatistics(LSWORKAREASTATISTICS *pStats);
 EXTERN_CDECL(BOOL) LSEnumDisplayMonitors(HDC, LPCRECT, MONITORENUMPROC, LPARAM); // See Win32 EnumDisplayMonitors
 EXTERN_CDECL(BOOL) LSEnumDisplayDevices(LPCSTR, DWORD, PDISPLAY_DEVICEA, DWORD); // See Win32 EnumDisplayDevices
 EXTERN_CDECL(BOOL) LSGetMonitorInfo(HMONITOR, LPMONITORINFO);                    // See Win32 GetMonitorInfo
@@ -305,6 +399,17 @@ EXTERN_CDECL(BOOL) LSLogPrintf(INT nLevel, LPCSTR pszModule, LPCSTR pszFormat, .
 EXTERN_CDECL(HMONITOR) LSMonitorFromPoint(POINT, DWORD);                         // See Win32 MonitorFromPoint
 EXTERN_CDECL(HMONITOR) LSMonitorFromRect(LPCRECT, DWORD);                        // See Win32 MonitorFromRect
 EXTERN_CDECL(HMONITOR) LSMonitorFromWindow(HWND, DWORD);                         // See Win32 MonitorFromWindow
+EXTERN_CDECL(BOOL) LSLoadImageAsyncA(LPCSTR pszPath, LPVOID pReserved, HWND hwndNotify, UINT uMsg, LPARAM lParam);
+EXTERN_CDECL(BOOL) LSLoadImageAsyncW(LPCWSTR pszPath, LPVOID pReserved, HWND hwndNotify, UINT uMsg, LPARAM lParam);
+EXTERN_CDECL(HBITMAP) LSLoadSharedImageA(LPCSTR pszPath, LPVOID pReserved);
+EXTERN_CDECL(HBITMAP) LSLoadSharedImageW(LPCWSTR pszPath, LPVOID pReserved);
+EXTERN_CDECL(HBITMAP) LSLoadSharedImageExA(LPCSTR pszPath, LPVOID pReserved, DWORD dwFlags);
+EXTERN_CDECL(HBITMAP) LSLoadSharedImageExW(LPCWSTR pszPath, LPVOID pReserved, DWORD dwFlags);
+EXTERN_CDECL(UINT) LSPrefetchImagesA(LPCSTR pszPattern);
+EXTERN_CDECL(UINT) LSPrefetchImagesW(LPCWSTR pszPattern);
+EXTERN_CDECL(BOOL) LSQueueWorkItem(LSWORKPROC pfnWork, LPVOID pvContext, DWORD dwFlags);
+EXTERN_CDECL(VOID) LSReleaseSharedImage(HBITMAP hbmImage);
+EXTERN_CDECL(BOOL) LSRunOnMainThread(LSWORKPROC pfnWork, LPVOID pvContext);
 EXTERN_CDECL(BOOL) LSSetVariableA(LPCSTR pszKeyName, LPCSTR pszValue);
 EXTERN_CDECL(BOOL) LSSetVariableW(LPCWSTR pszKeyName, LPCWSTR pszValue);
 EXTERN_CDECL(BOOL) matchA(LPCSTR pszPattern, LPCSTR pszText);
@@ -353,6 +458,10 @@ EXTERN_CDECL(VOID) VarExpansionExW(LPWSTR pszBuffer, LPCWSTR pszString, UINT cch
 #   define LSExecuteEx LSExecuteExW
 #   define LSGetImagePath LSGetImagePathW
 #   define LSGetLitestepPath LSGetLitestepPathW
+#   define LSLoadImageAsync LSLoadImageAsyncW
+#   define LSLoadSharedImage LSLoadSharedImageW
+#   define LSLoadSharedImageEx LSLoadSharedImageExW
+#   define LSPrefetchImages LSPrefetchImagesW
 #   define LSGetVariable LSGetVariableW
 #   define LSGetVariableEx LSGetVariableExW
 #   define LSSetVariable LSSetVariableW
@@ -392,6 +501,10 @@ EXTERN_CDECL(VOID) VarExpansionExW(LPWSTR pszBuffer, LPCWSTR pszString, UINT cch
 #   define LSExecuteEx LSExecuteExA
 #   define LSGetImagePath LSGetImagePathA
 #   define LSGetLitestepPath LSGetLitestepPathA
+#   define LSLoadImageAsync LSLoadImageAsyncA
+#   define LSLoadSharedImage LSLoadSharedImageA
+#   define LSLoadSharedImageEx LSLoadSharedImageExA
+#   define LSPrefetchImages LSPrefetchImagesA
 #   define LSGetVariable LSGetVariableA
 #   define LSGetVariableEx LSGetVariableExA
 #   define LSSetVariable LSSetVariableA
@@ -0,0 +1,541 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/DataStoreImage.h"
+#include "Test.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Layout of the image, see DataStoreImage.cpp
+#define HEADER_BYTES    32
+#define SLOT_BYTES      32
+#define PAYLOAD_START   (HEADER_BYTES + DataStoreImage::SLOT_COUNT * SLOT_BYTES)
+
+#define SLOT_STATE      0
+#define SLOT_IDENT      1
+#define SLOT_OFFSET     3
+
+#define BLOCK_SIZE      (64 * 1024)
+
+
+typedef std::vector<BYTE> Block;
+
+
+static DWORD* GetSlot(Block& block, UINT uSlot)
+{
+    return (DWORD*)&block[HEADER_BYTES + uSlot * SLOT_BYTES];
+}
+
+
+//
+// Looks up an item by identifier, the way DataStore restores them
+//
+static bool FindItem(const DataStoreImage& image, DWORD dwIdent,
+    std::string& sData)
+{
+    for (UINT uSlot = 0; uSlot < DataStoreImage::SLOT_COUNT; ++uSlot)
+    {
+        DWORD dwSlotIdent = 0;
+        const void* pvData = nullptr;
+        DWORD dwLength = 0;
+
+        if (image.GetItem(uSlot, dwSlotIdent, pvData, dwLength) &&
+            dwSlotIdent == dwIdent)
+        {
+            sData.assign((const char*)pvData, dwLength);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static size_t CountItems(const DataStoreImage& image)
+{
+    size_t cItems = 0;
+
+    for (UINT uSlot = 0; uSlot < DataStoreImage::SLOT_COUNT; ++uSlot)
+    {
+        DWORD dwIdent = 0;
+        const void* pvData = nullptr;
+        DWORD dwLength = 0;
+
+        if (image.GetItem(uSlot, dwIdent, pvData, dwLength))
+        {
+            ++cItems;
+        }
+    }
+
+    return cItems;
+}
+
+
+static bool Write(DataStoreImage& image, DWORD dwIdent, const std::string& s)
+{
+    return image.Write(dwIdent, s.data(), (DWORD)s.size());
+}
+
+
+static bool HasItem(Block& block, DWORD dwIdent, const std::string& sExpected)
+{
+    DataStoreImage image;
+    std::string sData;
+
+    return image.Attach(&block[0], (DWORD)block.size()) &&
+        FindItem(image, dwIdent, sData) && sData == sExpected;
+}
+
+
+//
+// Items written in one run are there in the next
+//
+static void TestRoundTrip()
+{
+    Block block(BLOCK_SIZE, 0xCD);
+
+    {
+        DataStoreImage image;
+        CHECK(image.Attach(&block[0], BLOCK_SIZE));
+        CHECK_EQUAL((size_t)0, CountItems(image));
+
+        CHECK(Write(image, 1, "one"));
+        CHECK(Write(image, 2, "two"));
+        CHECK(Write(image, 3, "three"));
+        CHECK(Write(image, 2, "second"));
+        CHECK(image.Remove(3));
+        CHECK(!image.Remove(3));
+
+        // Rejected outright
+        CHECK(!image.Write(4, "x", 0));
+        CHECK(!image.Write(4, nullptr, 1));
+        CHECK(!Write(image, 5, std::string(BLOCK_SIZE, 'x')));
+    }
+
+    DataStoreImage image;
+    std::string sData;
+
+    CHECK(image.Attach(&block[0], BLOCK_SIZE));
+    CHECK_EQUAL((size_t)2, CountItems(image));
+    CHECK(FindItem(image, 1, sData) && sData == "one");
+    CHECK(FindItem(image, 2, sData) && sData == "second");
+    CHECK(!FindItem(image, 3, sData));
+
+    image.Clear();
+    CHECK_EQUAL((size_t)0, CountItems(image));
+}
+
+
+//
+// Items nobody restored are dropped after one more run
+//
+static void TestRuns()
+{
+    Block block(BLOCK_SIZE, 0);
+
+    {
+        DataStoreImage image;
+        image.Attach(&block[0], BLOCK_SIZE);
+        Write(image, 1, "stale");
+        Write(image, 2, "restored");
+    }
+
+    {
+        // Next run: item 2 is restored and stored again, item 1 isn't
+        DataStoreImage image;
+        std::string sData;
+
+        image.Attach(&block[0], BLOCK_SIZE);
+        CHECK(FindItem(image, 1, sData));
+        CHECK(FindItem(image, 2, sData));
+        Write(image, 2, sData);
+    }
+
+    DataStoreImage image;
+    std::string sData;
+
+    image.Attach(&block[0], BLOCK_SIZE);
+    CHECK(!FindItem(image, 1, sData));
+    CHECK(FindItem(image, 2, sData) && sData == "restored");
+}
+
+
+//
+// Incompatible or damaged headers get the block formatted
+//
+static void TestFormat()
+{
+    Block block(BLOCK_SIZE, 0);
+
+    {
+        DataStoreImage image;
+        CHECK(!image.Attach(&block[0], PAYLOAD_START + 4095));
+        CHECK(!image.Attach(nullptr, BLOCK_SIZE));
+
+        CHECK(image.Attach(&block[0], BLOCK_SIZE));
+        Write(image, 1, "one");
+    }
+
+    CHECK(HasItem(block, 1, "one"));
+
+    // A different size (e.g. another build) doesn't fit the header
+    {
+        DataStoreImage image;
+        std::string sData;
+
+        CHECK(image.Attach(&block[0], BLOCK_SIZE - 8));
+        CHECK(!FindItem(image, 1, sData));
+        Write(image, 1, "one");
+    }
+
+    // Any header change breaks its checksum
+    block[12] ^= 0x01;
+    CHECK(!HasItem(block, 1, "one"));
+}
+
+
+//
+// Damaged slots and payloads are discarded, the rest survives
+//
+static void TestCorruption()
+{
+    Block block(BLOCK_SIZE, 0);
+
+    {
+        DataStoreImage image;
+        image.Attach(&block[0], BLOCK_SIZE);
+        Write(image, 1, "payload");
+        Write(image, 2, "slot");
+        Write(image, 3, "state");
+        Write(image, 4, "intact");
+    }
+
+    block[PAYLOAD_START + GetSlot(block, 0)[SLOT_OFFSET] + 2] ^= 0x40;
+    GetSlot(block, 1)[SLOT_IDENT] = 22;
+    GetSlot(block, 2)[SLOT_STATE] = 0x12345678;
+
+    DataStoreImage image;
+    std::string sData;
+
+    CHECK(image.Attach(&block[0], BLOCK_SIZE));
+    CHECK(!FindItem(image, 1, sData));
+    CHECK(!FindItem(image, 2, sData));
+    CHECK(!FindItem(image, 22, sData));
+    CHECK(!FindItem(image, 3, sData));
+    CHECK(FindItem(image, 4, sData) && sData == "intact");
+    CHECK_EQUAL((size_t)1, CountItems(image));
+
+    // Discarded slots are free again
+    CHECK_EQUAL((DWORD)0, GetSlot(block, 2)[SLOT_STATE]);
+}
+
+
+//
+// Applies the bytes that a write changed in some order, stopping at every
+// point. Whatever the image holds then must be either the old or the new
+// value, never a mix.
+//
+static void TearWrite(const Block& before, const Block& after,
+    const std::vector<size_t>& vecOrder, const std::string& sOld,
+    const std::string& sNew)
+{
+    for (size_t cApplied = 0; cApplied <= vecOrder.size(); ++cApplied)
+    {
+        Block torn(before);
+
+        for (size_t n = 0; n < cApplied; ++n)
+        {
+            torn[vecOrder[n]] = after[vecOrder[n]];
+        }
+
+        DataStoreImage image;
+        std::string sData;
+
+        CHECK(image.Attach(&torn[0], BLOCK_SIZE));
+
+        if (FindItem(image, 1, sData))
+        {
+            CHECK(sData == sOld || sData == sNew);
+        }
+
+        CHECK(FindItem(image, 2, sData) && sData == "bystander");
+    }
+}
+
+
+static void TestTornWrites()
+{
+    Block block(BLOCK_SIZE, 0);
+    DataStoreImage image;
+
+    image.Attach(&block[0], BLOCK_SIZE);
+    Write(image, 1, "old value");
+    Write(image, 2, "bystander");
+
+    const std::string sNew("a new, longer value");
+    Block before(block);
+    Write(image, 1, sNew);
+    Block after(block);
+
+    std::vector<size_t> vecChanged;
+
+    for (size_t n = 0; n < BLOCK_SIZE; ++n)
+    {
+        if (before[n] != after[n])
+        {
+            vecChanged.push_back(n);
+        }
+    }
+
+    CHECK(!vecChanged.empty());
+
+    // In address order the slot is committed before its payload lands,
+    // backwards the payload comes first
+    TearWrite(before, after, vecChanged, "old value", sNew);
+
+    std::vector<size_t> vecReversed(vecChanged.rbegin(), vecChanged.rend());
+    TearWrite(before, after, vecReversed, "old value", sNew);
+
+    // And some arbitrary orders
+    unsigned int uSeed = 1;
+
+    for (int nRound = 0; nRound < 16; ++nRound)
+    {
+        std::vector<size_t> vecShuffled(vecChanged);
+
+        for (size_t n = vecShuffled.size(); n > 1; --n)
+        {
+            uSeed = uSeed * 1103515245 + 12345;
+            std::swap(vecShuffled[n - 1], vecShuffled[(uSeed >> 16) % n]);
+        }
+
+        TearWrite(before, after, vecShuffled, "old value", sNew);
+    }
+}
+
+
+//
+// Filling the payload area compacts it, and moved items survive
+//
+static void TestCompact()
+{
+    const DWORD cbSize = PAYLOAD_START + 8192;
+    Block block(cbSize, 0);
+
+    {
+        DataStoreImage image;
+        CHECK(image.Attach(&block[0], cbSize));
+
+        for (DWORD dwIdent = 0; dwIdent < 8; ++dwIdent)
+        {
+            CHECK(Write(image, dwIdent, std::string(1000, (char)('a' + dwIdent))));
+        }
+
+        // Out of room until the holes are squeezed out
+        for (DWORD dwIdent = 0; dwIdent < 8; dwIdent += 2)
+        {
+            image.Remove(dwIdent);
+        }
+
+        CHECK(Write(image, 100, std::string(3000, 'z')));
+        CHECK(!Write(image, 101, std::string(3000, 'y')));
+    }
+
+    DataStoreImage image;
+    std::string sData;
+
+    CHECK(image.Attach(&block[0], cbSize));
+    CHECK_EQUAL((size_t)5, CountItems(image));
+
+    for (DWORD dwIdent = 1; dwIdent < 8; dwIdent += 2)
+    {
+        CHECK(FindItem(image, dwIdent, sData) &&
+            sData == std::string(1000, (char)('a' + dwIdent)));
+    }
+
+    CHECK(FindItem(image, 100, sData) && sData == std::string(3000, 'z'));
+}
+
+
+//
+// Payload that checks itself: it starts with the identifier and version,
+// and its length and filler derive from them
+//
+static std::string MakePayload(DWORD dwIdent, DWORD dwVersion)
+{
+    DWORD adwHead[] = { dwIdent, dwVersion };
+    std::string sData((const char*)adwHead, sizeof(adwHead));
+
+    sData.append(16 + dwVersion % 200, (char)(dwIdent * 31 + dwVersion));
+    return sData;
+}
+
+
+static bool IsPayload(DWORD dwIdent, const std::string& sData)
+{
+    DWORD adwHead[2] = { 0 };
+
+    if (sData.size() < sizeof(adwHead))
+    {
+        return false;
+    }
+
+    memcpy(adwHead, sData.data(), sizeof(adwHead));
+
+    return adwHead[0] == dwIdent && sData == MakePayload(dwIdent, adwHead[1]);
+}
+
+
+static BYTE* MapBlock(int fd)
+{
+    void* pv = mmap(nullptr, BLOCK_SIZE, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+
+    return pv == MAP_FAILED ? nullptr : (BYTE*)pv;
+}
+
+
+//
+// A process killed while writing to a shared mapping leaves an image the
+// next run can attach to
+//
+static void TestCrash()
+{
+    char szPath[] = "/tmp/DataStoreImageTest.XXXXXX";
+    int fd = mkstemp(szPath);
+
+    CHECK(fd != -1);
+
+    if (fd == -1)
+    {
+        return;
+    }
+
+    unlink(szPath);
+    CHECK_EQUAL(0, ftruncate(fd, BLOCK_SIZE));
+
+    // Killed after it's done
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        DataStoreImage image;
+        image.Attach(MapBlock(fd), BLOCK_SIZE);
+
+        Write(image, 1, "kept");
+        Write(image, 2, "replaced");
+        Write(image, 2, "replacement");
+
+        kill(getpid(), SIGKILL);
+    }
+
+    int nStatus = 0;
+    waitpid(pid, &nStatus, 0);
+    CHECK(WIFSIGNALED(nStatus));
+
+    BYTE* pbBlock = MapBlock(fd);
+    CHECK(pbBlock != nullptr);
+
+    {
+        DataStoreImage image;
+        std::string sData;
+
+        CHECK(image.Attach(pbBlock, BLOCK_SIZE));
+        CHECK(FindItem(image, 1, sData) && sData == "kept");
+        CHECK(FindItem(image, 2, sData) && sData == "replacement");
+        image.Clear();
+    }
+
+    munmap(pbBlock, BLOCK_SIZE);
+
+    // Killed at an arbitrary point while it keeps rewriting and removing
+    for (int nRound = 0; nRound < 8; ++nRound)
+    {
+        pid = fork();
+
+        if (pid == 0)
+        {
+            DataStoreImage image;
+            image.Attach(MapBlock(fd), BLOCK_SIZE);
+
+            for (DWORD dwVersion = 0; ; ++dwVersion)
+            {
+                DWORD dwIdent = dwVersion % 50;
+
+                if (dwVersion % 7 == 0)
+                {
+                    image.Remove(dwIdent);
+                }
+                else
+                {
+                    Write(image, dwIdent, MakePayload(dwIdent, dwVersion));
+                }
+            }
+        }
+
+        usleep(1000 + nRound * 3000);
+        kill(pid, SIGKILL);
+        waitpid(pid, &nStatus, 0);
+
+        pbBlock = MapBlock(fd);
+
+        DataStoreImage image;
+        CHECK(image.Attach(pbBlock, BLOCK_SIZE));
+
+        for (UINT uSlot = 0; uSlot < DataStoreImage::SLOT_COUNT; ++uSlot)
+        {
+            DWORD dwIdent = 0;
+            const void* pvData = nullptr;
+            DWORD dwLength = 0;
+
+            if (image.GetItem(uSlot, dwIdent, pvData, dwLength))
+            {
+                CHECK(dwIdent < 50);
+                CHECK(IsPayload(dwIdent,
+                    std::string((const char*)pvData, dwLength)));
+            }
+        }
+
+        munmap(pbBlock, BLOCK_SIZE);
+    }
+
+    close(fd);
+}
+
+
+int main()
+{
+    TestRoundTrip();
+    TestRuns();
+    TestFormat();
+    TestCorruption();
+    TestTornWrites();
+    TestCompact();
+    TestCrash();
+
+    return TestResult("DataStoreImageTest");
+}
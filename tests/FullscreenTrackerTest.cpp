@@ -0,0 +1,386 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/FullscreenTracker.h"
+#include "Test.h"
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The intervals FullscreenMonitor uses
+#define COALESCE_DELAY  50
+#define POLL_INTERVAL   1000
+
+#define LITESTEP_WINDOW ((HWND)1)
+
+
+//
+// One recorded event. Windows and monitors are plain numbers.
+//
+struct TraceEvent
+{
+    enum Type
+    {
+        Activate,       // window became the foreground window (shell hook)
+        Location,       // location change of the foreground application
+        Fullscreen,     // window now fills a monitor, nobody is told
+        Restore,        // window no longer fills a monitor, nobody is told
+        Destroy,        // window destroyed (shell hook)
+        Recycle         // LiteStep recycled
+    };
+
+    DWORD dwTime;
+    Type type;
+    uintptr_t uWindow;
+    uintptr_t uMonitor;
+};
+
+
+//
+// Replays a trace against a tracker, the way FullscreenMonitor's worker
+// drives it, with a simulated clock. Logs the actions taken and counts how
+// often the worker woke up.
+//
+class Replay
+{
+public:
+    explicit Replay(DWORD dwStart)
+        : m_tracker(COALESCE_DELAY, POLL_INTERVAL)
+        , m_dwNow(dwStart)
+        , m_hForeground(nullptr)
+        , m_uWakeups(0)
+    {
+    }
+
+    // Runs until the last event, then lets dwIdle milliseconds pass
+    void Run(const std::vector<TraceEvent>& vecTrace, DWORD dwIdle)
+    {
+        size_t stNext = 0;
+        DWORD dwEnd = (vecTrace.empty() ? m_dwNow :
+            vecTrace.back().dwTime) + dwIdle;
+
+        for (;;)
+        {
+            DWORD dwTimeout = m_tracker.GetTimeout(m_dwNow);
+            bool bEvent = stNext < vecTrace.size();
+            DWORD dwUntilEvent = bEvent ?
+                vecTrace[stNext].dwTime - m_dwNow : dwEnd - m_dwNow;
+
+            // Nothing left that could wake the worker
+            if (!bEvent && (dwTimeout == INFINITE || dwTimeout > dwUntilEvent))
+            {
+                m_dwNow = dwEnd;
+                break;
+            }
+
+            if (bEvent && (dwTimeout == INFINITE || dwUntilEvent <= dwTimeout))
+            {
+                m_dwNow = vecTrace[stNext].dwTime;
+
+                if (_Dispatch(vecTrace[stNext++]))
+                {
+                    ++m_uWakeups;
+                }
+            }
+            else
+            {
+                m_dwNow += dwTimeout;
+                ++m_uWakeups;
+            }
+
+            if (m_tracker.BeginEvaluation(m_dwNow))
+            {
+                _Evaluate();
+            }
+        }
+    }
+
+    std::string GetLog() const
+    {
+        return m_ssLog.str();
+    }
+
+    DWORD GetLastActionTime() const
+    {
+        return m_dwLastAction;
+    }
+
+    UINT GetWakeups() const
+    {
+        return m_uWakeups;
+    }
+
+    UINT GetEvaluations() const
+    {
+        return m_tracker.GetEvaluationCount();
+    }
+
+private:
+    // Returns false for changes the worker isn't told about
+    bool _Dispatch(const TraceEvent& event)
+    {
+        HWND hWnd = (HWND)event.uWindow;
+        FullscreenTracker::ActionList actions;
+
+        switch (event.type)
+        {
+        case TraceEvent::Activate:
+            m_hForeground = hWnd;
+            m_tracker.NotifyEvent(m_dwNow);
+            break;
+
+        case TraceEvent::Location:
+            m_tracker.NotifyEvent(m_dwNow);
+            break;
+
+        case TraceEvent::Fullscreen:
+            m_mapFullscreen[hWnd] = (HMONITOR)event.uMonitor;
+            return false;
+
+        case TraceEvent::Restore:
+            m_mapFullscreen.erase(hWnd);
+            return false;
+
+        case TraceEvent::Destroy:
+            m_mapFullscreen.erase(hWnd);
+            m_tracker.RemoveWindow(hWnd, actions);
+            break;
+
+        case TraceEvent::Recycle:
+            m_tracker.Rehide(actions);
+            break;
+        }
+
+        _Apply(actions);
+        return true;
+    }
+
+    // Mirrors FullscreenMonitor::Evaluate
+    void _Evaluate()
+    {
+        FullscreenTracker::ActionList actions;
+        std::vector<HWND> vecWindows;
+
+        m_tracker.GetWindows(vecWindows);
+
+        for (size_t st = 0; st < vecWindows.size(); ++st)
+        {
+            m_tracker.SetWindowMonitor(
+                vecWindows[st], _GetMonitor(vecWindows[st]), actions);
+        }
+
+        if (std::find(vecWindows.begin(), vecWindows.end(), m_hForeground) ==
+            vecWindows.end())
+        {
+            if (m_hForeground == LITESTEP_WINDOW)
+            {
+                m_tracker.ShowAll(actions);
+            }
+            else if (_GetMonitor(m_hForeground))
+            {
+                m_tracker.SetWindowMonitor(
+                    m_hForeground, _GetMonitor(m_hForeground), actions);
+            }
+        }
+
+        _Apply(actions);
+    }
+
+    void _Apply(const FullscreenTracker::ActionList& actions)
+    {
+        for (size_t st = 0; st < actions.size(); ++st)
+        {
+            if (actions[st].type == FullscreenTracker::HideModules)
+            {
+                m_ssLog << "hide " << (uintptr_t)actions[st].hMonitor
+                    << " " << (uintptr_t)actions[st].hWnd << ";";
+            }
+            else
+            {
+                m_ssLog << "show " << (uintptr_t)actions[st].hMonitor << ";";
+            }
+
+            m_dwLastAction = m_dwNow;
+        }
+    }
+
+    HMONITOR _GetMonitor(HWND hWnd) const
+    {
+        std::map<HWND, HMONITOR>::const_iterator iter =
+            m_mapFullscreen.find(hWnd);
+
+        return iter != m_mapFullscreen.end() ? iter->second : nullptr;
+    }
+
+    FullscreenTracker m_tracker;
+    DWORD m_dwNow;
+    DWORD m_dwLastAction;
+    HWND m_hForeground;
+    std::map<HWND, HMONITOR> m_mapFullscreen;
+    std::ostringstream m_ssLog;
+    UINT m_uWakeups;
+};
+
+
+static TraceEvent Event(DWORD dwTime, TraceEvent::Type type,
+    uintptr_t uWindow = 0, uintptr_t uMonitor = 0)
+{
+    TraceEvent event = { dwTime, type, uWindow, uMonitor };
+    return event;
+}
+
+
+//
+// Nothing fullscreen means nothing to do: the worker never wakes on its own
+//
+static void TestIdle()
+{
+    Replay replay(1000);
+    std::vector<TraceEvent> vecTrace;
+
+    vecTrace.push_back(Event(2000, TraceEvent::Activate, 10));
+    vecTrace.push_back(Event(2010, TraceEvent::Location, 10));
+    replay.Run(vecTrace, 3600 * 1000);
+
+    CHECK_EQUAL(std::string(), replay.GetLog());
+    CHECK_EQUAL((UINT)1, replay.GetEvaluations());
+    CHECK_EQUAL((UINT)3, replay.GetWakeups());
+}
+
+
+//
+// A browser going fullscreen after F11 sends a burst of location changes,
+// which is evaluated once. While it stays fullscreen the fallback check runs
+// once a second, and catches it leaving fullscreen in the background.
+//
+static void TestBurstAndFallback()
+{
+    Replay replay(0);
+    std::vector<TraceEvent> vecTrace;
+
+    vecTrace.push_back(Event(500, TraceEvent::Activate, 10));
+    vecTrace.push_back(Event(1000, TraceEvent::Fullscreen, 10, 1));
+
+    for (DWORD dwTime = 1000; dwTime < 1040; dwTime += 2)
+    {
+        vecTrace.push_back(Event(dwTime, TraceEvent::Location, 10));
+    }
+
+    vecTrace.push_back(Event(5000, TraceEvent::Activate, 20));
+    vecTrace.push_back(Event(10500, TraceEvent::Restore, 10));
+    replay.Run(vecTrace, 60 * 1000);
+
+    CHECK_EQUAL(std::string("hide 1 10;show 1;"), replay.GetLog());
+
+    // Shown at the first fallback check after the restore
+    CHECK(replay.GetLastActionTime() > 10500);
+    CHECK(replay.GetLastActionTime() <= 10500 + POLL_INTERVAL);
+
+    // Activation, burst, activation, then ten or so fallback checks; none
+    // once the window is gone. Other than for the 22 events, the worker only
+    // wakes up to evaluate.
+    CHECK(replay.GetEvaluations() >= 12 && replay.GetEvaluations() <= 14);
+    CHECK(replay.GetWakeups() <= 22 + replay.GetEvaluations());
+}
+
+
+//
+// Modules on a monitor stay hidden until its last fullscreen window is gone
+//
+static void TestMonitors()
+{
+    Replay replay(0);
+    std::vector<TraceEvent> vecTrace;
+
+    vecTrace.push_back(Event(100, TraceEvent::Fullscreen, 10, 1));
+    vecTrace.push_back(Event(100, TraceEvent::Activate, 10));
+    vecTrace.push_back(Event(200, TraceEvent::Fullscreen, 20, 2));
+    vecTrace.push_back(Event(200, TraceEvent::Activate, 20));
+    vecTrace.push_back(Event(300, TraceEvent::Fullscreen, 30, 1));
+    vecTrace.push_back(Event(300, TraceEvent::Activate, 30));
+    vecTrace.push_back(Event(400, TraceEvent::Destroy, 10));
+    vecTrace.push_back(Event(500, TraceEvent::Destroy, 30));
+
+    // Moves to the other monitor and stays fullscreen
+    vecTrace.push_back(Event(600, TraceEvent::Fullscreen, 20, 3));
+    vecTrace.push_back(Event(600, TraceEvent::Location, 20));
+    replay.Run(vecTrace, COALESCE_DELAY);
+
+    CHECK_EQUAL(std::string(
+        "hide 1 10;hide 2 20;show 1;show 2;hide 3 20;"), replay.GetLog());
+}
+
+
+//
+// Activating LiteStep shows everything; a recycle hides again what's
+// still known to be fullscreen
+//
+static void TestLiteStepAndRecycle()
+{
+    Replay replay(0);
+    std::vector<TraceEvent> vecTrace;
+
+    vecTrace.push_back(Event(100, TraceEvent::Fullscreen, 10, 1));
+    vecTrace.push_back(Event(100, TraceEvent::Activate, 10));
+    vecTrace.push_back(Event(200, TraceEvent::Recycle));
+    vecTrace.push_back(Event(300, TraceEvent::Activate, (uintptr_t)LITESTEP_WINDOW));
+    vecTrace.push_back(Event(400, TraceEvent::Recycle));
+    replay.Run(vecTrace, 10 * 1000);
+
+    CHECK_EQUAL(std::string("hide 1 10;hide 1 10;show 1;"), replay.GetLog());
+
+    // Nothing tracked after LiteStep was activated, so no fallback checks
+    CHECK_EQUAL((UINT)2, replay.GetEvaluations());
+}
+
+
+//
+// Tick counts wrap after 49.7 days
+//
+static void TestWrap()
+{
+    Replay replay(0xFFFFFE00);
+    std::vector<TraceEvent> vecTrace;
+
+    vecTrace.push_back(Event(0xFFFFFFF0, TraceEvent::Fullscreen, 10, 1));
+    vecTrace.push_back(Event(0xFFFFFFF0, TraceEvent::Activate, 10));
+    vecTrace.push_back(Event(3000, TraceEvent::Restore, 10));
+    replay.Run(vecTrace, 10 * 1000);
+
+    CHECK_EQUAL(std::string("hide 1 10;show 1;"), replay.GetLog());
+    CHECK(replay.GetLastActionTime() > 3000);
+    CHECK(replay.GetLastActionTime() <= 3000 + POLL_INTERVAL);
+    CHECK(replay.GetEvaluations() <= 6);
+}
+
+
+int main()
+{
+    TestIdle();
+    TestBurstAndFallback();
+    TestMonitors();
+    TestLiteStepAndRecycle();
+    TestWrap();
+
+    return TestResult("FullscreenTrackerTest");
+}
@@ -0,0 +1,307 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/ImageCache.h"
+#include "Test.h"
+
+
+// Images destroyed so far
+static UINT s_uDestroyed = 0;
+
+
+//
+// An image of the given size without any pixels, counting its destruction
+//
+class TestImage : public CachedImage
+{
+public:
+    explicit TestImage(size_t cbSize)
+        : CachedImage(cbSize, 0)
+    {
+    }
+
+protected:
+    virtual ~TestImage()
+    {
+        ++s_uDestroyed;
+    }
+};
+
+
+static ImageCache::Key MakeKey(const wchar_t* pwzPath)
+{
+    ImageCache::Key key = { pwzPath, 1000, 2000, 0, 0 };
+    return key;
+}
+
+
+// Inserts a new image and drops the caller's reference
+static ImageCache::InsertResult Add(ImageCache& cache, const wchar_t* pwzPath,
+    size_t cbSize)
+{
+    CachedImage* pImage = new TestImage(cbSize);
+    CachedImage* pExisting;
+
+    ImageCache::InsertResult result =
+        cache.Insert(MakeKey(pwzPath), pImage, &pExisting);
+
+    if (pExisting)
+    {
+        pExisting->Release();
+    }
+
+    pImage->Release();
+    return result;
+}
+
+
+// True if the image is cached; doesn't keep a reference
+static bool Has(ImageCache& cache, const wchar_t* pwzPath)
+{
+    CachedImage* pImage = cache.Find(MakeKey(pwzPath));
+
+    if (pImage)
+    {
+        pImage->Release();
+    }
+
+    return pImage != NULL;
+}
+
+
+//
+// Keys differ by any of their fields
+//
+static void TestKeys()
+{
+    ImageCache cache(1000);
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"a.png", 10));
+
+    ImageCache::Key key = MakeKey(L"a.png");
+    CHECK(Has(cache, L"a.png"));
+
+    key.ullWriteTime = 2001;
+    CHECK(cache.Find(key) == NULL);
+
+    key = MakeKey(L"a.png");
+    key.nIndex = 1;
+    CHECK(cache.Find(key) == NULL);
+
+    key = MakeKey(L"a.png");
+    key.dwFlags = 1;
+    CHECK(cache.Find(key) == NULL);
+
+    ImageCache::Statistics stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)1, stats.uHits);
+    CHECK_EQUAL((UINT)3, stats.uMisses);
+    CHECK_EQUAL((UINT)1, stats.uImages);
+    CHECK_EQUAL((ULONGLONG)10, stats.ullBytes);
+    CHECK_EQUAL((ULONGLONG)1000, stats.ullBudget);
+}
+
+
+//
+// The image used least recently goes first, and Find counts as a use
+//
+static void TestEvictionOrder()
+{
+    ImageCache cache(300);
+    s_uDestroyed = 0;
+
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"a.png", 100));
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"b.png", 100));
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"c.png", 100));
+    CHECK_EQUAL((UINT)0, s_uDestroyed);
+
+    // a is now newer than b
+    CHECK(Has(cache, L"a.png"));
+
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"d.png", 100));
+    CHECK(!Has(cache, L"b.png"));
+    CHECK(Has(cache, L"a.png"));
+    CHECK(Has(cache, L"c.png"));
+    CHECK(Has(cache, L"d.png"));
+    CHECK_EQUAL((UINT)1, s_uDestroyed);
+
+    // a and c are older than d now, and a larger image needs both to go
+    CHECK(Has(cache, L"d.png"));
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"e.png", 200));
+    CHECK(!Has(cache, L"a.png"));
+    CHECK(!Has(cache, L"c.png"));
+    CHECK(Has(cache, L"d.png"));
+    CHECK(Has(cache, L"e.png"));
+
+    ImageCache::Statistics stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)3, stats.uEvictions);
+    CHECK_EQUAL((UINT)2, stats.uImages);
+    CHECK_EQUAL((ULONGLONG)300, stats.ullBytes);
+    CHECK_EQUAL((UINT)3, s_uDestroyed);
+}
+
+
+//
+// Images evicted while someone holds them stay alive until released
+//
+static void TestEvictReferenced()
+{
+    ImageCache cache(100);
+    s_uDestroyed = 0;
+
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"a.png", 100));
+    CachedImage* pImage = cache.Find(MakeKey(L"a.png"));
+    CHECK(pImage != NULL);
+
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"b.png", 100));
+    CHECK(!Has(cache, L"a.png"));
+    CHECK_EQUAL((UINT)0, s_uDestroyed);
+
+    // No longer counted against the budget
+    CHECK_EQUAL((ULONGLONG)100, cache.GetStatistics().ullBytes);
+
+    pImage->Release();
+    CHECK_EQUAL((UINT)1, s_uDestroyed);
+}
+
+
+//
+// A second image for the same key isn't cached, the first one is handed back
+//
+static void TestDuplicate()
+{
+    ImageCache cache(1000);
+    s_uDestroyed = 0;
+
+    CachedImage* pFirst = new TestImage(100);
+    CachedImage* pExisting;
+    CHECK_EQUAL(ImageCache::InsertAdded,
+        cache.Insert(MakeKey(L"a.png"), pFirst, &pExisting));
+    CHECK(pExisting == NULL);
+
+    CachedImage* pSecond = new TestImage(100);
+    CHECK_EQUAL(ImageCache::InsertExisting,
+        cache.Insert(MakeKey(L"a.png"), pSecond, &pExisting));
+    CHECK(pExisting == pFirst);
+
+    // The caller drops the second image; nothing else refers to it
+    pSecond->Release();
+    CHECK_EQUAL((UINT)1, s_uDestroyed);
+
+    CachedImage* pFound = cache.Find(MakeKey(L"a.png"));
+    CHECK(pFound == pFirst);
+
+    ImageCache::Statistics stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)1, stats.uImages);
+    CHECK_EQUAL((ULONGLONG)100, stats.ullBytes);
+
+    // The cache keeps its own reference past the caller's three
+    pFound->Release();
+    pExisting->Release();
+    pFirst->Release();
+    CHECK_EQUAL((UINT)1, s_uDestroyed);
+
+    cache.Clear();
+    CHECK_EQUAL((UINT)2, s_uDestroyed);
+    CHECK_EQUAL((UINT)0, cache.GetStatistics().uImages);
+}
+
+
+//
+// Images larger than the budget are rejected without touching the cache
+//
+static void TestTooLarge()
+{
+    ImageCache cache(100);
+    s_uDestroyed = 0;
+
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"a.png", 60));
+    CHECK_EQUAL(ImageCache::InsertTooLarge, Add(cache, L"b.png", 101));
+    CHECK_EQUAL((UINT)1, s_uDestroyed);
+
+    CHECK(Has(cache, L"a.png"));
+    CHECK(!Has(cache, L"b.png"));
+
+    ImageCache::Statistics stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)0, stats.uEvictions);
+    CHECK_EQUAL((UINT)1, stats.uImages);
+    CHECK_EQUAL((ULONGLONG)60, stats.ullBytes);
+
+    // Exactly the budget fits, at the expense of everything else
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"c.png", 100));
+    CHECK(!Has(cache, L"a.png"));
+    CHECK(Has(cache, L"c.png"));
+
+    // Nothing fits a zero budget
+    ImageCache empty(0);
+    CHECK_EQUAL(ImageCache::InsertTooLarge, Add(empty, L"a.png", 1));
+    CHECK_EQUAL((UINT)0, empty.GetStatistics().uImages);
+}
+
+
+//
+// Shrinking the budget evicts the least recently used images right away
+//
+static void TestSetBudget()
+{
+    ImageCache cache(400);
+    s_uDestroyed = 0;
+
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"a.png", 100));
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"b.png", 100));
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"c.png", 100));
+    CHECK_EQUAL(ImageCache::InsertAdded, Add(cache, L"d.png", 100));
+    CHECK(Has(cache, L"a.png"));
+
+    cache.SetBudget(250);
+    CHECK_EQUAL((size_t)250, cache.GetBudget());
+    CHECK_EQUAL((UINT)2, s_uDestroyed);
+    CHECK(!Has(cache, L"b.png"));
+    CHECK(!Has(cache, L"c.png"));
+    CHECK(Has(cache, L"a.png"));
+    CHECK(Has(cache, L"d.png"));
+
+    ImageCache::Statistics stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)2, stats.uEvictions);
+    CHECK_EQUAL((ULONGLONG)200, stats.ullBytes);
+    CHECK_EQUAL((ULONGLONG)250, stats.ullBudget);
+
+    // Growing it evicts nothing
+    cache.SetBudget(1000);
+    CHECK_EQUAL((UINT)2, cache.GetStatistics().uImages);
+
+    // A zero budget empties the cache
+    cache.SetBudget(0);
+    CHECK_EQUAL((UINT)0, cache.GetStatistics().uImages);
+    CHECK_EQUAL((ULONGLONG)0, cache.GetStatistics().ullBytes);
+    CHECK_EQUAL((UINT)4, s_uDestroyed);
+}
+
+
+int main()
+{
+    TestKeys();
+    TestEvictionOrder();
+    TestEvictReferenced();
+    TestDuplicate();
+    TestTooLarge();
+    TestSetBudget();
+
+    return TestResult("ImageCacheTest");
+}
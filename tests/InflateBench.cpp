@@ -0,0 +1,241 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/Inflate.h"
+#include "../utility/crc32.h"
+#include "Test.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+
+//
+// Times InflateZlib against zlib's uncompress on the kinds of data PNG
+// files hold, and the checksums against zlib's: Adler-32 in SSE2 and plain
+// C, and the slicing-by-8 CRC-32.
+//
+
+typedef std::vector<unsigned char> Bytes;
+
+const size_t DATA_SIZE = 4 * 1024 * 1024;
+
+
+//
+// Random
+//
+// xorshift32, so every run sees the same data.
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+// Filtered scanlines of a smooth BGRA image, like a skin's IDAT data
+static Bytes MakeScanlines()
+{
+    Random random(1);
+    Bytes data;
+
+    while (data.size() < DATA_SIZE)
+    {
+        data.push_back((unsigned char)random.Next(5));
+
+        for (int x = 0; x < 256; ++x)
+        {
+            data.push_back((unsigned char)(x + random.Next(3)));
+            data.push_back((unsigned char)(x / 2 + random.Next(2)));
+            data.push_back((unsigned char)(random.Next(2)));
+            data.push_back(x < 32 || x > 224 ? 0 : 0xFF);
+        }
+    }
+
+    data.resize(DATA_SIZE);
+    return data;
+}
+
+
+static Bytes MakeRandom()
+{
+    Random random(2);
+    Bytes data(DATA_SIZE);
+
+    for (size_t st = 0; st < data.size(); ++st)
+    {
+        data[st] = (unsigned char)random.Next(256);
+    }
+
+    return data;
+}
+
+
+static Bytes Compress(const Bytes& data, int nLevel)
+{
+    uLongf cbCompressed = compressBound((uLong)data.size());
+    Bytes compressed(cbCompressed);
+
+    compress2(&compressed[0], &cbCompressed, &data[0], (uLong)data.size(),
+        nLevel);
+    compressed.resize(cbCompressed);
+
+    return compressed;
+}
+
+
+static double MBPerSecond(size_t cb, int nPasses, const Stopwatch& stopwatch)
+{
+    return cb * (double)nPasses / (1024 * 1024) /
+        std::max(stopwatch.GetSeconds(), 1e-9);
+}
+
+
+static void PrintRow(const char* pszName, double dZlib, double dOurs)
+{
+    printf("%-24s %12.1f %12.1f %8.2fx\n", pszName, dZlib, dOurs,
+        dOurs / std::max(dZlib, 0.001));
+}
+
+
+//
+// Output MB/s decompressing data compressed at nLevel
+//
+static void BenchInflate(const char* pszName, const Bytes& data, int nLevel)
+{
+    const int PASSES = 20;
+
+    Bytes compressed = Compress(data, nLevel);
+    Bytes out(data.size());
+
+    Stopwatch stopwatch;
+
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        uLongf cbOut = (uLongf)out.size();
+        uncompress(&out[0], &cbOut, &compressed[0], (uLong)compressed.size());
+    }
+
+    double dZlib = MBPerSecond(data.size(), PASSES, stopwatch);
+    CHECK(out == data);
+
+    out.assign(out.size(), 0);
+    stopwatch.Restart();
+
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        size_t cbWritten = 0;
+        CHECK_EQUAL(0, InflateZlib(&compressed[0], compressed.size(),
+            &out[0], out.size(), &cbWritten));
+    }
+
+    double dOurs = MBPerSecond(data.size(), PASSES, stopwatch);
+    CHECK(out == data);
+
+    PrintRow(pszName, dZlib, dOurs);
+}
+
+
+static void BenchChecksums(const Bytes& data)
+{
+    const int PASSES = 50;
+
+    unsigned int uZlib = 1, uScalar = 1, uSse2 = 1;
+
+    Stopwatch stopwatch;
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        uZlib = (unsigned int)adler32(uZlib, &data[0], (uInt)data.size());
+    }
+    double dZlib = MBPerSecond(data.size(), PASSES, stopwatch);
+
+    stopwatch.Restart();
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        uScalar = Adler32Scalar(uScalar, &data[0], data.size());
+    }
+    double dScalar = MBPerSecond(data.size(), PASSES, stopwatch);
+
+    stopwatch.Restart();
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        uSse2 = Adler32(uSse2, &data[0], data.size());
+    }
+    double dSse2 = MBPerSecond(data.size(), PASSES, stopwatch);
+
+    PrintRow("Adler32Scalar", dZlib, dScalar);
+    PrintRow("Adler32", dZlib, dSse2);
+    CHECK_EQUAL(uZlib, uScalar);
+    CHECK_EQUAL(uZlib, uSse2);
+
+    unsigned int uCrcZlib = 0, uCrc = 0;
+
+    stopwatch.Restart();
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        uCrcZlib = (unsigned int)crc32(uCrcZlib, &data[0], (uInt)data.size());
+    }
+    dZlib = MBPerSecond(data.size(), PASSES, stopwatch);
+
+    stopwatch.Restart();
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        uCrc = Crc32(uCrc, &data[0], data.size());
+    }
+    double dCrc = MBPerSecond(data.size(), PASSES, stopwatch);
+
+    PrintRow("Crc32", dZlib, dCrc);
+    CHECK_EQUAL(uCrcZlib, uCrc);
+}
+
+
+int main()
+{
+    printf("%-24s %12s %12s %9s\n", "", "zlib(MB/s)", "Ours(MB/s)",
+        "Ratio");
+
+    Bytes scanlines = MakeScanlines();
+    Bytes random = MakeRandom();
+
+    BenchInflate("Inflate scanlines, 1", scanlines, 1);
+    BenchInflate("Inflate scanlines, 6", scanlines, 6);
+    BenchInflate("Inflate scanlines, 9", scanlines, 9);
+    BenchInflate("Inflate random, 6", random, 6);
+
+    BenchChecksums(random);
+
+    return TestResult("InflateBench");
+}
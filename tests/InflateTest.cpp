@@ -0,0 +1,414 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/Inflate.h"
+#include "../utility/crc32.h"
+#include "Test.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+
+//
+// Checks InflateZlib, Adler32 and Crc32 against zlib: every stream zlib's
+// deflate produces must come back byte for byte, and the checksums must
+// agree with zlib's for any length and starting value.
+//
+
+typedef std::vector<unsigned char> Bytes;
+
+
+//
+// Random
+//
+// xorshift32, so every run sees the same data.
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+enum DataKind
+{
+    DATA_RANDOM,
+    DATA_TEXT,
+    DATA_RUNS,
+    DATA_SCANLINES,
+    DATA_KINDS
+};
+
+
+//
+// Data that makes deflate use different parts of the format: stored
+// blocks for noise, long matches for text, length 258 runs, and the short
+// near matches filtered PNG scanlines give
+//
+static Bytes MakeData(DataKind kind, size_t cbData, uint32_t uSeed)
+{
+    static const char* const WORDS[] =
+    {
+        "litestep ", "module ", "*Hotkey ", "Win+E ", "!Execute ",
+        "[explorer.exe] ", "\r\n", "LSImageFolder ", "$ThemeDir$ "
+    };
+
+    Random random(uSeed);
+    Bytes data;
+    data.reserve(cbData);
+
+    while (data.size() < cbData)
+    {
+        switch (kind)
+        {
+        case DATA_RANDOM:
+            data.push_back((unsigned char)random.Next(256));
+            break;
+
+        case DATA_TEXT:
+            {
+                const char* pszWord = WORDS[random.Next(9)];
+                data.insert(data.end(), pszWord, pszWord + strlen(pszWord));
+            }
+            break;
+
+        case DATA_RUNS:
+            data.insert(data.end(), 1 + random.Next(600),
+                (unsigned char)random.Next(4));
+            break;
+
+        default:
+            {
+                // A filter type byte, then a row of smooth BGRA pixels
+                data.push_back((unsigned char)random.Next(5));
+
+                for (int x = 0; x < 64; ++x)
+                {
+                    data.push_back((unsigned char)(x * 3 + random.Next(3)));
+                    data.push_back((unsigned char)(x + random.Next(2)));
+                    data.push_back((unsigned char)(random.Next(2)));
+                    data.push_back(0xFF);
+                }
+            }
+            break;
+        }
+    }
+
+    data.resize(cbData);
+    return data;
+}
+
+
+static Bytes Compress(const Bytes& data, int nLevel, int nWindowBits,
+    int nStrategy)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    deflateInit2(&stream, nLevel, Z_DEFLATED, nWindowBits, 8, nStrategy);
+
+    // deflateBound comes up a few bytes short for stored blocks with a
+    // small window, so leave some slack
+    Bytes compressed(deflateBound(&stream, (uLong)data.size()) + 64);
+
+    stream.next_in = (Bytef*)(data.empty() ? nullptr : &data[0]);
+    stream.avail_in = (uInt)data.size();
+    stream.next_out = &compressed[0];
+    stream.avail_out = (uInt)compressed.size();
+
+    int nResult = deflate(&stream, Z_FINISH);
+    CHECK_EQUAL(Z_STREAM_END, nResult);
+
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return compressed;
+}
+
+
+// InflateZlib into a buffer of exactly cbOut bytes
+static int Inflate(const Bytes& compressed, size_t cbOut, Bytes& out)
+{
+    // At least one byte, so &out[0] is valid
+    out.assign(cbOut + 1, 0xCD);
+
+    size_t cbWritten = 0;
+    int nError = InflateZlib(&compressed[0], compressed.size(), &out[0],
+        cbOut, &cbWritten);
+
+    CHECK_EQUAL((unsigned char)0xCD, out[cbOut]);
+    out.resize(cbWritten);
+
+    return nError;
+}
+
+
+//
+// Everything deflate makes at any level, window size and strategy
+// decompresses to the original
+//
+static void TestRoundTrip()
+{
+    const size_t SIZES[] = { 0, 1, 2, 100, 258, 4000, 40000, 300000 };
+    const int LEVELS[] = { 0, 1, 6, 9 };
+    const int STRATEGIES[] =
+        { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+    const int WINDOW_BITS[] = { 9, 12, 15 };
+
+    size_t stMismatches = 0;
+    uint32_t uSeed = 1;
+
+    for (int nKind = 0; nKind < DATA_KINDS; ++nKind)
+    {
+        for (size_t stSize = 0; stSize < sizeof(SIZES) / sizeof(SIZES[0]);
+            ++stSize)
+        {
+            Bytes data = MakeData((DataKind)nKind, SIZES[stSize], ++uSeed);
+
+            for (size_t stLevel = 0; stLevel < 4; ++stLevel)
+            {
+                for (size_t stStrategy = 0; stStrategy < 5; ++stStrategy)
+                {
+                    for (size_t stWindow = 0; stWindow < 3; ++stWindow)
+                    {
+                        Bytes compressed = Compress(data, LEVELS[stLevel],
+                            WINDOW_BITS[stWindow], STRATEGIES[stStrategy]);
+
+                        Bytes out;
+
+                        if (Inflate(compressed, data.size(), out) != 0 ||
+                            out != data)
+                        {
+                            ++stMismatches;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Broken streams give the documented error codes
+//
+static void TestErrors()
+{
+    Bytes data = MakeData(DATA_TEXT, 10000, 1);
+    Bytes compressed = Compress(data, 6, 15, Z_DEFAULT_STRATEGY);
+    Bytes out;
+
+    // One byte short of room
+    CHECK_EQUAL(72, Inflate(compressed, data.size() - 1, out));
+
+    // More room than needed is fine
+    CHECK_EQUAL(0, Inflate(compressed, data.size() + 100, out));
+    CHECK(out == data);
+
+    Bytes bad = compressed;
+    bad[bad.size() - 1] ^= 1;
+    CHECK_EQUAL(58, Inflate(bad, data.size(), out));
+
+    bad = compressed;
+    bad.resize(bad.size() - 2);
+    CHECK_EQUAL(52, Inflate(bad, data.size(), out));
+
+    bad = compressed;
+    bad.resize(bad.size() / 2);
+    CHECK(Inflate(bad, data.size(), out) != 0);
+
+    bad = compressed;
+    bad[1] ^= 1;
+    CHECK_EQUAL(24, Inflate(bad, data.size(), out));
+
+    // Method 7, with the header checksum fixed up
+    bad = compressed;
+    bad[0] = 0x77;
+    bad[1] = (unsigned char)(31 - (bad[0] * 256) % 31);
+    CHECK_EQUAL(25, Inflate(bad, data.size(), out));
+
+    // Preset dictionary
+    bad = compressed;
+    bad[1] = 0x20;
+    bad[1] = (unsigned char)(bad[1] + 31 - (bad[0] * 256 + bad[1]) % 31);
+    CHECK_EQUAL(26, Inflate(bad, data.size(), out));
+
+    bad.assign(1, 0x78);
+    CHECK_EQUAL(53, Inflate(bad, data.size(), out));
+
+    // Block type 3: final bit, then type bits 11
+    bad.assign(2, 0);
+    bad[0] = 0x78;
+    bad[1] = 0x9C;
+    bad.push_back(0x07);
+    bad.push_back(0x00);
+    CHECK_EQUAL(20, Inflate(bad, data.size(), out));
+}
+
+
+//
+// Corrupted streams never read or write out of bounds, which ASan checks,
+// and are only accepted if zlib accepts them with the same output
+//
+static void TestCorrupt()
+{
+    Random random(7);
+    size_t stMismatches = 0;
+
+    for (int nKind = 0; nKind < DATA_KINDS; ++nKind)
+    {
+        Bytes data = MakeData((DataKind)nKind, 5000, nKind + 1);
+        Bytes compressed = Compress(data, 6, 15, Z_DEFAULT_STRATEGY);
+
+        for (int nTrial = 0; nTrial < 2000; ++nTrial)
+        {
+            Bytes bad = compressed;
+            uint32_t uFlips = 1 + random.Next(4);
+
+            for (uint32_t u = 0; u < uFlips; ++u)
+            {
+                bad[2 + random.Next((uint32_t)bad.size() - 2)] ^=
+                    (unsigned char)(1 << random.Next(8));
+            }
+
+            Bytes out;
+
+            if (Inflate(bad, data.size(), out) == 0)
+            {
+                Bytes expected(data.size() + 1);
+                uLongf cbExpected = (uLongf)expected.size();
+
+                if (uncompress(&expected[0], &cbExpected, &bad[0],
+                        (uLong)bad.size()) != Z_OK ||
+                    !std::equal(out.begin(), out.end(), expected.begin()) ||
+                    cbExpected != out.size())
+                {
+                    ++stMismatches;
+                }
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Both Adler-32 versions and the CRC-32 match zlib for every length around
+// the SSE2 block and the 5552 byte reduction interval, at any alignment,
+// from any starting value, and when a buffer is fed in pieces
+//
+static void TestChecksums()
+{
+    Random random(3);
+    Bytes data(70000);
+
+    for (size_t st = 0; st < data.size(); ++st)
+    {
+        data[st] = (unsigned char)random.Next(256);
+    }
+
+    // All 0xFF is the worst case for the sums' growth
+    Bytes ones(70000, 0xFF);
+
+    const size_t LENGTHS[] = { 5551, 5552, 5553, 11104, 11105, 65536, 69990 };
+    size_t stMismatches = 0;
+
+    for (int nPass = 0; nPass < 2; ++nPass)
+    {
+        const Bytes& bytes = nPass ? ones : data;
+
+        for (size_t cb = 0; cb < 300 + sizeof(LENGTHS) / sizeof(LENGTHS[0]);
+            ++cb)
+        {
+            size_t cbData = cb < 300 ? cb : LENGTHS[cb - 300];
+            size_t stOffset = random.Next(8);
+            const unsigned char* p = &bytes[stOffset];
+
+            unsigned int uStart = random.Next(2) ? 1 :
+                ((random.Next(65521) << 16) | random.Next(65521));
+
+            unsigned int uAdler = (unsigned int)adler32(uStart, p,
+                (uInt)cbData);
+
+            if (Adler32(uStart, p, cbData) != uAdler ||
+                Adler32Scalar(uStart, p, cbData) != uAdler)
+            {
+                ++stMismatches;
+            }
+
+            unsigned int uCrcStart = random.Next(2) ? 0 : random.Next(~0u);
+
+            if (Crc32(uCrcStart, p, cbData) !=
+                (unsigned int)crc32(uCrcStart, p, (uInt)cbData))
+            {
+                ++stMismatches;
+            }
+
+            // In two pieces
+            size_t cbFirst = cbData ? random.Next((uint32_t)cbData) : 0;
+
+            if (Adler32(Adler32(uStart, p, cbFirst), p + cbFirst,
+                    cbData - cbFirst) != uAdler ||
+                Crc32(Crc32(0, p, cbFirst), p + cbFirst, cbData - cbFirst) !=
+                    (unsigned int)crc32(0, p, (uInt)cbData))
+            {
+                ++stMismatches;
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+
+    // Known values
+    const unsigned char* pCheck = (const unsigned char*)"123456789";
+    CHECK_EQUAL(0xCBF43926u, Crc32(0, pCheck, 9));
+    CHECK_EQUAL(0x091E01DEu, Adler32(1, pCheck, 9));
+    CHECK_EQUAL(1u, Adler32(1, pCheck, 0));
+}
+
+
+int main()
+{
+    TestRoundTrip();
+    TestErrors();
+    TestCorrupt();
+    TestChecksums();
+
+    return TestResult("InflateTest");
+}
@@ -0,0 +1,368 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/MessageManager.h"
+#include "Test.h"
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define WM_TEST         0x0400
+#define WM_OTHER        0x0401
+#define LM_TIMEOUT      0x0402
+
+
+//
+// FakeTransport
+//
+// Windows are plain numbers. Each has a result, an owning instance, and can
+// be made to time out. Deliveries are logged.
+//
+class FakeTransport : public MessageManager::Transport
+{
+public:
+    struct Window
+    {
+        LRESULT lResult;
+        HINSTANCE hInstance;
+        bool bHung;
+    };
+
+    struct Delivery
+    {
+        HWND hWnd;
+        UINT uMsg;
+        WPARAM wParam;
+        LPARAM lParam;
+        bool bPosted;
+    };
+
+    FakeTransport()
+        : m_pfnOnSend(NULL)
+        , m_pvOnSend(NULL)
+    {
+    }
+
+    bool Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam,
+        UINT uTimeout, LRESULT& lResult)
+    {
+        (void)uTimeout;
+        Log(hWnd, uMsg, wParam, lParam, false);
+
+        if (m_windows[hWnd].bHung)
+        {
+            return false;
+        }
+
+        lResult = m_windows[hWnd].lResult;
+        return true;
+    }
+
+    LRESULT Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        Log(hWnd, uMsg, wParam, lParam, false);
+        return m_windows[hWnd].lResult;
+    }
+
+    BOOL Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+    {
+        Log(hWnd, uMsg, wParam, lParam, true);
+        return TRUE;
+    }
+
+    HINSTANCE GetInstance(HWND hWnd)
+    {
+        return m_windows[hWnd].hInstance;
+    }
+
+    void Log(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, bool bPosted)
+    {
+        Delivery delivery = { hWnd, uMsg, wParam, lParam, bPosted };
+        m_log.push_back(delivery);
+
+        if (m_pfnOnSend && !bPosted)
+        {
+            m_pfnOnSend(m_pvOnSend);
+        }
+    }
+
+    std::map<HWND, Window> m_windows;
+    std::vector<Delivery> m_log;
+
+    // Called during every send, while the message manager is delivering
+    void (*m_pfnOnSend)(void*);
+    void* m_pvOnSend;
+};
+
+
+static HWND MakeWindow(FakeTransport* pTransport, uintptr_t uId,
+    LRESULT lResult, uintptr_t uInstance = 1)
+{
+    HWND hWnd = (HWND)uId;
+    FakeTransport::Window window = { lResult, (HINSTANCE)uInstance, false };
+    pTransport->m_windows[hWnd] = window;
+    return hWnd;
+}
+
+
+static size_t CountPosts(const FakeTransport* pTransport, UINT uMsg)
+{
+    size_t cPosts = 0;
+
+    for (size_t st = 0; st < pTransport->m_log.size(); ++st)
+    {
+        if (pTransport->m_log[st].bPosted && pTransport->m_log[st].uMsg == uMsg)
+        {
+            ++cPosts;
+        }
+    }
+
+    return cPosts;
+}
+
+
+//
+// Broadcasts reach every registered window once and OR their results
+//
+static void TestBroadcast()
+{
+    FakeTransport* pTransport = new FakeTransport();
+    MessageManager mm(pTransport, LM_TIMEOUT);
+
+    HWND hWnd1 = MakeWindow(pTransport, 0x10, 0x1);
+    HWND hWnd2 = MakeWindow(pTransport, 0x20, 0x4);
+    HWND hWnd3 = MakeWindow(pTransport, 0x30, 0x8);
+
+    UINT auMessages[] = { WM_TEST, WM_OTHER, 0 };
+    mm.AddMessages(hWnd1, auMessages);
+    mm.AddMessage(hWnd2, WM_TEST);
+    mm.AddMessage(hWnd2, WM_TEST);
+    mm.AddMessage(hWnd3, WM_OTHER);
+
+    CHECK(mm.HandlerExists(WM_TEST));
+    CHECK(!mm.HandlerExists(LM_TIMEOUT));
+
+    CHECK_EQUAL((LRESULT)0x5, mm.SendMessage(WM_TEST, 1, 2));
+    CHECK_EQUAL((size_t)2, pTransport->m_log.size());
+
+    CHECK_EQUAL((LRESULT)0x9, mm.SendMessageTimeout(WM_OTHER, 0, 0, 100));
+    CHECK_EQUAL((size_t)4, pTransport->m_log.size());
+
+    CHECK_EQUAL(TRUE, mm.PostMessage(WM_TEST, 3, 4));
+    CHECK_EQUAL((size_t)2, CountPosts(pTransport, WM_TEST));
+
+    // Nobody listens
+    CHECK_EQUAL((LRESULT)0, mm.SendMessage(LM_TIMEOUT, 0, 0));
+    CHECK_EQUAL((size_t)6, pTransport->m_log.size());
+
+    mm.RemoveMessages(hWnd1, auMessages);
+    CHECK_EQUAL((LRESULT)0x4, mm.SendMessage(WM_TEST, 0, 0));
+
+    mm.RemoveMessage(hWnd2, WM_TEST);
+    CHECK(!mm.HandlerExists(WM_TEST));
+
+    mm.ClearMessages();
+    CHECK(!mm.HandlerExists(WM_OTHER));
+}
+
+
+//
+// Windows that time out are skipped, and reported after
+// MESSAGE_TIMEOUT_THRESHOLD timeouts in a row
+//
+static void TestTimeouts()
+{
+    FakeTransport* pTransport = new FakeTransport();
+    MessageManager mm(pTransport, LM_TIMEOUT);
+
+    HWND hWndGood = MakeWindow(pTransport, 0x10, 0x1);
+    HWND hWndHung = MakeWindow(pTransport, 0x20, 0x2);
+    HWND hWndListener = MakeWindow(pTransport, 0x30, 0);
+
+    pTransport->m_windows[hWndHung].bHung = true;
+
+    mm.AddMessage(hWndGood, WM_TEST);
+    mm.AddMessage(hWndHung, WM_TEST);
+    mm.AddMessage(hWndListener, LM_TIMEOUT);
+
+    for (UINT u = 1; u < MESSAGE_TIMEOUT_THRESHOLD; ++u)
+    {
+        CHECK_EQUAL((LRESULT)0x1, mm.SendMessageTimeout(WM_TEST, 0, 0, 10));
+    }
+
+    CHECK_EQUAL((size_t)0, CountPosts(pTransport, LM_TIMEOUT));
+
+    CHECK_EQUAL((LRESULT)0x1, mm.SendMessageTimeout(WM_TEST, 0, 0, 10));
+    CHECK_EQUAL((size_t)1, CountPosts(pTransport, LM_TIMEOUT));
+
+    const FakeTransport::Delivery& report = pTransport->m_log.back();
+    CHECK(report.bPosted);
+    CHECK(report.hWnd == hWndListener);
+    CHECK_EQUAL((WPARAM)hWndHung, report.wParam);
+    CHECK_EQUAL((LPARAM)WM_TEST, report.lParam);
+
+    // Counting starts over after a report
+    for (UINT u = 1; u < MESSAGE_TIMEOUT_THRESHOLD; ++u)
+    {
+        mm.SendMessageTimeout(WM_TEST, 0, 0, 10);
+    }
+
+    CHECK_EQUAL((size_t)1, CountPosts(pTransport, LM_TIMEOUT));
+
+    // A delivery in between resets the count
+    pTransport->m_windows[hWndHung].bHung = false;
+    mm.SendMessageTimeout(WM_TEST, 0, 0, 10);
+    pTransport->m_windows[hWndHung].bHung = true;
+
+    for (UINT u = 1; u < MESSAGE_TIMEOUT_THRESHOLD; ++u)
+    {
+        mm.SendMessageTimeout(WM_TEST, 0, 0, 10);
+    }
+
+    CHECK_EQUAL((size_t)1, CountPosts(pTransport, LM_TIMEOUT));
+}
+
+
+//
+// A window that unregisters completely starts from zero timeouts when it
+// registers again, e.g. when its handle is reused
+//
+static void TestTimeoutPurge()
+{
+    FakeTransport* pTransport = new FakeTransport();
+    MessageManager mm(pTransport, LM_TIMEOUT);
+
+    HWND hWndHung = MakeWindow(pTransport, 0x20, 0x2);
+    HWND hWndListener = MakeWindow(pTransport, 0x30, 0);
+
+    pTransport->m_windows[hWndHung].bHung = true;
+
+    mm.AddMessage(hWndHung, WM_TEST);
+    mm.AddMessage(hWndHung, WM_OTHER);
+    mm.AddMessage(hWndListener, LM_TIMEOUT);
+
+    for (UINT u = 1; u < MESSAGE_TIMEOUT_THRESHOLD; ++u)
+    {
+        mm.SendMessageTimeout(WM_TEST, 0, 0, 10);
+    }
+
+    // Still registered for WM_OTHER, the count stays
+    mm.RemoveMessage(hWndHung, WM_TEST);
+    mm.SendMessageTimeout(WM_OTHER, 0, 0, 10);
+    CHECK_EQUAL((size_t)1, CountPosts(pTransport, LM_TIMEOUT));
+
+    for (UINT u = 1; u < MESSAGE_TIMEOUT_THRESHOLD; ++u)
+    {
+        mm.SendMessageTimeout(WM_OTHER, 0, 0, 10);
+    }
+
+    mm.RemoveMessage(hWndHung, WM_OTHER);
+    mm.AddMessage(hWndHung, WM_OTHER);
+
+    for (UINT u = 1; u < MESSAGE_TIMEOUT_THRESHOLD; ++u)
+    {
+        mm.SendMessageTimeout(WM_OTHER, 0, 0, 10);
+    }
+
+    CHECK_EQUAL((size_t)1, CountPosts(pTransport, LM_TIMEOUT));
+}
+
+
+//
+// Registrations can change on another thread while a window is processing
+// a broadcast, so the lock must not be held during delivery
+//
+static void _RegisterFromOtherThread(void* pvContext)
+{
+    MessageManager* pmm = (MessageManager*)pvContext;
+
+    std::shared_ptr<std::promise<void>> pDone =
+        std::make_shared<std::promise<void>>();
+    std::future<void> done = pDone->get_future();
+
+    std::thread([pmm, pDone]()
+    {
+        pmm->AddMessage((HWND)0x40, WM_OTHER);
+        pDone->set_value();
+    }).detach();
+
+    CHECK(done.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+}
+
+static void TestUnlockedDelivery()
+{
+    FakeTransport* pTransport = new FakeTransport();
+    MessageManager mm(pTransport, LM_TIMEOUT);
+
+    mm.AddMessage(MakeWindow(pTransport, 0x10, 0x1), WM_TEST);
+
+    pTransport->m_pfnOnSend = _RegisterFromOtherThread;
+    pTransport->m_pvOnSend = &mm;
+
+    mm.SendMessage(WM_TEST, 0, 0);
+    mm.SendMessageTimeout(WM_TEST, 0, 0, 10);
+
+    pTransport->m_pfnOnSend = NULL;
+
+    CHECK(mm.HandlerExists(WM_OTHER));
+}
+
+
+//
+// Registrations are counted per owning module
+//
+static void TestMessageCount()
+{
+    FakeTransport* pTransport = new FakeTransport();
+    MessageManager mm(pTransport, LM_TIMEOUT);
+
+    HWND hWnd1 = MakeWindow(pTransport, 0x10, 0, 0x1000);
+    HWND hWnd2 = MakeWindow(pTransport, 0x20, 0, 0x1000);
+    HWND hWnd3 = MakeWindow(pTransport, 0x30, 0, 0x2000);
+
+    mm.AddMessage(hWnd1, WM_TEST);
+    mm.AddMessage(hWnd1, WM_OTHER);
+    mm.AddMessage(hWnd2, WM_TEST);
+    mm.AddMessage(hWnd3, WM_TEST);
+
+    CHECK_EQUAL(3u, mm.GetMessageCount((HINSTANCE)0x1000));
+    CHECK_EQUAL(1u, mm.GetMessageCount((HINSTANCE)0x2000));
+    CHECK_EQUAL(0u, mm.GetMessageCount((HINSTANCE)0x3000));
+
+    MessageManager::windowSetT setWindows;
+    CHECK(mm.GetWindowsForMessage(WM_TEST, setWindows));
+    CHECK_EQUAL((size_t)3, setWindows.size());
+}
+
+
+int main()
+{
+    TestBroadcast();
+    TestTimeouts();
+    TestTimeoutPurge();
+    TestUnlockedDelivery();
+    TestMessageCount();
+
+    return TestResult("MessageManagerTest");
+}
@@ -0,0 +1,160 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayNotifyIcon.h"
+#include <string.h>
+
+
+//
+// NotifyIcon copies and converts icons through GDI. The tray tests and
+// benchmarks that only need what TrayIconStore indexes on, and what
+// TrayShell passes on to the systray modules, link this stand-in instead:
+// it keeps the window, ID, GUID, callback message and icon handle, and
+// nothing else.
+//
+
+NotifyIcon::NotifyIcon(const NID_XX& nidSource)
+    :m_hWnd((HWND)(UINT_PTR)nidSource.hWnd)
+    ,m_uID(nidSource.uID)
+    ,m_uFlags(0)
+    ,m_uCallbackMessage(0)
+    ,m_hIcon(nullptr)
+    ,m_pwzTip(nullptr)
+    ,m_dwState(0)
+    ,m_hBalloonIcon(nullptr)
+    ,m_uVersion(0)
+    ,m_hOriginalIcon(nullptr)
+    ,m_hOriginalBalloonIcon(nullptr)
+    ,m_hSharedWnd(nullptr)
+    ,m_uSharedID(0)
+{
+    memset(&m_guidItem, 0, sizeof(GUID));
+    Update(nidSource);
+}
+
+NotifyIcon::~NotifyIcon()
+{
+}
+
+void NotifyIcon::Update(const NID_XX& nidSource)
+{
+    copy_guid(&nidSource);
+    copy_message(&nidSource);
+    copy_icon(&nidSource);
+}
+
+void NotifyIcon::copy_guid(PCNID_XX pnidSource)
+{
+    if ((pnidSource->uFlags & NIF_GUID) == NIF_GUID)
+    {
+        switch (pnidSource->cbSize)
+        {
+        case NID_7W_SIZE:
+        case NID_6W_SIZE:
+            m_guidItem = ((const NID_6W*)pnidSource)->guidItem;
+            m_uFlags |= NIF_GUID;
+            break;
+
+        case NID_6A_SIZE:
+            m_guidItem = ((const NID_6A*)pnidSource)->guidItem;
+            m_uFlags |= NIF_GUID;
+            break;
+        }
+    }
+}
+
+void NotifyIcon::copy_message(PCNID_XX pnidSource)
+{
+    if (NIF_MESSAGE & pnidSource->uFlags)
+    {
+        m_uCallbackMessage = pnidSource->uCallbackMessage;
+        m_uFlags |= NIF_MESSAGE;
+    }
+}
+
+void NotifyIcon::copy_icon(PCNID_XX pnidSource)
+{
+    if (NIF_ICON & pnidSource->uFlags)
+    {
+        m_hIcon = (HICON)(UINT_PTR)pnidSource->hIcon;
+        m_uFlags |= NIF_ICON;
+    }
+}
+
+void NotifyIcon::CopyLSNID(LSNOTIFYICONDATA * plsnid, UINT uFlagMask) const
+{
+    plsnid->cbSize = sizeof(LSNOTIFYICONDATA);
+    plsnid->hWnd = m_hWnd;
+    plsnid->uID = m_uID;
+    plsnid->uFlags = 0;
+
+    if (NIF_GUID & m_uFlags & uFlagMask)
+    {
+        plsnid->guidItem = m_guidItem;
+        plsnid->uFlags |= NIF_GUID;
+    }
+
+    if (NIF_MESSAGE & m_uFlags & uFlagMask)
+    {
+        plsnid->uCallbackMessage = m_uCallbackMessage;
+        plsnid->uFlags |= NIF_MESSAGE;
+    }
+
+    if (NIF_ICON & m_uFlags & uFlagMask)
+    {
+        plsnid->hIcon = m_hIcon;
+        plsnid->uFlags |= NIF_ICON;
+    }
+}
+
+//
+// Without code pages the strings are narrowed by dropping the high byte
+//
+static void Narrow(CHAR* pszDest, const WCHAR* pwzSrc, size_t cchDest)
+{
+    size_t cch = 0;
+
+    for (; cch + 1 < cchDest && pwzSrc[cch]; ++cch)
+    {
+        pszDest[cch] = (CHAR)pwzSrc[cch];
+    }
+
+    pszDest[cch] = 0;
+}
+
+LSNOTIFYICONDATAA::LSNOTIFYICONDATAA(PCLSNOTIFYICONDATA nid)
+{
+    this->cbSize = sizeof(this);
+    this->hWnd = nid->hWnd;
+    this->uID = nid->uID;
+    this->uFlags = nid->uFlags;
+    this->uCallbackMessage = nid->uCallbackMessage;
+    this->hIcon = nid->hIcon;
+    Narrow(this->szTip, nid->szTip, sizeof(this->szTip));
+    this->dwState = nid->dwState;
+    this->dwStateMask = nid->dwStateMask;
+    Narrow(this->szInfo, nid->szInfo, sizeof(this->szInfo));
+    this->uVersion = nid->uVersion;
+    Narrow(this->szInfoTitle, nid->szInfoTitle, sizeof(this->szInfoTitle));
+    this->dwInfoFlags = nid->dwInfoFlags;
+    this->guidItem = nid->guidItem;
+    this->hBalloonIcon = nid->hBalloonIcon;
+}
@@ -0,0 +1,250 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/PixelConvert.h"
+#include "Test.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+//
+// Times the PixelConvert routines, SSE2 where the compiler targets it,
+// against their plain C versions on a 512x512 image, the size of a large
+// skin. HasAlpha only has the one version.
+//
+
+typedef std::vector<unsigned char> Pixels;
+
+const size_t PIXELS = 512 * 512;
+const int PASSES = 200;
+
+
+//
+// Random
+//
+// xorshift32, so every run sees the same image.
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+static Pixels MakeImage()
+{
+    Pixels pixels(PIXELS * 4);
+    Random random(1);
+
+    for (size_t st = 0; st < pixels.size(); ++st)
+    {
+        pixels[st] = (unsigned char)random.Next(256);
+    }
+
+    return pixels;
+}
+
+
+static void PrintRow(const char* pszRoutine, double dScalar, double dSse2)
+{
+    printf("%-20s %12.1f %12.1f %8.1fx\n", pszRoutine, dScalar, dSse2,
+        dSse2 / std::max(dScalar, 0.001));
+}
+
+
+// Megapixels per second swizzling the image into a second buffer
+static double TimeSwizzle(void (*pSwizzle)(unsigned char*,
+    const unsigned char*, size_t), const Pixels& source, Pixels& dest)
+{
+    Stopwatch stopwatch;
+
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        pSwizzle(&dest[0], &source[0], PIXELS);
+    }
+
+    return PIXELS * (double)PASSES / 1e6 /
+        std::max(stopwatch.GetSeconds(), 1e-9);
+}
+
+
+static void BenchSwizzle()
+{
+    Pixels source = MakeImage();
+    Pixels scalar(source.size());
+    Pixels sse2(source.size());
+
+    double dScalar = TimeSwizzle(SwizzleRGBAToBGRAScalar, source, scalar);
+    double dSse2 = TimeSwizzle(SwizzleRGBAToBGRA, source, sse2);
+    PrintRow("SwizzleRGBAToBGRA", dScalar, dSse2);
+
+    CHECK(scalar == sse2);
+}
+
+
+// Megapixels per second for an in place conversion, each pass on a fresh
+// copy of the image, which is not timed
+template <typename Convert>
+static double TimeInPlace(Convert convert, const Pixels& source,
+    Pixels& pixels)
+{
+    double dSeconds = 0;
+
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        pixels = source;
+
+        Stopwatch stopwatch;
+        convert(&pixels[0]);
+        dSeconds += stopwatch.GetSeconds();
+    }
+
+    return PIXELS * (double)PASSES / 1e6 / std::max(dSeconds, 1e-9);
+}
+
+
+//
+// A skin: most pixels opaque, a transparent border, and a few soft edges
+//
+static Pixels MakeSkin()
+{
+    Pixels pixels = MakeImage();
+    Random random(3);
+
+    for (size_t st = 0; st < PIXELS; ++st)
+    {
+        size_t x = st % 512;
+        size_t y = st / 512;
+
+        if (x < 32 || x >= 480 || y < 32 || y >= 480)
+        {
+            pixels[st * 4 + 3] = 0;
+        }
+        else if (x < 36 || x >= 476 || y < 36 || y >= 476)
+        {
+            pixels[st * 4 + 3] = (unsigned char)random.Next(256);
+        }
+        else
+        {
+            pixels[st * 4 + 3] = 0xFF;
+        }
+    }
+
+    return pixels;
+}
+
+
+static void BenchPremultiply(const char* pszImage, const Pixels& source)
+{
+    Pixels scalar;
+    Pixels sse2;
+
+    double dScalar = TimeInPlace([](unsigned char* p)
+        { PremultiplyAlphaScalar(p, PIXELS); }, source, scalar);
+    double dSse2 = TimeInPlace([](unsigned char* p)
+        { PremultiplyAlpha(p, PIXELS); }, source, sse2);
+    PrintRow(pszImage, dScalar, dSse2);
+
+    CHECK(scalar == sse2);
+}
+
+
+static void BenchColorKey()
+{
+    Pixels source = MakeImage();
+
+    // A magenta background around the image
+    for (size_t st = 0; st < PIXELS; ++st)
+    {
+        if (st % 512 < 64 || st / 512 < 64)
+        {
+            source[st * 4] = 0xFF;
+            source[st * 4 + 1] = 0x00;
+            source[st * 4 + 2] = 0xFF;
+        }
+    }
+
+    Pixels scalar;
+    Pixels sse2;
+
+    double dScalar = TimeInPlace([](unsigned char* p)
+        { ColorKeyToAlphaScalar(p, PIXELS, 0xFF00FF); }, source, scalar);
+    double dSse2 = TimeInPlace([](unsigned char* p)
+        { ColorKeyToAlpha(p, PIXELS, 0xFF00FF); }, source, sse2);
+    PrintRow("ColorKeyToAlpha", dScalar, dSse2);
+
+    CHECK(scalar == sse2);
+}
+
+
+// HasAlpha on a bitmap without alpha has to read every pixel
+static void BenchHasAlpha()
+{
+    Pixels pixels = MakeImage();
+
+    for (size_t st = 0; st < PIXELS; ++st)
+    {
+        pixels[st * 4 + 3] = 0;
+    }
+
+    bool bHasAlpha = false;
+    Stopwatch stopwatch;
+
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        bHasAlpha |= HasAlpha(&pixels[0], PIXELS);
+    }
+
+    printf("%-20s %12.1f\n", "HasAlpha, none",
+        PIXELS * (double)PASSES / 1e6 / std::max(stopwatch.GetSeconds(), 1e-9));
+
+    CHECK(!bHasAlpha);
+}
+
+
+int main()
+{
+    printf("%-20s %12s %12s %9s\n", "Routine", "Scalar(Mp/s)",
+        "SSE2(Mp/s)", "Speedup");
+
+    BenchSwizzle();
+    BenchPremultiply("Premultiply, skin", MakeSkin());
+    BenchPremultiply("Premultiply, noise", MakeImage());
+    BenchColorKey();
+    BenchHasAlpha();
+
+    return TestResult("PixelConvertBench");
+}
@@ -0,0 +1,358 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/PixelConvert.h"
+#include "Test.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+typedef std::vector<unsigned char> Pixels;
+
+
+//
+// Random
+//
+// xorshift32, so every run sees the same pixels.
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+//
+// Random pixels with a few guard bytes either side. The offset moves the
+// first pixel off the 16 byte alignment the SSE2 loops would like.
+//
+static const size_t GUARD = 19;
+
+static Pixels MakePixels(Random& random, size_t cPixels)
+{
+    Pixels pixels(cPixels * 4 + 2 * GUARD);
+
+    for (size_t st = 0; st < pixels.size(); ++st)
+    {
+        pixels[st] = (unsigned char)random.Next(256);
+    }
+
+    return pixels;
+}
+
+
+// a and b agree outside the cb bytes at stStart
+static bool SameOutside(const Pixels& a, const Pixels& b, size_t stStart,
+    size_t cb)
+{
+    return std::equal(a.begin(), a.begin() + stStart, b.begin()) &&
+        std::equal(a.begin() + stStart + cb, a.end(), b.begin() + stStart + cb);
+}
+
+
+//
+// The SSE2 swizzle matches the plain one for every count around the four
+// pixel blocks, copying and in place, and touches nothing past the end
+//
+static void TestSwizzle()
+{
+    size_t stMismatches = 0;
+    Random random(1);
+
+    for (size_t cPixels = 0; cPixels <= 67; ++cPixels)
+    {
+        for (size_t stOffset = 0; stOffset < 4; ++stOffset)
+        {
+            size_t stStart = GUARD - stOffset;
+
+            Pixels source = MakePixels(random, cPixels);
+            Pixels expected(source.size(), 0xCD);
+            Pixels copy(source.size(), 0xCD);
+            Pixels inPlace = source;
+
+            SwizzleRGBAToBGRAScalar(&expected[stStart], &source[stStart],
+                cPixels);
+            SwizzleRGBAToBGRA(&copy[stStart], &source[stStart], cPixels);
+            SwizzleRGBAToBGRA(&inPlace[stStart], &inPlace[stStart], cPixels);
+
+            if (copy != expected)
+            {
+                ++stMismatches;
+            }
+
+            // In place gives the same pixels and leaves the rest alone
+            if (!std::equal(inPlace.begin() + stStart,
+                    inPlace.begin() + stStart + cPixels * 4,
+                    copy.begin() + stStart) ||
+                !SameOutside(inPlace, source, stStart, cPixels * 4))
+            {
+                ++stMismatches;
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Byte by byte: red and blue swap, green and alpha stay, and swizzling
+// twice gives back the original
+//
+static void TestSwizzleBytes()
+{
+    const unsigned char rgba[] =
+    {
+        0x01, 0x02, 0x03, 0x04,  0xFF, 0x00, 0x80, 0x7F,
+        0x10, 0x20, 0x30, 0x40,  0xAA, 0xBB, 0xCC, 0xDD,
+        0x00, 0xFF, 0x00, 0xFF
+    };
+    const unsigned char bgra[] =
+    {
+        0x03, 0x02, 0x01, 0x04,  0x80, 0x00, 0xFF, 0x7F,
+        0x30, 0x20, 0x10, 0x40,  0xCC, 0xBB, 0xAA, 0xDD,
+        0x00, 0xFF, 0x00, 0xFF
+    };
+
+    Pixels pixels(rgba, rgba + sizeof(rgba));
+
+    SwizzleRGBAToBGRA(&pixels[0], &pixels[0], 5);
+    CHECK(std::equal(pixels.begin(), pixels.end(), bgra));
+
+    SwizzleRGBAToBGRA(&pixels[0], &pixels[0], 5);
+    CHECK(std::equal(pixels.begin(), pixels.end(), rgba));
+}
+
+
+//
+// Random pixels, with runs of opaque and fully transparent ones so the
+// SSE2 loop's opaque block skip is taken and left at every position
+//
+static Pixels MakeSkinPixels(Random& random, size_t cPixels)
+{
+    Pixels pixels = MakePixels(random, cPixels);
+
+    for (size_t st = 0; st < cPixels; ++st)
+    {
+        uint32_t uKind = random.Next(4);
+
+        if (uKind < 2)
+        {
+            pixels[GUARD + st * 4 + 3] = uKind ? 0xFF : 0x00;
+        }
+    }
+
+    return pixels;
+}
+
+
+//
+// Every color and alpha pair premultiplies to c * a / 255 rounded to
+// nearest, in both versions
+//
+static void TestPremultiplyExact()
+{
+    Pixels pixels(256 * 256 * 4);
+
+    for (unsigned int a = 0; a < 256; ++a)
+    {
+        for (unsigned int c = 0; c < 256; ++c)
+        {
+            unsigned char* p = &pixels[(a * 256 + c) * 4];
+            p[0] = (unsigned char)c;
+            p[1] = (unsigned char)(255 - c);
+            p[2] = (unsigned char)(c ^ 0x55);
+            p[3] = (unsigned char)a;
+        }
+    }
+
+    Pixels scalar = pixels;
+    Pixels sse2 = pixels;
+
+    PremultiplyAlphaScalar(&scalar[0], 256 * 256);
+    PremultiplyAlpha(&sse2[0], 256 * 256);
+
+    size_t stMismatches = 0;
+
+    for (size_t st = 0; st < pixels.size(); ++st)
+    {
+        unsigned int a = pixels[st | 3];
+        unsigned int uExpected = (st & 3) == 3 ? a :
+            (pixels[st] * a + 127) / 255;
+
+        if (scalar[st] != uExpected || sse2[st] != uExpected)
+        {
+            ++stMismatches;
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// The SSE2 premultiply and color key match the plain versions for every
+// count around the four pixel blocks, and touch nothing past the end
+//
+static void TestPremultiplyAndColorKey()
+{
+    const unsigned int KEYS[] = { 0x00FF00FF, 0xFFFF00FF, 0x00000000 };
+
+    size_t stMismatches = 0;
+    Random random(2);
+
+    for (size_t cPixels = 0; cPixels <= 67; ++cPixels)
+    {
+        for (size_t stOffset = 0; stOffset < 4; ++stOffset)
+        {
+            size_t stStart = GUARD - stOffset;
+
+            Pixels pixels = MakeSkinPixels(random, cPixels);
+            Pixels scalar = pixels;
+            Pixels sse2 = pixels;
+
+            PremultiplyAlphaScalar(&scalar[stStart], cPixels);
+            PremultiplyAlpha(&sse2[stStart], cPixels);
+
+            if (sse2 != scalar ||
+                !SameOutside(sse2, pixels, stStart, cPixels * 4))
+            {
+                ++stMismatches;
+            }
+
+            unsigned int uKey = KEYS[random.Next(3)];
+
+            // Make some pixels match the key, with any alpha
+            for (size_t st = 0; st < cPixels; ++st)
+            {
+                if (random.Next(3) == 0)
+                {
+                    pixels[stStart + st * 4] = (unsigned char)uKey;
+                    pixels[stStart + st * 4 + 1] = (unsigned char)(uKey >> 8);
+                    pixels[stStart + st * 4 + 2] = (unsigned char)(uKey >> 16);
+                }
+            }
+
+            scalar = pixels;
+            sse2 = pixels;
+
+            ColorKeyToAlphaScalar(&scalar[stStart], cPixels, uKey);
+            ColorKeyToAlpha(&sse2[stStart], cPixels, uKey);
+
+            if (sse2 != scalar ||
+                !SameOutside(sse2, pixels, stStart, cPixels * 4))
+            {
+                ++stMismatches;
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Keyed pixels become transparent black whatever their alpha was, all
+// others opaque with their color kept
+//
+static void TestColorKeyBytes()
+{
+    unsigned char pixels[] =
+    {
+        0xFF, 0x00, 0xFF, 0x00,  0xFF, 0x00, 0xFF, 0x80,
+        0xFF, 0x01, 0xFF, 0x00,  0x12, 0x34, 0x56, 0x78,
+        0xFF, 0x00, 0xFF, 0xFF
+    };
+    const unsigned char expected[] =
+    {
+        0x00, 0x00, 0x00, 0x00,  0x00, 0x00, 0x00, 0x00,
+        0xFF, 0x01, 0xFF, 0xFF,  0x12, 0x34, 0x56, 0xFF,
+        0x00, 0x00, 0x00, 0x00
+    };
+
+    // The key's alpha byte is ignored
+    ColorKeyToAlpha(pixels, 5, 0x12FF00FF);
+    CHECK(std::equal(pixels, pixels + sizeof(pixels), expected));
+}
+
+
+//
+// HasAlpha finds a single non-zero alpha byte anywhere, and ignores the
+// color bytes
+//
+static void TestHasAlpha()
+{
+    Pixels pixels(67 * 4, 0xFF);
+
+    for (size_t st = 3; st < pixels.size(); st += 4)
+    {
+        pixels[st] = 0;
+    }
+
+    CHECK(!HasAlpha(&pixels[0], 67));
+    CHECK(!HasAlpha(&pixels[0], 0));
+
+    size_t stMismatches = 0;
+
+    for (size_t stPixel = 0; stPixel < 67; ++stPixel)
+    {
+        pixels[stPixel * 4 + 3] = 1;
+
+        if (!HasAlpha(&pixels[0], 67) ||
+            HasAlpha(&pixels[0], stPixel) ||
+            !HasAlpha(&pixels[0], stPixel + 1))
+        {
+            ++stMismatches;
+        }
+
+        pixels[stPixel * 4 + 3] = 0;
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+int main()
+{
+    TestSwizzle();
+    TestSwizzleBytes();
+    TestPremultiplyExact();
+    TestPremultiplyAndColorKey();
+    TestColorKeyBytes();
+    TestHasAlpha();
+
+    return TestResult("PixelConvertTest");
+}
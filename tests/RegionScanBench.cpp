@@ -0,0 +1,173 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/RegionScan.h"
+#include "Test.h"
+#include <algorithm>
+#include <vector>
+
+
+//
+// Times ScanOpaqueSpans, SSE2 where the compiler targets it, against the
+// plain C scan on the kinds of images BitmapToRegion is given: skins with a
+// magenta or ranged background around a solid shape, fully opaque images,
+// and noise.
+//
+
+typedef std::vector<DWORD> Image;
+typedef int (*ScanProc)(const DWORD*, int, const RegionKey&, int*);
+
+const DWORD MAGENTA = 0xFFFF00FF;
+
+
+//
+// Random
+//
+// xorshift32, so every run sees the same images.
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+// An opaque ellipse with a few holes, on a transparent background
+static Image MakeSkin(int nWidth, int nHeight, DWORD dwBackground)
+{
+    Image image(nWidth * nHeight, dwBackground);
+    Random random(1);
+
+    for (int y = 0; y < nHeight; ++y)
+    {
+        for (int x = 0; x < nWidth; ++x)
+        {
+            double dx = (x - nWidth / 2.0) / (nWidth / 2.0);
+            double dy = (y - nHeight / 2.0) / (nHeight / 2.0);
+
+            if (dx * dx + dy * dy < 0.9 && (x / 8 + y / 8) % 7 != 0)
+            {
+                image[y * nWidth + x] = 0xFF000000 | random.Next(0x1000000);
+            }
+        }
+    }
+
+    return image;
+}
+
+
+// Every pixel transparent or not at random
+static Image MakeNoise(int nWidth, int nHeight)
+{
+    Image image(nWidth * nHeight);
+    Random random(2);
+
+    for (size_t st = 0; st < image.size(); ++st)
+    {
+        image[st] = random.Next(2) ? MAGENTA : 0xFF808080;
+    }
+
+    return image;
+}
+
+
+// Megapixels per second scanning the whole image, row by row
+static double Time(ScanProc pScan, const Image& image, int nWidth,
+    const RegionKey& key, int& nTotal)
+{
+    const int PASSES = 200;
+
+    int nHeight = (int)(image.size() / nWidth);
+    std::vector<int> spans(nWidth + 1);
+
+    Stopwatch stopwatch;
+
+    for (int nPass = 0; nPass < PASSES; ++nPass)
+    {
+        for (int y = 0; y < nHeight; ++y)
+        {
+            nTotal += pScan(&image[y * nWidth], nWidth, key, &spans[0]);
+        }
+    }
+
+    return image.size() * (double)PASSES / 1e6 /
+        std::max(stopwatch.GetSeconds(), 1e-9);
+}
+
+
+static void Run(const char* pszImage, const Image& image, int nWidth,
+    const RegionKey& key)
+{
+    int nScalar = 0;
+    int nSse2 = 0;
+
+    double dScalar = Time(ScanOpaqueSpansScalar, image, nWidth, key, nScalar);
+    double dSse2 = Time(ScanOpaqueSpans, image, nWidth, key, nSse2);
+
+    printf("%-20s %6s %12.1f %12.1f %8.1fx\n", pszImage,
+        key.bExact ? "exact" : "range", dScalar, dSse2, dSse2 / dScalar);
+
+    CHECK_EQUAL(nScalar, nSse2);
+}
+
+
+int main()
+{
+    const int WIDTH = 512;
+    const int HEIGHT = 512;
+
+    const RegionKey keyExact = RegionKey::Exact(MAGENTA);
+    const RegionKey keyRange = RegionKey::Range(0x00F000F0, 0x00FF10FF);
+
+    printf("%-20s %6s %12s %12s %9s\n", "Image", "Key",
+        "Scalar(Mp/s)", "SSE2(Mp/s)", "Speedup");
+
+    Image skin = MakeSkin(WIDTH, HEIGHT, MAGENTA);
+    Run("skin", skin, WIDTH, keyExact);
+    Run("skin", skin, WIDTH, keyRange);
+
+    Image skinNear = MakeSkin(WIDTH, HEIGHT, 0xFFF808F8);
+    Run("skin, near magenta", skinNear, WIDTH, keyRange);
+
+    Image opaque(WIDTH * HEIGHT, 0xFF808080);
+    Run("opaque", opaque, WIDTH, keyExact);
+    Run("opaque", opaque, WIDTH, keyRange);
+
+    Image noise = MakeNoise(WIDTH, HEIGHT);
+    Run("noise", noise, WIDTH, keyExact);
+    Run("noise", noise, WIDTH, keyRange);
+
+    return TestResult("RegionScanBench");
+}
@@ -0,0 +1,387 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../lsapi/RegionScan.h"
+#include "Test.h"
+#include <vector>
+
+
+typedef std::vector<DWORD> Row;
+typedef std::vector<int> Spans;
+
+
+//
+// Random
+//
+// xorshift32, so every run sees the same rows.
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+    DWORD NextPixel()
+    {
+        return (DWORD)Next(0x10000) << 16 | (DWORD)Next(0x10000);
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+//
+// Transparency spelled out per channel, independently of RegionScan.cpp
+//
+static bool NaiveTransparent(DWORD dwPixel, const RegionKey& key)
+{
+    if (key.bExact)
+    {
+        return dwPixel == key.dwLow;
+    }
+
+    BYTE bBlue = (BYTE)(dwPixel), bGreen = (BYTE)(dwPixel >> 8);
+    BYTE bRed = (BYTE)(dwPixel >> 16);
+
+    return
+        bBlue >= (BYTE)(key.dwLow) && bBlue <= (BYTE)(key.dwHigh) &&
+        bGreen >= (BYTE)(key.dwLow >> 8) && bGreen <= (BYTE)(key.dwHigh >> 8) &&
+        bRed >= (BYTE)(key.dwLow >> 16) && bRed <= (BYTE)(key.dwHigh >> 16);
+}
+
+
+static Spans NaiveSpans(const Row& row, const RegionKey& key)
+{
+    Spans spans;
+    size_t st = 0;
+
+    while (st < row.size())
+    {
+        if (NaiveTransparent(row[st], key))
+        {
+            ++st;
+            continue;
+        }
+
+        size_t stStart = st;
+
+        while (st < row.size() && !NaiveTransparent(row[st], key))
+        {
+            ++st;
+        }
+
+        spans.push_back((int)stStart);
+        spans.push_back((int)st);
+    }
+
+    return spans;
+}
+
+
+typedef int (*ScanProc)(const DWORD*, int, const RegionKey&, int*);
+
+static Spans Scan(ScanProc pScan, const Row& row, const RegionKey& key)
+{
+    // One extra int past the documented maximum, to catch overruns
+    Spans spans(row.size() + 2, -1);
+    int nSpans = pScan(row.empty() ? nullptr : &row[0], (int)row.size(), key,
+        &spans[0]);
+
+    CHECK_EQUAL(-1, spans[row.size() + 1]);
+    spans.resize(2 * (size_t)nSpans);
+
+    return spans;
+}
+
+
+//
+// A row of runs of random length, each either transparent or one of a few
+// pixels that sit right at and around the edges of the key
+//
+static Row MakeRow(Random& random, int nWidth, const RegionKey& key,
+    uint32_t uMaxRun)
+{
+    const DWORD dwNear[] =
+    {
+        key.dwLow,
+        key.dwHigh,
+        key.dwLow ^ 0x00000001,
+        key.dwLow ^ 0x00000100,
+        key.dwLow ^ 0x00010000,
+        key.dwLow ^ 0xFF000000,
+        key.dwHigh + 0x00000001,
+        key.dwHigh - 0x00000100,
+        (key.dwLow & 0xFF00FFFF) | 0x00FF0000,
+        key.dwLow - 0x00000001
+    };
+
+    Row row;
+
+    while ((int)row.size() < nWidth)
+    {
+        uint32_t uPick = random.Next(16);
+        DWORD dwPixel;
+
+        if (uPick < 6)
+        {
+            dwPixel = key.dwLow;
+        }
+        else if (uPick < 14)
+        {
+            dwPixel = dwNear[random.Next(sizeof(dwNear) / sizeof(dwNear[0]))];
+        }
+        else
+        {
+            dwPixel = random.NextPixel();
+        }
+
+        uint32_t uRun = 1 + random.Next(uMaxRun);
+
+        for (uint32_t u = 0; u < uRun && (int)row.size() < nWidth; ++u)
+        {
+            row.push_back(dwPixel);
+        }
+    }
+
+    return row;
+}
+
+
+//
+// The SSE2 scan, the plain one and the naive one agree on every width
+// around the 4 and 16 pixel blocks, for exact and range keys
+//
+static void TestScan()
+{
+    const RegionKey keys[] =
+    {
+        RegionKey::Exact(0xFFFF00FF),
+        RegionKey::Exact(0x00000000),
+        RegionKey::Range(0x00F000F0, 0x00FF10FF),
+        RegionKey::Range(0x00000000, 0x00000000),
+        RegionKey::Range(0x00102030, 0x00807060),
+        RegionKey::Range(0x00000000, 0x00FFFFFF)
+    };
+
+    size_t stMismatches = 0;
+    Random random(1);
+
+    for (size_t stKey = 0; stKey < sizeof(keys) / sizeof(keys[0]); ++stKey)
+    {
+        for (int nWidth = 0; nWidth <= 70; ++nWidth)
+        {
+            for (uint32_t uMaxRun = 1; uMaxRun <= 40; uMaxRun += 3)
+            {
+                for (int nRepeat = 0; nRepeat < 10; ++nRepeat)
+                {
+                    const RegionKey& key = keys[stKey];
+                    Row row = MakeRow(random, nWidth, key, uMaxRun);
+                    Spans naive = NaiveSpans(row, key);
+
+                    if (Scan(ScanOpaqueSpansScalar, row, key) != naive ||
+                        Scan(ScanOpaqueSpans, row, key) != naive)
+                    {
+                        ++stMismatches;
+                    }
+                }
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Every one of the 2^16 patterns of a 16 pixel block, with a pixel either
+// side that is sometimes opaque, so runs cross the block edges
+//
+static void TestBlockPatterns()
+{
+    const RegionKey key = RegionKey::Exact(0xFFFF00FF);
+    size_t stMismatches = 0;
+
+    for (uint32_t uPattern = 0; uPattern < 0x40000; ++uPattern)
+    {
+        Row row(18);
+
+        for (int n = 0; n < 18; ++n)
+        {
+            row[n] = (uPattern & (1u << n)) ? 0x00123456 : key.dwLow;
+        }
+
+        Spans naive = NaiveSpans(row, key);
+
+        if (Scan(ScanOpaqueSpans, row, key) != naive)
+        {
+            ++stMismatches;
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+static bool SameRect(const RECT& rc, int left, int top, int right,
+    int bottom)
+{
+    return rc.left == left && rc.top == top && rc.right == right &&
+        rc.bottom == bottom;
+}
+
+
+//
+// Identical consecutive rows extend the rects above them, anything else
+// starts new ones, and the bounds cover them all
+//
+static void TestRectList()
+{
+    const int spansA[] = { 2, 5, 8, 10 };
+    const int spansB[] = { 2, 5 };
+
+    RegionRectList list(100, 200);
+    CHECK(SameRect(list.GetBounds(), 0, 0, 0, 0));
+
+    list.AddRow(0, spansA, 2);
+    list.AddRow(1, spansA, 2);
+    list.AddRow(2, spansA, 2);
+    CHECK_EQUAL((size_t)2, list.GetRects().size());
+    CHECK(SameRect(list.GetRects()[0], 102, 200, 105, 203));
+    CHECK(SameRect(list.GetRects()[1], 108, 200, 110, 203));
+
+    // Different runs
+    list.AddRow(3, spansB, 1);
+    CHECK_EQUAL((size_t)3, list.GetRects().size());
+    CHECK(SameRect(list.GetRects()[2], 102, 203, 105, 204));
+
+    // An empty row adds nothing, and the row after it doesn't merge
+    // across it
+    list.AddRow(4, spansB, 0);
+    list.AddRow(5, spansB, 1);
+    CHECK_EQUAL((size_t)4, list.GetRects().size());
+    CHECK(SameRect(list.GetRects()[3], 102, 205, 105, 206));
+
+    // Same runs, but not the next row
+    list.AddRow(7, spansB, 1);
+    CHECK_EQUAL((size_t)5, list.GetRects().size());
+    CHECK(SameRect(list.GetRects()[4], 102, 207, 105, 208));
+
+    list.AddRow(8, spansB, 1);
+    CHECK_EQUAL((size_t)5, list.GetRects().size());
+    CHECK(SameRect(list.GetRects()[4], 102, 207, 105, 209));
+
+    CHECK(SameRect(list.GetBounds(), 102, 200, 110, 209));
+}
+
+
+//
+// Rects built from random images cover exactly the opaque pixels
+//
+static void TestRectCoverage()
+{
+    const RegionKey key = RegionKey::Exact(0xFFFF00FF);
+    const int nWidth = 37, nHeight = 29;
+
+    size_t stMismatches = 0;
+
+    for (uint32_t uSeed = 1; uSeed <= 50; ++uSeed)
+    {
+        Random random(uSeed);
+        std::vector<Row> rows;
+        RegionRectList list(3, 5);
+        Spans spans(nWidth + 1);
+
+        for (int y = 0; y < nHeight; ++y)
+        {
+            // Repeat the row above often, so rows merge
+            if (y > 0 && random.Next(2) == 0)
+            {
+                rows.push_back(rows.back());
+            }
+            else
+            {
+                rows.push_back(MakeRow(random, nWidth, key, 8));
+            }
+
+            int nSpans = ScanOpaqueSpans(&rows[y][0], nWidth, key, &spans[0]);
+            list.AddRow(y, &spans[0], nSpans);
+        }
+
+        std::vector<int> coverage(nWidth * nHeight, 0);
+        const std::vector<RECT>& rects = list.GetRects();
+
+        for (size_t st = 0; st < rects.size(); ++st)
+        {
+            for (int y = rects[st].top - 5; y < rects[st].bottom - 5; ++y)
+            {
+                for (int x = rects[st].left - 3; x < rects[st].right - 3; ++x)
+                {
+                    ++coverage[y * nWidth + x];
+                }
+            }
+
+            // Banded: ordered by top, then left
+            if (st > 0 && (rects[st].top < rects[st - 1].top ||
+                (rects[st].top == rects[st - 1].top &&
+                 rects[st].left < rects[st - 1].left)))
+            {
+                ++stMismatches;
+            }
+        }
+
+        for (int y = 0; y < nHeight; ++y)
+        {
+            for (int x = 0; x < nWidth; ++x)
+            {
+                int nExpected = NaiveTransparent(rows[y][x], key) ? 0 : 1;
+
+                if (coverage[y * nWidth + x] != nExpected)
+                {
+                    ++stMismatches;
+                }
+            }
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+int main()
+{
+    TestScan();
+    TestBlockPatterns();
+    TestRectList();
+    TestRectCoverage();
+
+    return TestResult("RegionScanTest");
+}
@@ -0,0 +1,281 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/StartupPlan.h"
+#include "Test.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+
+//
+// FakeLauncher
+//
+// Drives a plan the way StartupRunner does, with a simulated clock. Every
+// item takes a given time to launch. Records when each item started and
+// finished, and the most launches that were ever in flight.
+//
+class FakeLauncher
+{
+public:
+    struct Item
+    {
+        StartupPlan::DelayClass dcClass;
+        DWORD dwDuration;
+        DWORD dwStarted;
+        DWORD dwFinished;
+    };
+
+    FakeLauncher(UINT uConcurrency, DWORD dwDeferDelay, DWORD dwStart = 0)
+        : m_plan(uConcurrency, dwDeferDelay)
+        , m_dwNow(dwStart)
+        , m_dwStart(dwStart)
+        , m_uMaxInFlight(0)
+    {
+    }
+
+    size_t Add(StartupPlan::DelayClass dcClass, DWORD dwDuration)
+    {
+        Item item = { dcClass, dwDuration, 0, 0 };
+        m_vecItems.push_back(item);
+
+        return m_plan.Add(dcClass);
+    }
+
+    void Run()
+    {
+        m_plan.Start(m_dwNow);
+
+        for (;;)
+        {
+            size_t stIndex = 0;
+            DWORD dwTimeout = 0;
+            StartupPlan::NextStep nsStep =
+                m_plan.GetNext(m_dwNow, stIndex, dwTimeout);
+
+            if (nsStep == StartupPlan::StepDone)
+            {
+                break;
+            }
+            else if (nsStep == StartupPlan::StepLaunch)
+            {
+                m_vecItems[stIndex].dwStarted = m_dwNow;
+                m_vecOrder.push_back(stIndex);
+                m_mapRunning.insert(std::make_pair(
+                    m_dwNow - m_dwStart + m_vecItems[stIndex].dwDuration,
+                    stIndex));
+                m_uMaxInFlight = std::max(
+                    m_uMaxInFlight, (UINT)m_mapRunning.size());
+            }
+            else
+            {
+                // Waits for the first launch to finish, or the timeout
+                if (m_mapRunning.empty() && dwTimeout == INFINITE)
+                {
+                    CHECK(!"waiting forever with nothing in flight");
+                    break;
+                }
+
+                DWORD dwElapsed = m_dwNow - m_dwStart;
+                std::multimap<DWORD, size_t>::iterator iter =
+                    m_mapRunning.begin();
+
+                if (iter != m_mapRunning.end() &&
+                    (dwTimeout == INFINITE ||
+                     iter->first - dwElapsed <= dwTimeout))
+                {
+                    m_dwNow = m_dwStart + iter->first;
+                    m_vecItems[iter->second].dwFinished = m_dwNow;
+                    m_plan.Done(iter->second);
+                    m_mapRunning.erase(iter);
+                }
+                else
+                {
+                    m_dwNow += dwTimeout;
+                }
+            }
+        }
+    }
+
+    // Time relative to the start of the run
+    DWORD Started(size_t stIndex) const
+    {
+        return m_vecItems[stIndex].dwStarted - m_dwStart;
+    }
+
+    DWORD Finished(size_t stIndex) const
+    {
+        return m_vecItems[stIndex].dwFinished - m_dwStart;
+    }
+
+    DWORD GetElapsed() const
+    {
+        return m_dwNow - m_dwStart;
+    }
+
+    StartupPlan m_plan;
+    DWORD m_dwNow;
+    DWORD m_dwStart;
+    std::vector<Item> m_vecItems;
+    std::vector<size_t> m_vecOrder;
+
+    // Launches in flight, by the time they finish
+    std::multimap<DWORD, size_t> m_mapRunning;
+    UINT m_uMaxInFlight;
+};
+
+
+//
+// Normal items run up to the concurrency limit at once, in order
+//
+static void TestConcurrency()
+{
+    FakeLauncher launcher(3, 0);
+
+    for (int n = 0; n < 10; ++n)
+    {
+        launcher.Add(StartupPlan::ClassNormal, 100);
+    }
+
+    launcher.Run();
+
+    CHECK_EQUAL((UINT)3, launcher.m_uMaxInFlight);
+    CHECK_EQUAL((size_t)10, launcher.m_vecOrder.size());
+
+    for (size_t n = 0; n < 10; ++n)
+    {
+        CHECK_EQUAL(n, launcher.m_vecOrder[n]);
+    }
+
+    // Four waves of 100 ms
+    CHECK_EQUAL((DWORD)400, launcher.GetElapsed());
+
+    // One at a time is the old sequential behavior; zero means one
+    FakeLauncher sequential(0, 0);
+
+    for (int n = 0; n < 4; ++n)
+    {
+        sequential.Add(StartupPlan::ClassNormal, 100);
+    }
+
+    sequential.Run();
+
+    CHECK_EQUAL((UINT)1, sequential.m_uMaxInFlight);
+    CHECK_EQUAL((DWORD)400, sequential.GetElapsed());
+}
+
+
+//
+// Blocking items wait for everything before them, and nothing starts while
+// they run
+//
+static void TestBarriers()
+{
+    FakeLauncher launcher(4, 0);
+
+    size_t stA = launcher.Add(StartupPlan::ClassNormal, 50);
+    size_t stB = launcher.Add(StartupPlan::ClassNormal, 300);
+    size_t stBlock = launcher.Add(StartupPlan::ClassBlocking, 200);
+    size_t stC = launcher.Add(StartupPlan::ClassNormal, 10);
+    size_t stD = launcher.Add(StartupPlan::ClassNormal, 10);
+    size_t stBlock2 = launcher.Add(StartupPlan::ClassBlocking, 20);
+    size_t stBlock3 = launcher.Add(StartupPlan::ClassBlocking, 20);
+
+    launcher.Run();
+
+    CHECK_EQUAL((DWORD)0, launcher.Started(stA));
+    CHECK_EQUAL((DWORD)0, launcher.Started(stB));
+    CHECK_EQUAL(launcher.Finished(stB), launcher.Started(stBlock));
+    CHECK_EQUAL(launcher.Finished(stBlock), launcher.Started(stC));
+    CHECK_EQUAL(launcher.Finished(stBlock), launcher.Started(stD));
+    CHECK_EQUAL(launcher.Finished(stC), launcher.Started(stBlock2));
+    CHECK_EQUAL(launcher.Finished(stBlock2), launcher.Started(stBlock3));
+    CHECK_EQUAL((DWORD)(300 + 200 + 10 + 20 + 20), launcher.GetElapsed());
+}
+
+
+//
+// Deferred items wait for the defer delay, and normal items that come
+// after them move ahead, but not past a blocking item
+//
+static void TestDeferDelay()
+{
+    FakeLauncher launcher(2, 1000);
+
+    size_t stDeferred = launcher.Add(StartupPlan::ClassDeferred, 10);
+    size_t stNormal = launcher.Add(StartupPlan::ClassNormal, 100);
+    size_t stDeferred2 = launcher.Add(StartupPlan::ClassDeferred, 10);
+    size_t stBlock = launcher.Add(StartupPlan::ClassBlocking, 50);
+    size_t stAfter = launcher.Add(StartupPlan::ClassNormal, 10);
+
+    launcher.Run();
+
+    CHECK_EQUAL(stNormal, launcher.m_vecOrder[0]);
+    CHECK_EQUAL(stDeferred, launcher.m_vecOrder[1]);
+    CHECK_EQUAL(stDeferred2, launcher.m_vecOrder[2]);
+    CHECK_EQUAL(stBlock, launcher.m_vecOrder[3]);
+    CHECK_EQUAL(stAfter, launcher.m_vecOrder[4]);
+
+    CHECK_EQUAL((DWORD)0, launcher.Started(stNormal));
+    CHECK_EQUAL((DWORD)1000, launcher.Started(stDeferred));
+    CHECK_EQUAL((DWORD)1000, launcher.Started(stDeferred2));
+    CHECK_EQUAL((DWORD)1010, launcher.Started(stBlock));
+    CHECK_EQUAL((DWORD)1060, launcher.Started(stAfter));
+
+    // Once the delay has passed, deferred items run like normal ones
+    FakeLauncher late(1, 100);
+
+    size_t stSlow = late.Add(StartupPlan::ClassNormal, 500);
+    size_t stLate = late.Add(StartupPlan::ClassDeferred, 10);
+
+    late.Run();
+
+    CHECK_EQUAL(late.Finished(stSlow), late.Started(stLate));
+}
+
+
+//
+// The defer delay survives the tick count wrapping around
+//
+static void TestWrap()
+{
+    FakeLauncher launcher(2, 1000, 0xFFFFFF00);
+
+    size_t stDeferred = launcher.Add(StartupPlan::ClassDeferred, 10);
+    size_t stNormal = launcher.Add(StartupPlan::ClassNormal, 10);
+
+    launcher.Run();
+
+    CHECK_EQUAL((DWORD)0, launcher.Started(stNormal));
+    CHECK_EQUAL((DWORD)1000, launcher.Started(stDeferred));
+    CHECK_EQUAL((DWORD)1010, launcher.GetElapsed());
+}
+
+
+int main()
+{
+    TestConcurrency();
+    TestBarriers();
+    TestDeferDelay();
+    TestWrap();
+
+    return TestResult("StartupPlanTest");
+}
@@ -0,0 +1,62 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "Test.h"
+
+static unsigned int s_uFailures = 0;
+
+
+//
+// TestFailed
+//
+void TestFailed(const char* pszFile, int nLine, const char* pszExpr)
+{
+    fprintf(stderr, "%s(%d): check failed: %s\n", pszFile, nLine, pszExpr);
+    ++s_uFailures;
+}
+
+
+//
+// TestResult
+//
+int TestResult(const char* pszTest)
+{
+    if (s_uFailures == 0)
+    {
+        printf("%s: passed\n", pszTest);
+        return 0;
+    }
+
+    printf("%s: %u check(s) failed\n", pszTest, s_uFailures);
+    return 1;
+}
+
+
+//
+// DbgTraceMessage
+//
+// utility/debug.cpp writes to the debugger, which needs Windows. Traces go
+// nowhere here.
+//
+void DbgTraceMessage(const char* pszFormat, ...)
+{
+    (void)pszFormat;
+}
@@ -0,0 +1,81 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TEST_H)
+#define TEST_H
+
+#include <chrono>
+#include <cstdio>
+
+
+//
+// Minimal checks for the tests in this directory. A failed check is
+// reported and counted, and the test carries on. main returns TestResult().
+//
+#define CHECK(expr) \
+    ((expr) ? (void)0 : TestFailed(__FILE__, __LINE__, #expr))
+
+#define CHECK_EQUAL(expected, actual) \
+    (((expected) == (actual)) ? (void)0 : \
+        TestFailed(__FILE__, __LINE__, #expected " == " #actual))
+
+void TestFailed(const char* pszFile, int nLine, const char* pszExpr);
+
+// Prints a summary and returns the exit code for main
+int TestResult(const char* pszTest);
+
+
+//
+// Stopwatch
+//
+// Wall clock time for the benchmarks.
+//
+class Stopwatch
+{
+public:
+    Stopwatch()
+        : m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    void Restart()
+    {
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    double GetSeconds() const
+    {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    static unsigned long long GetTicks()
+    {
+        return (unsigned long long)std::chrono::duration_cast<
+            std::chrono::nanoseconds>(std::chrono::steady_clock::now().
+                time_since_epoch()).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // TEST_H
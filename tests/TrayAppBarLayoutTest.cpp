@@ -0,0 +1,674 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayAppBarLayout.h"
+#include "Test.h"
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+
+typedef AppBarLayout::Rect Rect;
+
+static const unsigned EDGE_LEFT = AppBarLayout::EdgeLeft;
+static const unsigned EDGE_TOP = AppBarLayout::EdgeTop;
+static const unsigned EDGE_RIGHT = AppBarLayout::EdgeRight;
+static const unsigned EDGE_BOTTOM = AppBarLayout::EdgeBottom;
+
+static const size_t MONITOR_COUNT = 2;
+static const Rect MONITORS[MONITOR_COUNT] =
+{
+    { 0, 0, 1920, 1080 },
+    { 1920, 0, 3840, 1200 }
+};
+
+
+static Rect MakeRect(long left, long top, long right, long bottom)
+{
+    Rect rc = { left, top, right, bottom };
+    return rc;
+}
+
+
+static bool SameRect(const Rect& rcA, const Rect& rcB)
+{
+    return rcA.left == rcB.left && rcA.top == rcB.top &&
+        rcA.right == rcB.right && rcA.bottom == rcB.bottom;
+}
+
+
+static bool Intersects(const Rect& rcA, const Rect& rcB)
+{
+    return std::max(rcA.left, rcB.left) < std::min(rcA.right, rcB.right) &&
+        std::max(rcA.top, rcB.top) < std::min(rcA.bottom, rcB.bottom);
+}
+
+
+// Bars and monitors are opaque keys to the layout
+static AppBarLayout::BarId MakeBar(uintptr_t uId)
+{
+    return (AppBarLayout::BarId)(uId + 1);
+}
+
+static AppBarLayout::MonitorId MakeMonitor(size_t stIndex)
+{
+    return (AppBarLayout::MonitorId)(uintptr_t)(0x1000 + stIndex);
+}
+
+
+//
+// A bar strip of the given breadth along an edge of a monitor, the way
+// bars usually ask for their position
+//
+static Rect MakeRequest(const Rect& rcMonitor, unsigned uEdge, long lBreadth)
+{
+    Rect rc = rcMonitor;
+
+    switch (uEdge)
+    {
+    case EDGE_LEFT:
+        rc.right = rc.left + lBreadth;
+        break;
+    case EDGE_TOP:
+        rc.bottom = rc.top + lBreadth;
+        break;
+    case EDGE_RIGHT:
+        rc.left = rc.right - lBreadth;
+        break;
+    case EDGE_BOTTOM:
+        rc.top = rc.bottom - lBreadth;
+        break;
+    }
+
+    return rc;
+}
+
+
+//
+// Small deterministic generator, so failures reproduce
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+//
+// Model
+//
+// The layout recomputed from scratch on every query: a list of bars in
+// the order they were added, scanned linearly. The layout must always
+// agree with it, whatever the history of its caches.
+//
+class Model
+{
+public:
+    void AddBar(uintptr_t uId)
+    {
+        if (_Find(uId) == m_vecBars.end())
+        {
+            ModelBar bar = { uId, false, 0, 0, MakeRect(0, 0, 0, 0) };
+            m_vecBars.push_back(bar);
+        }
+    }
+
+    void RemoveBar(uintptr_t uId)
+    {
+        std::vector<ModelBar>::iterator it = _Find(uId);
+
+        if (it != m_vecBars.end())
+        {
+            m_vecBars.erase(it);
+        }
+    }
+
+    void PlaceBar(uintptr_t uId, size_t stMonitor, unsigned uEdge, const Rect& rc)
+    {
+        std::vector<ModelBar>::iterator it = _Find(uId);
+
+        if (it != m_vecBars.end())
+        {
+            it->bPlaced = true;
+            it->stMonitor = stMonitor;
+            it->uEdge = uEdge;
+            it->rc = rc;
+        }
+    }
+
+    Rect QueryPos(uintptr_t uId, size_t stMonitor, unsigned uEdge,
+        const Rect& rcBase, const Rect& rcRequested) const
+    {
+        Rect rcDst = rcBase;
+        AppBarLayout::ApplyExtent(rcDst, rcRequested, uEdge);
+
+        // The last bar on the edge added before this one; all of them if
+        // this one is unknown
+        const ModelBar* pBefore = nullptr;
+
+        for (size_t st = 0; st < m_vecBars.size(); ++st)
+        {
+            const ModelBar& bar = m_vecBars[st];
+
+            if (bar.uId == uId)
+            {
+                break;
+            }
+
+            if (_IsOn(bar, stMonitor, uEdge))
+            {
+                pBefore = &bar;
+            }
+        }
+
+        if (pBefore)
+        {
+            switch (uEdge)
+            {
+            case EDGE_LEFT:   rcDst.left = pBefore->rc.right;  break;
+            case EDGE_TOP:    rcDst.top = pBefore->rc.bottom;  break;
+            case EDGE_RIGHT:  rcDst.right = pBefore->rc.left;  break;
+            case EDGE_BOTTOM: rcDst.bottom = pBefore->rc.top;  break;
+            }
+        }
+
+        if (uEdge == EDGE_LEFT || uEdge == EDGE_RIGHT)
+        {
+            for (size_t st = 0; st < m_vecBars.size(); ++st)
+            {
+                const ModelBar& bar = m_vecBars[st];
+
+                if (bar.uId != uId && _IsOn(bar, stMonitor, EDGE_TOP) &&
+                    Intersects(bar.rc, rcDst))
+                {
+                    rcDst.top = std::max(rcDst.top, bar.rc.bottom);
+                }
+            }
+
+            for (size_t st = 0; st < m_vecBars.size(); ++st)
+            {
+                const ModelBar& bar = m_vecBars[st];
+
+                if (bar.uId != uId && _IsOn(bar, stMonitor, EDGE_BOTTOM) &&
+                    Intersects(bar.rc, rcDst))
+                {
+                    rcDst.bottom = std::min(rcDst.bottom, bar.rc.top);
+                }
+            }
+        }
+
+        AppBarLayout::ApplyBreadth(rcDst, rcRequested, uEdge);
+
+        return rcDst;
+    }
+
+    Rect GetWorkArea(size_t stMonitor) const
+    {
+        Rect rcWork = MONITORS[stMonitor];
+
+        for (size_t st = 0; st < m_vecBars.size(); ++st)
+        {
+            const ModelBar& bar = m_vecBars[st];
+
+            if (!bar.bPlaced || bar.stMonitor != stMonitor)
+            {
+                continue;
+            }
+
+            switch (bar.uEdge)
+            {
+            case EDGE_LEFT:
+                rcWork.left = std::max(rcWork.left, bar.rc.right);
+                break;
+            case EDGE_TOP:
+                rcWork.top = std::max(rcWork.top, bar.rc.bottom);
+                break;
+            case EDGE_RIGHT:
+                rcWork.right = std::min(rcWork.right, bar.rc.left);
+                break;
+            case EDGE_BOTTOM:
+                rcWork.bottom = std::min(rcWork.bottom, bar.rc.top);
+                break;
+            }
+        }
+
+        rcWork.right = std::max(rcWork.right, rcWork.left);
+        rcWork.bottom = std::max(rcWork.bottom, rcWork.top);
+
+        return rcWork;
+    }
+
+    const std::vector<uintptr_t> GetIds() const
+    {
+        std::vector<uintptr_t> vecIds;
+
+        for (size_t st = 0; st < m_vecBars.size(); ++st)
+        {
+            vecIds.push_back(m_vecBars[st].uId);
+        }
+
+        return vecIds;
+    }
+
+private:
+    struct ModelBar
+    {
+        uintptr_t uId;
+        bool bPlaced;
+        size_t stMonitor;
+        unsigned uEdge;
+        Rect rc;
+    };
+
+    static bool _IsOn(const ModelBar& bar, size_t stMonitor, unsigned uEdge)
+    {
+        return bar.bPlaced && bar.stMonitor == stMonitor && bar.uEdge == uEdge;
+    }
+
+    std::vector<ModelBar>::iterator _Find(uintptr_t uId)
+    {
+        for (std::vector<ModelBar>::iterator it = m_vecBars.begin();
+            it != m_vecBars.end(); ++it)
+        {
+            if (it->uId == uId)
+            {
+                return it;
+            }
+        }
+
+        return m_vecBars.end();
+    }
+
+    std::vector<ModelBar> m_vecBars;
+};
+
+
+//
+// Counts every query on which the layout and the model disagree: each bar
+// known to the model, plus one unknown bar, on every edge of every monitor,
+// and the work area of every monitor
+//
+static size_t CountMismatches(AppBarLayout& layout, const Model& model,
+    uintptr_t uUnknown)
+{
+    size_t stMismatches = 0;
+    std::vector<uintptr_t> vecIds = model.GetIds();
+    vecIds.push_back(uUnknown);
+
+    for (size_t stMonitor = 0; stMonitor < MONITOR_COUNT; ++stMonitor)
+    {
+        const Rect& rcMonitor = MONITORS[stMonitor];
+
+        for (size_t st = 0; st < vecIds.size(); ++st)
+        {
+            for (unsigned uEdge = 0; uEdge < AppBarLayout::EdgeCount; ++uEdge)
+            {
+                Rect rcRequest = MakeRequest(rcMonitor, uEdge, 30);
+
+                Rect rcLayout = layout.QueryPos(MakeBar(vecIds[st]),
+                    MakeMonitor(stMonitor), uEdge, rcMonitor, rcRequest);
+                Rect rcModel = model.QueryPos(vecIds[st], stMonitor, uEdge,
+                    rcMonitor, rcRequest);
+
+                if (!SameRect(rcLayout, rcModel))
+                {
+                    ++stMismatches;
+                }
+            }
+        }
+
+        if (!SameRect(layout.GetWorkArea(MakeMonitor(stMonitor), rcMonitor),
+            model.GetWorkArea(stMonitor)))
+        {
+            ++stMismatches;
+        }
+    }
+
+    return stMismatches;
+}
+
+
+//
+// Every assignment of three bars to the edges of two monitors, added in
+// every order and placed in every order, then each one removed in turn.
+// After every step the layout agrees with the model.
+//
+static void TestExhaustive()
+{
+    const size_t BAR_COUNT = 3;
+    const size_t SLOT_COUNT = MONITOR_COUNT * AppBarLayout::EdgeCount;
+
+    size_t stMismatches = 0;
+    size_t stScenarios = 0;
+
+    size_t stAssignments = 1;
+
+    for (size_t st = 0; st < BAR_COUNT; ++st)
+    {
+        stAssignments *= SLOT_COUNT;
+    }
+
+    for (size_t stAssign = 0; stAssign < stAssignments; ++stAssign)
+    {
+        size_t arMonitor[BAR_COUNT];
+        unsigned arEdge[BAR_COUNT];
+
+        for (size_t st = 0, stRest = stAssign; st < BAR_COUNT; ++st)
+        {
+            arMonitor[st] = (stRest % SLOT_COUNT) / AppBarLayout::EdgeCount;
+            arEdge[st] = (unsigned)(stRest % AppBarLayout::EdgeCount);
+            stRest /= SLOT_COUNT;
+        }
+
+        size_t arAddOrder[BAR_COUNT] = { 0, 1, 2 };
+
+        do
+        {
+            size_t arPlaceOrder[BAR_COUNT] = { 0, 1, 2 };
+
+            do
+            {
+                for (size_t stRemove = 0; stRemove < BAR_COUNT; ++stRemove)
+                {
+                    AppBarLayout layout;
+                    Model model;
+
+                    for (size_t st = 0; st < BAR_COUNT; ++st)
+                    {
+                        layout.AddBar(MakeBar(arAddOrder[st]));
+                        model.AddBar(arAddOrder[st]);
+                    }
+
+                    for (size_t st = 0; st < BAR_COUNT; ++st)
+                    {
+                        size_t stBar = arPlaceOrder[st];
+                        size_t stMonitor = arMonitor[stBar];
+                        const Rect& rcMonitor = MONITORS[stMonitor];
+
+                        // Bars take the position they are offered, each
+                        // with its own breadth
+                        Rect rcRequest = MakeRequest(rcMonitor, arEdge[stBar],
+                            (long)(20 + 10 * stBar));
+                        Rect rc = layout.QueryPos(MakeBar(stBar),
+                            MakeMonitor(stMonitor), arEdge[stBar], rcMonitor,
+                            rcRequest);
+
+                        layout.PlaceBar(MakeBar(stBar), MakeMonitor(stMonitor),
+                            arEdge[stBar], rc);
+                        model.PlaceBar(stBar, stMonitor, arEdge[stBar], rc);
+
+                        stMismatches += CountMismatches(layout, model, 99);
+                    }
+
+                    layout.RemoveBar(MakeBar(stRemove));
+                    model.RemoveBar(stRemove);
+
+                    stMismatches += CountMismatches(layout, model, 99);
+                    ++stScenarios;
+                }
+            }
+            while (std::next_permutation(arPlaceOrder, arPlaceOrder + BAR_COUNT));
+        }
+        while (std::next_permutation(arAddOrder, arAddOrder + BAR_COUNT));
+    }
+
+    CHECK_EQUAL((size_t)(SLOT_COUNT * SLOT_COUNT * SLOT_COUNT * 6 * 6 * 3),
+        stScenarios);
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Long random histories of adds, moves, resizes and removes, with a
+// comparison after every operation
+//
+static void TestRandom()
+{
+    const uintptr_t BAR_IDS = 8;
+
+    size_t stMismatches = 0;
+
+    for (uint32_t uSeed = 1; uSeed <= 20; ++uSeed)
+    {
+        Random random(uSeed);
+        AppBarLayout layout;
+        Model model;
+
+        for (int nStep = 0; nStep < 500; ++nStep)
+        {
+            uintptr_t uId = random.Next(BAR_IDS);
+
+            switch (random.Next(4))
+            {
+            case 0:
+                layout.AddBar(MakeBar(uId));
+                model.AddBar(uId);
+                break;
+
+            case 1:
+                layout.RemoveBar(MakeBar(uId));
+                model.RemoveBar(uId);
+                break;
+
+            default:
+                {
+                    size_t stMonitor = random.Next(MONITOR_COUNT);
+                    unsigned uEdge = random.Next(AppBarLayout::EdgeCount);
+                    const Rect& rcMonitor = MONITORS[stMonitor];
+
+                    Rect rcRequest = MakeRequest(rcMonitor, uEdge,
+                        (long)(10 + random.Next(60)));
+
+                    // Some bars only use part of their edge
+                    if (random.Next(2))
+                    {
+                        long lInset = (long)random.Next(400);
+
+                        if (uEdge == EDGE_LEFT || uEdge == EDGE_RIGHT)
+                        {
+                            rcRequest.top += lInset;
+                        }
+                        else
+                        {
+                            rcRequest.right -= lInset;
+                        }
+                    }
+
+                    Rect rc = layout.QueryPos(MakeBar(uId),
+                        MakeMonitor(stMonitor), uEdge, rcMonitor, rcRequest);
+
+                    // Unregistered bars can't be placed
+                    layout.PlaceBar(MakeBar(uId), MakeMonitor(stMonitor),
+                        uEdge, rc);
+                    model.PlaceBar(uId, stMonitor, uEdge, rc);
+                }
+                break;
+            }
+
+            stMismatches += CountMismatches(layout, model, BAR_IDS);
+        }
+    }
+
+    CHECK_EQUAL((size_t)0, stMismatches);
+}
+
+
+//
+// Bars stacked on one edge never overlap, and each docks against the one
+// before it
+//
+static void TestStacking()
+{
+    AppBarLayout layout;
+    const Rect& rcMonitor = MONITORS[0];
+
+    for (uintptr_t uId = 0; uId < 4; ++uId)
+    {
+        layout.AddBar(MakeBar(uId));
+    }
+
+    // Placed out of order, they still stack in the order they were added
+    const uintptr_t arOrder[] = { 2, 0, 3, 1 };
+
+    for (int nPass = 0; nPass < 4; ++nPass)
+    {
+        for (size_t st = 0; st < 4; ++st)
+        {
+            uintptr_t uId = arOrder[st];
+            Rect rc = layout.QueryPos(MakeBar(uId), MakeMonitor(0), EDGE_TOP,
+                rcMonitor, MakeRequest(rcMonitor, EDGE_TOP, 25));
+
+            layout.PlaceBar(MakeBar(uId), MakeMonitor(0), EDGE_TOP, rc);
+        }
+    }
+
+    for (uintptr_t uId = 0; uId < 4; ++uId)
+    {
+        Rect rc = layout.QueryPos(MakeBar(uId), MakeMonitor(0), EDGE_TOP,
+            rcMonitor, MakeRequest(rcMonitor, EDGE_TOP, 25));
+
+        CHECK_EQUAL((long)(25 * uId), rc.top);
+        CHECK_EQUAL((long)(25 * (uId + 1)), rc.bottom);
+
+        if (uId > 0)
+        {
+            CHECK(layout.IsStackedBefore(MakeBar(uId - 1), MakeBar(uId)));
+            CHECK(!layout.IsStackedBefore(MakeBar(uId), MakeBar(uId - 1)));
+        }
+    }
+
+    CHECK_EQUAL(100L, layout.GetWorkArea(MakeMonitor(0), rcMonitor).top);
+
+    // Removing a bar leaves a gap until the others are placed again
+    layout.RemoveBar(MakeBar(1));
+
+    CHECK_EQUAL(100L, layout.GetWorkArea(MakeMonitor(0), rcMonitor).top);
+    CHECK_EQUAL(25L, layout.QueryPos(MakeBar(2), MakeMonitor(0), EDGE_TOP,
+        rcMonitor, MakeRequest(rcMonitor, EDGE_TOP, 25)).top);
+
+    // A bar added again goes to the end of the stacking order
+    layout.AddBar(MakeBar(1));
+
+    CHECK(layout.IsStackedBefore(MakeBar(3), MakeBar(1)));
+    CHECK_EQUAL(100L, layout.QueryPos(MakeBar(1), MakeMonitor(0), EDGE_TOP,
+        rcMonitor, MakeRequest(rcMonitor, EDGE_TOP, 25)).top);
+
+    // Left and right bars fit between the top and bottom bars
+    layout.AddBar(MakeBar(10));
+    layout.AddBar(MakeBar(11));
+
+    Rect rcBottom = MakeRequest(rcMonitor, EDGE_BOTTOM, 40);
+    layout.PlaceBar(MakeBar(10), MakeMonitor(0), EDGE_BOTTOM, rcBottom);
+
+    Rect rcLeft = layout.QueryPos(MakeBar(11), MakeMonitor(0), EDGE_LEFT,
+        rcMonitor, MakeRequest(rcMonitor, EDGE_LEFT, 50));
+
+    CHECK(SameRect(MakeRect(0, 100, 50, 1040), rcLeft));
+}
+
+
+//
+// Only changes that can move the work area dirty a monitor, and only that
+// monitor
+//
+static void TestDirty()
+{
+    AppBarLayout layout;
+    const Rect& rcMonitor = MONITORS[0];
+    Rect rcTop = MakeRequest(rcMonitor, EDGE_TOP, 30);
+
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+
+    // Registering doesn't place anything
+    layout.AddBar(MakeBar(0));
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+
+    layout.PlaceBar(MakeBar(0), MakeMonitor(0), EDGE_TOP, rcTop);
+    CHECK(layout.TakeDirty(MakeMonitor(0)));
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+    CHECK(!layout.TakeDirty(MakeMonitor(1)));
+
+    // Placing it where it already is changes nothing
+    layout.PlaceBar(MakeBar(0), MakeMonitor(0), EDGE_TOP, rcTop);
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+
+    // Resizing does
+    rcTop.bottom += 5;
+    layout.PlaceBar(MakeBar(0), MakeMonitor(0), EDGE_TOP, rcTop);
+    CHECK(layout.TakeDirty(MakeMonitor(0)));
+    CHECK_EQUAL(35L, layout.GetWorkArea(MakeMonitor(0), rcMonitor).top);
+
+    // Moving to another monitor dirties both
+    layout.PlaceBar(MakeBar(0), MakeMonitor(1), EDGE_TOP,
+        MakeRequest(MONITORS[1], EDGE_TOP, 30));
+    CHECK(layout.TakeDirty(MakeMonitor(0)));
+    CHECK(layout.TakeDirty(MakeMonitor(1)));
+    CHECK(SameRect(rcMonitor, layout.GetWorkArea(MakeMonitor(0), rcMonitor)));
+
+    // Invalid edges and unknown bars are ignored
+    layout.PlaceBar(MakeBar(0), MakeMonitor(0), AppBarLayout::EdgeCount, rcTop);
+    layout.PlaceBar(MakeBar(5), MakeMonitor(0), EDGE_TOP, rcTop);
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+    CHECK(SameRect(rcMonitor, layout.GetWorkArea(MakeMonitor(0), rcMonitor)));
+
+    layout.Invalidate(MakeMonitor(0));
+    CHECK(layout.TakeDirty(MakeMonitor(0)));
+
+    // Removing an unplaced bar changes nothing either
+    layout.AddBar(MakeBar(1));
+    layout.RemoveBar(MakeBar(1));
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+
+    layout.RemoveBar(MakeBar(0));
+    CHECK(layout.TakeDirty(MakeMonitor(1)));
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+
+    layout.AddBar(MakeBar(2));
+    layout.PlaceBar(MakeBar(2), MakeMonitor(0), EDGE_TOP, rcTop);
+    layout.Clear();
+    CHECK(!layout.TakeDirty(MakeMonitor(0)));
+    CHECK(SameRect(rcMonitor, layout.GetWorkArea(MakeMonitor(0), rcMonitor)));
+}
+
+
+int main()
+{
+    TestExhaustive();
+    TestRandom();
+    TestStacking();
+    TestDirty();
+
+    return TestResult("TrayAppBarLayoutTest");
+}
@@ -0,0 +1,250 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayIconCache.h"
+#include "Test.h"
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+
+//
+// Replays icon updates through the lookups NotifyIcon::acquire_icon makes,
+// reading the bits of every icon handed in as it used to, and looking the
+// handle up first as it does now.
+//
+// GetIconBits is replaced by a copy of the bits a 32x32 icon yields. The
+// GDI calls it really makes (GetIconInfo, GetDC, two GetDIBits and the
+// DeleteObjects) cost far more than that copy, so the speedups shown are
+// a lower bound.
+//
+// The last two sessions show where the handle lookup doesn't help: frames
+// that don't fit among the idle copies the cache keeps are read and copied
+// again, and so are handles an application never passes twice.
+//
+
+typedef std::vector<BYTE> Bits;
+
+// Mask and color planes of a 32x32 icon, each with its dimensions
+static const size_t ICON_BITS = 1 + 2 * (2 * 4 + 32 * 32 * 4);
+
+
+//
+// Small deterministic generator, so runs are comparable
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+//
+// One update: the tray icon it is for, the image and the handle its
+// application passed in
+//
+struct Update
+{
+    UINT uTrayIcon;
+    UINT uImage;
+    HICON hSource;
+};
+
+
+//
+// The images, and the updates of a session in which uApps applications
+// animate through uFrames frames each. With bHandlePerUpdate they create a
+// new handle for every frame they show, otherwise they keep one per frame.
+//
+static void MakeSession(UINT uApps, UINT uFrames, UINT uUpdates,
+    bool bHandlePerUpdate, std::vector<Bits>& vecImages,
+    std::vector<Update>& vecUpdates)
+{
+    Random random(uApps * 31 + uFrames);
+
+    for (UINT uImage = 0; uImage < uApps * uFrames; ++uImage)
+    {
+        Bits bits(ICON_BITS);
+
+        for (size_t st = 0; st < bits.size(); ++st)
+        {
+            bits[st] = (BYTE)(uImage * 13 + st * 7);
+        }
+
+        vecImages.push_back(bits);
+    }
+
+    std::vector<UINT> vecFrame(uApps, 0);
+    uintptr_t uNextHandle = 0x100000;
+
+    for (UINT u = 0; u < uUpdates; ++u)
+    {
+        Update update;
+        update.uTrayIcon = random.Next(uApps);
+
+        UINT& uFrame = vecFrame[update.uTrayIcon];
+        uFrame = (uFrame + 1) % uFrames;
+
+        update.uImage = update.uTrayIcon * uFrames + uFrame;
+        update.hSource = (HICON)(bHandlePerUpdate ?
+            uNextHandle++ : 0x1000 + update.uImage);
+
+        vecUpdates.push_back(update);
+    }
+}
+
+
+//
+// GetIconBits stand-in
+//
+static void ReadBits(const Bits& image, std::vector<BYTE>& vecBits)
+{
+    vecBits.assign(image.begin(), image.end());
+}
+
+
+//
+// Replays a session, returns nanoseconds per update and the number of
+// times the bits were read
+//
+static double Replay(const std::vector<Bits>& vecImages,
+    const std::vector<Update>& vecUpdates, UINT uApps, bool bBySource,
+    UINT& uReads)
+{
+    TrayIconCache cache;
+    std::vector<HICON> vecCurrent(uApps, (HICON)nullptr);
+    uintptr_t uNextCopy = 0x10000000;
+
+    uReads = 0;
+    Stopwatch stopwatch;
+
+    for (size_t st = 0; st < vecUpdates.size(); ++st)
+    {
+        const Update& update = vecUpdates[st];
+        HICON hIcon = bBySource ? cache.FindSource(update.hSource) : nullptr;
+
+        if (!hIcon)
+        {
+            std::vector<BYTE> vecBits;
+            ReadBits(vecImages[update.uImage], vecBits);
+            ++uReads;
+
+            hIcon = cache.Find(&vecBits[0], vecBits.size(),
+                bBySource ? update.hSource : nullptr);
+
+            if (!hIcon)
+            {
+                hIcon = (HICON)uNextCopy++;
+                cache.Insert(&vecBits[0], vecBits.size(), hIcon,
+                    bBySource ? update.hSource : nullptr);
+            }
+        }
+
+        HICON& hCurrent = vecCurrent[update.uTrayIcon];
+
+        if (hCurrent)
+        {
+            cache.Release(hCurrent);
+        }
+
+        hCurrent = hIcon;
+    }
+
+    double dSeconds = stopwatch.GetSeconds();
+
+    // The copies in use are the ones the tray icons show
+    const TrayIconCache::Statistics& stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)uApps, (UINT)(stats.uIcons - stats.uIdle +
+        std::count(vecCurrent.begin(), vecCurrent.end(), (HICON)nullptr)));
+
+    return dSeconds * 1e9 / std::max<size_t>(vecUpdates.size(), 1);
+}
+
+
+int main()
+{
+    struct Scenario
+    {
+        const char* pszName;
+        UINT uApps;
+        UINT uFrames;
+        bool bHandlePerUpdate;
+    };
+
+    const Scenario SCENARIOS[] = {
+        { "1 app, 4 frames",          1,  4, false },
+        { "8 apps, 4 frames",         8,  4, false },
+        { "8 apps, 16 frames",        8, 16, false },
+        { "8 apps, handle/update",    8,  4, true  },
+    };
+
+    const UINT UPDATES = 200000;
+
+    printf("%-24s %10s %10s %9s %10s\n", "Session", "Bits(ns)",
+        "Handle(ns)", "Speedup", "Reads");
+
+    for (size_t st = 0; st < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); ++st)
+    {
+        const Scenario& scenario = SCENARIOS[st];
+
+        std::vector<Bits> vecImages;
+        std::vector<Update> vecUpdates;
+        MakeSession(scenario.uApps, scenario.uFrames, UPDATES,
+            scenario.bHandlePerUpdate, vecImages, vecUpdates);
+
+        UINT uBitsReads = 0;
+        UINT uHandleReads = 0;
+
+        double dBits = Replay(vecImages, vecUpdates, scenario.uApps,
+            false, uBitsReads);
+        double dHandle = Replay(vecImages, vecUpdates, scenario.uApps,
+            true, uHandleReads);
+
+        printf("%-24s %10.1f %10.1f %8.1fx %10u\n", scenario.pszName,
+            dBits, dHandle, dBits / std::max(dHandle, 0.001), uHandleReads);
+
+        CHECK_EQUAL(UPDATES, uBitsReads);
+
+        // Each handle is read once, as long as the frames not on show fit
+        // among the idle icons the cache keeps
+        if (!scenario.bHandlePerUpdate &&
+            scenario.uApps * (scenario.uFrames - 1) <= 32)
+        {
+            CHECK_EQUAL(scenario.uApps * scenario.uFrames, uHandleReads);
+        }
+    }
+
+    return TestResult("TrayIconCacheBench");
+}
@@ -0,0 +1,348 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayIconCache.h"
+#include "Test.h"
+#include <vector>
+
+
+typedef std::vector<BYTE> Bits;
+
+
+//
+// Bits of a made up icon: a size prefix like NotifyIcon produces, then
+// pixels derived from the seed
+//
+static Bits MakeBits(BYTE bSeed, size_t cbPixels = 16 * 16 * 4)
+{
+    Bits bits(1 + cbPixels);
+
+    bits[0] = 1;
+
+    for (size_t st = 1; st < bits.size(); ++st)
+    {
+        bits[st] = (BYTE)(bSeed + st * 7);
+    }
+
+    return bits;
+}
+
+
+// Icon handles are whatever the caller created, the cache only compares them
+static HICON MakeIcon(uintptr_t uId)
+{
+    return (HICON)uId;
+}
+
+
+//
+// Looking up the same bits yields the same icon, with a reference each
+//
+static void TestIcons()
+{
+    TrayIconCache cache;
+    Bits bitsA = MakeBits(1);
+    Bits bitsB = MakeBits(2);
+
+    CHECK(cache.Find(&bitsA[0], bitsA.size(), nullptr) == nullptr);
+    cache.Insert(&bitsA[0], bitsA.size(), MakeIcon(0x100), nullptr);
+
+    CHECK(cache.Find(&bitsB[0], bitsB.size(), nullptr) == nullptr);
+    cache.Insert(&bitsB[0], bitsB.size(), MakeIcon(0x200), nullptr);
+
+    CHECK(cache.Find(&bitsA[0], bitsA.size(), nullptr) == MakeIcon(0x100));
+    CHECK(cache.Find(&bitsB[0], bitsB.size(), nullptr) == MakeIcon(0x200));
+
+    // Same prefix, different length
+    Bits bitsShort(bitsA.begin(), bitsA.end() - 1);
+    CHECK(cache.Find(&bitsShort[0], bitsShort.size(), nullptr) == nullptr);
+
+    const TrayIconCache::Statistics& stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)2, stats.uHits);
+    CHECK_EQUAL((UINT)3, stats.uMisses);
+    CHECK_EQUAL((UINT)2, stats.uIcons);
+
+    // A: inserted + found; idle after the second release
+    CHECK(cache.Release(MakeIcon(0x100)) == nullptr);
+    CHECK(cache.Release(MakeIcon(0x100)) == nullptr);
+    CHECK_EQUAL((UINT)2, stats.uIcons);
+    CHECK_EQUAL((UINT)1, stats.uIdle);
+
+    // Idle icons are still found
+    CHECK(cache.Find(&bitsA[0], bitsA.size(), nullptr) == MakeIcon(0x100));
+    CHECK_EQUAL((UINT)0, stats.uIdle);
+    CHECK(cache.Release(MakeIcon(0x100)) == nullptr);
+
+    // Until they are taken for destruction
+    CHECK(cache.TakeIdle() == MakeIcon(0x100));
+    CHECK(cache.TakeIdle() == nullptr);
+    CHECK_EQUAL((UINT)1, stats.uIcons);
+    CHECK(cache.Find(&bitsA[0], bitsA.size(), nullptr) == nullptr);
+
+    // Sharing an existing copy
+    CHECK(cache.AddRef(MakeIcon(0x200)));
+    CHECK(!cache.AddRef(MakeIcon(0x100)));
+    CHECK(cache.Release(MakeIcon(0x200)) == nullptr);
+    CHECK(cache.Release(MakeIcon(0x200)) == nullptr);
+    CHECK(cache.Release(MakeIcon(0x200)) == nullptr);
+    CHECK(cache.TakeIdle() == MakeIcon(0x200));
+    CHECK_EQUAL((UINT)0, stats.uIcons);
+
+    // Icons that were never cached are the caller's to destroy
+    CHECK(cache.Release(MakeIcon(0x300)) == MakeIcon(0x300));
+}
+
+
+//
+// Once too many icons are idle, the one idle longest is handed back
+//
+static void TestIdleLimit()
+{
+    TrayIconCache cache;
+    std::vector<Bits> vecBits;
+
+    for (BYTE b = 0; b < 40; ++b)
+    {
+        vecBits.push_back(MakeBits(b));
+        cache.Insert(&vecBits[b][0], vecBits[b].size(), MakeIcon(0x100 + b),
+            nullptr);
+    }
+
+    for (BYTE b = 0; b < 32; ++b)
+    {
+        CHECK(cache.Release(MakeIcon(0x100 + b)) == nullptr);
+    }
+
+    // Using an idle icon again makes it the most recently used
+    CHECK(cache.Find(&vecBits[0][0], vecBits[0].size(), nullptr) ==
+        MakeIcon(0x100));
+    CHECK(cache.Release(MakeIcon(0x100)) == nullptr);
+
+    CHECK(cache.Release(MakeIcon(0x100 + 32)) == MakeIcon(0x101));
+    CHECK(cache.Release(MakeIcon(0x100 + 33)) == MakeIcon(0x102));
+    CHECK_EQUAL((UINT)32, cache.GetStatistics().uIdle);
+    CHECK_EQUAL((UINT)38, cache.GetStatistics().uIcons);
+
+    UINT uTaken = 0;
+
+    while (cache.TakeIdle())
+    {
+        ++uTaken;
+    }
+
+    CHECK_EQUAL((UINT)32, uTaken);
+    CHECK_EQUAL((UINT)6, cache.GetStatistics().uIcons);
+
+    for (BYTE b = 34; b < 40; ++b)
+    {
+        CHECK(cache.Release(MakeIcon(0x100 + b)) == nullptr);
+    }
+}
+
+
+//
+// An application animating through a few frames ends up with one copy per
+// frame, however often it modifies its icon. Each frame's bits are read
+// once, as the application keeps passing the same handles.
+//
+static void TestAnimation()
+{
+    TrayIconCache cache;
+    std::vector<Bits> vecFrames;
+
+    for (BYTE bFrame = 0; bFrame < 4; ++bFrame)
+    {
+        vecFrames.push_back(MakeBits(bFrame * 16));
+    }
+
+    HICON hCurrent = nullptr;
+    uintptr_t uNextIcon = 0x1000;
+    UINT uCreated = 0;
+
+    UINT uRead = 0;
+
+    for (int nModify = 0; nModify < 1000; ++nModify)
+    {
+        size_t stFrame = nModify % vecFrames.size();
+        const Bits& bits = vecFrames[stFrame];
+
+        // The application keeps one handle per frame
+        HICON hSource = MakeIcon(0x10 + stFrame);
+
+        // What NotifyIcon::acquire_icon does
+        HICON hIcon = cache.FindSource(hSource);
+
+        if (!hIcon)
+        {
+            ++uRead;
+            hIcon = cache.Find(&bits[0], bits.size(), hSource);
+        }
+
+        if (!hIcon)
+        {
+            hIcon = MakeIcon(uNextIcon++);
+            cache.Insert(&bits[0], bits.size(), hIcon, hSource);
+            ++uCreated;
+        }
+
+        if (hCurrent)
+        {
+            CHECK(cache.Release(hCurrent) == nullptr);
+        }
+
+        hCurrent = hIcon;
+    }
+
+    CHECK_EQUAL((UINT)4, uCreated);
+    CHECK_EQUAL((UINT)4, uRead);
+    CHECK_EQUAL((UINT)4, cache.GetStatistics().uIcons);
+    CHECK_EQUAL((UINT)996, cache.GetStatistics().uHits);
+    CHECK_EQUAL((UINT)996, cache.GetStatistics().uSourceHits);
+}
+
+
+//
+// Source handles lead to the copy made from them, until the copy goes
+//
+static void TestSources()
+{
+    TrayIconCache cache;
+    Bits bitsA = MakeBits(1);
+    Bits bitsB = MakeBits(2);
+
+    CHECK(cache.FindSource(MakeIcon(0x10)) == nullptr);
+    cache.Insert(&bitsA[0], bitsA.size(), MakeIcon(0x100), MakeIcon(0x10));
+
+    CHECK(cache.FindSource(MakeIcon(0x10)) == MakeIcon(0x100));
+
+    // Another handle with the same image is remembered by the bits lookup
+    CHECK(cache.FindSource(MakeIcon(0x11)) == nullptr);
+    CHECK(cache.Find(&bitsA[0], bitsA.size(), MakeIcon(0x11)) ==
+        MakeIcon(0x100));
+    CHECK(cache.FindSource(MakeIcon(0x11)) == MakeIcon(0x100));
+
+    // A handle maps to the image it was last seen with
+    cache.Insert(&bitsB[0], bitsB.size(), MakeIcon(0x200), MakeIcon(0x11));
+    CHECK(cache.FindSource(MakeIcon(0x11)) == MakeIcon(0x200));
+    CHECK(cache.FindSource(MakeIcon(0x10)) == MakeIcon(0x100));
+
+    // 0x100: inserted, found by bits once and by source three times
+    for (int n = 0; n < 5; ++n)
+    {
+        CHECK(cache.Release(MakeIcon(0x100)) == nullptr);
+    }
+
+    // Idle icons keep their sources until they go
+    CHECK(cache.FindSource(MakeIcon(0x10)) == MakeIcon(0x100));
+    CHECK(cache.Release(MakeIcon(0x100)) == nullptr);
+    CHECK(cache.TakeIdle() == MakeIcon(0x100));
+
+    CHECK(cache.FindSource(MakeIcon(0x10)) == nullptr);
+    CHECK(cache.FindSource(MakeIcon(0x11)) == MakeIcon(0x200));
+
+    // An application creating a handle per update only leaves the newest
+    // few behind
+    for (uintptr_t u = 0; u < 20; ++u)
+    {
+        CHECK(cache.Find(&bitsB[0], bitsB.size(), MakeIcon(0x1000 + u)) ==
+            MakeIcon(0x200));
+    }
+
+    CHECK(cache.FindSource(MakeIcon(0x1000)) == nullptr);
+    CHECK(cache.FindSource(MakeIcon(0x11)) == nullptr);
+    CHECK(cache.FindSource(MakeIcon(0x1000 + 19)) == MakeIcon(0x200));
+
+    const TrayIconCache::Statistics& stats = cache.GetStatistics();
+    CHECK_EQUAL((UINT)7, stats.uSourceHits);
+    CHECK_EQUAL((UINT)28, stats.uHits);
+
+    // 0x200: inserted, found by bits 20 times and by source three times
+    for (int n = 0; n < 24; ++n)
+    {
+        CHECK(cache.Release(MakeIcon(0x200)) == nullptr);
+    }
+
+    CHECK(cache.TakeIdle() == MakeIcon(0x200));
+    CHECK_EQUAL((UINT)0, stats.uIcons);
+    CHECK(cache.FindSource(MakeIcon(0x1000 + 19)) == nullptr);
+}
+
+
+//
+// Equal tips share one string
+//
+static void TestTips()
+{
+    TrayIconCache cache;
+
+    CHECK(cache.InternTip(nullptr) == nullptr);
+    CHECK(cache.InternTip(L"") == nullptr);
+
+    LPCWSTR pwzA = cache.InternTip(L"Volume: 42%");
+    LPCWSTR pwzB = cache.InternTip(L"Network");
+    LPCWSTR pwzA2 = cache.InternTip(L"Volume: 42%");
+
+    CHECK(pwzA != nullptr && pwzB != nullptr);
+    CHECK(pwzA == pwzA2);
+    CHECK(pwzA != pwzB);
+    CHECK(std::wstring(pwzA) == L"Volume: 42%");
+    CHECK_EQUAL((UINT)2, cache.GetStatistics().uTips);
+
+    cache.ReleaseTip(pwzA);
+    CHECK_EQUAL((UINT)2, cache.GetStatistics().uTips);
+
+    // Still the same string while referenced
+    CHECK(cache.InternTip(L"Volume: 42%") == pwzA);
+    cache.ReleaseTip(pwzA);
+    cache.ReleaseTip(pwzA);
+    CHECK_EQUAL((UINT)1, cache.GetStatistics().uTips);
+
+    cache.ReleaseTip(nullptr);
+    cache.ReleaseTip(pwzB);
+    CHECK_EQUAL((UINT)0, cache.GetStatistics().uTips);
+}
+
+
+//
+// FNV-1a reference values
+//
+static void TestHash()
+{
+    const BYTE abA[] = { 'a' };
+    const BYTE abFoobar[] = { 'f', 'o', 'o', 'b', 'a', 'r' };
+
+    CHECK_EQUAL(14695981039346656037ULL, TrayIconCache::Hash(abA, 0));
+    CHECK_EQUAL(0xAF63DC4C8601EC8CULL, TrayIconCache::Hash(abA, 1));
+    CHECK_EQUAL(0x85944171F73967E8ULL, TrayIconCache::Hash(abFoobar, 6));
+}
+
+
+int main()
+{
+    TestIcons();
+    TestIdleLimit();
+    TestAnimation();
+    TestSources();
+    TestTips();
+    TestHash();
+
+    return TestResult("TrayIconCacheTest");
+}
@@ -0,0 +1,517 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayIconStore.h"
+#include "../litestep/TrayShell.h"
+#include "TraySystemStub.h"
+#include "Test.h"
+#include <algorithm>
+#include <vector>
+
+
+//
+// Replays NIM_ADD, NIM_MODIFY, NIM_SETVERSION and NIM_DELETE the way
+// TrayShell::HandleNotification does, against TrayIconStore and against
+// the linear scan it replaced, for growing numbers of icons. The same
+// messages are then recorded and replayed into TrayShell itself, on a
+// TraySystemStub, to show what the store costs next to the rest of the
+// message handling. NotifyIcon is the stand-in from NotifyIconStub.cpp.
+//
+// Every session starts and ends with an empty tray, and is replayed often
+// enough that each phase covers over a hundred thousand messages, so that
+// the small trays are measured as precisely as the large ones.
+//
+
+//
+// LinearStore
+//
+// The icon vector and findIcon from before TrayIconStore, with the same
+// interface as TrayIconStore
+//
+class LinearStore
+{
+    typedef std::vector<NotifyIcon*> IconVector;
+
+public:
+    typedef IconVector::iterator iterator;
+
+    ~LinearStore()
+    {
+        for (iterator it = m_icons.begin(); it != m_icons.end(); ++it)
+        {
+            delete *it;
+        }
+    }
+
+    iterator begin() { return m_icons.begin(); }
+    iterator end() { return m_icons.end(); }
+
+    iterator Find(const NID_XX& nid)
+    {
+        GUID guidItem;
+        memset(&guidItem, 0, sizeof(guidItem));
+
+        switch (nid.cbSize)
+        {
+        case NID_7W_SIZE:
+        case NID_6W_SIZE:
+            guidItem = ((const NID_6W&)nid).guidItem;
+            break;
+
+        case NID_6A_SIZE:
+            guidItem = ((const NID_6A&)nid).guidItem;
+            break;
+        }
+
+        for (iterator iter = m_icons.begin(); iter != m_icons.end(); ++iter)
+        {
+            // If the GUID is valid, we ignore the uID and hWnd
+            if ((nid.uFlags & NIF_GUID) == NIF_GUID)
+            {
+                if (IsEqualGUID(guidItem, (*iter)->GetGUID()))
+                {
+                    return iter;
+                }
+            }
+            else if ((*iter)->GetuID() == nid.uID &&
+                (*iter)->GetHwnd() == (HWND)(UINT_PTR)nid.hWnd)
+            {
+                return iter;
+            }
+        }
+
+        return m_icons.end();
+    }
+
+    iterator Add(NotifyIcon* pni)
+    {
+        m_icons.push_back(pni);
+        return m_icons.end() - 1;
+    }
+
+    void Update(iterator it, const NID_XX& nid)
+    {
+        (*it)->Update(nid);
+    }
+
+    iterator Remove(iterator it)
+    {
+        delete *it;
+        return m_icons.erase(it);
+    }
+
+private:
+    IconVector m_icons;
+};
+
+
+//
+// HandleNotification
+//
+// The store handling of addIcon, modifyIcon, setVersionIcon and deleteIcon
+// in TrayShell
+//
+template <typename Store>
+static bool HandleNotification(Store& store, DWORD dwMessage, const NID_XX& nid)
+{
+    typename Store::iterator it = store.Find(nid);
+
+    switch (dwMessage)
+    {
+    case NIM_ADD:
+        if (it == store.end())
+        {
+            store.Add(new NotifyIcon(nid));
+            return true;
+        }
+        break;
+
+    case NIM_MODIFY:
+        if (it != store.end())
+        {
+            store.Update(it, nid);
+            return true;
+        }
+        break;
+
+    case NIM_SETVERSION:
+        if (it != store.end())
+        {
+            (*it)->SetVersion(((const NID_5W&)nid).uVersion);
+            return true;
+        }
+        break;
+
+    case NIM_DELETE:
+        if (it != store.end())
+        {
+            store.Remove(it);
+            return true;
+        }
+        break;
+    }
+
+    return false;
+}
+
+
+//
+// Small deterministic generator, so runs are comparable
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+//
+// One message as the shell sends it. Every fourth icon is identified by
+// GUID, the others by window and ID, spread over the old layouts.
+//
+struct Message
+{
+    DWORD dwMessage;
+    NID_7W nid;
+};
+
+static Message MakeMessage(DWORD dwMessage, UINT uIcon, DWORD dwIcon)
+{
+    static const DWORD SIZES[] = { NID_4W_SIZE, NID_5W_SIZE, NID_6W_SIZE };
+
+    Message msg;
+    memset(&msg, 0, sizeof(msg));
+
+    msg.dwMessage = dwMessage;
+    msg.nid.hWnd = 0x10000 + 4 * (uIcon / 3);
+    msg.nid.uID = uIcon % 3;
+    msg.nid.uCallbackMessage = 0x8000;
+    msg.nid.hIcon = dwIcon;
+
+    if (uIcon % 4 == 0)
+    {
+        msg.nid.cbSize = NID_7W_SIZE;
+        msg.nid.uFlags = NIF_GUID;
+        msg.nid.guidItem.Data1 = 0xC0FFEE00 + uIcon;
+        msg.nid.guidItem.Data4[7] = (uint8_t)uIcon;
+    }
+    else
+    {
+        msg.nid.cbSize = SIZES[uIcon % 3];
+    }
+
+    switch (dwMessage)
+    {
+    case NIM_ADD:
+        msg.nid.uFlags |= NIF_MESSAGE | NIF_ICON | NIF_TIP;
+        break;
+    case NIM_MODIFY:
+        msg.nid.uFlags |= NIF_ICON;
+        break;
+    case NIM_SETVERSION:
+        msg.nid.cbSize = std::max(msg.nid.cbSize, (DWORD)NID_5W_SIZE);
+        msg.nid.uVersion = 4;
+        break;
+    }
+
+    return msg;
+}
+
+
+typedef std::vector<Message> MessageList;
+
+//
+// The messages of each phase of a session with uIcons icons
+//
+struct Session
+{
+    MessageList vecAdd;
+    MessageList vecVersion;
+    MessageList vecModify;
+    MessageList vecChurn;
+    MessageList vecDelete;
+};
+
+static void MakeSession(UINT uIcons, Session& session)
+{
+    Random random(uIcons);
+
+    for (UINT uIcon = 0; uIcon < uIcons; ++uIcon)
+    {
+        session.vecAdd.push_back(MakeMessage(NIM_ADD, uIcon, uIcon));
+        session.vecVersion.push_back(MakeMessage(NIM_SETVERSION, uIcon, 0));
+    }
+
+    // Animation frames, each icon equally likely
+    for (UINT u = 0; u < 8 * uIcons; ++u)
+    {
+        session.vecModify.push_back(MakeMessage(NIM_MODIFY,
+            random.Next(uIcons), random.Next(1024)));
+    }
+
+    // Applications restarting: their icons go and come back at the end
+    for (UINT u = 0; u < uIcons; ++u)
+    {
+        UINT uIcon = random.Next(uIcons);
+
+        session.vecChurn.push_back(MakeMessage(NIM_DELETE, uIcon, 0));
+        session.vecChurn.push_back(MakeMessage(NIM_ADD, uIcon, uIcon));
+    }
+
+    for (UINT uIcon = 0; uIcon < uIcons; ++uIcon)
+    {
+        session.vecDelete.push_back(MakeMessage(NIM_DELETE,
+            (uIcon * 7919) % uIcons, 0));
+    }
+}
+
+
+//
+// Replays a phase, adding its duration to dSeconds and counting the
+// messages the store accepted
+//
+template <typename Store>
+static void Replay(Store& store, const MessageList& vecMessages,
+    double& dSeconds, UINT& uHandled)
+{
+    Stopwatch stopwatch;
+
+    for (MessageList::const_iterator it = vecMessages.begin();
+        it != vecMessages.end(); ++it)
+    {
+        if (HandleNotification(store, it->dwMessage, (const NID_XX&)it->nid))
+        {
+            ++uHandled;
+        }
+    }
+
+    dSeconds += stopwatch.GetSeconds();
+}
+
+
+// The icons a store holds, in order
+template <typename Store>
+static std::vector<UINT_PTR> GetOrder(Store& store)
+{
+    std::vector<UINT_PTR> vecOrder;
+
+    for (typename Store::iterator it = store.begin(); it != store.end(); ++it)
+    {
+        vecOrder.push_back(((UINT_PTR)(*it)->GetHwnd() << 8) | (*it)->GetuID());
+    }
+
+    return vecOrder;
+}
+
+
+//
+// Records a phase the way LSTrayRecordFile would, as SHELLTRAYDATA
+//
+static void Record(const MessageList& vecMessages, TrayRecorder& recorder)
+{
+    struct
+    {
+        DWORD dwUnknown;
+        DWORD dwMessage;
+        NID_7W nid;
+    } std;
+
+    recorder.Begin(0);
+
+    for (MessageList::const_iterator it = vecMessages.begin();
+        it != vecMessages.end(); ++it)
+    {
+        memset(&std, 0, sizeof(std));
+        std.dwMessage = it->dwMessage;
+        std.nid = it->nid;
+
+        recorder.Append(SH_TRAY_DATA, 2 * sizeof(DWORD) + it->nid.cbSize,
+            &std, 0);
+    }
+}
+
+
+//
+// ShellSink
+//
+// Hands the replayed messages to a TrayShell, counting those it accepted
+//
+class ShellSink : public ITrayMessageSink
+{
+public:
+    explicit ShellSink(TrayShell& shell)
+        : m_shell(shell)
+        , m_uHandled(0)
+    {
+    }
+
+    virtual LRESULT HandleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData) override
+    {
+        LRESULT lResult = m_shell.HandleCopyData(dwData, cbData, lpData);
+
+        if (lResult)
+        {
+            ++m_uHandled;
+        }
+
+        return lResult;
+    }
+
+    UINT GetHandled() const
+    {
+        return m_uHandled;
+    }
+
+private:
+    TrayShell& m_shell;
+    UINT m_uHandled;
+};
+
+
+//
+// Replays a recorded phase into the shell, adding the time spent in it to
+// dSeconds. That includes reading the clock around every message.
+//
+static void ReplayShell(ShellSink& sink, const TrayRecorder& recorder,
+    double& dSeconds)
+{
+    TrayReplayer replayer(recorder.GetData(), recorder.GetSize());
+    TrayReplayer::StatisticsMap stats;
+
+    replayer.Run(sink, Stopwatch::GetTicks, stats);
+    dSeconds += stats[SH_TRAY_DATA].ullTotal / 1e9;
+}
+
+
+static void PrintRow(UINT uIcons, const char* pszPhase, size_t stMessages,
+    double dLinear, double dIndexed, double dShell)
+{
+    dLinear *= 1e9 / stMessages;
+    dIndexed *= 1e9 / stMessages;
+    dShell *= 1e9 / stMessages;
+
+    printf("%6u  %-16s %12.1f %12.1f %8.1fx %12.1f\n", uIcons, pszPhase,
+        dLinear, dIndexed, dLinear / std::max(dIndexed, 0.001), dShell);
+}
+
+
+int main()
+{
+    const UINT ICON_COUNTS[] = { 16, 64, 256, 1024 };
+    const UINT PHASE_MESSAGES = 131072;
+
+    const char* const PHASES[] = {
+        "NIM_ADD", "NIM_SETVERSION", "NIM_MODIFY", "NIM_DELETE+ADD",
+        "NIM_DELETE"
+    };
+    const size_t PHASE_COUNT = sizeof(PHASES) / sizeof(PHASES[0]);
+
+    printf("%6s  %-16s %12s %12s %9s %12s\n", "Icons", "Message",
+        "Linear(ns)", "Indexed(ns)", "Speedup", "Shell(ns)");
+
+    for (size_t st = 0; st < sizeof(ICON_COUNTS) / sizeof(ICON_COUNTS[0]); ++st)
+    {
+        UINT uIcons = ICON_COUNTS[st];
+        UINT uRounds = std::max(PHASE_MESSAGES / uIcons, 1u);
+
+        Session session;
+        MakeSession(uIcons, session);
+
+        const MessageList* apPhases[PHASE_COUNT] = {
+            &session.vecAdd, &session.vecVersion, &session.vecModify,
+            &session.vecChurn, &session.vecDelete
+        };
+
+        TrayRecorder arecPhases[PHASE_COUNT];
+
+        for (size_t stPhase = 0; stPhase < PHASE_COUNT; ++stPhase)
+        {
+            Record(*apPhases[stPhase], arecPhases[stPhase]);
+        }
+
+        // Notifications go out right away, as with LSTrayCoalesceDelay 0
+        TraySystemStub* pSystem = new TraySystemStub();
+        TrayShell shell(pSystem);
+        shell.SetDelays(0, 50);
+        pSystem->Attach(&shell);
+
+        ShellSink sink(shell);
+
+        LinearStore linear;
+        TrayIconStore indexed;
+        double adLinear[PHASE_COUNT] = { 0 };
+        double adIndexed[PHASE_COUNT] = { 0 };
+        double adShell[PHASE_COUNT] = { 0 };
+        UINT uLinear = 0;
+        UINT uIndexed = 0;
+
+        for (UINT uRound = 0; uRound < uRounds; ++uRound)
+        {
+            for (size_t stPhase = 0; stPhase < PHASE_COUNT; ++stPhase)
+            {
+                // Both stores must have ended up with the same icons, in
+                // order, before the final deletes
+                if (uRound == 0 && stPhase == PHASE_COUNT - 1)
+                {
+                    CHECK(GetOrder(linear) == GetOrder(indexed));
+                }
+
+                Replay(linear, *apPhases[stPhase],
+                    adLinear[stPhase], uLinear);
+                Replay(indexed, *apPhases[stPhase],
+                    adIndexed[stPhase], uIndexed);
+                ReplayShell(sink, arecPhases[stPhase], adShell[stPhase]);
+            }
+
+            CHECK(indexed.empty());
+            CHECK(linear.begin() == linear.end());
+            CHECK_EQUAL((size_t)0, shell.GetIconCount());
+        }
+
+        for (size_t stPhase = 0; stPhase < PHASE_COUNT; ++stPhase)
+        {
+            PrintRow(uIcons, PHASES[stPhase],
+                apPhases[stPhase]->size() * uRounds,
+                adLinear[stPhase], adIndexed[stPhase], adShell[stPhase]);
+        }
+
+        CHECK_EQUAL(uLinear, uIndexed);
+        CHECK_EQUAL(uIndexed, sink.GetHandled());
+        CHECK_EQUAL(pSystem->GetNotifyCount(NIM_ADD),
+            pSystem->GetNotifyCount(NIM_DELETE));
+    }
+
+    return TestResult("TrayIconStoreBench");
+}
@@ -0,0 +1,186 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayIconStore.h"
+#include "Test.h"
+#include <string.h>
+
+
+//
+// Builds a notification for the icon (dwWnd, uID), identified by GUID if
+// dwGuid is not zero
+//
+static NID_6W MakeNid(DWORD dwWnd, UINT uID, DWORD dwGuid)
+{
+    NID_6W nid;
+    memset(&nid, 0, sizeof(nid));
+
+    nid.cbSize = NID_6W_SIZE;
+    nid.hWnd = dwWnd;
+    nid.uID = uID;
+    nid.uFlags = NIF_ICON;
+    nid.hIcon = 0x100;
+
+    if (dwGuid)
+    {
+        nid.uFlags |= NIF_GUID;
+        nid.guidItem.Data1 = dwGuid;
+    }
+
+    return nid;
+}
+
+
+static TrayIconStore::iterator Add(TrayIconStore& store, const NID_6W& nid)
+{
+    return store.Add(new NotifyIcon((const NID_XX&)nid));
+}
+
+
+static void TestLookups()
+{
+    TrayIconStore store;
+
+    NID_6W nidPlain = MakeNid(0x10, 1, 0);
+    NID_6W nidGuid = MakeNid(0x20, 2, 0xAB);
+
+    TrayIconStore::iterator itPlain = Add(store, nidPlain);
+    TrayIconStore::iterator itGuid = Add(store, nidGuid);
+
+    CHECK(store.Find((const NID_XX&)nidPlain) == itPlain);
+    CHECK(store.Find((const NID_XX&)nidGuid) == itGuid);
+
+    // GUID icons are found by (hWnd, uID) as well
+    CHECK(store.Find((HWND)0x20, 2) == itGuid);
+
+    // A GUID notification ignores hWnd and uID
+    NID_6W nidOther = MakeNid(0x10, 1, 0xCD);
+    CHECK(store.Find((const NID_XX&)nidOther) == store.end());
+
+    // Old layouts have no room for a GUID
+    NID_6W nidOld = nidGuid;
+    nidOld.cbSize = NID_5W_SIZE;
+    CHECK(store.Find((const NID_XX&)nidOld) == store.end());
+
+    CHECK(store.Remove(itPlain) == itGuid);
+    CHECK(store.Find((HWND)0x10, 1) == store.end());
+    CHECK(store.Find((const NID_XX&)nidGuid) == itGuid);
+
+    store.Remove(itGuid);
+    CHECK(store.Find((const NID_XX&)nidGuid) == store.end());
+    CHECK(store.empty());
+}
+
+
+//
+// GUID icons may share hWnd and uID. The oldest one answers lookups by
+// (hWnd, uID), like the linear scan did, and hands them on when removed.
+//
+static void TestShadowedKeys()
+{
+    TrayIconStore store;
+
+    TrayIconStore::iterator itFirst = Add(store, MakeNid(0x10, 1, 0xA1));
+    TrayIconStore::iterator itSecond = Add(store, MakeNid(0x10, 1, 0xA2));
+    TrayIconStore::iterator itOther = Add(store, MakeNid(0x30, 3, 0));
+    TrayIconStore::iterator itThird = Add(store, MakeNid(0x10, 1, 0xA3));
+
+    CHECK(store.Find((HWND)0x10, 1) == itFirst);
+
+    // Removing a shadowed icon leaves the lookup alone
+    store.Remove(itSecond);
+    CHECK(store.Find((HWND)0x10, 1) == itFirst);
+
+    // Removing the indexed one hands the key to the oldest remaining icon
+    store.Remove(itFirst);
+    CHECK(store.Find((HWND)0x10, 1) == itThird);
+
+    store.Remove(itThird);
+    CHECK(store.Find((HWND)0x10, 1) == store.end());
+    CHECK(store.Find((HWND)0x30, 3) == itOther);
+
+    // With nothing shadowed any more, a new icon takes the key at once
+    TrayIconStore::iterator itNew = Add(store, MakeNid(0x10, 1, 0));
+    CHECK(store.Find((HWND)0x10, 1) == itNew);
+    CHECK_EQUAL((size_t)2, store.size());
+}
+
+
+static void TestOrderAndOwners()
+{
+    TrayIconStore store;
+
+    TrayIconStore::iterator itA = Add(store, MakeNid(0x10, 1, 0));
+    TrayIconStore::iterator itB = Add(store, MakeNid(0x20, 1, 0));
+    TrayIconStore::iterator itC = Add(store, MakeNid(0x10, 2, 0xC0));
+    TrayIconStore::iterator itD = Add(store, MakeNid(0x20, 2, 0));
+
+    std::vector<TrayIconStore::iterator> vecOwned;
+    store.FindOwned((HWND)0x10, vecOwned);
+
+    CHECK_EQUAL((size_t)2, vecOwned.size());
+    CHECK(vecOwned.size() == 2 && vecOwned[0] == itA && vecOwned[1] == itC);
+
+    for (size_t st = 0; st < vecOwned.size(); ++st)
+    {
+        store.Remove(vecOwned[st]);
+    }
+
+    // The rest keep the order they were added in
+    TrayIconStore::iterator it = store.begin();
+    CHECK(it == itB);
+    CHECK(++it == itD);
+    CHECK(++it == store.end());
+
+    store.Clear();
+    CHECK(store.empty());
+    CHECK(store.Find((HWND)0x20, 1) == store.end());
+}
+
+
+static void TestUpdateGuid()
+{
+    TrayIconStore store;
+
+    NID_6W nid = MakeNid(0x10, 1, 0);
+    TrayIconStore::iterator it = Add(store, nid);
+
+    // A later update may give an icon its GUID
+    NID_6W nidGuid = MakeNid(0x10, 1, 0xEE);
+    store.Update(it, (const NID_XX&)nidGuid);
+
+    CHECK(store.Find((const NID_XX&)nidGuid) == it);
+    CHECK(store.Find((HWND)0x10, 1) == it);
+
+    store.Remove(it);
+    CHECK(store.Find((const NID_XX&)nidGuid) == store.end());
+}
+
+
+int main()
+{
+    TestLookups();
+    TestShadowedKeys();
+    TestOrderAndOwners();
+    TestUpdateGuid();
+
+    return TestResult("TrayIconStoreTest");
+}
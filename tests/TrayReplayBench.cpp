@@ -0,0 +1,639 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayShell.h"
+#include "TraySystemStub.h"
+#include "Test.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+
+//
+// Replays a tray recording into TrayShell, with TraySystemStub standing in
+// for the windows, and reports throughput and latency per message type.
+// Without arguments it records a synthetic session first; pass the path of
+// an LSTrayRecordFile recording to replay that instead.
+//
+// Every message is followed by a millisecond of message loop, so the time
+// of a message includes the flushes and work area updates it triggers, and
+// reading the clock twice.
+//
+
+// What the shell puts in SHELLTRAYDATA::dwUnknown
+static const DWORD TRAY_SIGNATURE = 0x34753423;
+
+static const DWORD NIM_COUNT = NIM_SETVERSION + 1;
+static const DWORD ABM_COUNT = ABM_SETSTATE + 1;
+
+static const char* const NIM_NAMES[NIM_COUNT] =
+{
+    "NIM_ADD", "NIM_MODIFY", "NIM_DELETE", "NIM_SETFOCUS", "NIM_SETVERSION"
+};
+
+static const char* const ABM_NAMES[ABM_COUNT] =
+{
+    "ABM_NEW", "ABM_REMOVE", "ABM_QUERYPOS", "ABM_SETPOS", "ABM_GETSTATE",
+    "ABM_GETTASKBARPOS", "ABM_ACTIVATE", "ABM_GETAUTOHIDEBAR",
+    "ABM_SETAUTOHIDEBAR", "ABM_WINDOWPOSCHANGED", "ABM_SETSTATE"
+};
+
+
+//
+// Names a message by the structures TrayShell decodes it with
+//
+static const char* GetTypeName(DWORD dwData, DWORD cbData, LPCVOID pvData)
+{
+    DWORD dwMessage;
+
+    if (dwData == SH_TRAY_DATA)
+    {
+        if (cbData < 2 * sizeof(DWORD))
+        {
+            return "NIM_unknown";
+        }
+
+        dwMessage = ((const _SHELLTRAYDATA*)pvData)->dwMessage;
+        return (dwMessage < NIM_COUNT) ? NIM_NAMES[dwMessage] : "NIM_unknown";
+    }
+    else if (dwData == SH_APPBAR_DATA)
+    {
+        switch (cbData)
+        {
+        case sizeof(APPBARMSGDATAV3):
+            dwMessage = ((PCAPPBARMSGDATAV3)pvData)->dwMessage;
+            break;
+        case sizeof(APPBARMSGDATAV2):
+            dwMessage = ((PCAPPBARMSGDATAV2)pvData)->dwMessage;
+            break;
+        case sizeof(APPBARMSGDATAV1):
+            dwMessage = ((PCAPPBARMSGDATAV1)pvData)->dwMessage;
+            break;
+        default:
+            return "ABM_unknown";
+        }
+
+        return (dwMessage < ABM_COUNT) ? ABM_NAMES[dwMessage] : "ABM_unknown";
+    }
+
+    return "other";
+}
+
+
+//
+// ShellHarness
+//
+// The sink the recording is replayed into: a TrayShell on a TraySystemStub,
+// set up like TrayService does with the default delays. Remembers the type
+// of the last message it handled, so the caller can time each type
+// separately.
+//
+class ShellHarness : public ITrayMessageSink
+{
+public:
+    ShellHarness()
+        : m_pSystem(new TraySystemStub())
+        , m_shell(m_pSystem)
+        , m_pszLast("")
+        , m_uFailed(0)
+    {
+        m_shell.SetDelays(16, 50);
+        m_pSystem->Attach(&m_shell);
+    }
+
+    virtual LRESULT HandleCopyData(DWORD dwData, DWORD cbData, LPVOID lpData) override
+    {
+        m_pszLast = GetTypeName(dwData, cbData, lpData);
+        ++m_mapCounts[m_pszLast];
+
+        LRESULT lResult = m_shell.HandleCopyData(dwData, cbData, lpData);
+
+        if (lResult == 0)
+        {
+            ++m_uFailed;
+        }
+
+        m_pSystem->Pump(1);
+
+        return lResult;
+    }
+
+    const char* GetLastType() const
+    {
+        return m_pszLast;
+    }
+
+    UINT GetCount(const std::string& sType) const
+    {
+        std::map<std::string, UINT>::const_iterator it = m_mapCounts.find(sType);
+        return (it != m_mapCounts.end()) ? it->second : 0;
+    }
+
+    // Messages TrayShell returned zero for
+    UINT GetFailed() const
+    {
+        return m_uFailed;
+    }
+
+    const TrayShell& GetShell() const
+    {
+        return m_shell;
+    }
+
+    TraySystemStub& GetSystem()
+    {
+        return *m_pSystem;
+    }
+
+private:
+    TraySystemStub* m_pSystem; // owned by m_shell
+    TrayShell m_shell;
+
+    const char* m_pszLast;
+    std::map<std::string, UINT> m_mapCounts;
+    UINT m_uFailed;
+};
+
+
+//
+// Small deterministic generator, so runs are comparable
+//
+class Random
+{
+public:
+    explicit Random(uint32_t uSeed)
+        : m_uState(uSeed ? uSeed : 1)
+    {
+    }
+
+    uint32_t Next(uint32_t uLimit)
+    {
+        m_uState ^= m_uState << 13;
+        m_uState ^= m_uState >> 17;
+        m_uState ^= m_uState << 5;
+        return m_uState % uLimit;
+    }
+
+private:
+    uint32_t m_uState;
+};
+
+
+//
+// Fills a NID_* tip, narrowing or widening as the layout wants
+//
+template <typename CH, size_t N>
+static void CopyTip(CH (&szTip)[N], const wchar_t* pwzTip)
+{
+    for (size_t st = 0; pwzTip[st] && st + 1 < N; ++st)
+    {
+        szTip[st] = (CH)pwzTip[st];
+    }
+}
+
+//
+// Sets the NIM_SETVERSION version; the NT 4.0 layouts have none
+//
+template <typename NID>
+static void SetVersion(NID& nid, UINT uVersion)
+{
+    nid.uVersion = uVersion;
+}
+
+static void SetVersion(NID_4A& /*nid*/, UINT /*uVersion*/)
+{
+}
+
+static void SetVersion(NID_4W& /*nid*/, UINT /*uVersion*/)
+{
+}
+
+
+//
+// SyntheticSession
+//
+// Records what a busy desktop sends: icons of all NID layouts being added,
+// animated and retitled, and AppBars of all three message layouts moving
+// around. Only records what TrayShell should accept, and counts it, so the
+// replay can be checked against it.
+//
+class SyntheticSession
+{
+public:
+    static const UINT ICON_COUNT = 32;
+    static const UINT BAR_COUNT = 4;
+
+    // NID_4A to NID_7W
+    static const UINT NID_LAYOUT_COUNT = 7;
+
+    explicit SyntheticSession(UINT uSteps)
+        : m_random(42)
+        , m_dwNow(0)
+    {
+        m_recorder.Begin(m_dwNow);
+
+        for (UINT uIcon = 0; uIcon < ICON_COUNT; ++uIcon)
+        {
+            _Notify(NIM_ADD, uIcon, NIF_MESSAGE | NIF_ICON | NIF_TIP, L"Starting");
+
+            if (_HasVersion(uIcon))
+            {
+                _Notify(NIM_SETVERSION, uIcon, 0, L"");
+            }
+        }
+
+        for (UINT uBar = 0; uBar < BAR_COUNT; ++uBar)
+        {
+            _AppBar(ABM_NEW, uBar, 30);
+            _AppBar(ABM_QUERYPOS, uBar, 30);
+            _AppBar(ABM_SETPOS, uBar, 30);
+        }
+
+        for (UINT uStep = 0; uStep < uSteps; ++uStep)
+        {
+            UINT uIcon = m_random.Next(ICON_COUNT);
+            UINT uRoll = m_random.Next(100);
+
+            if (uRoll < 60)
+            {
+                // Animation frames
+                _Notify(NIM_MODIFY, uIcon, NIF_ICON, L"");
+            }
+            else if (uRoll < 80)
+            {
+                wchar_t wzTip[64];
+                swprintf(wzTip, 64, L"CPU %u%%, %u processes",
+                    m_random.Next(100), 50 + m_random.Next(100));
+
+                _Notify(NIM_MODIFY, uIcon, NIF_ICON | NIF_TIP, wzTip);
+            }
+            else if (uRoll < 85)
+            {
+                _Notify(NIM_DELETE, uIcon, 0, L"");
+                _Notify(NIM_ADD, uIcon, NIF_MESSAGE | NIF_ICON | NIF_TIP, L"Back");
+            }
+            else if (uRoll < 86)
+            {
+                _Notify(NIM_SETFOCUS, uIcon, 0, L"");
+            }
+            else if (uRoll < 95)
+            {
+                UINT uBar = m_random.Next(BAR_COUNT);
+                LONG lBreadth = 20 + (LONG)m_random.Next(40);
+
+                _AppBar(ABM_QUERYPOS, uBar, lBreadth);
+                _AppBar(ABM_SETPOS, uBar, lBreadth);
+                _AppBar(ABM_WINDOWPOSCHANGED, uBar, lBreadth);
+            }
+            else if (uRoll < 97)
+            {
+                _AppBar(ABM_ACTIVATE, m_random.Next(BAR_COUNT), 0);
+            }
+            else
+            {
+                _AppBar(ABM_GETTASKBARPOS, m_random.Next(BAR_COUNT), 0);
+            }
+        }
+
+        for (UINT uIcon = 0; uIcon < ICON_COUNT; ++uIcon)
+        {
+            _Notify(NIM_DELETE, uIcon, 0, L"");
+        }
+
+        for (UINT uBar = 0; uBar < BAR_COUNT; ++uBar)
+        {
+            _AppBar(ABM_REMOVE, uBar, 0);
+        }
+    }
+
+    const TrayRecorder& GetRecorder() const
+    {
+        return m_recorder;
+    }
+
+    const std::map<std::string, UINT>& GetCounts() const
+    {
+        return m_mapCounts;
+    }
+
+private:
+    static bool _HasVersion(UINT uIcon)
+    {
+        // All but NID_4A and NID_4W
+        return uIcon % NID_LAYOUT_COUNT >= 2;
+    }
+
+    void _Notify(DWORD dwMessage, UINT uIcon, DWORD dwFlags, const wchar_t* pwzTip)
+    {
+        switch (uIcon % NID_LAYOUT_COUNT)
+        {
+        case 0: _NotifyAs<NID_4A>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        case 1: _NotifyAs<NID_4W>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        case 2: _NotifyAs<NID_5A>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        case 3: _NotifyAs<NID_5W>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        case 4: _NotifyAs<NID_6A>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        case 5: _NotifyAs<NID_6W>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        case 6: _NotifyAs<NID_7W>(dwMessage, uIcon, dwFlags, pwzTip); break;
+        }
+    }
+
+    template <typename NID>
+    void _NotifyAs(DWORD dwMessage, UINT uIcon, DWORD dwFlags, const wchar_t* pwzTip)
+    {
+        // SHELLTRAYDATA with the whole structure instead of NID_XX
+        struct
+        {
+            DWORD dwUnknown;
+            DWORD dwMessage;
+            NID nid;
+        } std;
+
+        memset(&std, 0, sizeof(std));
+        std.dwUnknown = TRAY_SIGNATURE;
+        std.dwMessage = dwMessage;
+        std.nid.cbSize = sizeof(NID);
+        std.nid.hWnd = 0x10000 + 4 * (uIcon / 2);
+        std.nid.uID = uIcon % 2;
+        std.nid.uFlags = dwFlags;
+        std.nid.uCallbackMessage = 0x8000 + uIcon;
+        std.nid.hIcon = 0x20000 + m_random.Next(1024);
+        CopyTip(std.nid.szTip, pwzTip);
+        SetVersion(std.nid, 4);
+
+        _Record(SH_TRAY_DATA, &std, sizeof(std));
+    }
+
+    void _AppBar(DWORD dwMessage, UINT uBar, LONG lBreadth)
+    {
+        UINT uEdge = uBar % 4;
+        RECT rc = { 0, 0, 1920, 1080 };
+
+        switch (uEdge)
+        {
+        case ABE_LEFT:   rc.right = rc.left + lBreadth;   break;
+        case ABE_TOP:    rc.bottom = rc.top + lBreadth;   break;
+        case ABE_RIGHT:  rc.left = rc.right - lBreadth;   break;
+        case ABE_BOTTOM: rc.top = rc.bottom - lBreadth;   break;
+        }
+
+        // Older bars send older structures
+        switch (uBar % 3)
+        {
+        case 0: _AppBarAs<APPBARMSGDATAV1>(dwMessage, uBar, uEdge, rc); break;
+        case 1: _AppBarAs<APPBARMSGDATAV2>(dwMessage, uBar, uEdge, rc); break;
+        case 2: _AppBarAs<APPBARMSGDATAV3>(dwMessage, uBar, uEdge, rc); break;
+        }
+    }
+
+    template <typename AMD>
+    void _AppBarAs(DWORD dwMessage, UINT uBar, UINT uEdge, const RECT& rc)
+    {
+        AMD amd;
+
+        memset(&amd, 0, sizeof(amd));
+        amd.abd.cbSize = sizeof(amd.abd);
+        amd.abd.hWnd = 0x30000 + 4 * uBar;
+        amd.abd.uCallbackMessage = WM_USER + 100;
+        amd.abd.uEdge = uEdge;
+        amd.abd.rc = rc;
+        amd.dwMessage = dwMessage;
+        amd.hSharedMemory = 0x40000 + 4 * uBar;
+        amd.dwSourceProcessId = 1000 + uBar;
+
+        _Record(SH_APPBAR_DATA, &amd, sizeof(amd));
+    }
+
+    void _Record(DWORD dwData, LPCVOID pvData, size_t cbData)
+    {
+        m_dwNow += m_random.Next(3);
+        m_recorder.Append(dwData, (DWORD)cbData, pvData, m_dwNow);
+        ++m_mapCounts[GetTypeName(dwData, (DWORD)cbData, pvData)];
+    }
+
+    TrayRecorder m_recorder;
+    Random m_random;
+    DWORD m_dwNow;
+    std::map<std::string, UINT> m_mapCounts;
+};
+
+
+//
+// Latency and volume of one message type
+//
+struct TypeTimes
+{
+    ULONGLONG ullBytes;
+    std::vector<ULONGLONG> vecTicks;
+};
+
+
+static ULONGLONG Percentile(const std::vector<ULONGLONG>& vecSorted, double dFraction)
+{
+    size_t stIndex = (size_t)(dFraction * (vecSorted.size() - 1) + 0.5);
+    return vecSorted[stIndex];
+}
+
+
+//
+// Replays every entry on its own and times it under its type
+//
+static void TimeTypes(const BYTE* pbRecording, size_t cbRecording, int nRuns)
+{
+    std::map<std::string, TypeTimes> mapTimes;
+    std::vector<BYTE> vecScratch;
+
+    for (int nRun = 0; nRun < nRuns; ++nRun)
+    {
+        TrayReplayer replayer(pbRecording, cbRecording);
+        ShellHarness harness;
+
+        TRAYRECENTRY entry;
+        LPCVOID pvData;
+
+        while (replayer.Next(entry, pvData))
+        {
+            // Same headroom as TrayReplayer::Run
+            vecScratch.assign(entry.cbData + 1024, 0);
+            memcpy(&vecScratch[0], pvData, entry.cbData);
+
+            ULONGLONG ullStart = Stopwatch::GetTicks();
+            harness.HandleCopyData(entry.dwData, entry.cbData, &vecScratch[0]);
+            ULONGLONG ullTicks = Stopwatch::GetTicks() - ullStart;
+
+            TypeTimes& times = mapTimes[harness.GetLastType()];
+            times.ullBytes += entry.cbData;
+            times.vecTicks.push_back(ullTicks);
+        }
+    }
+
+    printf("%-22s %8s %11s %8s %9s %8s %8s %9s\n", "Message", "Count",
+        "Msgs/s", "MB/s", "Mean(ns)", "p50", "p99", "Max");
+
+    for (std::map<std::string, TypeTimes>::iterator it = mapTimes.begin();
+        it != mapTimes.end(); ++it)
+    {
+        std::vector<ULONGLONG>& vecTicks = it->second.vecTicks;
+        std::sort(vecTicks.begin(), vecTicks.end());
+
+        ULONGLONG ullTotal = 0;
+
+        for (size_t st = 0; st < vecTicks.size(); ++st)
+        {
+            ullTotal += vecTicks[st];
+        }
+
+        double dSeconds = std::max(ullTotal, 1ULL) / 1e9;
+
+        printf("%-22s %8zu %11.0f %8.1f %9.0f %8llu %8llu %9llu\n",
+            it->first.c_str(), vecTicks.size() / nRuns,
+            vecTicks.size() / dSeconds, it->second.ullBytes / dSeconds / 1e6,
+            (double)ullTotal / vecTicks.size(), Percentile(vecTicks, 0.5),
+            Percentile(vecTicks, 0.99), vecTicks.back());
+    }
+}
+
+
+//
+// Replays the whole recording through TrayReplayer::Run, as the replay in
+// TrayService would
+//
+static void TimeRuns(const BYTE* pbRecording, size_t cbRecording, int nRuns)
+{
+    TrayReplayer::StatisticsMap stats;
+    UINT uReplayed = 0;
+    Stopwatch stopwatch;
+
+    for (int nRun = 0; nRun < nRuns; ++nRun)
+    {
+        TrayReplayer replayer(pbRecording, cbRecording);
+        ShellHarness harness;
+
+        uReplayed += replayer.Run(harness, Stopwatch::GetTicks, stats);
+    }
+
+    double dSeconds = stopwatch.GetSeconds();
+
+    printf("\nWhole recording, %d runs: %.0f msgs/s, %.1f MB/s\n", nRuns,
+        uReplayed / dSeconds, (double)cbRecording * nRuns / dSeconds / 1e6);
+
+    for (TrayReplayer::StatisticsMap::const_iterator it = stats.begin();
+        it != stats.end(); ++it)
+    {
+        const TrayReplayer::Statistics& stat = it->second;
+
+        printf("  dwData %u: %u messages, mean %.0f ns, max %llu ns\n",
+            it->first, stat.uCount / nRuns,
+            (double)stat.ullTotal / std::max(stat.uCount, 1U), stat.ullMax);
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    const int RUNS = 5;
+
+    std::vector<BYTE> vecRecording;
+
+    if (argc > 1)
+    {
+        FILE* pFile = fopen(argv[1], "rb");
+
+        if (!pFile)
+        {
+            fprintf(stderr, "TrayReplayBench: can't open %s\n", argv[1]);
+            return 1;
+        }
+
+        BYTE abBuffer[65536];
+        size_t cbRead;
+
+        while ((cbRead = fread(abBuffer, 1, sizeof(abBuffer), pFile)) > 0)
+        {
+            vecRecording.insert(vecRecording.end(), abBuffer, abBuffer + cbRead);
+        }
+
+        fclose(pFile);
+    }
+    else
+    {
+        SyntheticSession session(50000);
+        const TrayRecorder& recorder = session.GetRecorder();
+
+        vecRecording.assign((const BYTE*)recorder.GetData(),
+            (const BYTE*)recorder.GetData() + recorder.GetSize());
+
+        // TrayShell must accept exactly what was recorded
+        TrayReplayer replayer(&vecRecording[0], vecRecording.size());
+        ShellHarness harness;
+        TrayReplayer::StatisticsMap stats;
+
+        CHECK(replayer.IsValid());
+        replayer.Run(harness, Stopwatch::GetTicks, stats);
+
+        const std::map<std::string, UINT>& mapCounts = session.GetCounts();
+
+        for (std::map<std::string, UINT>::const_iterator it = mapCounts.begin();
+            it != mapCounts.end(); ++it)
+        {
+            CHECK_EQUAL(it->second, harness.GetCount(it->first));
+        }
+
+        CHECK_EQUAL(0U, harness.GetFailed());
+
+        // Everything is gone again once the timers have run
+        TraySystemStub& system = harness.GetSystem();
+        system.Drain();
+
+        CHECK_EQUAL((size_t)0, harness.GetShell().GetIconCount());
+        CHECK_EQUAL((size_t)0, harness.GetShell().GetBarCount());
+        CHECK(system.GetNotifyCount(NIM_ADD) > 0);
+        CHECK_EQUAL(system.GetNotifyCount(NIM_ADD),
+            system.GetNotifyCount(NIM_DELETE));
+        CHECK(system.GetBarNoticeCount() > 0);
+
+        RECT rcScreen;
+        system.GetScreenRect(rcScreen);
+
+        CHECK_EQUAL(rcScreen.left, system.GetWorkArea().left);
+        CHECK_EQUAL(rcScreen.top, system.GetWorkArea().top);
+        CHECK_EQUAL(rcScreen.right, system.GetWorkArea().right);
+        CHECK_EQUAL(rcScreen.bottom, system.GetWorkArea().bottom);
+        CHECK(system.GetWorkAreaChanges() > 1);
+    }
+
+    TrayReplayer check(vecRecording.empty() ? nullptr : &vecRecording[0],
+        vecRecording.size());
+
+    if (!check.IsValid())
+    {
+        fprintf(stderr, "TrayReplayBench: not a tray recording\n");
+        return 1;
+    }
+
+    printf("TrayReplayBench: %zu bytes\n\n", vecRecording.size());
+
+    TimeTypes(&vecRecording[0], vecRecording.size(), RUNS);
+    TimeRuns(&vecRecording[0], vecRecording.size(), RUNS);
+
+    return TestResult("TrayReplayBench");
+}
@@ -0,0 +1,296 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "TraySystemStub.h"
+#include <algorithm>
+#include <string.h>
+
+
+static const HWND LITESTEP_WND = (HWND)(uintptr_t)0x100;
+static const HWND TRAY_WND = (HWND)(uintptr_t)0x200;
+static const HWND NOTIFY_WND = (HWND)(uintptr_t)0x300;
+
+static const HMONITOR MONITOR = (HMONITOR)(uintptr_t)0x1000;
+
+static const LONG SCREEN_WIDTH = 1920;
+static const LONG SCREEN_HEIGHT = 1080;
+
+// The work area broadcast comes back to the tray window as this
+static const UINT STUB_WM_SETTINGCHANGE = 0x001A;
+
+
+TraySystemStub::TraySystemStub()
+    : m_pShell(nullptr)
+    , m_dwNow(0)
+    , m_uWorkAreaChanges(0)
+    , m_uBarNotices(0)
+{
+    GetScreenRect(m_rcWorkArea);
+    memset(&m_abdShared, 0, sizeof(m_abdShared));
+}
+
+
+void TraySystemStub::Attach(TrayShell* pShell)
+{
+    m_pShell = pShell;
+
+    // What TrayService::Start does
+    m_pShell->ResetWorkArea();
+    m_pShell->SetWindows(LITESTEP_WND, TRAY_WND, NOTIFY_WND);
+}
+
+
+void TraySystemStub::Pump(DWORD dwElapsed)
+{
+    m_dwNow += dwElapsed;
+
+    do
+    {
+        while (!m_posted.empty())
+        {
+            Posted posted = m_posted.front();
+            m_posted.pop_front();
+
+            switch (posted.uMsg)
+            {
+            case ABP_NOTIFYPOSCHANGED:
+                m_pShell->OnPosChanged((HWND)posted.wParam,
+                    (HMONITOR)posted.lParam);
+                break;
+
+            case ABP_NOTIFYSTATECHANGE:
+                m_pShell->OnStateChange();
+                break;
+
+            case STUB_WM_SETTINGCHANGE:
+                m_pShell->OnWorkAreaChanged(m_rcWorkArea);
+                break;
+
+            default:
+                // ABP_RAISEAUTOHIDEHWND only reorders windows
+                break;
+            }
+        }
+    }
+    while (fireTimer());
+}
+
+
+void TraySystemStub::Drain()
+{
+    Pump(0);
+
+    // A timer nobody kills would keep this going forever
+    for (UINT u = 0; u < 100000 && !m_timers.empty(); ++u)
+    {
+        LONG lWait = 0x7FFFFFFF;
+
+        for (TimerMap::const_iterator it = m_timers.begin();
+            it != m_timers.end(); ++it)
+        {
+            lWait = std::min(lWait, (LONG)(it->second.dwDue - m_dwNow));
+        }
+
+        Pump((DWORD)std::max(lWait, (LONG)0));
+    }
+}
+
+
+bool TraySystemStub::fireTimer()
+{
+    for (TimerMap::iterator it = m_timers.begin(); it != m_timers.end(); ++it)
+    {
+        if ((LONG)(m_dwNow - it->second.dwDue) >= 0)
+        {
+            // Timers keep firing until killed
+            UINT_PTR uID = it->first;
+            it->second.dwDue = m_dwNow + it->second.uElapse;
+
+            m_pShell->OnTimer(uID);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+UINT TraySystemStub::GetNotifyCount(DWORD dwMessage) const
+{
+    std::map<DWORD, UINT>::const_iterator it = m_notifyCounts.find(dwMessage);
+    return (it != m_notifyCounts.end()) ? it->second : 0;
+}
+
+
+LRESULT TraySystemStub::Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM /*lParam*/)
+{
+    if (hWnd != LITESTEP_WND)
+    {
+        // An AppBar's callback message
+        ++m_uBarNotices;
+        return 0;
+    }
+
+    if (uMsg == LM_SYSTRAYW)
+    {
+        ++m_notifyCounts[(DWORD)wParam];
+        return TRUE;
+    }
+
+    return 0;
+}
+
+
+BOOL TraySystemStub::Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    if (hWnd != TRAY_WND)
+    {
+        return FALSE;
+    }
+
+    Posted posted = { uMsg, wParam, lParam };
+    m_posted.push_back(posted);
+
+    return TRUE;
+}
+
+
+bool TraySystemStub::IsHandled(UINT /*uMsg*/)
+{
+    // No legacy systray modules loaded
+    return false;
+}
+
+
+BOOL TraySystemStub::IsWindow(HWND hWnd)
+{
+    return hWnd != NULL;
+}
+
+
+BOOL TraySystemStub::GetWindowRect(HWND hWnd, RECT& rc)
+{
+    if (hWnd != NOTIFY_WND)
+    {
+        return FALSE;
+    }
+
+    // A taskbar along the bottom edge
+    rc.left = 0;
+    rc.top = SCREEN_HEIGHT - 30;
+    rc.right = SCREEN_WIDTH;
+    rc.bottom = SCREEN_HEIGHT;
+
+    return TRUE;
+}
+
+
+BOOL TraySystemStub::SetTimer(HWND hWnd, UINT_PTR uID, UINT uElapse)
+{
+    if (hWnd != TRAY_WND)
+    {
+        return FALSE;
+    }
+
+    Timer timer = { m_dwNow + uElapse, uElapse };
+    m_timers[uID] = timer;
+
+    return TRUE;
+}
+
+
+void TraySystemStub::KillTimer(HWND /*hWnd*/, UINT_PTR uID)
+{
+    m_timers.erase(uID);
+}
+
+
+DWORD TraySystemStub::GetTickCount()
+{
+    return m_dwNow;
+}
+
+
+HMONITOR TraySystemStub::MonitorFromRect(const RECT& /*rc*/)
+{
+    return MONITOR;
+}
+
+
+HMONITOR TraySystemStub::MonitorFromWindow(HWND /*hWnd*/)
+{
+    return MONITOR;
+}
+
+
+bool TraySystemStub::GetMonitorRects(HMONITOR hMon, RECT& rcMonitor, RECT& rcWork)
+{
+    if (hMon != MONITOR)
+    {
+        return false;
+    }
+
+    GetScreenRect(rcMonitor);
+    rcWork = m_rcWorkArea;
+
+    return true;
+}
+
+
+void TraySystemStub::GetScreenRect(RECT& rc)
+{
+    rc.left = 0;
+    rc.top = 0;
+    rc.right = SCREEN_WIDTH;
+    rc.bottom = SCREEN_HEIGHT;
+}
+
+
+void TraySystemStub::SetWorkArea(const RECT& rc)
+{
+    m_rcWorkArea = rc;
+    ++m_uWorkAreaChanges;
+}
+
+
+void TraySystemStub::BroadcastWorkAreaChange()
+{
+    // Reaches the tray window too
+    Post(TRAY_WND, STUB_WM_SETTINGCHANGE, 0, 0);
+}
+
+
+LPVOID TraySystemStub::LockShared(HANDLE hData, DWORD /*dwProcessId*/)
+{
+    return hData ? &m_abdShared : NULL;
+}
+
+
+void TraySystemStub::UnlockShared(LPVOID /*pvData*/)
+{
+    // do nothing
+}
+
+
+LRESULT TraySystemStub::LoadInProc(const GUID& /*clsid*/, DWORD /*dwMessage*/)
+{
+    return 0;
+}
@@ -0,0 +1,133 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(TRAYSYSTEMSTUB_H)
+#define TRAYSYSTEMSTUB_H
+
+#include "../litestep/TrayShell.h"
+#include <deque>
+#include <map>
+
+
+//
+// TraySystemStub
+//
+// Stands in for the window and system calls of TrayShell, so recordings can
+// be replayed into the real thing. There is one 1920x1080 monitor, every
+// window other than NULL exists, and the clock only moves when told to.
+// What TrayShell posts to the tray window, the timers it sets and the work
+// area broadcasts it makes wait for Pump, like they would wait for the
+// message loop.
+//
+class TraySystemStub : public TrayShell::System
+{
+public:
+    TraySystemStub();
+
+    // Hands the shell the stand-in windows and lets Pump reach it
+    void Attach(TrayShell* pShell);
+
+    //
+    // Advances the clock by dwElapsed, then runs the posted messages and the
+    // timers that are due
+    //
+    void Pump(DWORD dwElapsed);
+
+    // Pumps until no timer is left
+    void Drain();
+
+    // LM_SYSTRAYW notifications sent, per NIM_* message
+    UINT GetNotifyCount(DWORD dwMessage) const;
+
+    // ABN_* notifications sent to AppBars
+    UINT GetBarNoticeCount() const
+    {
+        return m_uBarNotices;
+    }
+
+    // The work area last set, and how many times it was set
+    const RECT& GetWorkArea() const
+    {
+        return m_rcWorkArea;
+    }
+
+    UINT GetWorkAreaChanges() const
+    {
+        return m_uWorkAreaChanges;
+    }
+
+    //
+    // TrayShell::System
+    //
+    virtual LRESULT Send(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) override;
+    virtual BOOL Post(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) override;
+    virtual bool IsHandled(UINT uMsg) override;
+    virtual BOOL IsWindow(HWND hWnd) override;
+    virtual BOOL GetWindowRect(HWND hWnd, RECT& rc) override;
+    virtual BOOL SetTimer(HWND hWnd, UINT_PTR uID, UINT uElapse) override;
+    virtual void KillTimer(HWND hWnd, UINT_PTR uID) override;
+    virtual DWORD GetTickCount() override;
+    virtual HMONITOR MonitorFromRect(const RECT& rc) override;
+    virtual HMONITOR MonitorFromWindow(HWND hWnd) override;
+    virtual bool GetMonitorRects(HMONITOR hMon, RECT& rcMonitor, RECT& rcWork) override;
+    virtual void GetScreenRect(RECT& rc) override;
+    virtual void SetWorkArea(const RECT& rc) override;
+    virtual void BroadcastWorkAreaChange() override;
+    virtual LPVOID LockShared(HANDLE hData, DWORD dwProcessId) override;
+    virtual void UnlockShared(LPVOID pvData) override;
+    virtual LRESULT LoadInProc(const GUID& clsid, DWORD dwMessage) override;
+
+private:
+    struct Posted
+    {
+        UINT uMsg;
+        WPARAM wParam;
+        LPARAM lParam;
+    };
+
+    struct Timer
+    {
+        DWORD dwDue;
+        UINT uElapse;
+    };
+
+    typedef std::map<UINT_PTR, Timer> TimerMap;
+
+    // Runs one due timer, returns false if none is due
+    bool fireTimer();
+
+    TrayShell* m_pShell;
+    DWORD m_dwNow;
+
+    std::deque<Posted> m_posted;
+    TimerMap m_timers;
+
+    RECT m_rcWorkArea;
+    UINT m_uWorkAreaChanges;
+
+    // What SHLockShared would map, the AppBar handlers write results here
+    APPBARDATAV1 m_abdShared;
+
+    std::map<DWORD, UINT> m_notifyCounts;
+    UINT m_uBarNotices;
+};
+
+#endif // TRAYSYSTEMSTUB_H
@@ -0,0 +1,236 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "../litestep/TrayWorkAreaScheduler.h"
+#include "Test.h"
+
+
+static const DWORD DELAY = 100;
+
+static const HMONITOR MONITOR_A = (HMONITOR)(uintptr_t)0x10;
+static const HMONITOR MONITOR_B = (HMONITOR)(uintptr_t)0x20;
+
+
+static RECT MakeRect(LONG lTop, LONG lBottom)
+{
+    RECT rc = { 0, lTop, 1920, lBottom };
+    return rc;
+}
+
+static bool IsEqual(const RECT& rcA, const RECT& rcB)
+{
+    return rcA.left == rcB.left && rcA.top == rcB.top &&
+        rcA.right == rcB.right && rcA.bottom == rcB.bottom;
+}
+
+
+//
+// A change is held back until no other request has come in for the delay
+//
+static void TestDebounce(DWORD dwStart)
+{
+    WorkAreaScheduler scheduler(DELAY);
+    WorkAreaScheduler::ChangeList changes;
+
+    RECT rcScreen = MakeRect(0, 1080);
+    RECT rcTop = MakeRect(30, 1080);
+    RECT rcBoth = MakeRect(30, 1050);
+
+    CHECK_EQUAL(INFINITE, scheduler.GetTimeout(dwStart));
+
+    scheduler.Request(MONITOR_A, rcScreen, rcTop, dwStart);
+    CHECK_EQUAL(DELAY, scheduler.GetTimeout(dwStart));
+
+    // A second AppBar moves in, the wait starts over
+    scheduler.Request(MONITOR_A, rcTop, rcBoth, dwStart + 60);
+    CHECK_EQUAL(DELAY, scheduler.GetTimeout(dwStart + 60));
+    CHECK_EQUAL((DWORD)10, scheduler.GetTimeout(dwStart + 150));
+
+    scheduler.TakeSettled(dwStart + 159, changes);
+    CHECK(changes.empty());
+
+    // Only the last work area is applied
+    scheduler.TakeSettled(dwStart + 160, changes);
+    CHECK_EQUAL((size_t)1, changes.size());
+    CHECK(changes.size() == 1 && changes[0].hMonitor == MONITOR_A &&
+        IsEqual(changes[0].rcWorkArea, rcBoth));
+    CHECK_EQUAL(INFINITE, scheduler.GetTimeout(dwStart + 160));
+
+    // Overdue changes have no wait left
+    scheduler.Request(MONITOR_A, rcBoth, rcTop, dwStart + 200);
+    CHECK_EQUAL((DWORD)0, scheduler.GetTimeout(dwStart + 400));
+
+    const WorkAreaScheduler::Statistics& stats = scheduler.GetStatistics();
+    CHECK_EQUAL((UINT)3, stats.uRequested);
+    CHECK_EQUAL((UINT)0, stats.uSuppressed);
+    CHECK_EQUAL((UINT)1, stats.uSuperseded);
+    CHECK_EQUAL((UINT)1, stats.uApplied);
+}
+
+
+//
+// Requests that leave the work area as it is are dropped, and so are
+// changes undone before they settled; each counts once
+//
+static void TestSuppression()
+{
+    WorkAreaScheduler scheduler(DELAY);
+    WorkAreaScheduler::ChangeList changes;
+
+    RECT rcScreen = MakeRect(0, 1080);
+    RECT rcTop = MakeRect(30, 1080);
+
+    scheduler.Request(MONITOR_A, rcScreen, rcScreen, 0);
+    CHECK_EQUAL(INFINITE, scheduler.GetTimeout(0));
+
+    // Asking for the pending work area again still restarts the wait
+    scheduler.Request(MONITOR_A, rcScreen, rcTop, 0);
+    scheduler.Request(MONITOR_A, rcTop, rcTop, 50);
+    CHECK_EQUAL(DELAY, scheduler.GetTimeout(50));
+
+    // The AppBar went away again before anything was broadcast
+    scheduler.Request(MONITOR_A, rcTop, rcScreen, 80);
+    CHECK_EQUAL(INFINITE, scheduler.GetTimeout(80));
+
+    scheduler.TakeSettled(1000, changes);
+    CHECK(changes.empty());
+
+    const WorkAreaScheduler::Statistics& stats = scheduler.GetStatistics();
+    CHECK_EQUAL((UINT)4, stats.uRequested);
+    CHECK_EQUAL((UINT)3, stats.uSuppressed);
+    CHECK_EQUAL((UINT)0, stats.uSuperseded);
+    CHECK_EQUAL((UINT)0, stats.uApplied);
+}
+
+
+//
+// A steady stream of requests can hold a change back for at most four
+// times the delay
+//
+static void TestDeadline(DWORD dwStart)
+{
+    WorkAreaScheduler scheduler(DELAY);
+    WorkAreaScheduler::ChangeList changes;
+
+    RECT rcScreen = MakeRect(0, 1080);
+    DWORD dwNow = dwStart;
+
+    scheduler.Request(MONITOR_A, rcScreen, MakeRect(1, 1080), dwNow);
+
+    for (LONG l = 2; dwNow - dwStart < 4 * DELAY; ++l)
+    {
+        dwNow += DELAY / 2;
+
+        DWORD dwTimeout = scheduler.GetTimeout(dwNow);
+        CHECK(dwTimeout <= DELAY);
+        CHECK(dwTimeout == INFINITE ||
+            dwNow + dwTimeout - dwStart <= 4 * DELAY);
+
+        scheduler.TakeSettled(dwNow, changes);
+
+        if (!changes.empty())
+        {
+            break;
+        }
+
+        scheduler.Request(MONITOR_A, rcScreen, MakeRect(l, 1080), dwNow);
+    }
+
+    CHECK_EQUAL(dwStart + 4 * DELAY, dwNow);
+    CHECK_EQUAL((size_t)1, changes.size());
+
+    // The stream goes on; the next change starts a deadline of its own
+    scheduler.Request(MONITOR_A, rcScreen, MakeRect(50, 1080), dwNow);
+    CHECK_EQUAL(DELAY, scheduler.GetTimeout(dwNow));
+}
+
+
+//
+// Monitors settle independently, and the first one due sets the timeout
+//
+static void TestMonitors()
+{
+    WorkAreaScheduler scheduler(DELAY);
+    WorkAreaScheduler::ChangeList changes;
+
+    RECT rcScreen = MakeRect(0, 1080);
+
+    scheduler.Request(MONITOR_A, rcScreen, MakeRect(30, 1080), 0);
+    scheduler.Request(MONITOR_B, rcScreen, MakeRect(0, 1050), 40);
+    CHECK_EQUAL((DWORD)60, scheduler.GetTimeout(40));
+
+    scheduler.TakeSettled(100, changes);
+    CHECK(changes.size() == 1 && changes[0].hMonitor == MONITOR_A);
+    CHECK_EQUAL((DWORD)40, scheduler.GetTimeout(100));
+
+    // Settling at the same time, they share one pass
+    changes.clear();
+    scheduler.Request(MONITOR_A, rcScreen, MakeRect(60, 1080), 140);
+    scheduler.TakeSettled(240, changes);
+    CHECK_EQUAL((size_t)2, changes.size());
+
+    // A new delay applies to later requests
+    scheduler.SetDelay(10);
+    scheduler.Request(MONITOR_B, rcScreen, MakeRect(0, 1000), 300);
+    CHECK_EQUAL((DWORD)10, scheduler.GetTimeout(300));
+
+    scheduler.Clear();
+    CHECK_EQUAL(INFINITE, scheduler.GetTimeout(300));
+}
+
+
+//
+// Our own broadcasts come back as WM_SETTINGCHANGE too
+//
+static void TestEchoes()
+{
+    WorkAreaScheduler scheduler(DELAY);
+
+    scheduler.NoteBroadcast();
+    scheduler.NoteBroadcast();
+    CHECK_EQUAL((UINT)2, scheduler.GetPendingEchoes());
+
+    CHECK(scheduler.TakeEcho());
+    CHECK(scheduler.TakeEcho());
+    CHECK(!scheduler.TakeEcho());
+    CHECK_EQUAL((UINT)0, scheduler.GetPendingEchoes());
+
+    const WorkAreaScheduler::Statistics& stats = scheduler.GetStatistics();
+    CHECK_EQUAL((UINT)2, stats.uBroadcasts);
+    CHECK_EQUAL((UINT)2, stats.uEchoes);
+    CHECK_EQUAL((UINT)1, stats.uExternal);
+}
+
+
+int main()
+{
+    TestDebounce(1000);
+    TestSuppression();
+    TestDeadline(1000);
+    TestMonitors();
+    TestEchoes();
+
+    // GetTickCount wraps after 49.7 days
+    TestDebounce(0xFFFFFFC0);
+    TestDeadline(0xFFFFFF00);
+
+    return TestResult("TrayWorkAreaSchedulerTest");
+}
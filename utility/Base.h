@@ -22,7 +22,7 @@
 #if !defined(BASE_H)
 #define BASE_H
 
-#include "common.h"
+#include "portable.h"
 
 class Base
 {
@@ -28,6 +28,7 @@ class ILiteStep : public CountedBase
 {
 public:
     virtual void PeekAllMsgs() = 0;
+    virtual UINT GetMessageCount(HINSTANCE hInstance) = 0;
 };
 
 #endif // ILITESTEP_H
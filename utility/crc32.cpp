@@ -0,0 +1,97 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#include "crc32.h"
+#include <string.h>
+
+
+//
+// CRC-32 tables for slicing-by-8. Table 0 is the usual bytewise table; table
+// n gives the CRC of a byte followed by n zero bytes. They are built when
+// the module loads.
+//
+static unsigned int s_crcTables[8][256];
+
+static struct CrcTablesInit
+{
+    CrcTablesInit()
+    {
+        for (unsigned int u = 0; u < 256; ++u)
+        {
+            unsigned int uCrc = u;
+
+            for (int nBit = 0; nBit < 8; ++nBit)
+            {
+                uCrc = (uCrc & 1) ? (0xEDB88320 ^ (uCrc >> 1)) : (uCrc >> 1);
+            }
+
+            s_crcTables[0][u] = uCrc;
+        }
+
+        for (unsigned int u = 0; u < 256; ++u)
+        {
+            for (int nTable = 1; nTable < 8; ++nTable)
+            {
+                unsigned int uPrevious = s_crcTables[nTable - 1][u];
+
+                s_crcTables[nTable][u] = (uPrevious >> 8) ^
+                    s_crcTables[0][uPrevious & 0xFF];
+            }
+        }
+    }
+} s_crcTablesInit;
+
+
+//
+// Crc32
+//
+unsigned int Crc32(unsigned int uCrc, const unsigned char* pData,
+    size_t cbData)
+{
+    uCrc = ~uCrc;
+
+    for (; cbData >= 8; cbData -= 8, pData += 8)
+    {
+        // Little endian, as on all targets we build for
+        unsigned int uLow, uHigh;
+        memcpy(&uLow, pData, 4);
+        memcpy(&uHigh, pData + 4, 4);
+
+        uLow ^= uCrc;
+
+        uCrc =
+            s_crcTables[7][uLow & 0xFF] ^
+            s_crcTables[6][(uLow >> 8) & 0xFF] ^
+            s_crcTables[5][(uLow >> 16) & 0xFF] ^
+            s_crcTables[4][uLow >> 24] ^
+            s_crcTables[3][uHigh & 0xFF] ^
+            s_crcTables[2][(uHigh >> 8) & 0xFF] ^
+            s_crcTables[1][(uHigh >> 16) & 0xFF] ^
+            s_crcTables[0][uHigh >> 24];
+    }
+
+    for (; cbData > 0; --cbData)
+    {
+        uCrc = s_crcTables[0][(uCrc ^ *pData++) & 0xFF] ^ (uCrc >> 8);
+    }
+
+    return ~uCrc;
+}
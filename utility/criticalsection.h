@@ -22,7 +22,11 @@
 #if !defined(CRITICALSECTION_H)
 #define CRITICALSECTION_H
 
-#include "common.h"
+#include "portable.h"
+
+#if !defined(_WIN32)
+#  include <mutex>
+#endif
 
 
 //=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
@@ -34,6 +38,7 @@ class CriticalSection
     CriticalSection(const CriticalSection& rhs);
     CriticalSection& operator=(const CriticalSection& rhs);
 
+#if defined(_WIN32)
     CRITICAL_SECTION m_CritSection;
 
 public:
@@ -56,6 +61,25 @@ public:
     {
         LeaveCriticalSection(&m_CritSection);
     }
+#else
+    // Recursive like a critical section, for the tests
+    std::recursive_mutex m_Mutex;
+
+public:
+    CriticalSection()
+    {
+    }
+
+    void Acquire()
+    {
+        m_Mutex.lock();
+    }
+
+    void Release()
+    {
+        m_Mutex.unlock();
+    }
+#endif
 };
 
 
@@ -0,0 +1,120 @@
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+//
+// This is a part of the Litestep Shell source code.
+//
+// Copyright (C) 1997-2015  LiteStep Development Team
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+//
+//=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+#if !defined(PORTABLE_H)
+#define PORTABLE_H
+
+//
+// Win32 base types for code that doesn't call Windows: the decision cores
+// behind the services, the image decoders and so on. On Windows this is
+// just common.h. Elsewhere it defines the few types and interlocked
+// functions such code uses, so it can be built and tested there (see
+// tests/Makefile).
+//
+// Handles are distinct opaque pointer types, as with STRICT. Fixed layout
+// data that crosses process boundaries must not rely on these; use explicit
+// sizes there.
+//
+#if defined(_WIN32)
+
+#  include "common.h"
+
+#else
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <cstring>
+
+typedef char CHAR;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef uintptr_t UINT_PTR;
+typedef uintptr_t WPARAM;
+typedef intptr_t LPARAM;
+typedef intptr_t LRESULT;
+typedef void* HANDLE;
+typedef void* LPVOID;
+typedef const void* LPCVOID;
+typedef wchar_t WCHAR;
+typedef WCHAR* LPWSTR;
+typedef const WCHAR* LPCWSTR;
+
+#  define DECLARE_HANDLE(name)  struct name##__ { int unused; }; \
+                                typedef struct name##__* name
+
+DECLARE_HANDLE(HWND);
+DECLARE_HANDLE(HICON);
+DECLARE_HANDLE(HINSTANCE);
+DECLARE_HANDLE(HMONITOR);
+
+typedef struct tagPOINT
+{
+    LONG x;
+    LONG y;
+} POINT;
+
+typedef struct tagRECT
+{
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+} RECT;
+
+typedef struct _GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+} GUID;
+
+inline BOOL IsEqualGUID(const GUID& rguid1, const GUID& rguid2)
+{
+    return memcmp(&rguid1, &rguid2, sizeof(GUID)) == 0;
+}
+
+inline LONG InterlockedIncrement(LONG volatile* plAddend)
+{
+    return __atomic_add_fetch(plAddend, 1, __ATOMIC_SEQ_CST);
+}
+
+inline LONG InterlockedDecrement(LONG volatile* plAddend)
+{
+    return __atomic_sub_fetch(plAddend, 1, __ATOMIC_SEQ_CST);
+}
+
+#  define DUMMYUNIONNAME
+
+#  define TRUE      1
+#  define FALSE     0
+#  define INFINITE  0xFFFFFFFF
+
+#endif // defined(_WIN32)
+
+#endif // PORTABLE_H